@@ -0,0 +1,119 @@
+-- Sub-allocator benchmark: creates many small buffers and images through
+-- vk_CreateBuffer/vk_CreateImage, frees every other one, and prints per-pool
+-- usage and fragmentation. Each pool line shows how few vkAllocateMemory
+-- calls (blocks) were needed.
+--
+-- Run from the build directory:
+--   hello_world.exe ..\examples\bench_allocator.lua [buffers]
+local SDL = require("SDL")
+local vulkan = require("vulkan")
+
+local args = { ... }
+local BUFFERS = tonumber(args[2]) or 10000
+
+assert(SDL.SDL_Init(SDL.SDL_INIT_VIDEO))
+local window = assert(SDL.SDL_CreateWindow("Allocator benchmark", 320, 240, SDL.SDL_WINDOW_VULKAN))
+local _, extensions = assert(SDL.SDL_Vulkan_GetInstanceExtensions())
+local instance = assert(vulkan.create_instance({
+    application_info = {
+        application_name = "Allocator benchmark",
+        application_version = vulkan.make_version(1, 0, 0),
+        engine_name = "LuaJIT Vulkan",
+        engine_version = vulkan.make_version(1, 0, 0),
+        api_version = vulkan.VK_API_VERSION_1_0
+    },
+    enabled_extension_names = extensions
+}))
+local surface = assert(SDL.SDL_Vulkan_CreateSurface(window, instance))
+local physicalDevice = assert(vulkan.vk_EnumeratePhysicalDevices(instance))[1]
+local device, graphicsFamily = vulkan.vk_CreateDevice(physicalDevice, surface, {
+    enabled_extension_names = { "VK_KHR_swapchain" }
+})
+assert(device, graphicsFamily)
+
+local allocator = assert(vulkan.vk_CreateAllocator(physicalDevice, device))
+
+local function printStats(label, stats)
+    print(string.format("%-24s type %2d %-8s blocks %3d  used %10d / %10d  allocations %6d  free ranges %5d  fragmentation %.3f",
+        label, stats.memoryTypeIndex, stats.kind, stats.blockCount, stats.usedBytes, stats.blockBytes,
+        stats.allocationCount, stats.freeRangeCount, stats.fragmentation))
+end
+
+local function printAllocator(title)
+    print(title)
+    for _, stats in ipairs(vulkan.vk_GetAllocatorStats(allocator)) do
+        printStats(stats.optimalImages and "  default (images)" or "  default (buffers)", stats)
+    end
+end
+
+-- Device-local vertex buffers of mixed sizes
+local start = os.clock()
+local buffers = {}
+for i = 1, BUFFERS do
+    buffers[i] = assert(vulkan.vk_CreateBuffer(allocator, {
+        size = 256 * (1 + i % 64),
+        usage = vulkan.VK_BUFFER_USAGE_VERTEX_BUFFER_BIT
+    }))
+end
+local ms = (os.clock() - start) * 1000
+print(string.format("%d buffers in %.2f ms (%.2f us/buffer)", BUFFERS, ms, ms * 1000 / BUFFERS))
+
+-- Host-visible uploads go into persistently mapped blocks
+local staging = assert(vulkan.vk_CreateBuffer(allocator, {
+    size = 4096,
+    usage = vulkan.VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+    memoryProperties = vulkan.VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+    preferredMemoryProperties = vulkan.VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+}))
+assert(vulkan.vk_WriteBuffer(staging, string.rep("\0", 4096)))
+
+local images = {}
+for i = 1, 64 do
+    images[i] = assert(vulkan.vk_CreateImage(allocator, {
+        width = 256, height = 256,
+        format = vulkan.VK_FORMAT_R8G8B8A8_UNORM,
+        usage = vulkan.VK_IMAGE_USAGE_SAMPLED_BIT
+    }))
+end
+printAllocator("After allocation:")
+
+for i = 1, BUFFERS, 2 do
+    assert(vulkan.vk_DestroyBuffer(device, buffers[i]))
+end
+printAllocator("After freeing every other buffer:")
+
+-- A linear pool for per-frame transient data, reset as a whole
+local linear = assert(vulkan.vk_CreateMemoryPool(allocator, {
+    kind = "linear",
+    memoryProperties = vulkan.VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+    blockSize = 1024 * 1024
+}))
+local transient = {}
+for i = 1, 100 do
+    transient[i] = assert(vulkan.vk_CreateBuffer(allocator, {
+        size = 1000,
+        usage = vulkan.VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
+        memoryProperties = vulkan.VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        pool = linear
+    }))
+end
+printStats("  linear pool", vulkan.vk_GetMemoryPoolStats(linear))
+for i = 1, #transient do
+    assert(vulkan.vk_DestroyBuffer(device, transient[i]))
+end
+printStats("  linear pool (freed)", vulkan.vk_GetMemoryPoolStats(linear))
+
+for i = 2, BUFFERS, 2 do
+    assert(vulkan.vk_DestroyBuffer(device, buffers[i]))
+end
+for i = 1, #images do
+    assert(vulkan.vk_DestroyImage(device, images[i]))
+end
+assert(vulkan.vk_DestroyBuffer(device, staging))
+assert(vulkan.vk_DestroyMemoryPool(linear))
+assert(vulkan.vk_DestroyAllocator(allocator))
+assert(vulkan.vk_DestroyDevice(device))
+assert(vulkan.vk_DestroySurfaceKHR(instance, surface))
+assert(vulkan.vk_DestroyInstance(instance))
+SDL.SDL_DestroyWindow(window)
+SDL.SDL_Quit()
@@ -0,0 +1,161 @@
+-- Command stream benchmark: records the same N draws per-call, into a command
+-- stream through the classic bindings, and into a command stream through the
+-- FFI fast path, then replays the stream in one call.
+--
+-- Run from the build directory (the shaders and the vulkan/ modules live there):
+--   hello_world.exe ..\examples\bench_cmdstream.lua [draws] [iterations]
+local SDL = require("SDL")
+local vulkan = require("vulkan")
+local vkffi = require("vulkan.ffi")
+
+local args = { ... }
+local DRAWS = tonumber(args[2]) or 10000
+local ITERATIONS = tonumber(args[3]) or 100
+
+assert(SDL.SDL_Init(SDL.SDL_INIT_VIDEO))
+local window = assert(SDL.SDL_CreateWindow("Command stream benchmark", 800, 600, SDL.SDL_WINDOW_VULKAN))
+local _, extensions = assert(SDL.SDL_Vulkan_GetInstanceExtensions())
+
+local instance = assert(vulkan.create_instance({
+    application_info = {
+        application_name = "Command stream benchmark",
+        application_version = vulkan.make_version(1, 0, 0),
+        engine_name = "LuaJIT Vulkan",
+        engine_version = vulkan.make_version(1, 0, 0),
+        api_version = vulkan.VK_API_VERSION_1_0
+    },
+    enabled_extension_names = extensions
+}))
+local surface = assert(SDL.SDL_Vulkan_CreateSurface(window, instance))
+local physicalDevice = assert(vulkan.vk_EnumeratePhysicalDevices(instance))[1]
+local device, graphicsFamily = vulkan.vk_CreateDevice(physicalDevice, surface, {
+    enabled_extension_names = { "VK_KHR_swapchain" }
+})
+assert(device, graphicsFamily)
+
+local caps = assert(vulkan.vk_GetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface))
+local swapchain = assert(vulkan.vk_CreateSwapchainKHR(device, {
+    surface = surface,
+    minImageCount = caps.minImageCount,
+    imageFormat = vulkan.VK_FORMAT_B8G8R8A8_UNORM,
+    imageColorSpace = vulkan.VK_COLOR_SPACE_SRGB_NONLINEAR_KHR,
+    imageExtentWidth = caps.currentWidth,
+    imageExtentHeight = caps.currentHeight,
+    queueFamilyIndices = { graphicsFamily },
+    presentMode = vulkan.VK_PRESENT_MODE_FIFO_KHR
+}))
+local swapchainImages = assert(vulkan.vk_GetSwapchainImagesKHR(device, swapchain))
+local imageView = assert(vulkan.vk_CreateImageView(device, {
+    image = swapchainImages[1],
+    format = vulkan.VK_FORMAT_B8G8R8A8_UNORM
+}))
+local renderPass = assert(vulkan.vk_CreateRenderPass(device, {
+    format = vulkan.VK_FORMAT_B8G8R8A8_UNORM,
+    initialLayout = vulkan.VK_IMAGE_LAYOUT_UNDEFINED,
+    finalLayout = vulkan.VK_IMAGE_LAYOUT_PRESENT_SRC_KHR
+}))
+local framebuffer = assert(vulkan.vk_CreateFramebuffer(device, {
+    renderPass = renderPass,
+    attachments = { imageView },
+    width = caps.currentWidth,
+    height = caps.currentHeight
+}))
+
+local vertShaderModule = assert(vulkan.vk_CreateShaderModuleFromFile(device, "triangle.vert.spv"))
+local fragShaderModule = assert(vulkan.vk_CreateShaderModuleFromFile(device, "triangle.frag.spv"))
+local pipelineLayout = assert(vulkan.vk_CreatePipelineLayout(device))
+local pipeline = assert(vulkan.vk_CreateGraphicsPipelines(device, {
+    vertexShader = vertShaderModule,
+    fragmentShader = fragShaderModule,
+    pipelineLayout = pipelineLayout,
+    renderPass = renderPass
+}))
+
+local commandPool = assert(vulkan.vk_CreateCommandPool(device, graphicsFamily))
+local cmdBuffer = assert(vulkan.vk_AllocateCommandBuffers(device, commandPool, 1))[1]
+local stream = assert(vulkan.vk_CreateCommandStream())
+
+-- Each case records DRAWS draws inside a render pass; the command buffer is
+-- never submitted, so only the CPU recording cost is measured.
+local function bench(name, record)
+    record() -- Warm up (and let the stream reach its steady-state size)
+    local start = os.clock()
+    for _ = 1, ITERATIONS do
+        record()
+    end
+    local ms = (os.clock() - start) * 1000 / ITERATIONS
+    print(string.format("%-28s %8.3f ms/iteration  %8.1f ns/draw", name, ms, ms * 1e6 / DRAWS))
+end
+
+local function begin()
+    vulkan.vk_ResetCommandBuffer(cmdBuffer)
+    vulkan.vk_BeginCommandBuffer(cmdBuffer)
+    vulkan.vk_CmdBeginRenderPass(cmdBuffer, renderPass, framebuffer)
+    vulkan.vk_CmdSetViewport(cmdBuffer, 0, 0, caps.currentWidth, caps.currentHeight)
+    vulkan.vk_CmdSetScissor(cmdBuffer, 0, 0, caps.currentWidth, caps.currentHeight)
+end
+
+local function finish()
+    vulkan.vk_CmdEndRenderPass(cmdBuffer)
+    vulkan.vk_EndCommandBuffer(cmdBuffer)
+end
+
+print(string.format("%d draws, %d iterations", DRAWS, ITERATIONS))
+
+bench("per-call vk_CmdDraw", function()
+    begin()
+    for _ = 1, DRAWS do
+        vulkan.vk_CmdBindPipeline(cmdBuffer, pipeline)
+        vulkan.vk_CmdDraw(cmdBuffer, 3, 1, 0, 0)
+    end
+    finish()
+end)
+
+bench("stream (classic) + replay", function()
+    vulkan.vk_ResetCommandStream(stream)
+    for _ = 1, DRAWS do
+        vulkan.vk_StreamBindPipeline(stream, pipeline)
+        vulkan.vk_StreamDraw(stream, 3, 1, 0, 0)
+    end
+    begin()
+    assert(vulkan.vk_ReplayCommandStream(cmdBuffer, stream))
+    finish()
+end)
+
+local streamPtr = vkffi.CommandStream(stream)
+local pipelineHandle = vkffi.Pipeline(pipeline)
+bench("stream (ffi) + replay", function()
+    vkffi.ResetCommandStream(streamPtr)
+    for _ = 1, DRAWS do
+        vkffi.StreamBindPipeline(streamPtr, pipelineHandle)
+        vkffi.StreamDraw(streamPtr, 3, 1, 0, 0)
+    end
+    begin()
+    assert(vulkan.vk_ReplayCommandStream(cmdBuffer, stream))
+    finish()
+end)
+
+-- Replay alone: the stream is recorded once and reused every frame
+bench("replay only", function()
+    begin()
+    assert(vulkan.vk_ReplayCommandStream(cmdBuffer, stream))
+    finish()
+end)
+
+local info = vulkan.vk_GetCommandStreamInfo(stream)
+print(string.format("stream: %d commands, %d bytes (capacity %d)", info.commandCount, info.size, info.capacity))
+
+assert(vulkan.vk_DestroyCommandPool(device, commandPool))
+assert(vulkan.vk_DestroyPipeline(device, pipeline))
+assert(vulkan.vk_DestroyPipelineLayout(device, pipelineLayout))
+assert(vulkan.vk_DestroyShaderModule(device, fragShaderModule))
+assert(vulkan.vk_DestroyShaderModule(device, vertShaderModule))
+assert(vulkan.vk_DestroyFramebuffer(device, framebuffer))
+assert(vulkan.vk_DestroyRenderPass(device, renderPass))
+assert(vulkan.vk_DestroyImageView(device, imageView))
+assert(vulkan.vk_DestroySwapchainKHR(device, swapchain))
+assert(vulkan.vk_DestroyDevice(device))
+assert(vulkan.vk_DestroySurfaceKHR(instance, surface))
+assert(vulkan.vk_DestroyInstance(instance))
+SDL.SDL_DestroyWindow(window)
+SDL.SDL_Quit()
@@ -0,0 +1,277 @@
+-- Headless end-to-end frame benchmark: runs the full SDL + Vulkan path with
+-- SDL's offscreen video driver and an offscreen render target, so it needs no
+-- display or GPU (lavapipe works). Each scene renders a number of frames and
+-- prints one JSON object per line:
+--   {"scene":"draws","n":1000,"frames":300,"fps":...,"cpu_ms_per_frame":...,
+--    "p50_ms":...,"p99_ms":...,"max_ms":...,"device":"...","video_driver":"..."}
+-- cpu_ms_per_frame is main-thread time per frame outside fence waits, i.e.
+-- the cost of the bindings; p50/p99/max are whole-frame latencies.
+--
+-- Scenes: draws (n draws per frame), pipelines (n pipeline binds), submits
+-- (n queue submits per frame) and resize (render target recreated every frame).
+--
+-- Built and run by the bench_frames CMake target, or by hand from the build directory:
+--   hello_world ../examples/bench_frames.lua [--frames=300] [--warmup=30] [--scenes=draws,pipelines,submits,resize]
+--       [--draws=1000] [--pipelines=64] [--submits=32] [--out=results.jsonl] [--video-driver=offscreen]
+local SDL = require("SDL")
+local vulkan = require("vulkan")
+
+local args = { ... }
+local options = {
+    frames = 300,
+    warmup = 30,
+    scenes = "draws,pipelines,submits,resize",
+    draws = 1000,
+    pipelines = 64,
+    submits = 32,
+    out = nil,
+    ["video-driver"] = "offscreen"
+}
+for i = 2, #args do
+    local key, value = args[i]:match("^%-%-([%w%-]+)=(.*)$")
+    if not key or options[key] == nil and key ~= "out" then
+        error("bench_frames: unknown argument " .. args[i])
+    end
+    options[key] = tonumber(value) or value
+end
+
+local FRAMES_IN_FLIGHT = 2
+local FORMAT = vulkan.VK_FORMAT_R8G8B8A8_UNORM
+local WIDTH, HEIGHT = 640, 480
+
+-- SDL: the offscreen driver needs no display server; the window only exists
+-- so event pumping is part of every frame, as in a real application
+SDL.SDL_SetHint("SDL_VIDEO_DRIVER", options["video-driver"])
+assert(SDL.SDL_Init(SDL.SDL_INIT_VIDEO))
+local window, windowErr = SDL.SDL_CreateWindow("bench_frames", WIDTH, HEIGHT, 0)
+if not window then
+    io.stderr:write("bench_frames: no window (" .. tostring(windowErr) .. "), events are still pumped\n")
+end
+local videoDriver = SDL.SDL_GetCurrentVideoDriver() or "none"
+
+local instance = assert(vulkan.create_instance({
+    application_info = {
+        application_name = "bench_frames",
+        application_version = vulkan.make_version(1, 0, 0),
+        engine_name = "LuaJIT Vulkan",
+        engine_version = vulkan.make_version(1, 0, 0),
+        api_version = vulkan.VK_API_VERSION_1_0
+    }
+}))
+local physicalDevice = assert(vulkan.vk_EnumeratePhysicalDevices(instance))[1]
+local deviceName = vulkan.vk_GetPhysicalDeviceProperties(physicalDevice).deviceName
+local device, graphicsFamily = vulkan.vk_CreateDevice(physicalDevice, nil, {})
+assert(device, graphicsFamily)
+local queue = assert(vulkan.vk_GetDeviceQueue(device, graphicsFamily, 0))
+local allocator = assert(vulkan.vk_CreateAllocator(physicalDevice, device))
+
+local renderPass = assert(vulkan.vk_CreateRenderPass(device, {
+    format = FORMAT,
+    finalLayout = vulkan.VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+}))
+
+local function createTarget(width, height)
+    local image = assert(vulkan.vk_CreateImage(allocator, {
+        width = width,
+        height = height,
+        format = FORMAT,
+        usage = vulkan.VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        memoryProperties = vulkan.VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+    }))
+    local view = assert(vulkan.vk_CreateImageView(device, { image = image, format = FORMAT }))
+    local framebuffer = assert(vulkan.vk_CreateFramebuffer(device, {
+        renderPass = renderPass,
+        attachments = { view },
+        width = width,
+        height = height
+    }))
+    return { image = image, view = view, framebuffer = framebuffer, width = width, height = height }
+end
+
+local function destroyTarget(target)
+    assert(vulkan.vk_DestroyFramebuffer(device, target.framebuffer))
+    assert(vulkan.vk_DestroyImageView(device, target.view))
+    assert(vulkan.vk_DestroyImage(device, target.image))
+end
+
+local vertShaderModule = assert(vulkan.vk_CreateShaderModuleFromFile(device, "triangle.vert.spv"))
+local fragShaderModule = assert(vulkan.vk_CreateShaderModuleFromFile(device, "triangle.frag.spv"))
+local pipelineLayout = assert(vulkan.vk_CreatePipelineLayout(device))
+local pipelines = {}
+for i = 1, math.max(options.pipelines, 1) do
+    pipelines[i] = assert(vulkan.vk_CreateGraphicsPipelines(device, {
+        vertexShader = vertShaderModule,
+        fragmentShader = fragShaderModule,
+        pipelineLayout = pipelineLayout,
+        renderPass = renderPass
+    }))
+end
+
+local commandPool = assert(vulkan.vk_CreateCommandPool(device, graphicsFamily))
+local commandBuffers = assert(vulkan.vk_AllocateCommandBuffers(device, commandPool, FRAMES_IN_FLIGHT))
+local fences = {}
+for i = 1, FRAMES_IN_FLIGHT do
+    fences[i] = assert(vulkan.vk_CreateFence(device, true))
+end
+local target = createTarget(WIDTH, HEIGHT)
+
+local function beginPass(cmd)
+    assert(vulkan.vk_ResetCommandBuffer(cmd))
+    assert(vulkan.vk_BeginCommandBuffer(cmd))
+    vulkan.vk_CmdBeginRenderPass(cmd, renderPass, target.framebuffer)
+    vulkan.vk_CmdSetViewport(cmd, 0, 0, target.width, target.height)
+    vulkan.vk_CmdSetScissor(cmd, 0, 0, target.width, target.height)
+end
+
+local function endPassAndSubmit(cmd, fence)
+    vulkan.vk_CmdEndRenderPass(cmd)
+    assert(vulkan.vk_EndCommandBuffer(cmd))
+    assert(vulkan.vk_QueueSubmit(queue, {{ commandBuffers = { cmd } }}, fence))
+end
+
+-- Each scene records and submits one frame into the slot's command buffer,
+-- signalling the slot's fence
+local scenes = {}
+
+scenes.draws = {
+    n = options.draws,
+    frame = function(slot)
+        local cmd = commandBuffers[slot]
+        beginPass(cmd)
+        vulkan.vk_CmdBindPipeline(cmd, pipelines[1])
+        for _ = 1, options.draws do
+            vulkan.vk_CmdDraw(cmd, 3, 1, 0, 0)
+        end
+        endPassAndSubmit(cmd, fences[slot])
+    end
+}
+
+scenes.pipelines = {
+    n = options.pipelines,
+    frame = function(slot)
+        local cmd = commandBuffers[slot]
+        beginPass(cmd)
+        for i = 1, options.pipelines do
+            vulkan.vk_CmdBindPipeline(cmd, pipelines[i])
+            vulkan.vk_CmdDraw(cmd, 3, 1, 0, 0)
+        end
+        endPassAndSubmit(cmd, fences[slot])
+    end
+}
+
+local submitBuffers
+scenes.submits = {
+    n = options.submits,
+    setup = function()
+        submitBuffers = {}
+        for slot = 1, FRAMES_IN_FLIGHT do
+            submitBuffers[slot] = assert(vulkan.vk_AllocateCommandBuffers(device, commandPool, options.submits))
+        end
+    end,
+    frame = function(slot)
+        local buffers = submitBuffers[slot]
+        for i = 1, options.submits do
+            local cmd = buffers[i]
+            beginPass(cmd)
+            vulkan.vk_CmdBindPipeline(cmd, pipelines[1])
+            vulkan.vk_CmdDraw(cmd, 3, 1, 0, 0)
+            endPassAndSubmit(cmd, i == options.submits and fences[slot] or nil)
+        end
+    end
+}
+
+-- A resize storm: the render target is recreated at a new size every frame,
+-- which drains the queue first, as swapchain recreation would
+local RESIZE_SIZES = { { 640, 480 }, { 800, 600 }, { 320, 240 }, { 1024, 768 }, { 500, 500 } }
+local resizeIndex = 0
+scenes.resize = {
+    n = 1,
+    frame = function(slot)
+        assert(vulkan.vk_QueueWaitIdle(queue))
+        destroyTarget(target)
+        resizeIndex = resizeIndex % #RESIZE_SIZES + 1
+        target = createTarget(RESIZE_SIZES[resizeIndex][1], RESIZE_SIZES[resizeIndex][2])
+        local cmd = commandBuffers[slot]
+        beginPass(cmd)
+        vulkan.vk_CmdBindPipeline(cmd, pipelines[1])
+        vulkan.vk_CmdDraw(cmd, 3, 1, 0, 0)
+        endPassAndSubmit(cmd, fences[slot])
+    end
+}
+
+local events = SDL.SDL_CreateEventBuffer(256)
+local frequency = SDL.SDL_GetPerformanceFrequency()
+local function now()
+    return SDL.SDL_GetPerformanceCounter() * 1000 / frequency
+end
+
+local function percentile(sorted, p)
+    return sorted[math.max(1, math.ceil(#sorted * p))]
+end
+
+local outFile = options.out and assert(io.open(options.out, "w"))
+
+local function report(name, scene, frameMs, cpuMs, wallMs)
+    local sorted = {}
+    for i, ms in ipairs(frameMs) do sorted[i] = ms end
+    table.sort(sorted)
+    local line = string.format(
+        '{"scene":"%s","n":%d,"frames":%d,"fps":%.2f,"cpu_ms_per_frame":%.4f,' ..
+        '"p50_ms":%.4f,"p99_ms":%.4f,"max_ms":%.4f,"device":"%s","video_driver":"%s"}',
+        name, scene.n, #frameMs, #frameMs * 1000 / wallMs, cpuMs / #frameMs,
+        percentile(sorted, 0.5), percentile(sorted, 0.99), sorted[#sorted],
+        (deviceName:gsub('[%c"\\]', "")), (videoDriver:gsub('[%c"\\]', "")))
+    print(line)
+    if outFile then outFile:write(line, "\n") end
+end
+
+local function runScene(name, scene)
+    if scene.setup then scene.setup() end
+    local frameMs, cpuMs, wallStart = {}, 0, 0
+    for frame = 1, options.warmup + options.frames do
+        if frame == options.warmup + 1 then
+            wallStart = now()
+        end
+        local start = now()
+        while select(2, SDL.SDL_PollEvents(events)) do end
+        local slot = (frame - 1) % FRAMES_IN_FLIGHT + 1
+        local waitStart = now()
+        assert(vulkan.vk_WaitForFences(device, fences[slot]))
+        local waitMs = now() - waitStart
+        assert(vulkan.vk_ResetFences(device, fences[slot]))
+        scene.frame(slot)
+        if frame > options.warmup then
+            local ms = now() - start
+            frameMs[#frameMs + 1] = ms
+            cpuMs = cpuMs + ms - waitMs
+        end
+    end
+    report(name, scene, frameMs, cpuMs, now() - wallStart)
+    assert(vulkan.vk_QueueWaitIdle(queue))
+end
+
+for name in options.scenes:gmatch("[^,]+") do
+    local scene = scenes[name]
+    if not scene then error("bench_frames: unknown scene " .. name) end
+    runScene(name, scene)
+end
+if outFile then outFile:close() end
+
+assert(vulkan.vk_QueueWaitIdle(queue))
+destroyTarget(target)
+for i = 1, FRAMES_IN_FLIGHT do
+    assert(vulkan.vk_DestroyFence(device, fences[i]))
+end
+assert(vulkan.vk_DestroyCommandPool(device, commandPool))
+for _, pipeline in ipairs(pipelines) do
+    assert(vulkan.vk_DestroyPipeline(device, pipeline))
+end
+assert(vulkan.vk_DestroyPipelineLayout(device, pipelineLayout))
+assert(vulkan.vk_DestroyShaderModule(device, fragShaderModule))
+assert(vulkan.vk_DestroyShaderModule(device, vertShaderModule))
+assert(vulkan.vk_DestroyRenderPass(device, renderPass))
+assert(vulkan.vk_DestroyAllocator(allocator))
+assert(vulkan.vk_DestroyDevice(device))
+assert(vulkan.vk_DestroyInstance(instance))
+if window then SDL.SDL_DestroyWindow(window) end
+SDL.SDL_Quit()
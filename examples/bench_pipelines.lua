@@ -0,0 +1,95 @@
+-- Pipeline compiler benchmark: compiles the same batch of graphics pipelines
+-- with 1, 2, 4 and 8 worker threads and reports the speedup over one thread.
+-- Runs headless (no window or surface); with several devices it prefers a
+-- software rasterizer (lavapipe reports "llvmpipe") so results are CPU bound
+-- and comparable across machines.
+--
+-- Run from the build directory (the shaders and the vulkan/ modules live there):
+--   hello_world.exe ..\examples\bench_pipelines.lua [pipelines] [maxThreads]
+local SDL = require("SDL")
+local vulkan = require("vulkan")
+
+local args = { ... }
+local PIPELINES = tonumber(args[2]) or 64
+local MAX_THREADS = tonumber(args[3]) or 8
+
+local instance = assert(vulkan.create_instance({
+    application_info = {
+        application_name = "Pipeline compiler benchmark",
+        application_version = vulkan.make_version(1, 0, 0),
+        engine_name = "LuaJIT Vulkan",
+        engine_version = vulkan.make_version(1, 0, 0),
+        api_version = vulkan.VK_API_VERSION_1_0
+    }
+}))
+local physicalDevices = assert(vulkan.vk_EnumeratePhysicalDevices(instance))
+local physicalDevice = physicalDevices[1]
+for _, candidate in ipairs(physicalDevices) do
+    if vulkan.vk_GetPhysicalDeviceProperties(candidate).deviceName:find("llvmpipe") then
+        physicalDevice = candidate
+        break
+    end
+end
+print("device: " .. vulkan.vk_GetPhysicalDeviceProperties(physicalDevice).deviceName)
+
+-- No surface: the device only needs a graphics queue
+local device = assert(vulkan.vk_CreateDevice(physicalDevice, nil, {}))
+local renderPass = assert(vulkan.vk_CreateRenderPass(device, {
+    format = vulkan.VK_FORMAT_B8G8R8A8_UNORM,
+    initialLayout = vulkan.VK_IMAGE_LAYOUT_UNDEFINED,
+    finalLayout = vulkan.VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+}))
+
+local vertShaderModule = assert(vulkan.vk_CreateShaderModuleFromFile(device, "triangle.vert.spv"))
+local fragShaderModule = assert(vulkan.vk_CreateShaderModuleFromFile(device, "triangle.frag.spv"))
+local pipelineLayout = assert(vulkan.vk_CreatePipelineLayout(device))
+
+local descs = {}
+for i = 1, PIPELINES do
+    descs[i] = {
+        vertexShader = vertShaderModule,
+        fragmentShader = fragShaderModule,
+        pipelineLayout = pipelineLayout,
+        renderPass = renderPass
+    }
+end
+
+-- No pipeline cache is used, so every run compiles from scratch
+local function run(threads)
+    local compiler, started = assert(vulkan.vk_CreatePipelineCompiler(device, threads))
+    -- Wall clock: os.clock() is process CPU time and counts every worker
+    local start = SDL.SDL_GetTicks()
+    local futures = vulkan.vk_CompileGraphicsPipelines(compiler, descs)
+    local workerMs = 0
+    local pipelines = {}
+    for i, future in ipairs(futures) do
+        local pipeline, ms = assert(vulkan.vk_PipelineFutureWait(future))
+        pipelines[i] = pipeline
+        workerMs = workerMs + ms
+    end
+    local batchMs = math.max(SDL.SDL_GetTicks() - start, 1)
+    assert(vulkan.vk_DestroyPipelineCompiler(compiler))
+    for _, pipeline in ipairs(pipelines) do
+        assert(vulkan.vk_DestroyPipeline(device, pipeline))
+    end
+    return started, batchMs, workerMs
+end
+
+print(string.format("%d pipelines per batch", PIPELINES))
+run(1) -- Warm up the driver
+local baseline
+local threads = 1
+while threads <= MAX_THREADS do
+    local started, batchMs, workerMs = run(threads)
+    baseline = baseline or batchMs
+    print(string.format("%2d threads  %7d ms/batch  %7.3f ms/pipeline (worker)  %5.2fx",
+        started, batchMs, workerMs / PIPELINES, baseline / batchMs))
+    threads = threads * 2
+end
+
+assert(vulkan.vk_DestroyPipelineLayout(device, pipelineLayout))
+assert(vulkan.vk_DestroyShaderModule(device, fragShaderModule))
+assert(vulkan.vk_DestroyShaderModule(device, vertShaderModule))
+assert(vulkan.vk_DestroyRenderPass(device, renderPass))
+assert(vulkan.vk_DestroyDevice(device))
+assert(vulkan.vk_DestroyInstance(instance))
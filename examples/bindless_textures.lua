@@ -0,0 +1,226 @@
+-- Bindless textures and buffers: a grid of quads, each sampling its own
+-- texture, drawn with one vk_CmdDraw. The textures and the per-instance data
+-- are registered in a bindless table; the table is bound once and shaders
+-- index it by slot, so nothing is rebound between instances. Afterwards a
+-- texture is freed and replaced: its slot is reused only once the frame that
+-- last read it has finished.
+-- Runs headless; the device must support Vulkan 1.3 (or 1.2 with
+-- VK_KHR_dynamic_rendering) and the descriptor indexing features.
+--
+-- Run from the build directory (the shaders and the vulkan/ modules live there):
+--   hello_world.exe ..\examples\bindless_textures.lua [columns] [rows]
+local ffi = require("ffi")
+local vulkan = require("vulkan")
+
+local args = { ... }
+local COLUMNS = tonumber(args[2]) or 8
+local ROWS = tonumber(args[3]) or 8
+local INSTANCES = COLUMNS * ROWS
+local WIDTH, HEIGHT = 512, 512
+local TEXTURE_SIZE = 16
+local FORMAT = vulkan.VK_FORMAT_R8G8B8A8_UNORM
+local COLORS = { { 1, 0, 0 }, { 0, 1, 0 }, { 0, 0, 1 }, { 1, 1, 0 }, { 1, 0, 1 }, { 0, 1, 1 } }
+
+local instance = assert(vulkan.create_instance({
+    application_info = {
+        application_name = "Bindless textures",
+        application_version = vulkan.make_version(1, 0, 0),
+        engine_name = "LuaJIT Vulkan",
+        engine_version = vulkan.make_version(1, 0, 0),
+        api_version = vulkan.make_version(1, 3, 0)
+    }
+}))
+local physicalDevice = assert(vulkan.vk_EnumeratePhysicalDevices(instance))[1]
+print("device: " .. vulkan.vk_GetPhysicalDeviceProperties(physicalDevice).deviceName)
+local device, graphicsFamily = vulkan.vk_CreateDevice(physicalDevice, nil, {
+    dynamicRendering = true,
+    descriptorIndexing = true
+})
+assert(device, graphicsFamily)
+local queue = assert(vulkan.vk_GetDeviceQueue(device, graphicsFamily, 0))
+local allocator = assert(vulkan.vk_CreateAllocator(physicalDevice, device))
+local commandPool = assert(vulkan.vk_CreateCommandPool(device, graphicsFamily))
+local cmd = assert(vulkan.vk_AllocateCommandBuffers(device, commandPool, 1))[1]
+local fence = assert(vulkan.vk_CreateFence(device, false))
+
+local table_ = assert(vulkan.vk_CreateBindlessTable(device, { buffers = 16, textures = 64 }))
+local sampler = assert(vulkan.vk_CreateSampler(device, { filter = vulkan.VK_FILTER_NEAREST }))
+
+local function colorBarrier(image, oldLayout, newLayout, srcStage, dstStage, srcAccess, dstAccess)
+    vulkan.vk_CmdPipelineBarrier(cmd, srcStage, dstStage, 0, nil, nil, {{
+        oldLayout = oldLayout,
+        newLayout = newLayout,
+        srcQueueFamilyIndex = vulkan.VK_QUEUE_FAMILY_IGNORED,
+        dstQueueFamilyIndex = vulkan.VK_QUEUE_FAMILY_IGNORED,
+        image = image,
+        srcAccessMask = srcAccess,
+        dstAccessMask = dstAccess,
+        subresourceRange = {
+            aspectMask = vulkan.VK_IMAGE_ASPECT_COLOR_BIT,
+            baseMipLevel = 0, levelCount = 1, baseArrayLayer = 0, layerCount = 1
+        }
+    }})
+end
+
+-- Textures are render targets cleared to a solid color, then made readable by shaders
+local function createTextures(colors)
+    local textures = {}
+    assert(vulkan.vk_ResetCommandBuffer(cmd))
+    assert(vulkan.vk_BeginCommandBuffer(cmd))
+    for i, color in ipairs(colors) do
+        local image, view = vulkan.vk_CreateRenderTarget(allocator, {
+            width = TEXTURE_SIZE, height = TEXTURE_SIZE, format = FORMAT
+        })
+        assert(image, view)
+        colorBarrier(image, vulkan.VK_IMAGE_LAYOUT_UNDEFINED, vulkan.VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            vulkan.VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, vulkan.VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+            0, vulkan.VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT)
+        vulkan.vk_CmdBeginRendering(cmd, {
+            width = TEXTURE_SIZE,
+            height = TEXTURE_SIZE,
+            colorAttachments = {{ imageView = view, clearColor = { color[1], color[2], color[3], 1 } }}
+        })
+        vulkan.vk_CmdEndRendering(cmd)
+        colorBarrier(image, vulkan.VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, vulkan.VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            vulkan.VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, vulkan.VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+            vulkan.VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, vulkan.VK_ACCESS_SHADER_READ_BIT)
+        textures[i] = { image = image, view = view, color = color }
+    end
+    assert(vulkan.vk_EndCommandBuffer(cmd))
+    assert(vulkan.vk_QueueSubmit(queue, {{ commandBuffers = { cmd } }}, fence))
+    assert(vulkan.vk_WaitForFences(device, fence))
+    assert(vulkan.vk_ResetFences(device, fence))
+    for _, texture in ipairs(textures) do
+        texture.slot = assert(vulkan.vk_BindlessAddTexture(table_, texture.view, sampler))
+    end
+    return textures
+end
+local textures = createTextures(COLORS)
+
+-- Instance i: vec4 rect (x, y, scale), uvec4 (texture slot); 32 bytes, std430
+local instanceData = ffi.new("struct { float rect[4]; uint32_t texture[4]; }[?]", INSTANCES)
+local cellW, cellH = 2 / COLUMNS, 2 / ROWS
+local function fillInstances()
+    for i = 0, INSTANCES - 1 do
+        local column, row = i % COLUMNS, math.floor(i / COLUMNS)
+        instanceData[i].rect[0] = -1 + (column + 0.5) * cellW
+        instanceData[i].rect[1] = -1 + (row + 0.5) * cellH
+        instanceData[i].rect[2] = 0.4 * math.min(cellW, cellH)
+        instanceData[i].texture[0] = textures[i % #textures + 1].slot
+    end
+end
+fillInstances()
+local instanceBuffer = assert(vulkan.vk_CreateBuffer(allocator, {
+    size = ffi.sizeof(instanceData),
+    usage = vulkan.VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+    memoryProperties = vulkan.VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+    preferredMemoryProperties = vulkan.VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+}))
+assert(vulkan.vk_WriteBuffer(instanceBuffer, ffi.string(instanceData, ffi.sizeof(instanceData))))
+local instanceSlot = assert(vulkan.vk_BindlessAddBuffer(table_, instanceBuffer))
+
+local target, targetView = vulkan.vk_CreateRenderTarget(allocator, { width = WIDTH, height = HEIGHT, format = FORMAT })
+assert(target, targetView)
+local readback = assert(vulkan.vk_CreateReadback(allocator, WIDTH * HEIGHT * 4))
+
+local vertShaderModule = assert(vulkan.vk_CreateShaderModuleFromFile(device, "bindless.vert.spv"))
+local fragShaderModule = assert(vulkan.vk_CreateShaderModuleFromFile(device, "bindless.frag.spv"))
+local pipelineLayout = assert(vulkan.vk_CreatePipelineLayout(device, {
+    setLayouts = { table_ },
+    pushConstantRanges = {{ stageFlags = vulkan.VK_SHADER_STAGE_VERTEX_BIT, size = 4 }}
+}))
+local pipeline = assert(vulkan.vk_CreateGraphicsPipelines(device, {
+    vertexShader = vertShaderModule,
+    fragmentShader = fragShaderModule,
+    pipelineLayout = pipelineLayout,
+    colorFormats = { FORMAT }
+}))
+local pushConstants = ffi.new("uint32_t[1]")
+
+-- Draws every instance with one call and returns the rendered pixels. Slots
+-- freed while the frame was recorded are retired against its fence, and come
+-- back once the table is told the fence has been waited on.
+local function render()
+    assert(vulkan.vk_ResetCommandBuffer(cmd))
+    assert(vulkan.vk_BeginCommandBuffer(cmd))
+    colorBarrier(target, vulkan.VK_IMAGE_LAYOUT_UNDEFINED, vulkan.VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+        vulkan.VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, vulkan.VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+        0, vulkan.VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT)
+    vulkan.vk_CmdBeginRendering(cmd, {
+        width = WIDTH,
+        height = HEIGHT,
+        colorAttachments = {{ imageView = targetView, clearColor = { 0, 0, 0, 1 } }}
+    })
+    vulkan.vk_CmdSetViewport(cmd, 0, 0, WIDTH, HEIGHT)
+    vulkan.vk_CmdSetScissor(cmd, 0, 0, WIDTH, HEIGHT)
+    vulkan.vk_CmdBindPipeline(cmd, pipeline)
+    vulkan.vk_CmdBindBindlessTable(cmd, pipelineLayout, table_)
+    pushConstants[0] = instanceSlot
+    vulkan.vk_CmdPushConstants(cmd, pipelineLayout, vulkan.VK_SHADER_STAGE_VERTEX_BIT, 0,
+        ffi.string(pushConstants, 4))
+    vulkan.vk_CmdDraw(cmd, 6, INSTANCES, 0, 0)
+    vulkan.vk_CmdEndRendering(cmd)
+    assert(vulkan.vk_CmdReadbackImage(cmd, target, readback, fence))
+    assert(vulkan.vk_EndCommandBuffer(cmd))
+    assert(vulkan.vk_QueueSubmit(queue, {{ commandBuffers = { cmd } }}, fence))
+    assert(vulkan.vk_BindlessEndFrame(table_, fence))
+    assert(vulkan.vk_WaitReadback(readback))
+    local pixels = assert(vulkan.vk_GetReadbackData(readback))
+    assert(vulkan.vk_BindlessBeginFrame(table_, fence))
+    assert(vulkan.vk_ResetFences(device, fence))
+    return pixels
+end
+
+-- Every quad's center must show its texture's color
+local function check(pixels)
+    for i = 0, INSTANCES - 1 do
+        local column, row = i % COLUMNS, math.floor(i / COLUMNS)
+        local x = math.floor((column + 0.5) / COLUMNS * WIDTH)
+        local y = math.floor((row + 0.5) / ROWS * HEIGHT)
+        local offset = (y * WIDTH + x) * 4
+        local color = textures[i % #textures + 1].color
+        for c = 1, 3 do
+            local expected = color[c] * 255
+            assert(pixels:byte(offset + c) == expected,
+                string.format("instance %d: channel %d is %d, expected %d", i, c, pixels:byte(offset + c), expected))
+        end
+    end
+end
+
+check(render())
+print(string.format("%d instances, %d textures: 1 table bind, 1 draw", INSTANCES, #textures))
+
+-- Replace the first texture with a white one. The freed slot is retired until
+-- the frame recorded after the free is complete, so the
+-- replacement is given a different slot and in-flight frames never see it.
+local old = textures[1]
+vulkan.vk_BindlessFreeTexture(table_, old.slot)
+textures[1] = createTextures({ { 1, 1, 1 } })[1]
+fillInstances()
+assert(vulkan.vk_WriteBuffer(instanceBuffer, ffi.string(instanceData, ffi.sizeof(instanceData))))
+check(render())
+local stats = vulkan.vk_GetBindlessTableStats(table_)
+print(string.format("replaced slot %d with slot %d; textures used %d/%d, retired %d",
+    old.slot, textures[1].slot, stats.textures.used, stats.textures.capacity, stats.textures.retired))
+assert(vulkan.vk_DestroyImageView(device, old.view))
+assert(vulkan.vk_DestroyImage(device, old.image))
+
+assert(vulkan.vk_DestroyPipeline(device, pipeline))
+assert(vulkan.vk_DestroyPipelineLayout(device, pipelineLayout))
+assert(vulkan.vk_DestroyShaderModule(device, fragShaderModule))
+assert(vulkan.vk_DestroyShaderModule(device, vertShaderModule))
+assert(vulkan.vk_DestroyReadback(device, readback))
+assert(vulkan.vk_DestroyImageView(device, targetView))
+assert(vulkan.vk_DestroyImage(device, target))
+assert(vulkan.vk_DestroyBindlessTable(device, table_))
+assert(vulkan.vk_DestroyBuffer(device, instanceBuffer))
+for _, texture in ipairs(textures) do
+    assert(vulkan.vk_DestroyImageView(device, texture.view))
+    assert(vulkan.vk_DestroyImage(device, texture.image))
+end
+assert(vulkan.vk_DestroySampler(device, sampler))
+assert(vulkan.vk_DestroyFence(device, fence))
+assert(vulkan.vk_DestroyCommandPool(device, commandPool))
+assert(vulkan.vk_DestroyAllocator(allocator))
+assert(vulkan.vk_DestroyDevice(device))
+assert(vulkan.vk_DestroyInstance(instance))
@@ -0,0 +1,116 @@
+-- Dynamic rendering: draws the triangle into offscreen images with
+-- vk_CmdBeginRendering, with no VkRenderPass or VkFramebuffer objects, and
+-- switches the target image every frame. Runs headless, so it works on
+-- lavapipe; the device must support Vulkan 1.3 (or VK_KHR_dynamic_rendering).
+--
+-- Run from the build directory (the shaders and the vulkan/ modules live there):
+--   hello_world.exe ..\examples\dynamic_rendering.lua [frames]
+local vulkan = require("vulkan")
+
+local args = { ... }
+local FRAMES = tonumber(args[2]) or 100
+local WIDTH, HEIGHT = 256, 256
+local FORMAT = vulkan.VK_FORMAT_R8G8B8A8_UNORM
+
+local instance = assert(vulkan.create_instance({
+    application_info = {
+        application_name = "Dynamic rendering",
+        application_version = vulkan.make_version(1, 0, 0),
+        engine_name = "LuaJIT Vulkan",
+        engine_version = vulkan.make_version(1, 0, 0),
+        api_version = vulkan.make_version(1, 3, 0)
+    }
+}))
+local physicalDevice = assert(vulkan.vk_EnumeratePhysicalDevices(instance))[1]
+print("device: " .. vulkan.vk_GetPhysicalDeviceProperties(physicalDevice).deviceName)
+local device, graphicsFamily = vulkan.vk_CreateDevice(physicalDevice, nil, { dynamicRendering = true })
+assert(device, graphicsFamily)
+local queue = assert(vulkan.vk_GetDeviceQueue(device, graphicsFamily, 0))
+local allocator = assert(vulkan.vk_CreateAllocator(physicalDevice, device))
+
+-- Two targets; a render pass flow would need a framebuffer for each
+local targets = {}
+for i = 1, 2 do
+    local image = assert(vulkan.vk_CreateImage(allocator, {
+        width = WIDTH,
+        height = HEIGHT,
+        format = FORMAT,
+        usage = vulkan.VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+        memoryProperties = vulkan.VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+    }))
+    local view = assert(vulkan.vk_CreateImageView(device, { image = image, format = FORMAT }))
+    targets[i] = { image = image, view = view, layout = vulkan.VK_IMAGE_LAYOUT_UNDEFINED }
+end
+
+local vertShaderModule = assert(vulkan.vk_CreateShaderModuleFromFile(device, "triangle.vert.spv"))
+local fragShaderModule = assert(vulkan.vk_CreateShaderModuleFromFile(device, "triangle.frag.spv"))
+local pipelineLayout = assert(vulkan.vk_CreatePipelineLayout(device))
+local pipeline = assert(vulkan.vk_CreateGraphicsPipelines(device, {
+    vertexShader = vertShaderModule,
+    fragmentShader = fragShaderModule,
+    pipelineLayout = pipelineLayout,
+    colorFormats = { FORMAT }
+}))
+
+local commandPool = assert(vulkan.vk_CreateCommandPool(device, graphicsFamily))
+local cmd = assert(vulkan.vk_AllocateCommandBuffers(device, commandPool, 1))[1]
+local fence = assert(vulkan.vk_CreateFence(device))
+
+-- Each target is moved to COLOR_ATTACHMENT_OPTIMAL the first time it is used
+-- and stays there; a render pass would have done this through its layouts
+local function toAttachment(target)
+    if target.layout == vulkan.VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL then return end
+    vulkan.vk_CmdPipelineBarrier(cmd,
+        vulkan.VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, vulkan.VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+        nil, nil, {{
+            oldLayout = target.layout,
+            newLayout = vulkan.VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            srcQueueFamilyIndex = vulkan.VK_QUEUE_FAMILY_IGNORED,
+            dstQueueFamilyIndex = vulkan.VK_QUEUE_FAMILY_IGNORED,
+            image = target.image,
+            dstAccessMask = vulkan.VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            subresourceRange = {
+                aspectMask = vulkan.VK_IMAGE_ASPECT_COLOR_BIT,
+                baseMipLevel = 0, levelCount = 1, baseArrayLayer = 0, layerCount = 1
+            }
+        }})
+    target.layout = vulkan.VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+end
+
+local start = os.clock()
+for frame = 1, FRAMES do
+    local target = targets[frame % 2 + 1]
+    assert(vulkan.vk_ResetCommandBuffer(cmd))
+    assert(vulkan.vk_BeginCommandBuffer(cmd))
+    toAttachment(target)
+    vulkan.vk_CmdBeginRendering(cmd, {
+        width = WIDTH,
+        height = HEIGHT,
+        colorAttachments = {{ imageView = target.view, clearColor = { 0.1, 0.1, 0.2, 1.0 } }}
+    })
+    vulkan.vk_CmdSetViewport(cmd, 0, 0, WIDTH, HEIGHT)
+    vulkan.vk_CmdSetScissor(cmd, 0, 0, WIDTH, HEIGHT)
+    vulkan.vk_CmdBindPipeline(cmd, pipeline)
+    vulkan.vk_CmdDraw(cmd, 3, 1, 0, 0)
+    vulkan.vk_CmdEndRendering(cmd)
+    assert(vulkan.vk_EndCommandBuffer(cmd))
+    assert(vulkan.vk_QueueSubmit(queue, {{ commandBuffers = { cmd } }}, fence))
+    assert(vulkan.vk_WaitForFences(device, fence))
+    assert(vulkan.vk_ResetFences(device, fence))
+end
+print(string.format("%d frames across %d targets, %.3f ms CPU/frame", FRAMES, #targets,
+    (os.clock() - start) * 1000 / FRAMES))
+
+assert(vulkan.vk_DestroyFence(device, fence))
+assert(vulkan.vk_DestroyCommandPool(device, commandPool))
+assert(vulkan.vk_DestroyPipeline(device, pipeline))
+assert(vulkan.vk_DestroyPipelineLayout(device, pipelineLayout))
+assert(vulkan.vk_DestroyShaderModule(device, fragShaderModule))
+assert(vulkan.vk_DestroyShaderModule(device, vertShaderModule))
+for _, target in ipairs(targets) do
+    assert(vulkan.vk_DestroyImageView(device, target.view))
+    assert(vulkan.vk_DestroyImage(device, target.image))
+end
+assert(vulkan.vk_DestroyAllocator(allocator))
+assert(vulkan.vk_DestroyDevice(device))
+assert(vulkan.vk_DestroyInstance(instance))
@@ -0,0 +1,178 @@
+-- GPU profiler: times named regions of every frame with timestamp queries and
+-- counts vertex/fragment shader invocations with pipeline statistics queries.
+-- Results come back framesInFlight frames later, when the frame's slot is
+-- reused, so reading them never waits on the GPU.
+-- Runs headless; the device must support Vulkan 1.3 (or VK_KHR_dynamic_rendering)
+-- and the pipelineStatisticsQuery feature.
+--
+-- Run from the build directory (the shaders and the vulkan/ modules live there):
+--   hello_world.exe ..\examples\gpu_profiler.lua [frames] [framesInFlight]
+local vulkan = require("vulkan")
+
+local args = { ... }
+local FRAMES = tonumber(args[2]) or 100
+local FRAMES_IN_FLIGHT = tonumber(args[3]) or 2
+local WIDTH, HEIGHT = 512, 512
+local FORMAT = vulkan.VK_FORMAT_R8G8B8A8_UNORM
+local COPY_SIZE = 4 * 1024 * 1024
+
+local instance = assert(vulkan.create_instance({
+    application_info = {
+        application_name = "GPU profiler",
+        application_version = vulkan.make_version(1, 0, 0),
+        engine_name = "LuaJIT Vulkan",
+        engine_version = vulkan.make_version(1, 0, 0),
+        api_version = vulkan.make_version(1, 3, 0)
+    }
+}))
+local physicalDevice = assert(vulkan.vk_EnumeratePhysicalDevices(instance))[1]
+print("device: " .. vulkan.vk_GetPhysicalDeviceProperties(physicalDevice).deviceName)
+local device, graphicsFamily = vulkan.vk_CreateDevice(physicalDevice, nil, {
+    dynamicRendering = true,
+    pipelineStatisticsQuery = true
+})
+assert(device, graphicsFamily)
+local queue = assert(vulkan.vk_GetDeviceQueue(device, graphicsFamily, 0))
+local allocator = assert(vulkan.vk_CreateAllocator(physicalDevice, device))
+local profiler = assert(vulkan.vk_CreateGpuProfiler(device, graphicsFamily, {
+    framesInFlight = FRAMES_IN_FLIGHT,
+    pipelineStatistics = true
+}))
+
+local image = assert(vulkan.vk_CreateImage(allocator, {
+    width = WIDTH,
+    height = HEIGHT,
+    format = FORMAT,
+    usage = vulkan.VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+    memoryProperties = vulkan.VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+}))
+local view = assert(vulkan.vk_CreateImageView(device, { image = image, format = FORMAT }))
+local src = assert(vulkan.vk_CreateBuffer(allocator, {
+    size = COPY_SIZE,
+    usage = vulkan.VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+    memoryProperties = vulkan.VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+}))
+local dst = assert(vulkan.vk_CreateBuffer(allocator, {
+    size = COPY_SIZE,
+    usage = vulkan.VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    memoryProperties = vulkan.VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+}))
+
+local vertShaderModule = assert(vulkan.vk_CreateShaderModuleFromFile(device, "triangle.vert.spv"))
+local fragShaderModule = assert(vulkan.vk_CreateShaderModuleFromFile(device, "triangle.frag.spv"))
+local pipelineLayout = assert(vulkan.vk_CreatePipelineLayout(device))
+local pipeline = assert(vulkan.vk_CreateGraphicsPipelines(device, {
+    vertexShader = vertShaderModule,
+    fragmentShader = fragShaderModule,
+    pipelineLayout = pipelineLayout,
+    colorFormats = { FORMAT }
+}))
+
+local commandPool = assert(vulkan.vk_CreateCommandPool(device, graphicsFamily))
+local commandBuffers = assert(vulkan.vk_AllocateCommandBuffers(device, commandPool, FRAMES_IN_FLIGHT))
+local fences = {}
+for i = 1, FRAMES_IN_FLIGHT do
+    fences[i] = assert(vulkan.vk_CreateFence(device, true))
+end
+
+local layout = vulkan.VK_IMAGE_LAYOUT_UNDEFINED
+local totals, samples, lastFrame = {}, 0, nil
+for frame = 1, FRAMES do
+    local slot = (frame - 1) % FRAMES_IN_FLIGHT + 1
+    local cmd = commandBuffers[slot]
+    -- The profiler reads this slot's previous frame back in BeginFrame, which
+    -- is safe once the fence guarding the command buffer has signalled
+    assert(vulkan.vk_WaitForFences(device, fences[slot]))
+    assert(vulkan.vk_ResetFences(device, fences[slot]))
+    assert(vulkan.vk_ResetCommandBuffer(cmd))
+    assert(vulkan.vk_BeginCommandBuffer(cmd))
+    vulkan.vk_GpuProfilerBeginFrame(profiler, cmd)
+
+    vulkan.vk_GpuProfilerBeginRegion(profiler, cmd, "upload")
+    vulkan.vk_CmdCopyBuffer(cmd, src, dst, COPY_SIZE)
+    vulkan.vk_GpuProfilerEndRegion(profiler, cmd)
+
+    vulkan.vk_GpuProfilerBeginRegion(profiler, cmd, "scene")
+    vulkan.vk_CmdPipelineBarrier(cmd,
+        vulkan.VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, vulkan.VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+        nil, nil, {{
+            oldLayout = layout,
+            newLayout = vulkan.VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            srcQueueFamilyIndex = vulkan.VK_QUEUE_FAMILY_IGNORED,
+            dstQueueFamilyIndex = vulkan.VK_QUEUE_FAMILY_IGNORED,
+            image = image,
+            srcAccessMask = vulkan.VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            dstAccessMask = vulkan.VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            subresourceRange = {
+                aspectMask = vulkan.VK_IMAGE_ASPECT_COLOR_BIT,
+                baseMipLevel = 0, levelCount = 1, baseArrayLayer = 0, layerCount = 1
+            }
+        }})
+    layout = vulkan.VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+    vulkan.vk_CmdBeginRendering(cmd, {
+        width = WIDTH,
+        height = HEIGHT,
+        colorAttachments = {{ imageView = view, clearColor = { 0.1, 0.1, 0.2, 1.0 } }}
+    })
+    vulkan.vk_CmdSetViewport(cmd, 0, 0, WIDTH, HEIGHT)
+    vulkan.vk_CmdSetScissor(cmd, 0, 0, WIDTH, HEIGHT)
+    vulkan.vk_CmdBindPipeline(cmd, pipeline)
+    -- Nested regions are timed, but only top-level regions get statistics
+    vulkan.vk_GpuProfilerBeginRegion(profiler, cmd, "triangles")
+    vulkan.vk_CmdDraw(cmd, 3, 100, 0, 0)
+    vulkan.vk_GpuProfilerEndRegion(profiler, cmd)
+    vulkan.vk_CmdEndRendering(cmd)
+    vulkan.vk_GpuProfilerEndRegion(profiler, cmd)
+
+    vulkan.vk_GpuProfilerEndFrame(profiler)
+    assert(vulkan.vk_EndCommandBuffer(cmd))
+    assert(vulkan.vk_QueueSubmit(queue, {{ commandBuffers = { cmd } }}, fences[slot]))
+
+    local results = vulkan.vk_GpuProfilerGetResults(profiler)
+    if results and results.frame ~= lastFrame then
+        lastFrame = results.frame
+        samples = samples + 1
+        for _, region in ipairs(results.regions) do
+            local total = totals[region.name] or { ms = 0, depth = region.depth }
+            total.ms = total.ms + region.ms
+            total.vertexInvocations = region.vertexInvocations
+            total.fragmentInvocations = region.fragmentInvocations
+            totals[region.name] = total
+        end
+    end
+end
+for i = 1, FRAMES_IN_FLIGHT do
+    assert(vulkan.vk_WaitForFences(device, fences[i]))
+end
+
+print(string.format("%d frames, %d read back (%d in flight)", FRAMES, samples, FRAMES_IN_FLIGHT))
+for _, name in ipairs({ "upload", "scene", "triangles" }) do
+    local total = totals[name]
+    if total then
+        local line = string.format("%s%-12s %8.3f ms avg", string.rep("  ", total.depth), name, total.ms / samples)
+        if total.vertexInvocations then
+            line = line .. string.format("  %d vertex / %d fragment invocations",
+                total.vertexInvocations, total.fragmentInvocations)
+        end
+        print(line)
+    end
+end
+local stats = vulkan.vk_GetGpuProfilerStats(profiler)
+print(string.format("dropped: %d regions, %d frames", stats.droppedRegions, stats.droppedFrames))
+
+for i = 1, FRAMES_IN_FLIGHT do
+    assert(vulkan.vk_DestroyFence(device, fences[i]))
+end
+assert(vulkan.vk_DestroyCommandPool(device, commandPool))
+assert(vulkan.vk_DestroyPipeline(device, pipeline))
+assert(vulkan.vk_DestroyPipelineLayout(device, pipelineLayout))
+assert(vulkan.vk_DestroyShaderModule(device, fragShaderModule))
+assert(vulkan.vk_DestroyShaderModule(device, vertShaderModule))
+assert(vulkan.vk_DestroyBuffer(device, dst))
+assert(vulkan.vk_DestroyBuffer(device, src))
+assert(vulkan.vk_DestroyImageView(device, view))
+assert(vulkan.vk_DestroyImage(device, image))
+assert(vulkan.vk_DestroyGpuProfiler(device, profiler))
+assert(vulkan.vk_DestroyAllocator(allocator))
+assert(vulkan.vk_DestroyDevice(device))
+assert(vulkan.vk_DestroyInstance(instance))
@@ -0,0 +1,178 @@
+-- Indexed, instanced and indirect draws: a grid of quads drawn once with one
+-- vk_CmdDrawIndexed per quad, and once with a single vk_CmdDrawIndexedIndirect
+-- whose commands (one per grid row) live in a GPU buffer. Both paths read the
+-- same vertex, index and per-instance buffers through the pipeline's vertex
+-- input, and must produce the same image; the CPU recording time is compared.
+-- Runs headless; the device must support Vulkan 1.3 (or VK_KHR_dynamic_rendering)
+-- and the multiDrawIndirect and drawIndirectFirstInstance features.
+--
+-- Run from the build directory (the shaders and the vulkan/ modules live there):
+--   hello_world.exe ..\examples\indirect_draw.lua [columns] [rows]
+local ffi = require("ffi")
+local vulkan = require("vulkan")
+
+local args = { ... }
+local COLUMNS = tonumber(args[2]) or 100
+local ROWS = tonumber(args[3]) or 100
+local INSTANCES = COLUMNS * ROWS
+local WIDTH, HEIGHT = 512, 512
+local FORMAT = vulkan.VK_FORMAT_R8G8B8A8_UNORM
+
+local instance = assert(vulkan.create_instance({
+    application_info = {
+        application_name = "Indirect draw",
+        application_version = vulkan.make_version(1, 0, 0),
+        engine_name = "LuaJIT Vulkan",
+        engine_version = vulkan.make_version(1, 0, 0),
+        api_version = vulkan.make_version(1, 3, 0)
+    }
+}))
+local physicalDevice = assert(vulkan.vk_EnumeratePhysicalDevices(instance))[1]
+print("device: " .. vulkan.vk_GetPhysicalDeviceProperties(physicalDevice).deviceName)
+local device, graphicsFamily = vulkan.vk_CreateDevice(physicalDevice, nil, {
+    dynamicRendering = true,
+    multiDrawIndirect = true,
+    drawIndirectFirstInstance = true
+})
+assert(device, graphicsFamily)
+local queue = assert(vulkan.vk_GetDeviceQueue(device, graphicsFamily, 0))
+local allocator = assert(vulkan.vk_CreateAllocator(physicalDevice, device))
+
+local function hostBuffer(usage, data)
+    local buffer = assert(vulkan.vk_CreateBuffer(allocator, {
+        size = #data,
+        usage = usage,
+        memoryProperties = vulkan.VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+        preferredMemoryProperties = vulkan.VK_MEMORY_PROPERTY_HOST_COHERENT_BIT
+    }))
+    assert(vulkan.vk_WriteBuffer(buffer, data))
+    return buffer
+end
+
+-- One quad, wound clockwise like triangle.vert
+local vertices = ffi.new("float[8]", { -1, -1, 1, -1, 1, 1, -1, 1 })
+local indices = ffi.new("uint16_t[6]", { 0, 1, 2, 0, 2, 3 })
+local instanceData = ffi.new("float[?]", INSTANCES * 4)
+local cellW, cellH = 2 / COLUMNS, 2 / ROWS
+for i = 0, INSTANCES - 1 do
+    local column, row = i % COLUMNS, math.floor(i / COLUMNS)
+    instanceData[i * 4 + 0] = -1 + (column + 0.5) * cellW
+    instanceData[i * 4 + 1] = -1 + (row + 0.5) * cellH
+    instanceData[i * 4 + 2] = 0.35 * math.min(cellW, cellH)
+end
+-- VkDrawIndexedIndirectCommand: indexCount, instanceCount, firstIndex, vertexOffset, firstInstance
+local commands = ffi.new("uint32_t[?]", ROWS * 5)
+for row = 0, ROWS - 1 do
+    commands[row * 5 + 0] = 6
+    commands[row * 5 + 1] = COLUMNS
+    commands[row * 5 + 4] = row * COLUMNS
+end
+
+local vertexBuffer = hostBuffer(vulkan.VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, ffi.string(vertices, ffi.sizeof(vertices)))
+local instanceBuffer = hostBuffer(vulkan.VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, ffi.string(instanceData, ffi.sizeof(instanceData)))
+local indexBuffer = hostBuffer(vulkan.VK_BUFFER_USAGE_INDEX_BUFFER_BIT, ffi.string(indices, ffi.sizeof(indices)))
+local indirectBuffer = hostBuffer(vulkan.VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT, ffi.string(commands, ffi.sizeof(commands)))
+
+local image, view = vulkan.vk_CreateRenderTarget(allocator, { width = WIDTH, height = HEIGHT, format = FORMAT })
+assert(image, view)
+local readback = assert(vulkan.vk_CreateReadback(allocator, WIDTH * HEIGHT * 4))
+
+local vertShaderModule = assert(vulkan.vk_CreateShaderModuleFromFile(device, "instanced.vert.spv"))
+local fragShaderModule = assert(vulkan.vk_CreateShaderModuleFromFile(device, "triangle.frag.spv"))
+local pipelineLayout = assert(vulkan.vk_CreatePipelineLayout(device))
+local pipeline = assert(vulkan.vk_CreateGraphicsPipelines(device, {
+    vertexShader = vertShaderModule,
+    fragmentShader = fragShaderModule,
+    pipelineLayout = pipelineLayout,
+    colorFormats = { FORMAT },
+    vertexBindings = {
+        { binding = 0, stride = 8 },
+        { binding = 1, stride = 16, inputRate = vulkan.VK_VERTEX_INPUT_RATE_INSTANCE }
+    },
+    vertexAttributes = {
+        { location = 0, binding = 0, format = vulkan.VK_FORMAT_R32G32_SFLOAT },
+        { location = 1, binding = 1, format = vulkan.VK_FORMAT_R32G32B32A32_SFLOAT }
+    }
+}))
+
+local commandPool = assert(vulkan.vk_CreateCommandPool(device, graphicsFamily))
+local cmd = assert(vulkan.vk_AllocateCommandBuffers(device, commandPool, 1))[1]
+local fence = assert(vulkan.vk_CreateFence(device, false))
+
+-- Renders one frame with drawScene and returns the CPU recording time and
+-- the number of lit pixels in the result
+local function render(drawScene)
+    assert(vulkan.vk_ResetCommandBuffer(cmd))
+    assert(vulkan.vk_BeginCommandBuffer(cmd))
+    vulkan.vk_CmdPipelineBarrier(cmd,
+        vulkan.VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, vulkan.VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+        nil, nil, {{
+            oldLayout = vulkan.VK_IMAGE_LAYOUT_UNDEFINED,
+            newLayout = vulkan.VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            srcQueueFamilyIndex = vulkan.VK_QUEUE_FAMILY_IGNORED,
+            dstQueueFamilyIndex = vulkan.VK_QUEUE_FAMILY_IGNORED,
+            image = image,
+            srcAccessMask = 0,
+            dstAccessMask = vulkan.VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            subresourceRange = {
+                aspectMask = vulkan.VK_IMAGE_ASPECT_COLOR_BIT,
+                baseMipLevel = 0, levelCount = 1, baseArrayLayer = 0, layerCount = 1
+            }
+        }})
+    vulkan.vk_CmdBeginRendering(cmd, {
+        width = WIDTH,
+        height = HEIGHT,
+        colorAttachments = {{ imageView = view, clearColor = { 0, 0, 0, 1 } }}
+    })
+    vulkan.vk_CmdSetViewport(cmd, 0, 0, WIDTH, HEIGHT)
+    vulkan.vk_CmdSetScissor(cmd, 0, 0, WIDTH, HEIGHT)
+    vulkan.vk_CmdBindPipeline(cmd, pipeline)
+    vulkan.vk_CmdBindVertexBuffers(cmd, 0, { vertexBuffer, instanceBuffer })
+    vulkan.vk_CmdBindIndexBuffer(cmd, indexBuffer, 0, vulkan.VK_INDEX_TYPE_UINT16)
+    local start = os.clock()
+    drawScene()
+    local recordMs = (os.clock() - start) * 1000
+    vulkan.vk_CmdEndRendering(cmd)
+    assert(vulkan.vk_CmdReadbackImage(cmd, image, readback, fence))
+    assert(vulkan.vk_EndCommandBuffer(cmd))
+    assert(vulkan.vk_QueueSubmit(queue, {{ commandBuffers = { cmd } }}, fence))
+    assert(vulkan.vk_WaitReadback(readback))
+    local pixels = assert(vulkan.vk_GetReadbackData(readback))
+    assert(vulkan.vk_ResetFences(device, fence))
+
+    local lit = 0
+    for i = 1, #pixels, 4 do
+        if pixels:byte(i) > 0 then lit = lit + 1 end
+    end
+    return recordMs, lit
+end
+
+local perDrawMs, perDrawLit = render(function()
+    for i = 0, INSTANCES - 1 do
+        vulkan.vk_CmdDrawIndexed(cmd, 6, 1, 0, 0, i)
+    end
+end)
+local indirectMs, indirectLit = render(function()
+    vulkan.vk_CmdDrawIndexedIndirect(cmd, indirectBuffer, 0, ROWS)
+end)
+
+print(string.format("%d quads: %d vk_CmdDrawIndexed calls %.3f ms, 1 vk_CmdDrawIndexedIndirect (%d commands) %.3f ms",
+    INSTANCES, INSTANCES, perDrawMs, ROWS, indirectMs))
+print(string.format("lit pixels: %d per-draw, %d indirect", perDrawLit, indirectLit))
+assert(perDrawLit == indirectLit and perDrawLit > 0, "indirect draw produced a different image")
+
+assert(vulkan.vk_DestroyFence(device, fence))
+assert(vulkan.vk_DestroyCommandPool(device, commandPool))
+assert(vulkan.vk_DestroyPipeline(device, pipeline))
+assert(vulkan.vk_DestroyPipelineLayout(device, pipelineLayout))
+assert(vulkan.vk_DestroyShaderModule(device, fragShaderModule))
+assert(vulkan.vk_DestroyShaderModule(device, vertShaderModule))
+assert(vulkan.vk_DestroyReadback(device, readback))
+assert(vulkan.vk_DestroyImageView(device, view))
+assert(vulkan.vk_DestroyImage(device, image))
+for _, buffer in ipairs({ indirectBuffer, indexBuffer, instanceBuffer, vertexBuffer }) do
+    assert(vulkan.vk_DestroyBuffer(device, buffer))
+end
+assert(vulkan.vk_DestroyAllocator(allocator))
+assert(vulkan.vk_DestroyDevice(device))
+assert(vulkan.vk_DestroyInstance(instance))
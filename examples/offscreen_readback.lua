@@ -0,0 +1,153 @@
+-- Offscreen rendering with asynchronous readback: each frame renders into a
+-- render target and records a copy into that slot's persistently mapped
+-- readback buffer. The pixels are picked up when the slot comes round again
+-- (or earlier, if vk_ReadbackReady says the fence has signalled), so the CPU
+-- never waits for the queue to drain. The last frame is written as a PPM.
+-- Runs headless; the device must support Vulkan 1.3 (or VK_KHR_dynamic_rendering).
+--
+-- Run from the build directory (the shaders and the vulkan/ modules live there):
+--   hello_world.exe ..\examples\offscreen_readback.lua [frames] [out.ppm]
+local vulkan = require("vulkan")
+
+local args = { ... }
+local FRAMES = tonumber(args[2]) or 60
+local OUT = args[3] or "offscreen_readback.ppm"
+local FRAMES_IN_FLIGHT = 2
+local WIDTH, HEIGHT = 256, 256
+local FORMAT = vulkan.VK_FORMAT_R8G8B8A8_UNORM
+
+local instance = assert(vulkan.create_instance({
+    application_info = {
+        application_name = "Offscreen readback",
+        application_version = vulkan.make_version(1, 0, 0),
+        engine_name = "LuaJIT Vulkan",
+        engine_version = vulkan.make_version(1, 0, 0),
+        api_version = vulkan.make_version(1, 3, 0)
+    }
+}))
+local physicalDevice = assert(vulkan.vk_EnumeratePhysicalDevices(instance))[1]
+print("device: " .. vulkan.vk_GetPhysicalDeviceProperties(physicalDevice).deviceName)
+local device, graphicsFamily = vulkan.vk_CreateDevice(physicalDevice, nil, { dynamicRendering = true })
+assert(device, graphicsFamily)
+local queue = assert(vulkan.vk_GetDeviceQueue(device, graphicsFamily, 0))
+local allocator = assert(vulkan.vk_CreateAllocator(physicalDevice, device))
+
+local image, view = vulkan.vk_CreateRenderTarget(allocator, { width = WIDTH, height = HEIGHT, format = FORMAT })
+assert(image, view)
+
+local vertShaderModule = assert(vulkan.vk_CreateShaderModuleFromFile(device, "triangle.vert.spv"))
+local fragShaderModule = assert(vulkan.vk_CreateShaderModuleFromFile(device, "triangle.frag.spv"))
+local pipelineLayout = assert(vulkan.vk_CreatePipelineLayout(device))
+local pipeline = assert(vulkan.vk_CreateGraphicsPipelines(device, {
+    vertexShader = vertShaderModule,
+    fragmentShader = fragShaderModule,
+    pipelineLayout = pipelineLayout,
+    colorFormats = { FORMAT }
+}))
+
+local commandPool = assert(vulkan.vk_CreateCommandPool(device, graphicsFamily))
+local commandBuffers = assert(vulkan.vk_AllocateCommandBuffers(device, commandPool, FRAMES_IN_FLIGHT))
+local fences, readbacks = {}, {}
+for i = 1, FRAMES_IN_FLIGHT do
+    fences[i] = assert(vulkan.vk_CreateFence(device, true))
+    readbacks[i] = assert(vulkan.vk_CreateReadback(allocator, WIDTH * HEIGHT * 4))
+end
+
+local pending = {} -- slot -> frame number whose copy is in flight
+local pixels, pixelsFrame, early = nil, 0, 0
+local function collect(slot)
+    local data = vulkan.vk_GetReadbackData(readbacks[slot])
+    if data then
+        pixels, pixelsFrame = data, pending[slot]
+        pending[slot] = nil
+    end
+end
+
+local layout = vulkan.VK_IMAGE_LAYOUT_UNDEFINED
+for frame = 1, FRAMES do
+    local slot = (frame - 1) % FRAMES_IN_FLIGHT + 1
+    local cmd = commandBuffers[slot]
+    -- Copies that have already landed are picked up without blocking
+    for other in pairs(pending) do
+        if other ~= slot and vulkan.vk_ReadbackReady(readbacks[other]) then
+            collect(other)
+            early = early + 1
+        end
+    end
+    assert(vulkan.vk_WaitForFences(device, fences[slot]))
+    if pending[slot] then collect(slot) end
+    assert(vulkan.vk_ResetFences(device, fences[slot]))
+    assert(vulkan.vk_ResetCommandBuffer(cmd))
+    assert(vulkan.vk_BeginCommandBuffer(cmd))
+
+    vulkan.vk_CmdPipelineBarrier(cmd,
+        vulkan.VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, vulkan.VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+        nil, nil, {{
+            oldLayout = layout,
+            newLayout = vulkan.VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+            srcQueueFamilyIndex = vulkan.VK_QUEUE_FAMILY_IGNORED,
+            dstQueueFamilyIndex = vulkan.VK_QUEUE_FAMILY_IGNORED,
+            image = image,
+            srcAccessMask = vulkan.VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            dstAccessMask = vulkan.VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+            subresourceRange = {
+                aspectMask = vulkan.VK_IMAGE_ASPECT_COLOR_BIT,
+                baseMipLevel = 0, levelCount = 1, baseArrayLayer = 0, layerCount = 1
+            }
+        }})
+    layout = vulkan.VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+    local t = frame / FRAMES
+    vulkan.vk_CmdBeginRendering(cmd, {
+        width = WIDTH,
+        height = HEIGHT,
+        colorAttachments = {{ imageView = view, clearColor = { 0.1, 0.1 + 0.4 * t, 0.2, 1.0 } }}
+    })
+    vulkan.vk_CmdSetViewport(cmd, 0, 0, WIDTH, HEIGHT)
+    vulkan.vk_CmdSetScissor(cmd, 0, 0, WIDTH, HEIGHT)
+    vulkan.vk_CmdBindPipeline(cmd, pipeline)
+    vulkan.vk_CmdDraw(cmd, 3, 1, 0, 0)
+    vulkan.vk_CmdEndRendering(cmd)
+
+    -- The copy completes with this submission's fence
+    assert(vulkan.vk_CmdReadbackImage(cmd, image, readbacks[slot], fences[slot]))
+    pending[slot] = frame
+    assert(vulkan.vk_EndCommandBuffer(cmd))
+    assert(vulkan.vk_QueueSubmit(queue, {{ commandBuffers = { cmd } }}, fences[slot]))
+end
+
+-- Drain the copies still in flight; waiting is fine once the loop is over
+for slot, frame in pairs(pending) do
+    assert(vulkan.vk_WaitReadback(readbacks[slot]))
+    if frame > pixelsFrame then collect(slot) end
+end
+print(string.format("%d frames, %d readbacks picked up before their slot came round", FRAMES, early))
+
+-- RGBA to binary PPM
+local rows = {}
+for y = 0, HEIGHT - 1 do
+    local row = {}
+    for x = 0, WIDTH - 1 do
+        local i = (y * WIDTH + x) * 4
+        row[x + 1] = pixels:sub(i + 1, i + 3)
+    end
+    rows[y + 1] = table.concat(row)
+end
+local file = assert(io.open(OUT, "wb"))
+file:write(string.format("P6\n%d %d\n255\n", WIDTH, HEIGHT), table.concat(rows))
+file:close()
+print(string.format("frame %d written to %s", pixelsFrame, OUT))
+
+for i = 1, FRAMES_IN_FLIGHT do
+    assert(vulkan.vk_DestroyReadback(device, readbacks[i]))
+    assert(vulkan.vk_DestroyFence(device, fences[i]))
+end
+assert(vulkan.vk_DestroyCommandPool(device, commandPool))
+assert(vulkan.vk_DestroyPipeline(device, pipeline))
+assert(vulkan.vk_DestroyPipelineLayout(device, pipelineLayout))
+assert(vulkan.vk_DestroyShaderModule(device, fragShaderModule))
+assert(vulkan.vk_DestroyShaderModule(device, vertShaderModule))
+assert(vulkan.vk_DestroyImageView(device, view))
+assert(vulkan.vk_DestroyImage(device, image))
+assert(vulkan.vk_DestroyAllocator(allocator))
+assert(vulkan.vk_DestroyDevice(device))
+assert(vulkan.vk_DestroyInstance(instance))
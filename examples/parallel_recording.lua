@@ -0,0 +1,161 @@
+-- Parallel command recording: worker threads, each with its own Lua state and
+-- command pools, record slices of a large draw list into secondary command
+-- buffers, which the primary runs with vk_CmdExecuteCommands. The same scene
+-- is then recorded inline on the main thread for comparison.
+-- Runs headless; the device must support Vulkan 1.3 (or VK_KHR_dynamic_rendering).
+--
+-- Run from the build directory (the shaders and the vulkan/ modules live there):
+--   hello_world.exe ..\examples\parallel_recording.lua [frames] [draws] [threads]
+local SDL = require("SDL")
+local vulkan = require("vulkan")
+
+local args = { ... }
+local FRAMES = tonumber(args[2]) or 200
+local DRAWS = tonumber(args[3]) or 20000
+local THREADS = tonumber(args[4])
+local FRAMES_IN_FLIGHT = 2
+local WIDTH, HEIGHT = 512, 512
+local FORMAT = vulkan.VK_FORMAT_R8G8B8A8_UNORM
+
+-- Runs in every worker state; the arguments after sliceCount are the ones
+-- given to vk_DispatchRecordWorkers, copied into the worker
+local WORKER_SOURCE = [[
+local vulkan = require("vulkan")
+return function(cmd, slice, sliceCount, pipeline, width, height, draws)
+    -- Dynamic state is not inherited by secondaries
+    vulkan.vk_CmdSetViewport(cmd, 0, 0, width, height)
+    vulkan.vk_CmdSetScissor(cmd, 0, 0, width, height)
+    vulkan.vk_CmdBindPipeline(cmd, pipeline)
+    local first = math.floor((slice - 1) * draws / sliceCount)
+    local last = math.floor(slice * draws / sliceCount)
+    for _ = first + 1, last do
+        vulkan.vk_CmdDraw(cmd, 3, 1, 0, 0)
+    end
+end
+]]
+
+local instance = assert(vulkan.create_instance({
+    application_info = {
+        application_name = "Parallel recording",
+        application_version = vulkan.make_version(1, 0, 0),
+        engine_name = "LuaJIT Vulkan",
+        engine_version = vulkan.make_version(1, 0, 0),
+        api_version = vulkan.make_version(1, 3, 0)
+    }
+}))
+local physicalDevice = assert(vulkan.vk_EnumeratePhysicalDevices(instance))[1]
+print("device: " .. vulkan.vk_GetPhysicalDeviceProperties(physicalDevice).deviceName)
+local device, graphicsFamily = vulkan.vk_CreateDevice(physicalDevice, nil, { dynamicRendering = true })
+assert(device, graphicsFamily)
+local queue = assert(vulkan.vk_GetDeviceQueue(device, graphicsFamily, 0))
+local allocator = assert(vulkan.vk_CreateAllocator(physicalDevice, device))
+
+local image, view = vulkan.vk_CreateRenderTarget(allocator, { width = WIDTH, height = HEIGHT, format = FORMAT })
+assert(image, view)
+local vertShaderModule = assert(vulkan.vk_CreateShaderModuleFromFile(device, "triangle.vert.spv"))
+local fragShaderModule = assert(vulkan.vk_CreateShaderModuleFromFile(device, "triangle.frag.spv"))
+local pipelineLayout = assert(vulkan.vk_CreatePipelineLayout(device))
+local pipeline = assert(vulkan.vk_CreateGraphicsPipelines(device, {
+    vertexShader = vertShaderModule,
+    fragmentShader = fragShaderModule,
+    pipelineLayout = pipelineLayout,
+    colorFormats = { FORMAT }
+}))
+
+local workers, threadCount = vulkan.vk_CreateRecordWorkers(device, graphicsFamily, {
+    source = WORKER_SOURCE,
+    threads = THREADS,
+    framesInFlight = FRAMES_IN_FLIGHT
+})
+assert(workers, threadCount)
+local SLICES = threadCount * 2 -- A little slack so a slow worker doesn't hold up the frame
+local inheritance = { colorFormats = { FORMAT } }
+
+local commandPool = assert(vulkan.vk_CreateCommandPool(device, graphicsFamily))
+local commandBuffers = assert(vulkan.vk_AllocateCommandBuffers(device, commandPool, FRAMES_IN_FLIGHT))
+local fences = {}
+for i = 1, FRAMES_IN_FLIGHT do
+    fences[i] = assert(vulkan.vk_CreateFence(device, true))
+end
+
+local frequency = SDL.SDL_GetPerformanceFrequency()
+local layout = vulkan.VK_IMAGE_LAYOUT_UNDEFINED
+
+local function run(parallel)
+    local recordTicks = 0
+    for frame = 1, FRAMES do
+        local slot = (frame - 1) % FRAMES_IN_FLIGHT + 1
+        local cmd = commandBuffers[slot]
+        -- Also guards the workers' pools for this slot, passed as frame - 1 below
+        assert(vulkan.vk_WaitForFences(device, fences[slot]))
+        assert(vulkan.vk_ResetFences(device, fences[slot]))
+
+        local start = SDL.SDL_GetPerformanceCounter()
+        if parallel then
+            assert(vulkan.vk_DispatchRecordWorkers(workers, frame - 1, inheritance, SLICES, pipeline, WIDTH, HEIGHT, DRAWS))
+        end
+        assert(vulkan.vk_ResetCommandBuffer(cmd))
+        assert(vulkan.vk_BeginCommandBuffer(cmd))
+        vulkan.vk_CmdPipelineBarrier(cmd,
+            vulkan.VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, vulkan.VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, 0,
+            nil, nil, {{
+                oldLayout = layout,
+                newLayout = vulkan.VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                srcQueueFamilyIndex = vulkan.VK_QUEUE_FAMILY_IGNORED,
+                dstQueueFamilyIndex = vulkan.VK_QUEUE_FAMILY_IGNORED,
+                image = image,
+                srcAccessMask = vulkan.VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                dstAccessMask = vulkan.VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+                subresourceRange = {
+                    aspectMask = vulkan.VK_IMAGE_ASPECT_COLOR_BIT,
+                    baseMipLevel = 0, levelCount = 1, baseArrayLayer = 0, layerCount = 1
+                }
+            }})
+        layout = vulkan.VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL
+        vulkan.vk_CmdBeginRendering(cmd, {
+            width = WIDTH,
+            height = HEIGHT,
+            colorAttachments = {{ imageView = view, clearColor = { 0.1, 0.1, 0.2, 1.0 } }},
+            secondaryCommandBuffers = parallel
+        })
+        if parallel then
+            local secondaries = assert(vulkan.vk_WaitRecordWorkers(workers))
+            vulkan.vk_CmdExecuteCommands(cmd, secondaries)
+        else
+            vulkan.vk_CmdSetViewport(cmd, 0, 0, WIDTH, HEIGHT)
+            vulkan.vk_CmdSetScissor(cmd, 0, 0, WIDTH, HEIGHT)
+            vulkan.vk_CmdBindPipeline(cmd, pipeline)
+            for _ = 1, DRAWS do
+                vulkan.vk_CmdDraw(cmd, 3, 1, 0, 0)
+            end
+        end
+        vulkan.vk_CmdEndRendering(cmd)
+        assert(vulkan.vk_EndCommandBuffer(cmd))
+        recordTicks = recordTicks + SDL.SDL_GetPerformanceCounter() - start
+        assert(vulkan.vk_QueueSubmit(queue, {{ commandBuffers = { cmd } }}, fences[slot]))
+    end
+    assert(vulkan.vk_QueueWaitIdle(queue))
+    return recordTicks * 1000 / frequency / FRAMES
+end
+
+local inlineMs = run(false)
+local parallelMs = run(true)
+print(string.format("%d draws per frame, %d frames", DRAWS, FRAMES))
+print(string.format("inline:   %8.3f ms recording per frame", inlineMs))
+print(string.format("parallel: %8.3f ms recording per frame (%d threads, %d slices), %.2fx",
+    parallelMs, threadCount, SLICES, inlineMs / parallelMs))
+
+assert(vulkan.vk_DestroyRecordWorkers(workers))
+for i = 1, FRAMES_IN_FLIGHT do
+    assert(vulkan.vk_DestroyFence(device, fences[i]))
+end
+assert(vulkan.vk_DestroyCommandPool(device, commandPool))
+assert(vulkan.vk_DestroyPipeline(device, pipeline))
+assert(vulkan.vk_DestroyPipelineLayout(device, pipelineLayout))
+assert(vulkan.vk_DestroyShaderModule(device, fragShaderModule))
+assert(vulkan.vk_DestroyShaderModule(device, vertShaderModule))
+assert(vulkan.vk_DestroyImageView(device, view))
+assert(vulkan.vk_DestroyImage(device, image))
+assert(vulkan.vk_DestroyAllocator(allocator))
+assert(vulkan.vk_DestroyDevice(device))
+assert(vulkan.vk_DestroyInstance(instance))
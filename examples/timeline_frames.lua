@@ -0,0 +1,84 @@
+-- Timeline semaphores: paces frames in flight with one counter instead of a
+-- fence per frame. Frame n signals value n on submit, so before reusing a
+-- command buffer the CPU waits for the value of the frame that last used it,
+-- and the GPU's progress can be read at any time without blocking.
+-- Runs headless; each "frame" is a buffer copy.
+--
+-- Run from the build directory (the vulkan/ modules live there):
+--   hello_world.exe ..\examples\timeline_frames.lua [frames] [framesInFlight]
+local vulkan = require("vulkan")
+
+local args = { ... }
+local FRAMES = tonumber(args[2]) or 1000
+local FRAMES_IN_FLIGHT = tonumber(args[3]) or 2
+local COPY_SIZE = 4 * 1024 * 1024
+
+local instance = assert(vulkan.create_instance({
+    application_info = {
+        application_name = "Timeline frames",
+        application_version = vulkan.make_version(1, 0, 0),
+        engine_name = "LuaJIT Vulkan",
+        engine_version = vulkan.make_version(1, 0, 0),
+        api_version = vulkan.make_version(1, 2, 0)
+    }
+}))
+local physicalDevice = assert(vulkan.vk_EnumeratePhysicalDevices(instance))[1]
+print("device: " .. vulkan.vk_GetPhysicalDeviceProperties(physicalDevice).deviceName)
+local device, graphicsFamily = vulkan.vk_CreateDevice(physicalDevice, nil, { timelineSemaphore = true })
+assert(device, graphicsFamily)
+local queue = assert(vulkan.vk_GetDeviceQueue(device, graphicsFamily, 0))
+local allocator = assert(vulkan.vk_CreateAllocator(physicalDevice, device))
+
+local src = assert(vulkan.vk_CreateBuffer(allocator, {
+    size = COPY_SIZE,
+    usage = vulkan.VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+    memoryProperties = vulkan.VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+}))
+local dst = assert(vulkan.vk_CreateBuffer(allocator, {
+    size = COPY_SIZE,
+    usage = vulkan.VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+    memoryProperties = vulkan.VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT
+}))
+
+local commandPool = assert(vulkan.vk_CreateCommandPool(device, graphicsFamily))
+local commandBuffers = assert(vulkan.vk_AllocateCommandBuffers(device, commandPool, FRAMES_IN_FLIGHT))
+local timeline = assert(vulkan.vk_CreateTimelineSemaphore(device, 0))
+
+local waitCount, maxLag = 0, 0
+local start = os.clock()
+for frame = 1, FRAMES do
+    local cmd = commandBuffers[(frame - 1) % FRAMES_IN_FLIGHT + 1]
+    -- The frame that last used this command buffer signalled frame - FRAMES_IN_FLIGHT
+    local reuseValue = frame - FRAMES_IN_FLIGHT
+    if reuseValue > 0 then
+        if not vulkan.vk_WaitSemaphores(device, timeline, reuseValue, 0) then
+            waitCount = waitCount + 1
+            assert(vulkan.vk_WaitSemaphores(device, timeline, reuseValue))
+        end
+    end
+
+    assert(vulkan.vk_ResetCommandBuffer(cmd))
+    assert(vulkan.vk_BeginCommandBuffer(cmd))
+    vulkan.vk_CmdCopyBuffer(cmd, src, dst, COPY_SIZE)
+    assert(vulkan.vk_EndCommandBuffer(cmd))
+    assert(vulkan.vk_QueueSubmit(queue, {{
+        commandBuffers = { cmd },
+        signalSemaphores = { timeline },
+        signalValues = { frame }
+    }}))
+
+    -- Non-blocking progress check: how many frames the GPU is behind
+    local completed = vulkan.vk_GetSemaphoreCounterValue(device, timeline)
+    maxLag = math.max(maxLag, frame - completed)
+end
+assert(vulkan.vk_WaitSemaphores(device, timeline, FRAMES))
+print(string.format("%d frames, %d in flight: %.3f ms/frame, blocked %d times, GPU at most %d frames behind",
+    FRAMES, FRAMES_IN_FLIGHT, (os.clock() - start) * 1000 / FRAMES, waitCount, maxLag))
+
+assert(vulkan.vk_DestroySemaphore(device, timeline))
+assert(vulkan.vk_DestroyCommandPool(device, commandPool))
+assert(vulkan.vk_DestroyBuffer(device, dst))
+assert(vulkan.vk_DestroyBuffer(device, src))
+assert(vulkan.vk_DestroyAllocator(allocator))
+assert(vulkan.vk_DestroyDevice(device))
+assert(vulkan.vk_DestroyInstance(instance))
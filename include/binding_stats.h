@@ -0,0 +1,150 @@
+#ifndef BINDING_STATS_H
+#define BINDING_STATS_H
+
+// Opt-in per-binding instrumentation for the Lua modules, compiled in with
+// -DLUAJIT_BINDING_STATS (cmake -DLUAJIT_BINDING_STATS=ON). Every function
+// of a module's luaL_Reg array is then registered as a closure that counts
+// and times its calls; without the define the functions are registered
+// directly, exactly as luaL_newlib would, and none of this code exists.
+//
+// Usage in a module:
+//   #if defined(LUAJIT_BINDING_STATS)
+//   static BindingStats funcs_stats[sizeof(funcs) / sizeof(funcs[0])];
+//   #endif
+//   ...
+//   binding_stats_newlib(L, funcs); // instead of luaL_newlib(L, funcs)
+//
+// The module table then has stats() and reset_stats(). Calls that raise a
+// Lua error unwind past the timer and are not counted. The counters are not
+// atomic, so bindings called from several threads at once may lose counts.
+
+#include "lua.h"
+#include "lauxlib.h"
+#include <SDL3/SDL.h>
+#include <stdint.h>
+#include <string.h>
+
+#define BINDING_STATS_BUCKETS 32
+
+typedef struct {
+  const char *name;
+  lua_CFunction func;
+  uint64_t calls;
+  uint64_t totalTicks; // SDL performance counter ticks
+  uint64_t maxTicks;
+  uint64_t histogram[BINDING_STATS_BUCKETS]; // Bucket i: calls taking [2^i, 2^(i+1)) ns; the last is open
+} BindingStats;
+
+#if defined(LUAJIT_BINDING_STATS)
+
+static uint64_t bindingStatsFrequency = 0;
+
+static int binding_stats_call(lua_State *L) {
+  BindingStats *stats = (BindingStats *)lua_touserdata(L, lua_upvalueindex(1));
+  uint64_t start = SDL_GetPerformanceCounter();
+  int results = stats->func(L);
+  uint64_t ticks = SDL_GetPerformanceCounter() - start;
+
+  stats->calls++;
+  stats->totalTicks += ticks;
+  if (ticks > stats->maxTicks) stats->maxTicks = ticks;
+  uint64_t ns = (uint64_t)((double)ticks * 1e9 / (double)bindingStatsFrequency);
+  int bucket = 0;
+  while (ns > 1 && bucket < BINDING_STATS_BUCKETS - 1) {
+      ns >>= 1;
+      bucket++;
+  }
+  stats->histogram[bucket]++;
+  return results;
+}
+
+// stats() -> { [name] = { calls, totalMs, maxMs, avgUs, histogram = { bucket counts } } },
+// only bindings called since the last reset_stats()
+static int binding_stats_l_stats(lua_State *L) {
+  BindingStats *stats = (BindingStats *)lua_touserdata(L, lua_upvalueindex(1));
+  int count = (int)lua_tointeger(L, lua_upvalueindex(2));
+  double msPerTick = 1000.0 / (double)bindingStatsFrequency;
+  lua_newtable(L);
+  for (int i = 0; i < count; i++) {
+      const BindingStats *s = &stats[i];
+      if (s->calls == 0) continue;
+      lua_createtable(L, 0, 5);
+      lua_pushinteger(L, (lua_Integer)s->calls);
+      lua_setfield(L, -2, "calls");
+      lua_pushnumber(L, (double)s->totalTicks * msPerTick);
+      lua_setfield(L, -2, "totalMs");
+      lua_pushnumber(L, (double)s->maxTicks * msPerTick);
+      lua_setfield(L, -2, "maxMs");
+      lua_pushnumber(L, (double)s->totalTicks * msPerTick * 1000.0 / (double)s->calls);
+      lua_setfield(L, -2, "avgUs");
+      int last = BINDING_STATS_BUCKETS;
+      while (last > 0 && s->histogram[last - 1] == 0) last--;
+      lua_createtable(L, last, 0);
+      for (int b = 0; b < last; b++) {
+          lua_pushinteger(L, (lua_Integer)s->histogram[b]);
+          lua_rawseti(L, -2, b + 1);
+      }
+      lua_setfield(L, -2, "histogram");
+      lua_setfield(L, -2, s->name);
+  }
+  return 1;
+}
+
+static int binding_stats_l_reset(lua_State *L) {
+  BindingStats *stats = (BindingStats *)lua_touserdata(L, lua_upvalueindex(1));
+  int count = (int)lua_tointeger(L, lua_upvalueindex(2));
+  for (int i = 0; i < count; i++) {
+      stats[i].calls = 0;
+      stats[i].totalTicks = 0;
+      stats[i].maxTicks = 0;
+      memset(stats[i].histogram, 0, sizeof(stats[i].histogram));
+  }
+  return 0;
+}
+
+// Creates the module table with every function of funcs wrapped in a timing
+// closure over its slot in stats (one slot per luaL_Reg entry, terminator included)
+static void binding_stats_register(lua_State *L, const luaL_Reg *funcs, BindingStats *stats, int count) {
+  bindingStatsFrequency = SDL_GetPerformanceFrequency();
+  lua_createtable(L, 0, count + 2);
+  for (int i = 0; funcs[i].name; i++) {
+      stats[i].name = funcs[i].name;
+      stats[i].func = funcs[i].func;
+      lua_pushlightuserdata(L, &stats[i]);
+      lua_pushcclosure(L, binding_stats_call, 1);
+      lua_setfield(L, -2, funcs[i].name);
+  }
+  lua_pushlightuserdata(L, stats);
+  lua_pushinteger(L, count);
+  lua_pushcclosure(L, binding_stats_l_stats, 2);
+  lua_setfield(L, -2, "stats");
+  lua_pushlightuserdata(L, stats);
+  lua_pushinteger(L, count);
+  lua_pushcclosure(L, binding_stats_l_reset, 2);
+  lua_setfield(L, -2, "reset_stats");
+}
+
+#define binding_stats_newlib(L, funcs) \
+  binding_stats_register(L, funcs, funcs##_stats, (int)(sizeof(funcs##_stats) / sizeof(funcs##_stats[0])))
+
+#else
+
+static int binding_stats_l_disabled(lua_State *L) {
+  lua_pushnil(L);
+  lua_pushstring(L, "Built without LUAJIT_BINDING_STATS");
+  return 2;
+}
+
+static void binding_stats_register_disabled(lua_State *L) {
+  lua_pushcfunction(L, binding_stats_l_disabled);
+  lua_setfield(L, -2, "stats");
+  lua_pushcfunction(L, binding_stats_l_disabled);
+  lua_setfield(L, -2, "reset_stats");
+}
+
+#define binding_stats_newlib(L, funcs) \
+  (luaL_newlib(L, funcs), binding_stats_register_disabled(L))
+
+#endif
+
+#endif
@@ -6,6 +6,44 @@
 #include <SDL3/SDL_vulkan.h> // For SDL_Vulkan_CreateSurface
 //#include <vulkan/vulkan.h>
 
+// Symbols exported from the executable so LuaJIT can bind them through ffi.C
+#if defined(_WIN32)
+#define SDL_LUAJIT_API __declspec(dllexport)
+#else
+#define SDL_LUAJIT_API __attribute__((visibility("default")))
+#endif
+
+// One event of an SDL_CreateEventBuffer, flattened so LuaJIT's FFI can read
+// it without a C call; declared again in lua/SDL/ffi.lua
+typedef struct {
+  uint32_t type;
+  uint32_t windowID;
+  double timestampMs;
+  int32_t key;       // Key events: SDL_Keycode
+  int32_t scancode;
+  uint16_t mod;
+  uint8_t down;      // Key and mouse button events
+  uint8_t repeat;
+  uint8_t button;    // Mouse button events
+  uint8_t clicks;
+  uint16_t coalesced; // Later events of the same type merged into this one
+  float x, y;        // Mouse position
+  float xrel, yrel;  // Mouse motion; wheel amount for wheel events
+  int32_t data1, data2; // Window events
+} SDLLuaEvent;
+
+typedef struct {
+  uint32_t capacity;
+  uint32_t count;       // Events written by the last drain
+  uint32_t more;        // Nonzero when the last drain filled up with events still queued
+  SDLLuaEvent *events;  // capacity entries, allocated with the userdata
+} SDLEventBuffer;
+
 int luaopen_SDL(lua_State *L);
 
-#endif
\ No newline at end of file
+// Drains the event queue into the buffer and returns the event count; buffer->more
+// says whether events were left queued
+SDL_LUAJIT_API uint32_t sdlffi_PollEvents(SDLEventBuffer *buffer);
+SDL_LUAJIT_API uint32_t sdlffi_WaitEvents(SDLEventBuffer *buffer, int32_t timeoutMs);
+
+#endif
@@ -4,18 +4,164 @@
 #include "lua.h"
 #include <SDL3/SDL.h>        // For SDL_Window in SDL_Vulkan_CreateSurface
 #include <SDL3/SDL_vulkan.h> // For SDL_Vulkan_CreateSurface
+// The executable does not link the Vulkan loader, every entry point is looked
+// up at run time through vkGetInstanceProcAddr
+#ifndef VK_NO_PROTOTYPES
+#define VK_NO_PROTOTYPES
+#endif
 #include <vulkan/vulkan.h>
 
+// Symbols exported from the executable so LuaJIT can bind them through ffi.C
+#if defined(_WIN32)
+#define VULKAN_LUAJIT_API __declspec(dllexport)
+#else
+#define VULKAN_LUAJIT_API __attribute__((visibility("default")))
+#endif
+
+// Every wrapper below keeps its Vulkan handle as the first field, the FFI
+// module reads handles straight out of the userdata payload.
+
+// Instance-level entry points, loaded per instance with vkGetInstanceProcAddr
+#define VULKAN_INSTANCE_FUNCTIONS(X) \
+  X(vkDestroyInstance) \
+  X(vkEnumeratePhysicalDevices) \
+  X(vkGetPhysicalDeviceProperties) \
+  X(vkGetPhysicalDeviceQueueFamilyProperties) \
+  X(vkGetPhysicalDeviceMemoryProperties) \
+  X(vkEnumerateDeviceExtensionProperties) \
+  X(vkCreateDevice) \
+  X(vkGetDeviceProcAddr) \
+  X(vkDestroySurfaceKHR) \
+  X(vkGetPhysicalDeviceSurfaceSupportKHR) \
+  X(vkGetPhysicalDeviceSurfaceCapabilitiesKHR) \
+  X(vkGetPhysicalDeviceSurfaceFormatsKHR) \
+  X(vkGetPhysicalDeviceSurfacePresentModesKHR)
+
+typedef struct {
+#define VULKAN_DISPATCH_MEMBER(name) PFN_##name name;
+  VULKAN_INSTANCE_FUNCTIONS(VULKAN_DISPATCH_MEMBER)
+#undef VULKAN_DISPATCH_MEMBER
+} VulkanInstanceDispatch;
+
 typedef struct {
   VkInstance instance;
+  const VulkanInstanceDispatch *vki; // Instance-level entry points of this instance
 } VulkanInstance;
 
 typedef struct {
   VkPhysicalDevice physicalDevice;
+  const VulkanInstanceDispatch *vki; // Of the instance it was enumerated from
 } VulkanPhysicalDevice;
 
+// Device-level entry points, loaded per device with vkGetDeviceProcAddr so
+// calls go straight to the driver
+#define VULKAN_DEVICE_FUNCTIONS(X) \
+  X(vkDestroyDevice) \
+  X(vkDeviceWaitIdle) \
+  X(vkGetDeviceQueue) \
+  X(vkQueueSubmit) \
+  X(vkQueueWaitIdle) \
+  X(vkQueuePresentKHR) \
+  X(vkCreateSwapchainKHR) \
+  X(vkDestroySwapchainKHR) \
+  X(vkGetSwapchainImagesKHR) \
+  X(vkAcquireNextImageKHR) \
+  X(vkAllocateMemory) \
+  X(vkFreeMemory) \
+  X(vkMapMemory) \
+  X(vkUnmapMemory) \
+  X(vkFlushMappedMemoryRanges) \
+  X(vkInvalidateMappedMemoryRanges) \
+  X(vkCreateBuffer) \
+  X(vkDestroyBuffer) \
+  X(vkGetBufferMemoryRequirements) \
+  X(vkBindBufferMemory) \
+  X(vkCreateImage) \
+  X(vkDestroyImage) \
+  X(vkGetImageMemoryRequirements) \
+  X(vkBindImageMemory) \
+  X(vkCreateImageView) \
+  X(vkDestroyImageView) \
+  X(vkCreateRenderPass) \
+  X(vkDestroyRenderPass) \
+  X(vkCreateFramebuffer) \
+  X(vkDestroyFramebuffer) \
+  X(vkCreateShaderModule) \
+  X(vkDestroyShaderModule) \
+  X(vkCreatePipelineLayout) \
+  X(vkDestroyPipelineLayout) \
+  X(vkCreateDescriptorSetLayout) \
+  X(vkDestroyDescriptorSetLayout) \
+  X(vkCreateDescriptorPool) \
+  X(vkDestroyDescriptorPool) \
+  X(vkAllocateDescriptorSets) \
+  X(vkUpdateDescriptorSets) \
+  X(vkCreateSampler) \
+  X(vkDestroySampler) \
+  X(vkCreatePipelineCache) \
+  X(vkDestroyPipelineCache) \
+  X(vkGetPipelineCacheData) \
+  X(vkCreateGraphicsPipelines) \
+  X(vkDestroyPipeline) \
+  X(vkCreateSemaphore) \
+  X(vkDestroySemaphore) \
+  X(vkGetSemaphoreCounterValue) \
+  X(vkWaitSemaphores) \
+  X(vkSignalSemaphore) \
+  X(vkCreateFence) \
+  X(vkDestroyFence) \
+  X(vkWaitForFences) \
+  X(vkResetFences) \
+  X(vkGetFenceStatus) \
+  X(vkCreateQueryPool) \
+  X(vkDestroyQueryPool) \
+  X(vkGetQueryPoolResults) \
+  X(vkCreateCommandPool) \
+  X(vkDestroyCommandPool) \
+  X(vkAllocateCommandBuffers) \
+  X(vkFreeCommandBuffers) \
+  X(vkResetCommandPool) \
+  X(vkBeginCommandBuffer) \
+  X(vkEndCommandBuffer) \
+  X(vkResetCommandBuffer) \
+  X(vkCmdBeginRenderPass) \
+  X(vkCmdEndRenderPass) \
+  X(vkCmdBeginRendering) \
+  X(vkCmdEndRendering) \
+  X(vkCmdBindPipeline) \
+  X(vkCmdSetViewport) \
+  X(vkCmdSetScissor) \
+  X(vkCmdBindVertexBuffers) \
+  X(vkCmdBindIndexBuffer) \
+  X(vkCmdBindDescriptorSets) \
+  X(vkCmdPushConstants) \
+  X(vkCmdDraw) \
+  X(vkCmdDrawIndexed) \
+  X(vkCmdDrawIndirect) \
+  X(vkCmdDrawIndexedIndirect) \
+  X(vkCmdDrawIndirectCount) \
+  X(vkCmdDrawIndexedIndirectCount) \
+  X(vkCmdPipelineBarrier) \
+  X(vkCmdCopyBuffer) \
+  X(vkCmdCopyImageToBuffer) \
+  X(vkCmdExecuteCommands) \
+  X(vkCmdResetQueryPool) \
+  X(vkCmdWriteTimestamp) \
+  X(vkCmdBeginQuery) \
+  X(vkCmdEndQuery) \
+  X(vkWaitForPresentKHR)
+
+typedef struct {
+#define VULKAN_DISPATCH_MEMBER(name) PFN_##name name;
+  VULKAN_DEVICE_FUNCTIONS(VULKAN_DISPATCH_MEMBER)
+#undef VULKAN_DISPATCH_MEMBER
+} VulkanDeviceDispatch;
+
 typedef struct {
   VkDevice device;
+  VkPhysicalDevice physicalDevice; // For properties needed after creation
+  const VulkanInstanceDispatch *vki; // Of the instance it was created from
+  const VulkanDeviceDispatch *vkd;  // Device-level entry points of this device
 } VulkanDevice;
 
 typedef struct {
@@ -25,67 +171,622 @@ typedef struct {
 
 typedef struct {
   VkQueue queue;
+  const VulkanDeviceDispatch *vkd; // Of the owning device
 } VulkanQueue;
 
+#define VULKAN_MAX_SWAPCHAIN_QUEUE_FAMILIES 4
+
 typedef struct {
   VkSwapchainKHR swapchain;
   VkDevice device; // For cleanup
+  const VulkanDeviceDispatch *vkd;
+  // Creation parameters, reused by vk_RecreateSwapchainKHR. pQueueFamilyIndices
+  // points at queueFamilyIndices below.
+  VkSwapchainCreateInfoKHR createInfo;
+  uint32_t queueFamilyIndices[VULKAN_MAX_SWAPCHAIN_QUEUE_FAMILIES];
 } VulkanSwapchain;
 
+// Device memory sub-allocator (vk_CreateAllocator). Pools carve resources out
+// of large VkDeviceMemory blocks instead of one vkAllocateMemory per resource.
+#define VULKAN_POOL_FREE_LIST 0 // General purpose, first fit with coalescing
+#define VULKAN_POOL_LINEAR 1    // Bump allocation, reset as a whole
+#define VULKAN_POOL_RING 2      // Single block, wraps around to the start
+
+typedef struct {
+  VkDeviceSize offset;
+  VkDeviceSize size;
+} VulkanMemoryRange;
+
+typedef struct {
+  VkDeviceMemory memory;
+  VkDeviceSize size;
+  void *mapped;                  // Persistently mapped if the memory type is host visible
+  VkDeviceSize usedBytes;
+  uint32_t allocationCount;
+  int dedicated;                 // Holds a single oversized allocation
+  VkDeviceSize head;             // Linear and ring pools: next free offset
+  VulkanMemoryRange *freeRanges; // Free-list and ring pools: sorted by offset and coalesced
+  uint32_t freeCount;
+  uint32_t freeCapacity;
+} VulkanMemoryBlock;
+
+typedef struct VulkanAllocator VulkanAllocator;
+
+typedef struct {
+  VulkanAllocator *allocator;
+  uint32_t memoryTypeIndex;
+  int kind;                 // VULKAN_POOL_*
+  int custom;               // Created by vk_CreateMemoryPool rather than per memory type
+  VkDeviceSize blockSize;
+  VkDeviceSize granularity; // bufferImageGranularity if buffers and optimal images share blocks
+  VulkanMemoryBlock **blocks;
+  uint32_t blockCount;
+  uint32_t blockCapacity;
+  uint32_t refs;            // Owner reference plus live allocations
+} VulkanMemoryPool;
+
+// Heap allocated and reference counted: resources outlive a destroyed or
+// collected allocator and release its memory when the last one is freed
+struct VulkanAllocator {
+  VkDevice device;
+  const VulkanDeviceDispatch *vkd;
+  VkPhysicalDeviceMemoryProperties memoryProperties;
+  VkDeviceSize bufferImageGranularity;
+  VkDeviceSize nonCoherentAtomSize;
+  VkDeviceSize blockSize;
+  // Default free-list pools by memory type, with buffers and linear images
+  // ([0]) kept apart from optimal images ([1]) so granularity never applies
+  VulkanMemoryPool *defaultPools[VK_MAX_MEMORY_TYPES][2];
+  uint32_t refs; // Owner reference plus custom pools and live allocations
+};
+
+typedef struct {
+  VulkanMemoryPool *pool; // NULL if not allocated by the sub-allocator
+  VulkanMemoryBlock *block;
+  VkDeviceSize offset;
+  VkDeviceSize size;      // Bytes reserved in the block
+} VulkanAllocation;
+
+typedef struct {
+  VulkanAllocator *allocator;
+} VulkanAllocatorHandle;
+
+typedef struct {
+  VulkanMemoryPool *pool;
+} VulkanMemoryPoolHandle;
+
 typedef struct {
   VkImage image;
+  VkDevice device;             // Set for images created with vk_CreateImage
+  const VulkanDeviceDispatch *vkd;
+  VulkanAllocation allocation; // Swapchain images own no memory
+  VkFormat format;
+  VkExtent2D extent;
 } VulkanImage;
 
 typedef struct {
   VkImageView imageView;
   VkDevice device;
+  const VulkanDeviceDispatch *vkd;
 } VulkanImageView;
 
 typedef struct {
   VkRenderPass renderPass;
   VkDevice device;
+  const VulkanDeviceDispatch *vkd;
 } VulkanRenderPass;
 
 typedef struct {
   VkFramebuffer framebuffer;
   VkDevice device;
+  const VulkanDeviceDispatch *vkd;
+  uint32_t width; // Render area used by vk_CmdBeginRenderPass
+  uint32_t height;
 } VulkanFramebuffer;
 
 typedef struct {
   VkShaderModule shaderModule;
   VkDevice device;
+  const VulkanDeviceDispatch *vkd;
 } VulkanShaderModule;
 
 typedef struct {
   VkPipelineLayout pipelineLayout;
   VkDevice device;
+  const VulkanDeviceDispatch *vkd;
 } VulkanPipelineLayout;
 
+typedef struct {
+  VkSampler sampler;
+  VkDevice device;
+  const VulkanDeviceDispatch *vkd;
+} VulkanSampler;
+
+typedef struct {
+  VkPipelineCache pipelineCache;
+  VkDevice device;
+  const VulkanDeviceDispatch *vkd;
+} VulkanPipelineCache;
+
 typedef struct {
   VkPipeline pipeline;
   VkDevice device;
+  const VulkanDeviceDispatch *vkd;
 } VulkanPipeline;
 
+#define VULKAN_MAX_COLOR_ATTACHMENTS 8
+#define VULKAN_MAX_VERTEX_BINDINGS 8
+#define VULKAN_MAX_VERTEX_ATTRIBUTES 16
+
+// Everything vk_CreateGraphicsPipelines reads from its Lua table, captured so
+// the pipeline can be built off the Lua thread
+typedef struct {
+  VkShaderModule vertexShader;
+  VkShaderModule fragmentShader;
+  VkPipelineLayout pipelineLayout;
+  VkRenderPass renderPass;       // VK_NULL_HANDLE for dynamic rendering
+  VkPipelineCache pipelineCache; // VK_NULL_HANDLE for none
+  // Dynamic rendering attachment formats, used when renderPass is null
+  uint32_t colorFormatCount;
+  VkFormat colorFormats[VULKAN_MAX_COLOR_ATTACHMENTS];
+  VkFormat depthFormat; // VK_FORMAT_UNDEFINED for no depth test
+  // Vertex input; both counts 0 for shaders that generate their vertices
+  VkPrimitiveTopology topology;
+  uint32_t vertexBindingCount;
+  VkVertexInputBindingDescription vertexBindings[VULKAN_MAX_VERTEX_BINDINGS];
+  uint32_t vertexAttributeCount;
+  VkVertexInputAttributeDescription vertexAttributes[VULKAN_MAX_VERTEX_ATTRIBUTES];
+} VulkanGraphicsPipelineDesc;
+
+// Asynchronous pipeline compilation (vk_CreatePipelineCompiler)
+#define VULKAN_PIPELINE_COMPILER_MAX_THREADS 32
+
+typedef struct VulkanPipelineJob {
+  VkDevice device;
+  const VulkanDeviceDispatch *vkd;
+  VulkanGraphicsPipelineDesc desc;
+  VkPipeline pipeline;
+  VkResult result;
+  double ms;   // Compile time on the worker thread
+  int done;    // Guarded by the compiler mutex
+  int taken;   // The pipeline was handed to Lua and is owned by a VulkanPipeline
+  int started; // Taken off the queue by a worker; guarded by the compiler mutex
+  int refs;    // Future + queue
+  struct VulkanPipelineJob *next;
+} VulkanPipelineJob;
+
+typedef struct {
+  VkDevice device;
+  const VulkanDeviceDispatch *vkd;
+  SDL_Mutex *mutex;
+  SDL_Condition *workAvailable;
+  SDL_Condition *jobDone;
+  SDL_Thread *threads[VULKAN_PIPELINE_COMPILER_MAX_THREADS];
+  int threadCount;
+  VulkanPipelineJob *head; // Pending jobs, FIFO
+  VulkanPipelineJob *tail;
+  int shutdown;
+  int refs; // Owning handle + outstanding futures
+} VulkanPipelineCompiler;
+
+typedef struct {
+  VulkanPipelineCompiler *compiler; // NULL once destroyed
+} VulkanPipelineCompilerHandle;
+
+typedef struct {
+  VulkanPipelineJob *job;
+  VulkanPipelineCompiler *compiler; // NULL until the job is queued
+  int descRef;                      // Registry copy of the description while the job may read it
+} VulkanPipelineFuture;
+
 typedef struct {
   VkSemaphore semaphore;
   VkDevice device;
+  const VulkanDeviceDispatch *vkd;
+  int timeline; // Created by vk_CreateTimelineSemaphore
 } VulkanSemaphore;
 
 typedef struct {
   VkFence fence;
   VkDevice device;
+  const VulkanDeviceDispatch *vkd;
 } VulkanFence;
 
 typedef struct {
   VkCommandPool commandPool;
   VkDevice device;
+  const VulkanDeviceDispatch *vkd;
 } VulkanCommandPool;
 
 typedef struct {
   VkCommandBuffer commandBuffer;
-  // Possibly other fields like VkDevice for cleanup
+  const VulkanDeviceDispatch *vkd; // Of the owning device
 } VulkanCommandBuffer;
 
+typedef struct {
+  VkBuffer buffer;
+  VkDevice device;
+  const VulkanDeviceDispatch *vkd;
+  VkDeviceSize size;
+  VulkanAllocation allocation;
+} VulkanBuffer;
+
+typedef struct VulkanFrameDriver VulkanFrameDriver;
+
+// Completion of submitted work: a fence, or a frame driver slot. A plain
+// fence may be reset or destroyed once its owner has waited on it, so work
+// tagged with one only completes when the owner says so. Driver slots count
+// their submits, which tells a later use of the slot from the tagged one.
+typedef struct {
+  VkFence fence;             // Plain fence; VK_NULL_HANDLE for a driver slot
+  VulkanFrameDriver *driver; // Kept alive by the owner of the tag
+  uint32_t slot;
+  uint64_t submit;           // Driver slots: the slot's submit count once the tagged frame is submitted
+} VulkanFrameFence;
+
+#define VULKAN_RETIRE_MAX_PENDING 16
+
+// Resources of one submitted frame, released once its work is complete
+typedef struct {
+  VulkanFrameFence fence;
+  uint64_t data[2]; // The owner's bookkeeping for the frame
+  int done;         // Known complete
+} VulkanRetireFrame;
+
+// Submitted frames still holding resources, oldest first
+typedef struct {
+  VulkanRetireFrame pending[VULKAN_RETIRE_MAX_PENDING];
+  uint32_t first;
+  uint32_t count;
+} VulkanRetireQueue;
+
+#define VULKAN_BINDLESS_BUFFERS 0 // Array index and descriptor binding of each bindless array
+#define VULKAN_BINDLESS_TEXTURES 1
+#define VULKAN_BINDLESS_ARRAYS 2 // At most the size of VulkanRetireFrame.data
+
+// Slot allocator of one descriptor array. Freed slots queue up in retired
+// until the frame that freed them is complete, so a descriptor is never
+// rewritten while a submitted command buffer may still read it.
+typedef struct {
+  uint32_t capacity;
+  uint32_t next;         // Slots below next have been handed out before
+  uint8_t *live;         // Per slot: handed out and not freed
+  uint32_t *free;        // Stack of reusable slots
+  uint32_t freeCount;
+  uint32_t *retired;     // Ring of freed slots, oldest frame first
+  uint32_t retiredFirst;
+  uint32_t retiredCount;
+  uint32_t frameRetired; // Freed since the last vk_BindlessEndFrame, at the end of the ring
+  uint32_t used;
+} VulkanBindlessArray;
+
+// Bindless resource table: one update-after-bind descriptor set holding a
+// partially bound array of storage buffers (binding 0) and a variable-count
+// array of combined image samplers (binding 1), indexed from shaders by slot
+typedef struct {
+  VkDescriptorSet set; // First, so the table can be used wherever a descriptor set handle is read
+  VkDevice device;
+  const VulkanDeviceDispatch *vkd;
+  VkDescriptorSetLayout setLayout;
+  VkDescriptorPool pool;
+  VulkanBindlessArray arrays[VULKAN_BINDLESS_ARRAYS];
+  VulkanRetireQueue retire; // data[a]: slots of array a freed during the frame
+} VulkanBindlessTable;
+
+typedef struct {
+  uint64_t reserveCount;
+  uint64_t bytesReserved;
+  VkDeviceSize highWater; // Most ring bytes in use at once
+  uint64_t stallCount;    // Reservations that blocked on a frame driver fence because the ring was full
+  double stallMs;
+} VulkanStagingStats;
+
+typedef struct {
+  VkBuffer buffer; // First, so the ring can be used wherever a buffer handle is read
+  VkDevice device;
+  const VulkanDeviceDispatch *vkd;
+  VulkanAllocation allocation;
+  uint8_t *mapped;
+  int coherent;
+  VkDeviceSize size;
+  VkDeviceSize head;       // Next free byte
+  VkDeviceSize tail;       // Start of the oldest live reservation
+  VkDeviceSize used;
+  VkDeviceSize frameBytes; // Consumed since the last vk_StagingEndFrame
+  VkDeviceSize frameStart; // Head when the frame being recorded began
+  VulkanRetireQueue retire; // data[0]: ring head when the frame was closed, data[1]: bytes it consumed
+  VulkanStagingStats stats;
+} VulkanStagingRing;
+
+// Image copy into a persistently mapped host buffer, resolved once the fence
+// of the submission that carries the copy signals
+typedef struct {
+  VkBuffer buffer; // First, so the readback can be used wherever a buffer handle is read
+  VkDevice device;
+  const VulkanDeviceDispatch *vkd;
+  VulkanAllocation allocation;
+  const uint8_t *mapped;
+  int coherent;
+  VkDeviceSize capacity;
+  VkDeviceSize size;   // Bytes written by the last recorded copy, rows tightly packed
+  uint32_t width;
+  uint32_t height;
+  VkFormat format;
+  VulkanFrameFence fence; // Submission carrying the copy; all zero until a copy is recorded
+  int ready;              // The copy was seen complete since it was recorded
+} VulkanReadback;
+
+// Inheritance of a secondary command buffer, from a Lua table: a render pass
+// (renderPass, subpass, framebuffer) or dynamic rendering attachment formats
+// (colorFormats, depthFormat). The pointers between the structs are set up
+// when the buffer is begun, so the struct can be copied.
+typedef struct {
+  VkCommandBufferInheritanceInfo info;
+  VkCommandBufferInheritanceRenderingInfo rendering;
+  VkFormat colorFormats[VULKAN_MAX_COLOR_ATTACHMENTS];
+  VkCommandBufferUsageFlags flags; // RENDER_PASS_CONTINUE when recorded inside a render pass or rendering
+} VulkanInheritance;
+
+// Parallel recording (vk_CreateRecordWorkers): each worker is a thread with
+// its own lua_State and one command pool per frame slot
+#define VULKAN_RECORD_WORKERS_MAX_THREADS 32
+#define VULKAN_RECORD_WORKERS_MAX_FRAMES 8
+
+struct VulkanRecordWorkers;
+
+typedef struct {
+  struct VulkanRecordWorkers *owner;
+  lua_State *L; // Stack: record function, command buffer cache, dispatch arguments
+  SDL_Thread *thread;
+  uint64_t seenDispatch;
+  VkCommandPool pools[VULKAN_RECORD_WORKERS_MAX_FRAMES];
+  VkCommandBuffer *buffers[VULKAN_RECORD_WORKERS_MAX_FRAMES]; // Secondaries allocated from pools[slot], reused
+  uint32_t bufferCounts[VULKAN_RECORD_WORKERS_MAX_FRAMES];
+  uint32_t used[VULKAN_RECORD_WORKERS_MAX_FRAMES];      // Secondaries recorded since pools[slot] was reset
+  uint64_t poolEpoch[VULKAN_RECORD_WORKERS_MAX_FRAMES]; // slotEpoch of the owner when pools[slot] was reset
+} VulkanRecordWorker;
+
+typedef struct VulkanRecordWorkers {
+  VkDevice device;
+  const VulkanDeviceDispatch *vkd;
+  SDL_Mutex *mutex;
+  SDL_Condition *workAvailable;
+  SDL_Condition *sliceDone;
+  VulkanRecordWorker workers[VULKAN_RECORD_WORKERS_MAX_THREADS];
+  int threadCount;
+  uint32_t framesInFlight;
+  VulkanInheritance inheritance; // Of the current dispatch
+  uint64_t slotFrame[VULKAN_RECORD_WORKERS_MAX_FRAMES]; // Frame tag of the last dispatch into each slot
+  uint64_t slotEpoch[VULKAN_RECORD_WORKERS_MAX_FRAMES]; // Bumped when a slot starts a new frame
+  // Guarded by the mutex
+  uint64_t dispatchCount;
+  uint32_t frame; // Pool slot of the current dispatch
+  uint32_t sliceCount;
+  uint32_t nextSlice;
+  uint32_t slicesDone;
+  int busy; // Dispatched and not waited for yet
+  int shutdown;
+  int failed;
+  char error[256]; // First error of the current dispatch
+  VkCommandBuffer *results; // Secondary of each slice
+  uint32_t resultCapacity;
+} VulkanRecordWorkers;
+
+#define VULKAN_GPU_PROFILER_MAX_FRAMES 8
+#define VULKAN_GPU_PROFILER_MAX_DEPTH 16
+
+// One named region of a profiled frame. Region i of a frame owns timestamp
+// queries 2*i and 2*i+1 of the frame's range and statistics query i.
+typedef struct {
+  uint32_t depth;
+  int statistics; // Pipeline statistics query begun; only top-level regions, queries can't nest
+} VulkanGpuRegion;
+
+// Queries of one frame; frame n is recorded into slot n % framesInFlight
+typedef struct {
+  uint64_t frame;
+  uint32_t regionCount;
+  uint32_t depth;
+  uint32_t stack[VULKAN_GPU_PROFILER_MAX_DEPTH]; // Open regions
+  int pending; // Closed by vk_GpuProfilerEndFrame, results not read back yet
+} VulkanGpuProfilerFrame;
+
+typedef struct {
+  VkQueryPool timestampPool; // 2 * maxRegions queries per frame slot
+  VkQueryPool statisticsPool; // maxRegions queries per frame slot, or VK_NULL_HANDLE
+  VkDevice device;
+  const VulkanDeviceDispatch *vkd;
+  double timestampPeriod; // Nanoseconds per timestamp tick
+  uint64_t timestampMask; // From the queue family's timestampValidBits
+  uint32_t framesInFlight;
+  uint32_t maxRegions;
+  uint64_t frameCount; // Frames begun
+  int inFrame;
+  uint64_t droppedRegions; // Regions beyond maxRegions, not timed
+  uint64_t droppedFrames;  // Frames whose queries were not available when their slot came around
+  VulkanGpuProfilerFrame frames[VULKAN_GPU_PROFILER_MAX_FRAMES];
+  VulkanGpuRegion *regions; // framesInFlight * maxRegions
+  uint64_t *readback;       // 4 * maxRegions: timestamps, then statistics pairs
+} VulkanGpuProfiler;
+
+// Recorded command stream, replayed into a VkCommandBuffer by vk_ReplayCommandStream
+typedef struct {
+  uint8_t *data;
+  size_t size;
+  size_t capacity;
+  uint32_t commandCount;
+  int failed; // Set when growing the buffer failed, replay refuses the stream
+} VulkanCommandStream;
+
+// Prebuilt submit/present descriptors. These are not handle wrappers: the
+// arrays the Vulkan structs point at are stored in the same userdata, after
+// the struct, and individual slots are patched in place between frames.
+typedef struct {
+  VkSubmitInfo submitInfo;
+  VkFence fence; // Used when vk_QueueSubmit is not given a fence
+  VkSemaphore *waitSemaphores;
+  VkPipelineStageFlags *waitStages;
+  VkCommandBuffer *commandBuffers;
+  VkSemaphore *signalSemaphores;
+} VulkanSubmitInfo;
+
+typedef struct {
+  VkPresentInfoKHR presentInfo;
+  VkSemaphore *waitSemaphores;
+  VkSwapchainKHR *swapchains;
+  uint32_t *imageIndices;
+  VkResult *results;
+} VulkanPresentInfo;
+
+#define VULKAN_FRAME_DRIVER_MAX_FRAMES 8
+#define VULKAN_FRAME_DRIVER_MAX_IMAGES 16
+#define VULKAN_FRAME_TIMING_HISTORY 16
+
+// Per frame in flight; indexed by currentFrame
+typedef struct {
+  VkCommandBuffer commandBuffer;
+  VkSemaphore imageAvailable;
+  VkFence inFlight;
+  uint64_t submits; // Successful vkQueueSubmit calls with inFlight
+} VulkanFrameSlot;
+
+// CPU timings of the most recent frame, in milliseconds
+typedef struct {
+  uint64_t frameCount;
+  double frameMs;       // Whole vk_FrameDriverRunFrame call
+  double waitMs;        // Blocked on the slot's fence and the acquired image's fence
+  double acquireMs;
+  double recordMs;      // Lua record callback
+  double submitMs;      // Submit and present
+  double intervalMs;    // Start of previous frame to start of this one
+  double avgIntervalMs; // Smoothed intervalMs
+  uint64_t skippedFrames; // vk_FrameDriverRunFrame calls skipped by an on-demand driver with nothing dirty
+  double paceMs;          // Last vk_FrameDriverPace: frame limiter sleep plus present wait
+  double latencyMs;       // CPU start to on screen of the newest frame seen displayed (present wait only)
+  double avgLatencyMs;    // Smoothed latencyMs
+} VulkanFrameStats;
+
+// Timestamps of one presented frame, in SDL performance counter ticks
+typedef struct {
+  uint64_t presentId; // VK_KHR_present_id value, 0 without present wait
+  uint64_t cpuStart;  // vk_FrameDriverRunFrame entered
+  uint64_t submitted; // vkQueueSubmit returned
+  uint64_t presented; // vkQueuePresentKHR returned
+  uint64_t displayed; // vkWaitForPresentKHR saw it (or a later frame) on screen; 0 until then
+} VulkanFrameTiming;
+
+struct VulkanFrameDriver {
+  VkDevice device;
+  const VulkanDeviceDispatch *vkd;
+  VulkanSwapchain *swapchain; // Read every frame so vk_RecreateSwapchainKHR is picked up
+  VkQueue graphicsQueue;
+  VkQueue presentQueue;
+  VkCommandPool commandPool;
+  uint32_t framesInFlight;
+  uint32_t currentFrame;
+  int recording; // Inside the record callback
+  int onDemand;         // Only render while dirtyFrames > 0
+  uint32_t dirtyFrames; // Frames still to render since the last vk_FrameDriverSetDirty
+  VulkanFrameSlot frames[VULKAN_FRAME_DRIVER_MAX_FRAMES];
+  // Per swapchain image; indexed by imageIndex. The present wait semaphore is
+  // tied to the image, since the presentation engine may still hold it when
+  // the frame slot comes around again.
+  VkSemaphore renderFinished[VULKAN_FRAME_DRIVER_MAX_IMAGES];
+  VkFence imagesInFlight[VULKAN_FRAME_DRIVER_MAX_IMAGES]; // Fence of the frame last submitted for the image
+  uint64_t lastFrameStart;
+  VulkanFrameStats stats;
+  // Pacing (vk_FrameDriverPace)
+  uint64_t framePeriod;  // Frame limiter period in performance counter ticks, 0 when off
+  uint64_t nextDeadline; // Start of the next limited frame, 0 to restart the schedule
+  PFN_vkWaitForPresentKHR waitForPresent; // Non-NULL with presentWait
+  uint32_t maxFrameLatency;            // Presents allowed ahead of the display with present wait
+  uint64_t presentId;                  // Last present id handed out
+  uint64_t displayedId;                // Newest present id known to be on screen (or given up on)
+  VkSwapchainKHR presentIdSwapchain;   // Present ids restart their meaning on a new swapchain
+  VkSwapchainKHR staleSwapchain;       // Holds an image a failed submit never presented; 0 when none
+  VulkanFrameTiming timings[VULKAN_FRAME_TIMING_HISTORY]; // Indexed by frameCount % VULKAN_FRAME_TIMING_HISTORY
+};
+
 int luaopen_vulkan(lua_State *L);
 
+// C-ABI fast path for the per-frame bindings, declared again in lua/vulkan/ffi.lua
+VULKAN_LUAJIT_API VkResult vkffi_BeginCommandBuffer(const VulkanCommandBuffer *commandBuffer);
+VULKAN_LUAJIT_API VkResult vkffi_EndCommandBuffer(const VulkanCommandBuffer *commandBuffer);
+VULKAN_LUAJIT_API VkResult vkffi_ResetCommandBuffer(const VulkanCommandBuffer *commandBuffer);
+VULKAN_LUAJIT_API void vkffi_CmdBeginRenderPass(const VulkanCommandBuffer *commandBuffer, VkRenderPass renderPass,
+    VkFramebuffer framebuffer, uint32_t width, uint32_t height);
+VULKAN_LUAJIT_API void vkffi_CmdEndRenderPass(const VulkanCommandBuffer *commandBuffer);
+VULKAN_LUAJIT_API void vkffi_CmdBeginRendering(const VulkanCommandBuffer *commandBuffer, VkImageView colorView,
+    uint32_t width, uint32_t height);
+VULKAN_LUAJIT_API void vkffi_CmdEndRendering(const VulkanCommandBuffer *commandBuffer);
+VULKAN_LUAJIT_API void vkffi_CmdBindPipeline(const VulkanCommandBuffer *commandBuffer, VkPipeline pipeline);
+VULKAN_LUAJIT_API void vkffi_CmdSetViewport(const VulkanCommandBuffer *commandBuffer, float x, float y,
+    float width, float height, float minDepth, float maxDepth);
+VULKAN_LUAJIT_API void vkffi_CmdSetScissor(const VulkanCommandBuffer *commandBuffer, int32_t x, int32_t y,
+    uint32_t width, uint32_t height);
+VULKAN_LUAJIT_API void vkffi_CmdDraw(const VulkanCommandBuffer *commandBuffer, uint32_t vertexCount,
+    uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance);
+VULKAN_LUAJIT_API void vkffi_CmdBindVertexBuffer(const VulkanCommandBuffer *commandBuffer, uint32_t binding,
+    VkBuffer buffer, VkDeviceSize offset);
+VULKAN_LUAJIT_API void vkffi_CmdBindIndexBuffer(const VulkanCommandBuffer *commandBuffer, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t indexType);
+VULKAN_LUAJIT_API void vkffi_CmdDrawIndexed(const VulkanCommandBuffer *commandBuffer, uint32_t indexCount,
+    uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance);
+VULKAN_LUAJIT_API void vkffi_CmdDrawIndirect(const VulkanCommandBuffer *commandBuffer, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t drawCount, uint32_t stride);
+VULKAN_LUAJIT_API void vkffi_CmdDrawIndexedIndirect(const VulkanCommandBuffer *commandBuffer, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t drawCount, uint32_t stride);
+VULKAN_LUAJIT_API void vkffi_CmdBindDescriptorSet(const VulkanCommandBuffer *commandBuffer, VkPipelineLayout layout,
+    uint32_t firstSet, VkDescriptorSet set);
+VULKAN_LUAJIT_API void vkffi_CmdPushConstants(const VulkanCommandBuffer *commandBuffer, VkPipelineLayout layout,
+    uint32_t stageFlags, uint32_t offset, uint32_t size, const void *data);
+VULKAN_LUAJIT_API VkResult vkffi_WaitForFences(const VulkanDevice *device, VkFence fence, uint64_t timeout);
+VULKAN_LUAJIT_API VkResult vkffi_ResetFences(const VulkanDevice *device, VkFence fence);
+VULKAN_LUAJIT_API uint64_t vkffi_GetSemaphoreCounterValue(const VulkanDevice *device, VkSemaphore semaphore);
+VULKAN_LUAJIT_API VkResult vkffi_WaitSemaphore(const VulkanDevice *device, VkSemaphore semaphore, uint64_t value,
+    uint64_t timeout);
+VULKAN_LUAJIT_API VkResult vkffi_AcquireNextImageKHR(const VulkanDevice *device, VkSwapchainKHR swapchain, uint64_t timeout,
+    VkSemaphore semaphore, VkFence fence, uint32_t *pImageIndex);
+VULKAN_LUAJIT_API uint64_t vkffi_GetHeapAllocationCount(void);
+VULKAN_LUAJIT_API VkDeviceSize vkffi_StagingReserve(VulkanStagingRing *ring, VkDeviceSize size, VkDeviceSize alignment);
+VULKAN_LUAJIT_API void *vkffi_StagingData(const VulkanStagingRing *ring);
+VULKAN_LUAJIT_API void vkffi_CmdCopyBuffer(const VulkanCommandBuffer *commandBuffer, VkBuffer src, VkBuffer dst,
+    VkDeviceSize srcOffset, VkDeviceSize dstOffset, VkDeviceSize size);
+VULKAN_LUAJIT_API const void *vkffi_ReadbackData(VulkanReadback *readback);
+VULKAN_LUAJIT_API VkDeviceSize vkffi_ReadbackSize(const VulkanReadback *readback);
+VULKAN_LUAJIT_API VkResult vkffi_QueueSubmit(const VulkanQueue *queue, const VulkanCommandBuffer *commandBuffer,
+    VkSemaphore waitSemaphore, VkSemaphore signalSemaphore, VkFence fence);
+VULKAN_LUAJIT_API VkResult vkffi_QueuePresentKHR(const VulkanQueue *queue, VkSwapchainKHR swapchain, uint32_t imageIndex,
+    VkSemaphore waitSemaphore);
+
+// Command stream recording and replay
+VULKAN_LUAJIT_API VkResult vkffi_QueueSubmitInfo(const VulkanQueue *queue, const VulkanSubmitInfo *info);
+VULKAN_LUAJIT_API VkResult vkffi_QueuePresentInfo(const VulkanQueue *queue, VulkanPresentInfo *info, uint32_t imageIndex);
+VULKAN_LUAJIT_API const VulkanFrameStats *vkffi_GetFrameStats(const VulkanFrameDriver *driver);
+VULKAN_LUAJIT_API void vkffi_ResetCommandStream(VulkanCommandStream *stream);
+VULKAN_LUAJIT_API void vkffi_StreamBindPipeline(VulkanCommandStream *stream, VkPipeline pipeline);
+VULKAN_LUAJIT_API void vkffi_StreamBindVertexBuffer(VulkanCommandStream *stream, uint32_t binding,
+    VkBuffer buffer, VkDeviceSize offset);
+VULKAN_LUAJIT_API void vkffi_StreamBindIndexBuffer(VulkanCommandStream *stream, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t indexType);
+VULKAN_LUAJIT_API void vkffi_StreamBindDescriptorSet(VulkanCommandStream *stream, VkPipelineLayout layout,
+    uint32_t firstSet, VkDescriptorSet set);
+VULKAN_LUAJIT_API void vkffi_StreamPushConstants(VulkanCommandStream *stream, VkPipelineLayout layout,
+    uint32_t stageFlags, uint32_t offset, uint32_t size, const void *data);
+VULKAN_LUAJIT_API void vkffi_StreamDraw(VulkanCommandStream *stream, uint32_t vertexCount,
+    uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance);
+VULKAN_LUAJIT_API void vkffi_StreamDrawIndexed(VulkanCommandStream *stream, uint32_t indexCount,
+    uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance);
+VULKAN_LUAJIT_API void vkffi_StreamDrawIndirect(VulkanCommandStream *stream, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t drawCount, uint32_t stride);
+VULKAN_LUAJIT_API void vkffi_StreamDrawIndexedIndirect(VulkanCommandStream *stream, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t drawCount, uint32_t stride);
+VULKAN_LUAJIT_API void vkffi_StreamMemoryBarrier(VulkanCommandStream *stream, uint32_t srcStageMask,
+    uint32_t dstStageMask, uint32_t srcAccessMask, uint32_t dstAccessMask);
+VULKAN_LUAJIT_API void vkffi_StreamImageBarrier(VulkanCommandStream *stream, VkImage image,
+    uint32_t oldLayout, uint32_t newLayout, uint32_t srcStageMask, uint32_t dstStageMask,
+    uint32_t srcAccessMask, uint32_t dstAccessMask, uint32_t aspectMask);
+VULKAN_LUAJIT_API VkResult vkffi_ReplayCommandStream(const VulkanCommandBuffer *commandBuffer,
+    const VulkanCommandStream *stream);
+
 #endif
\ No newline at end of file
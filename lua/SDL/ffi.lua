@@ -0,0 +1,62 @@
+-- LuaJIT FFI view of SDL event buffers (see SDL_PollEvents in
+-- src/sdl_luajit.c). Draining the queue is one C call per frame, and the
+-- events are read in place, so an event loop allocates nothing per event:
+--
+--   local sdlffi = require("SDL.ffi")
+--   local events = SDL.SDL_CreateEventBuffer(256)
+--   local buffer = sdlffi.EventBuffer(events)
+--   for i = 0, sdlffi.PollEvents(buffer) - 1 do
+--       local event = buffer.events[i]
+--       if event.type == SDL.SDL_EVENT_QUIT then running = false end
+--   end
+--
+-- The buffer pointer does not keep the userdata alive; hold on to it.
+local ffi = require("ffi")
+
+ffi.cdef[[
+typedef struct {
+  uint32_t type;
+  uint32_t windowID;
+  double timestampMs;
+  int32_t key;
+  int32_t scancode;
+  uint16_t mod;
+  uint8_t down;
+  uint8_t repeat;
+  uint8_t button;
+  uint8_t clicks;
+  uint16_t coalesced;
+  float x, y;
+  float xrel, yrel;
+  int32_t data1, data2;
+} SDLLuaEvent;
+
+typedef struct {
+  uint32_t capacity;
+  uint32_t count;
+  uint32_t more;
+  SDLLuaEvent *events;
+} SDLEventBuffer;
+
+uint32_t sdlffi_PollEvents(SDLEventBuffer *buffer);
+uint32_t sdlffi_WaitEvents(SDLEventBuffer *buffer, int32_t timeoutMs);
+]]
+
+local C = ffi.C
+local M = {}
+
+local bufferPtr = ffi.typeof("SDLEventBuffer *")
+function M.EventBuffer(ud)
+    return ffi.cast(bufferPtr, ud)
+end
+
+-- Drains the queue into the buffer; returns the event count. buffer.more is
+-- nonzero when the buffer filled up with events still queued.
+M.PollEvents = C.sdlffi_PollEvents
+
+-- Blocks until an event arrives or timeoutMs passes (-1 waits forever), then
+-- drains the queue into the buffer; returns the event count, 0 on timeout, and
+-- sets buffer.more like PollEvents
+M.WaitEvents = C.sdlffi_WaitEvents
+
+return M
@@ -0,0 +1,286 @@
+-- LuaJIT FFI fast path for the per-frame Vulkan bindings.
+-- The functions here are C-ABI exports of the executable (see vkffi_* in
+-- src/vulkan_luajit.c) called through ffi.C, so a render loop built on them
+-- stays on compiled traces. Setup and teardown still go through require("vulkan").
+--
+--   local vkffi = require("vulkan.ffi")
+--   local cmd = vkffi.CommandBuffer(commandBuffers[1])  -- cdata pointer
+--   vkffi.CmdDraw(cmd, 3, 1, 0, 0)
+--
+-- Devices, queues and command buffers are passed as pointers to their userdata,
+-- which carries the device's dispatch table; other handles are plain cdata
+-- copies. Neither keeps the userdata alive, so hold on to the original
+-- userdata for as long as the cdata is used.
+local ffi = require("ffi")
+
+ffi.cdef[[
+typedef int32_t VkResult;
+typedef struct VkSwapchainKHR_T *VkSwapchainKHR;
+typedef struct VkRenderPass_T *VkRenderPass;
+typedef struct VkFramebuffer_T *VkFramebuffer;
+typedef struct VkImageView_T *VkImageView;
+typedef struct VkPipeline_T *VkPipeline;
+typedef struct VkSemaphore_T *VkSemaphore;
+typedef struct VkFence_T *VkFence;
+typedef struct VkBuffer_T *VkBuffer;
+typedef struct VkImage_T *VkImage;
+typedef struct VkPipelineLayout_T *VkPipelineLayout;
+typedef struct VkDescriptorSet_T *VkDescriptorSet;
+typedef uint64_t VkDeviceSize;
+typedef struct VulkanDevice VulkanDevice;
+typedef struct VulkanQueue VulkanQueue;
+typedef struct VulkanCommandBuffer VulkanCommandBuffer;
+typedef struct VulkanCommandStream VulkanCommandStream;
+typedef struct VulkanSubmitInfo VulkanSubmitInfo;
+typedef struct VulkanPresentInfo VulkanPresentInfo;
+typedef struct VulkanFrameDriver VulkanFrameDriver;
+typedef struct VulkanStagingRing VulkanStagingRing;
+typedef struct VulkanReadback VulkanReadback;
+typedef struct {
+  uint64_t frameCount;
+  double frameMs, waitMs, acquireMs, recordMs, submitMs, intervalMs, avgIntervalMs;
+  uint64_t skippedFrames;
+  double paceMs, latencyMs, avgLatencyMs;
+} VulkanFrameStats;
+
+VkResult vkffi_BeginCommandBuffer(const VulkanCommandBuffer *commandBuffer);
+VkResult vkffi_EndCommandBuffer(const VulkanCommandBuffer *commandBuffer);
+VkResult vkffi_ResetCommandBuffer(const VulkanCommandBuffer *commandBuffer);
+void vkffi_CmdBeginRenderPass(const VulkanCommandBuffer *commandBuffer, VkRenderPass renderPass,
+    VkFramebuffer framebuffer, uint32_t width, uint32_t height);
+void vkffi_CmdEndRenderPass(const VulkanCommandBuffer *commandBuffer);
+void vkffi_CmdBeginRendering(const VulkanCommandBuffer *commandBuffer, VkImageView colorView,
+    uint32_t width, uint32_t height);
+void vkffi_CmdEndRendering(const VulkanCommandBuffer *commandBuffer);
+void vkffi_CmdBindPipeline(const VulkanCommandBuffer *commandBuffer, VkPipeline pipeline);
+void vkffi_CmdSetViewport(const VulkanCommandBuffer *commandBuffer, float x, float y,
+    float width, float height, float minDepth, float maxDepth);
+void vkffi_CmdSetScissor(const VulkanCommandBuffer *commandBuffer, int32_t x, int32_t y,
+    uint32_t width, uint32_t height);
+void vkffi_CmdDraw(const VulkanCommandBuffer *commandBuffer, uint32_t vertexCount,
+    uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance);
+void vkffi_CmdBindVertexBuffer(const VulkanCommandBuffer *commandBuffer, uint32_t binding,
+    VkBuffer buffer, VkDeviceSize offset);
+void vkffi_CmdBindIndexBuffer(const VulkanCommandBuffer *commandBuffer, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t indexType);
+void vkffi_CmdDrawIndexed(const VulkanCommandBuffer *commandBuffer, uint32_t indexCount,
+    uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance);
+void vkffi_CmdDrawIndirect(const VulkanCommandBuffer *commandBuffer, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t drawCount, uint32_t stride);
+void vkffi_CmdDrawIndexedIndirect(const VulkanCommandBuffer *commandBuffer, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t drawCount, uint32_t stride);
+void vkffi_CmdBindDescriptorSet(const VulkanCommandBuffer *commandBuffer, VkPipelineLayout layout,
+    uint32_t firstSet, VkDescriptorSet set);
+void vkffi_CmdPushConstants(const VulkanCommandBuffer *commandBuffer, VkPipelineLayout layout,
+    uint32_t stageFlags, uint32_t offset, uint32_t size, const void *data);
+VkResult vkffi_WaitForFences(const VulkanDevice *device, VkFence fence, uint64_t timeout);
+VkResult vkffi_ResetFences(const VulkanDevice *device, VkFence fence);
+uint64_t vkffi_GetSemaphoreCounterValue(const VulkanDevice *device, VkSemaphore semaphore);
+VkResult vkffi_WaitSemaphore(const VulkanDevice *device, VkSemaphore semaphore, uint64_t value, uint64_t timeout);
+VkResult vkffi_AcquireNextImageKHR(const VulkanDevice *device, VkSwapchainKHR swapchain, uint64_t timeout,
+    VkSemaphore semaphore, VkFence fence, uint32_t *pImageIndex);
+uint64_t vkffi_GetHeapAllocationCount(void);
+VkResult vkffi_QueueSubmit(const VulkanQueue *queue, const VulkanCommandBuffer *commandBuffer,
+    VkSemaphore waitSemaphore, VkSemaphore signalSemaphore, VkFence fence);
+VkResult vkffi_QueuePresentKHR(const VulkanQueue *queue, VkSwapchainKHR swapchain, uint32_t imageIndex,
+    VkSemaphore waitSemaphore);
+VkResult vkffi_QueueSubmitInfo(const VulkanQueue *queue, const VulkanSubmitInfo *info);
+VkResult vkffi_QueuePresentInfo(const VulkanQueue *queue, VulkanPresentInfo *info, uint32_t imageIndex);
+const VulkanFrameStats *vkffi_GetFrameStats(const VulkanFrameDriver *driver);
+VkDeviceSize vkffi_StagingReserve(VulkanStagingRing *ring, VkDeviceSize size, VkDeviceSize alignment);
+void *vkffi_StagingData(const VulkanStagingRing *ring);
+void vkffi_CmdCopyBuffer(const VulkanCommandBuffer *commandBuffer, VkBuffer src, VkBuffer dst,
+    VkDeviceSize srcOffset, VkDeviceSize dstOffset, VkDeviceSize size);
+const void *vkffi_ReadbackData(VulkanReadback *readback);
+VkDeviceSize vkffi_ReadbackSize(const VulkanReadback *readback);
+
+void vkffi_ResetCommandStream(VulkanCommandStream *stream);
+void vkffi_StreamBindPipeline(VulkanCommandStream *stream, VkPipeline pipeline);
+void vkffi_StreamBindVertexBuffer(VulkanCommandStream *stream, uint32_t binding,
+    VkBuffer buffer, VkDeviceSize offset);
+void vkffi_StreamBindIndexBuffer(VulkanCommandStream *stream, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t indexType);
+void vkffi_StreamBindDescriptorSet(VulkanCommandStream *stream, VkPipelineLayout layout,
+    uint32_t firstSet, VkDescriptorSet set);
+void vkffi_StreamPushConstants(VulkanCommandStream *stream, VkPipelineLayout layout,
+    uint32_t stageFlags, uint32_t offset, uint32_t size, const void *data);
+void vkffi_StreamDraw(VulkanCommandStream *stream, uint32_t vertexCount,
+    uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance);
+void vkffi_StreamDrawIndexed(VulkanCommandStream *stream, uint32_t indexCount,
+    uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance);
+void vkffi_StreamDrawIndirect(VulkanCommandStream *stream, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t drawCount, uint32_t stride);
+void vkffi_StreamDrawIndexedIndirect(VulkanCommandStream *stream, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t drawCount, uint32_t stride);
+void vkffi_StreamMemoryBarrier(VulkanCommandStream *stream, uint32_t srcStageMask,
+    uint32_t dstStageMask, uint32_t srcAccessMask, uint32_t dstAccessMask);
+void vkffi_StreamImageBarrier(VulkanCommandStream *stream, VkImage image,
+    uint32_t oldLayout, uint32_t newLayout, uint32_t srcStageMask, uint32_t dstStageMask,
+    uint32_t srcAccessMask, uint32_t dstAccessMask, uint32_t aspectMask);
+VkResult vkffi_ReplayCommandStream(const VulkanCommandBuffer *commandBuffer, const VulkanCommandStream *stream);
+]]
+
+local C = ffi.C
+local M = {}
+
+M.VK_SUCCESS = 0
+M.VK_TIMEOUT = 2
+M.VK_SUBOPTIMAL_KHR = 1000001003
+M.VK_ERROR_OUT_OF_DATE_KHR = -1000001004
+M.UINT64_MAX = 0xffffffffffffffffULL
+
+-- Read the handle stored as the first field of a vulkan userdata
+local function handle(ctype)
+    local ptr = ffi.typeof(ctype .. " *")
+    return function(ud)
+        return ffi.cast(ptr, ud)[0]
+    end
+end
+
+-- Userdata whose functions dispatch through their device's table
+local function wrapper(ctype)
+    local ptr = ffi.typeof(ctype .. " *")
+    return function(ud)
+        return ffi.cast(ptr, ud)
+    end
+end
+
+M.Device = wrapper("VulkanDevice")
+M.Queue = wrapper("VulkanQueue")
+M.CommandBuffer = wrapper("VulkanCommandBuffer")
+M.Swapchain = handle("VkSwapchainKHR")
+M.RenderPass = handle("VkRenderPass")
+M.Framebuffer = handle("VkFramebuffer")
+M.ImageView = handle("VkImageView")
+M.Pipeline = handle("VkPipeline")
+M.Semaphore = handle("VkSemaphore")
+M.Fence = handle("VkFence")
+M.Buffer = handle("VkBuffer")
+M.Image = handle("VkImage")
+M.PipelineLayout = handle("VkPipelineLayout")
+M.DescriptorSet = handle("VkDescriptorSet") -- Of a bindless table from vk_CreateBindlessTable
+
+-- Prebuilt descriptors from vk_CreateSubmitInfo/vk_CreatePresentInfo, used in place
+local submitInfoPtr = ffi.typeof("VulkanSubmitInfo *")
+local presentInfoPtr = ffi.typeof("VulkanPresentInfo *")
+function M.SubmitInfo(ud)
+    return ffi.cast(submitInfoPtr, ud)
+end
+function M.PresentInfo(ud)
+    return ffi.cast(presentInfoPtr, ud)
+end
+
+-- Live view of a frame driver's counters (see vk_FrameDriverGetStats); the
+-- pointer stays valid for the driver's lifetime, so fetch it once
+local frameDriverPtr = ffi.typeof("VulkanFrameDriver *")
+function M.FrameStats(ud)
+    return C.vkffi_GetFrameStats(ffi.cast(frameDriverPtr, ud))
+end
+
+-- Staging ring from vk_CreateStagingRing. Reserve returns a byte offset into
+-- the mapped memory returned by StagingData, or nil if the ring is too small
+-- for the current frame:
+--   local ring = vkffi.StagingRing(ringUd)
+--   local base = vkffi.StagingData(ring)
+--   local offset = vkffi.StagingReserve(ring, n)
+--   ffi.copy(base + offset, src, n)
+--   vkffi.CmdCopyBuffer(cmd, vkffi.Buffer(ringUd), vkffi.Buffer(dst), offset, 0, n)
+local stagingRingPtr = ffi.typeof("VulkanStagingRing *")
+local uint8Ptr = ffi.typeof("uint8_t *")
+local VK_WHOLE_SIZE = 0xffffffffffffffffULL
+function M.StagingRing(ud)
+    return ffi.cast(stagingRingPtr, ud)
+end
+function M.StagingData(ring)
+    return ffi.cast(uint8Ptr, C.vkffi_StagingData(ring))
+end
+function M.StagingReserve(ring, size, alignment)
+    local offset = C.vkffi_StagingReserve(ring, size, alignment or 16)
+    if offset == VK_WHOLE_SIZE then return nil end
+    return offset
+end
+
+-- Readback from vk_CmdReadbackImage. ReadbackData polls the fence without
+-- blocking and returns the mapped pixels and their size once the copy has
+-- landed, nil before; the pointer stays valid until the next copy into it:
+--   local rb = vkffi.Readback(readbackUd)
+--   local pixels, size = vkffi.ReadbackData(rb)
+local readbackPtr = ffi.typeof("VulkanReadback *")
+local constUint8Ptr = ffi.typeof("const uint8_t *")
+function M.Readback(ud)
+    return ffi.cast(readbackPtr, ud)
+end
+function M.ReadbackData(readback)
+    local data = C.vkffi_ReadbackData(readback)
+    if data == nil then return nil end
+    return ffi.cast(constUint8Ptr, data), C.vkffi_ReadbackSize(readback)
+end
+
+-- A stream is used in place, so this is a pointer to the userdata from
+-- vk_CreateCommandStream rather than a copy
+local streamPtr = ffi.typeof("VulkanCommandStream *")
+function M.CommandStream(ud)
+    return ffi.cast(streamPtr, ud)
+end
+
+M.BeginCommandBuffer = C.vkffi_BeginCommandBuffer
+M.EndCommandBuffer = C.vkffi_EndCommandBuffer
+M.ResetCommandBuffer = C.vkffi_ResetCommandBuffer
+M.CmdBeginRenderPass = C.vkffi_CmdBeginRenderPass
+M.CmdEndRenderPass = C.vkffi_CmdEndRenderPass
+M.CmdBeginRendering = C.vkffi_CmdBeginRendering
+M.CmdEndRendering = C.vkffi_CmdEndRendering
+M.CmdBindPipeline = C.vkffi_CmdBindPipeline
+M.CmdSetViewport = C.vkffi_CmdSetViewport
+M.CmdSetScissor = C.vkffi_CmdSetScissor
+M.CmdDraw = C.vkffi_CmdDraw
+M.CmdBindVertexBuffer = C.vkffi_CmdBindVertexBuffer
+M.CmdBindIndexBuffer = C.vkffi_CmdBindIndexBuffer
+M.CmdDrawIndexed = C.vkffi_CmdDrawIndexed
+M.CmdDrawIndirect = C.vkffi_CmdDrawIndirect
+M.CmdDrawIndexedIndirect = C.vkffi_CmdDrawIndexedIndirect
+M.CmdBindDescriptorSet = C.vkffi_CmdBindDescriptorSet
+M.CmdPushConstants = C.vkffi_CmdPushConstants
+M.CmdCopyBuffer = C.vkffi_CmdCopyBuffer
+M.ResetFences = C.vkffi_ResetFences
+M.GetSemaphoreCounterValue = C.vkffi_GetSemaphoreCounterValue
+M.QueueSubmit = C.vkffi_QueueSubmit
+M.QueuePresentKHR = C.vkffi_QueuePresentKHR
+M.GetHeapAllocationCount = C.vkffi_GetHeapAllocationCount
+M.QueueSubmitInfo = C.vkffi_QueueSubmitInfo
+M.QueuePresentInfo = C.vkffi_QueuePresentInfo
+
+-- Recording into a command stream. Check vk_GetCommandStreamInfo or the result
+-- of ReplayCommandStream for VK_ERROR_OUT_OF_HOST_MEMORY after recording.
+M.VK_ERROR_OUT_OF_HOST_MEMORY = -1
+M.ResetCommandStream = C.vkffi_ResetCommandStream
+M.StreamBindPipeline = C.vkffi_StreamBindPipeline
+M.StreamBindVertexBuffer = C.vkffi_StreamBindVertexBuffer
+M.StreamBindIndexBuffer = C.vkffi_StreamBindIndexBuffer
+M.StreamBindDescriptorSet = C.vkffi_StreamBindDescriptorSet
+M.StreamPushConstants = C.vkffi_StreamPushConstants
+M.StreamDraw = C.vkffi_StreamDraw
+M.StreamDrawIndexed = C.vkffi_StreamDrawIndexed
+M.StreamDrawIndirect = C.vkffi_StreamDrawIndirect
+M.StreamDrawIndexedIndirect = C.vkffi_StreamDrawIndexedIndirect
+M.StreamMemoryBarrier = C.vkffi_StreamMemoryBarrier
+M.StreamImageBarrier = C.vkffi_StreamImageBarrier
+M.ReplayCommandStream = C.vkffi_ReplayCommandStream
+
+function M.WaitForFences(device, fence, timeout)
+    return C.vkffi_WaitForFences(device, fence, timeout or M.UINT64_MAX)
+end
+
+-- Timeline semaphore from vk_CreateTimelineSemaphore; returns VK_SUCCESS or VK_TIMEOUT
+function M.WaitSemaphore(device, semaphore, value, timeout)
+    return C.vkffi_WaitSemaphore(device, semaphore, value, timeout or M.UINT64_MAX)
+end
+
+-- Returns result, imageIndex. The out parameter is reused between calls.
+local imageIndex = ffi.new("uint32_t[1]")
+function M.AcquireNextImageKHR(device, swapchain, timeout, semaphore, fence)
+    local result = C.vkffi_AcquireNextImageKHR(device, swapchain, timeout or M.UINT64_MAX, semaphore, fence, imageIndex)
+    return result, imageIndex[0]
+end
+
+return M
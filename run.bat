@@ -6,6 +6,13 @@ if %ERRORLEVEL% NEQ 0 (
     exit /b %ERRORLEVEL%
 )
 
+echo Copying Lua modules to build directory...
+xcopy /E /I /Y /Q .\lua build >nul
+if %ERRORLEVEL% NEQ 0 (
+    echo Failed to copy Lua modules
+    exit /b %ERRORLEVEL%
+)
+
 echo Changing to build directory...
 cd build
 if %ERRORLEVEL% NEQ 0 (
@@ -1,4 +1,7 @@
 @echo off
 "C:\VulkanSDK\1.4.304.1\Bin\glslangValidator.exe" -V shaders/triangle.vert -o shaders/triangle.vert.spv
 "C:\VulkanSDK\1.4.304.1\Bin\glslangValidator.exe" -V shaders/triangle.frag -o shaders/triangle.frag.spv
+"C:\VulkanSDK\1.4.304.1\Bin\glslangValidator.exe" -V shaders/instanced.vert -o shaders/instanced.vert.spv
+"C:\VulkanSDK\1.4.304.1\Bin\glslangValidator.exe" -V --target-env vulkan1.2 shaders/bindless.vert -o shaders/bindless.vert.spv
+"C:\VulkanSDK\1.4.304.1\Bin\glslangValidator.exe" -V --target-env vulkan1.2 shaders/bindless.frag -o shaders/bindless.frag.spv
 
@@ -0,0 +1,11 @@
+// bindless.frag
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+layout(set = 0, binding = 1) uniform sampler2D textures[];
+layout(location = 0) in vec2 inUV;
+layout(location = 1) flat in uint inTexture;
+layout(location = 0) out vec4 outColor;
+void main() {
+    // Instances of one draw use different slots, so the index is non-uniform
+    outColor = texture(textures[nonuniformEXT(inTexture)], inUV);
+}
\ No newline at end of file
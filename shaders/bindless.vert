@@ -0,0 +1,28 @@
+// bindless.vert
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+// Quads without vertex buffers: the instance data lives in one of the bindless
+// table's storage buffers (binding 0), whose slot comes in the push constants
+struct Instance {
+    vec4 rect;     // xy offset, z scale
+    uvec4 texture; // x: texture slot in the bindless table
+};
+layout(set = 0, binding = 0) readonly buffer Instances {
+    Instance items[];
+} buffers[];
+layout(push_constant) uniform Push {
+    uint instanceBuffer;
+} push;
+layout(location = 0) out vec2 outUV;
+layout(location = 1) flat out uint outTexture;
+void main() {
+    vec2 corners[6] = vec2[](
+        vec2(-1.0, -1.0), vec2(1.0, -1.0), vec2(1.0, 1.0),
+        vec2(-1.0, -1.0), vec2(1.0, 1.0), vec2(-1.0, 1.0)
+    );
+    Instance instance = buffers[push.instanceBuffer].items[gl_InstanceIndex];
+    vec2 corner = corners[gl_VertexIndex];
+    outUV = corner * 0.5 + 0.5;
+    outTexture = instance.texture.x;
+    gl_Position = vec4(corner * instance.rect.z + instance.rect.xy, 0.0, 1.0);
+}
\ No newline at end of file
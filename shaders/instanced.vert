@@ -0,0 +1,7 @@
+// instanced.vert
+#version 450
+layout(location = 0) in vec2 inPosition; // Per vertex
+layout(location = 1) in vec4 inInstance; // Per instance: xy offset, z scale
+void main() {
+    gl_Position = vec4(inPosition * inInstance.z + inInstance.xy, 0.0, 1.0);
+}
\ No newline at end of file
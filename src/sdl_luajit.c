@@ -1,7 +1,9 @@
 #include "sdl_luajit.h"
 #include "vulkan_luajit.h" // Add this to access VulkanInstance and VulkanSurface
+#include "binding_stats.h"
 #include "lauxlib.h"
 #include "lualib.h"
+#include <string.h>
 
 typedef struct {
     SDL_Window *window;
@@ -52,24 +54,290 @@ static int l_sdl_SDL_Quit(lua_State *L) {
     return 0;
 }
 
+static void push_event(lua_State *L, const SDL_Event *event) {
+  SDL_Event *eptr = (SDL_Event *)lua_newuserdata(L, sizeof(SDL_Event));
+  *eptr = *event;
+  luaL_getmetatable(L, "SDL_Event");
+  lua_setmetatable(L, -2);
+}
+
+// SDL_PollEvent() -> event, or nil when the queue is empty. Each event is a new
+// userdata; frame loops should use SDL_PollEvents below, which drains the queue
+// into a reusable buffer without any per-event allocation.
 static int l_sdl_SDL_PollEvent(lua_State *L) {
-  SDL_Event *event = (SDL_Event *)lua_newuserdata(L, sizeof(SDL_Event));
-  if (SDL_PollEvent(event)) {
-      luaL_getmetatable(L, "SDL_Event");
-      if (lua_isnil(L, -1)) {
-          lua_pop(L, 1);
-          luaL_newmetatable(L, "SDL_Event");
-          lua_pushvalue(L, -1);
-          lua_setfield(L, -2, "__index");
-          // No __gc needed since this is transient userdata per poll
-      }
-      lua_setmetatable(L, -2);
+  SDL_Event event;
+  if (!SDL_PollEvent(&event)) {
+      lua_pushnil(L);
       return 1;
   }
-  lua_pushnil(L);
+  push_event(L, &event);
+  return 1;
+}
+
+// SDL_WaitEventTimeout([timeoutMs]) -> event, or nil once timeoutMs passes;
+// -1 (the default) waits forever
+static int l_sdl_SDL_WaitEventTimeout(lua_State *L) {
+  lua_Integer timeoutMs = luaL_optinteger(L, 1, -1);
+  luaL_argcheck(L, timeoutMs >= -1 && timeoutMs <= INT32_MAX, 1, "timeout out of range");
+  SDL_Event event;
+  if (!SDL_WaitEventTimeout(&event, (int32_t)timeoutMs)) {
+      lua_pushnil(L);
+      return 1;
+  }
+  push_event(L, &event);
+  return 1;
+}
+
+// Batched event draining. SDL_PollEvents fills a reusable SDL_CreateEventBuffer
+// with flattened events in one call, and lua/SDL/ffi.lua reads them in place.
+// SDL_SetEventFilter drops event types as SDL queues them and marks types to
+// coalesce while draining: a run of events of such a type for the same window
+// becomes one event (mouse motion and wheel deltas are summed).
+#define SDL_EVENT_TYPE_COUNT (SDL_EVENT_LAST + 1)
+#define SDL_POLL_CHUNK 64
+
+// Written on the main thread; the filter only reads them, from whichever
+// thread queues an event
+static uint8_t eventDrop[SDL_EVENT_TYPE_COUNT / 8];
+static uint8_t eventCoalesce[SDL_EVENT_TYPE_COUNT / 8];
+
+static int event_type_flag(const uint8_t *flags, uint32_t type) {
+  return type < SDL_EVENT_TYPE_COUNT && (flags[type >> 3] & (1u << (type & 7)));
+}
+
+static bool SDLCALL drop_event_filter(void *userdata, SDL_Event *event) {
+  (void)userdata;
+  return !event_type_flag(eventDrop, event->type);
+}
+
+static void flatten_event(const SDL_Event *event, SDLLuaEvent *out) {
+  memset(out, 0, sizeof(*out));
+  out->type = event->type;
+  out->timestampMs = (double)event->common.timestamp / (double)SDL_NS_PER_MS;
+  switch (event->type) {
+  case SDL_EVENT_KEY_DOWN:
+  case SDL_EVENT_KEY_UP:
+      out->windowID = event->key.windowID;
+      out->key = (int32_t)event->key.key;
+      out->scancode = (int32_t)event->key.scancode;
+      out->mod = event->key.mod;
+      out->down = event->key.down;
+      out->repeat = event->key.repeat;
+      break;
+  case SDL_EVENT_MOUSE_MOTION:
+      out->windowID = event->motion.windowID;
+      out->x = event->motion.x;
+      out->y = event->motion.y;
+      out->xrel = event->motion.xrel;
+      out->yrel = event->motion.yrel;
+      break;
+  case SDL_EVENT_MOUSE_BUTTON_DOWN:
+  case SDL_EVENT_MOUSE_BUTTON_UP:
+      out->windowID = event->button.windowID;
+      out->button = event->button.button;
+      out->down = event->button.down;
+      out->clicks = event->button.clicks;
+      out->x = event->button.x;
+      out->y = event->button.y;
+      break;
+  case SDL_EVENT_MOUSE_WHEEL:
+      out->windowID = event->wheel.windowID;
+      out->x = event->wheel.mouse_x;
+      out->y = event->wheel.mouse_y;
+      out->xrel = event->wheel.x;
+      out->yrel = event->wheel.y;
+      break;
+  default:
+      if (event->type >= SDL_EVENT_WINDOW_FIRST && event->type <= SDL_EVENT_WINDOW_LAST) {
+          out->windowID = event->window.windowID;
+          out->data1 = event->window.data1;
+          out->data2 = event->window.data2;
+      }
+      break;
+  }
+}
+
+static void buffer_event(SDLEventBuffer *buffer, const SDL_Event *event) {
+  if (buffer->count > 0 && event_type_flag(eventCoalesce, event->type)) {
+      SDLLuaEvent *last = &buffer->events[buffer->count - 1];
+      if (last->type == event->type) {
+          SDLLuaEvent merged;
+          flatten_event(event, &merged);
+          if (merged.windowID == last->windowID) {
+              if (event->type == SDL_EVENT_MOUSE_MOTION || event->type == SDL_EVENT_MOUSE_WHEEL) {
+                  merged.xrel += last->xrel;
+                  merged.yrel += last->yrel;
+              }
+              merged.coalesced = (uint16_t)(last->coalesced + 1);
+              *last = merged;
+              return;
+          }
+      }
+  }
+  flatten_event(event, &buffer->events[buffer->count++]);
+}
+
+// Appends queued events without pumping; returns whether events were left
+// queued because the buffer filled up
+static int append_queued_events(SDLEventBuffer *buffer) {
+  SDL_Event chunk[SDL_POLL_CHUNK];
+  while (buffer->count < buffer->capacity) {
+      uint32_t room = buffer->capacity - buffer->count;
+      int want = room < SDL_POLL_CHUNK ? (int)room : SDL_POLL_CHUNK;
+      int got = SDL_PeepEvents(chunk, want, SDL_GETEVENT, SDL_EVENT_FIRST, SDL_EVENT_LAST);
+      for (int i = 0; i < got; i++) {
+          buffer_event(buffer, &chunk[i]);
+      }
+      if (got < want) {
+          return 0;
+      }
+  }
+  return SDL_HasEvents(SDL_EVENT_FIRST, SDL_EVENT_LAST);
+}
+
+static int drain_events(SDLEventBuffer *buffer) {
+  buffer->count = 0;
+  SDL_PumpEvents();
+  buffer->more = (uint32_t)append_queued_events(buffer);
+  return (int)buffer->more;
+}
+
+// Sleeps in SDL_WaitEventTimeout until an event arrives or timeoutMs passes
+// (-1 waits forever), then drains whatever else is queued behind it
+static int wait_events(SDLEventBuffer *buffer, int32_t timeoutMs) {
+  SDL_Event event;
+  buffer->count = 0;
+  buffer->more = 0;
+  if (!SDL_WaitEventTimeout(&event, timeoutMs)) {
+      return 0;
+  }
+  buffer_event(buffer, &event);
+  buffer->more = (uint32_t)append_queued_events(buffer);
+  return (int)buffer->more;
+}
+
+SDL_LUAJIT_API uint32_t sdlffi_PollEvents(SDLEventBuffer *buffer) {
+  drain_events(buffer);
+  return buffer->count;
+}
+
+SDL_LUAJIT_API uint32_t sdlffi_WaitEvents(SDLEventBuffer *buffer, int32_t timeoutMs) {
+  wait_events(buffer, timeoutMs);
+  return buffer->count;
+}
+
+// SDL_CreateEventBuffer([capacity]) -> buffer; capacity defaults to 256 events
+static int l_sdl_SDL_CreateEventBuffer(lua_State *L) {
+  lua_Integer capacity = luaL_optinteger(L, 1, 256);
+  luaL_argcheck(L, capacity > 0 && capacity <= 65536, 1, "capacity out of range");
+  SDLEventBuffer *buffer = (SDLEventBuffer *)lua_newuserdata(L,
+      sizeof(SDLEventBuffer) + (size_t)capacity * sizeof(SDLLuaEvent));
+  buffer->capacity = (uint32_t)capacity;
+  buffer->count = 0;
+  buffer->more = 0;
+  buffer->events = (SDLLuaEvent *)(buffer + 1);
+  luaL_getmetatable(L, "SDLEventBuffer");
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+// SDL_PollEvents(buffer) -> count, more; more is true when the buffer filled
+// up with events still queued
+static int l_sdl_SDL_PollEvents(lua_State *L) {
+  SDLEventBuffer *buffer = (SDLEventBuffer *)luaL_checkudata(L, 1, "SDLEventBuffer");
+  int more = drain_events(buffer);
+  lua_pushinteger(L, buffer->count);
+  lua_pushboolean(L, more);
+  return 2;
+}
+
+// SDL_WaitEvents(buffer[, timeoutMs]) -> count, more; like SDL_PollEvents but
+// blocks until the first event, for loops that have nothing to draw. The
+// timeout defaults to -1 (no timeout); a count of 0 means it expired.
+static int l_sdl_SDL_WaitEvents(lua_State *L) {
+  SDLEventBuffer *buffer = (SDLEventBuffer *)luaL_checkudata(L, 1, "SDLEventBuffer");
+  lua_Integer timeoutMs = luaL_optinteger(L, 2, -1);
+  luaL_argcheck(L, timeoutMs >= -1 && timeoutMs <= INT32_MAX, 2, "timeout out of range");
+  int more = wait_events(buffer, (int32_t)timeoutMs);
+  lua_pushinteger(L, buffer->count);
+  lua_pushboolean(L, more);
+  return 2;
+}
+
+// SDL_GetBufferedEvent(buffer, i[, out]) -> table with the fields of event i
+// (1-based), for code without FFI; pass out to reuse a table
+static int l_sdl_SDL_GetBufferedEvent(lua_State *L) {
+  SDLEventBuffer *buffer = (SDLEventBuffer *)luaL_checkudata(L, 1, "SDLEventBuffer");
+  lua_Integer i = luaL_checkinteger(L, 2);
+  luaL_argcheck(L, i >= 1 && i <= buffer->count, 2, "event index out of range");
+  const SDLLuaEvent *event = &buffer->events[i - 1];
+  if (lua_istable(L, 3)) {
+      lua_settop(L, 3);
+  } else {
+      lua_createtable(L, 0, 16);
+  }
+  lua_pushinteger(L, event->type); lua_setfield(L, -2, "type");
+  lua_pushinteger(L, event->windowID); lua_setfield(L, -2, "windowID");
+  lua_pushnumber(L, event->timestampMs); lua_setfield(L, -2, "timestampMs");
+  lua_pushinteger(L, event->key); lua_setfield(L, -2, "key");
+  lua_pushinteger(L, event->scancode); lua_setfield(L, -2, "scancode");
+  lua_pushinteger(L, event->mod); lua_setfield(L, -2, "mod");
+  lua_pushboolean(L, event->down); lua_setfield(L, -2, "down");
+  lua_pushboolean(L, event->repeat); lua_setfield(L, -2, "repeat");
+  lua_pushinteger(L, event->button); lua_setfield(L, -2, "button");
+  lua_pushinteger(L, event->clicks); lua_setfield(L, -2, "clicks");
+  lua_pushinteger(L, event->coalesced); lua_setfield(L, -2, "coalesced");
+  lua_pushnumber(L, event->x); lua_setfield(L, -2, "x");
+  lua_pushnumber(L, event->y); lua_setfield(L, -2, "y");
+  lua_pushnumber(L, event->xrel); lua_setfield(L, -2, "xrel");
+  lua_pushnumber(L, event->yrel); lua_setfield(L, -2, "yrel");
+  lua_pushinteger(L, event->data1); lua_setfield(L, -2, "data1");
+  lua_pushinteger(L, event->data2); lua_setfield(L, -2, "data2");
   return 1;
 }
 
+static void check_event_types(lua_State *L, int idx, const char *field, uint8_t *flags) {
+  memset(flags, 0, SDL_EVENT_TYPE_COUNT / 8);
+  lua_getfield(L, idx, field);
+  if (!lua_isnil(L, -1)) {
+      luaL_checktype(L, -1, LUA_TTABLE);
+      int count = (int)lua_objlen(L, -1);
+      for (int i = 1; i <= count; i++) {
+          lua_rawgeti(L, -1, i);
+          lua_Integer type = luaL_checkinteger(L, -1);
+          if (type < 0 || type >= SDL_EVENT_TYPE_COUNT) {
+              luaL_error(L, "SDL_SetEventFilter: %s[%d] is not an event type", field, i);
+          }
+          flags[type >> 3] |= (uint8_t)(1u << (type & 7));
+          lua_pop(L, 1);
+      }
+  }
+  lua_pop(L, 1);
+}
+
+// SDL_SetEventFilter({drop = {types}, coalesce = {types}}), or nil to remove
+// it. Dropped types never reach the queue; coalesced types are merged by
+// SDL_PollEvents.
+static int l_sdl_SDL_SetEventFilter(lua_State *L) {
+  if (lua_isnoneornil(L, 1)) {
+      SDL_SetEventFilter(NULL, NULL);
+      memset(eventDrop, 0, sizeof(eventDrop));
+      memset(eventCoalesce, 0, sizeof(eventCoalesce));
+      return 0;
+  }
+  luaL_checktype(L, 1, LUA_TTABLE);
+  SDL_SetEventFilter(NULL, NULL);
+  check_event_types(L, 1, "drop", eventDrop);
+  check_event_types(L, 1, "coalesce", eventCoalesce);
+  for (size_t i = 0; i < sizeof(eventDrop); i++) {
+      if (eventDrop[i]) {
+          SDL_SetEventFilter(drop_event_filter, NULL);
+          break;
+      }
+  }
+  return 0;
+}
+
 static int l_sdl_SDL_GetEventType(lua_State *L) {
   SDL_Event *event = (SDL_Event *)luaL_checkudata(L, 1, "SDL_Event");
   lua_pushinteger(L, event->type);
@@ -102,6 +370,35 @@ static int l_SDL_GetTicks(lua_State *L) {
   return 1;
 }
 
+// High-resolution timer, for frame timings finer than SDL_GetTicks' milliseconds
+static int l_sdl_SDL_GetPerformanceCounter(lua_State *L) {
+  lua_pushnumber(L, (lua_Number)SDL_GetPerformanceCounter());
+  return 1;
+}
+
+static int l_sdl_SDL_GetPerformanceFrequency(lua_State *L) {
+  lua_pushnumber(L, (lua_Number)SDL_GetPerformanceFrequency());
+  return 1;
+}
+
+// Hints such as "SDL_VIDEO_DRIVER" must be set before SDL_Init to take effect
+static int l_sdl_SDL_SetHint(lua_State *L) {
+  const char *name = luaL_checkstring(L, 1);
+  const char *value = luaL_checkstring(L, 2);
+  lua_pushboolean(L, SDL_SetHint(name, value));
+  return 1;
+}
+
+static int l_sdl_SDL_GetCurrentVideoDriver(lua_State *L) {
+  const char *driver = SDL_GetCurrentVideoDriver();
+  if (!driver) {
+      lua_pushnil(L);
+      return 1;
+  }
+  lua_pushstring(L, driver);
+  return 1;
+}
+
 static int l_sdl_SDL_DestroyWindow(lua_State *L) {
   SDLWindow *wptr = (SDLWindow *)luaL_checkudata(L, 1, "SDLWindow");
   printf("l_sdl_SDL_DestroyWindow: window=%p\n", (void*)wptr->window);
@@ -113,6 +410,20 @@ static int l_sdl_SDL_DestroyWindow(lua_State *L) {
   return 0;
 }
 
+// Drawable size in pixels, which is what the swapchain extent must match
+static int l_sdl_SDL_GetWindowSizeInPixels(lua_State *L) {
+  SDLWindow *wptr = (SDLWindow *)luaL_checkudata(L, 1, "SDLWindow");
+  int w = 0, h = 0;
+  if (!SDL_GetWindowSizeInPixels(wptr->window, &w, &h)) {
+      lua_pushnil(L);
+      lua_pushstring(L, SDL_GetError());
+      return 2;
+  }
+  lua_pushinteger(L, w);
+  lua_pushinteger(L, h);
+  return 2;
+}
+
 static int l_sdl_SDL_Vulkan_GetInstanceExtensions(lua_State *L) {
   Uint32 extensionCount = 0;
   const char *const *extensionNames = SDL_Vulkan_GetInstanceExtensions(&extensionCount);
@@ -167,7 +478,7 @@ static int l_sdl_SDL_Vulkan_CreateSurface(lua_State *L) {
 static int l_vk_surface_gc(lua_State *L) {
   VulkanSurface *sptr = (VulkanSurface *)luaL_checkudata(L, 1, "VulkanSurface");
   if (sptr->surface && sptr->instance) {
-      vkDestroySurfaceKHR(sptr->instance, sptr->surface, NULL);
+      SDL_Vulkan_DestroySurface(sptr->instance, sptr->surface, NULL);
       sptr->surface = VK_NULL_HANDLE;
   }
   return 0;
@@ -175,19 +486,34 @@ static int l_vk_surface_gc(lua_State *L) {
 
 static const luaL_Reg sdl_funcs[] = {
   {"SDL_GetTicks", l_SDL_GetTicks},
+  {"SDL_GetPerformanceCounter", l_sdl_SDL_GetPerformanceCounter},
+  {"SDL_GetPerformanceFrequency", l_sdl_SDL_GetPerformanceFrequency},
+  {"SDL_SetHint", l_sdl_SDL_SetHint},
+  {"SDL_GetCurrentVideoDriver", l_sdl_SDL_GetCurrentVideoDriver},
   {"SDL_Init", l_sdl_SDL_Init},
   {"SDL_CreateWindow", l_sdl_SDL_CreateWindow},
   {"SDL_Delay", l_sdl_SDL_Delay},
   {"SDL_Quit", l_sdl_SDL_Quit},
   {"SDL_PollEvent", l_sdl_SDL_PollEvent},
+  {"SDL_WaitEventTimeout", l_sdl_SDL_WaitEventTimeout},
   {"SDL_GetEventType", l_sdl_SDL_GetEventType},
+  {"SDL_CreateEventBuffer", l_sdl_SDL_CreateEventBuffer},
+  {"SDL_PollEvents", l_sdl_SDL_PollEvents},
+  {"SDL_WaitEvents", l_sdl_SDL_WaitEvents},
+  {"SDL_GetBufferedEvent", l_sdl_SDL_GetBufferedEvent},
+  {"SDL_SetEventFilter", l_sdl_SDL_SetEventFilter},
   {"SDL_GetKeyFromEvent", l_sdl_SDL_GetKeyFromEvent},
   {"SDL_DestroyWindow", l_sdl_SDL_DestroyWindow},
+  {"SDL_GetWindowSizeInPixels", l_sdl_SDL_GetWindowSizeInPixels},
   {"SDL_Vulkan_GetInstanceExtensions", l_sdl_SDL_Vulkan_GetInstanceExtensions},
   {"SDL_Vulkan_CreateSurface", l_sdl_SDL_Vulkan_CreateSurface},
   {NULL, NULL}
 };
 
+#if defined(LUAJIT_BINDING_STATS)
+static BindingStats sdl_funcs_stats[sizeof(sdl_funcs) / sizeof(sdl_funcs[0])];
+#endif
+
 static const luaL_Reg window_mt[] = {
   {"__gc", l_window_gc},
   {NULL, NULL}
@@ -207,12 +533,29 @@ int luaopen_SDL(lua_State *L) {
   luaL_setfuncs(L, surface_mt, 0);
   lua_pop(L, 1);
 
-  luaL_newlib(L, sdl_funcs);
+  luaL_newmetatable(L, "SDL_Event"); // Plain memory, nothing to release
+  lua_pop(L, 1);
+
+  luaL_newmetatable(L, "SDLEventBuffer");
+  lua_pop(L, 1);
+
+  binding_stats_newlib(L, sdl_funcs); // Also adds stats() and reset_stats()
 
   lua_pushinteger(L, SDL_INIT_VIDEO); lua_setfield(L, -2, "SDL_INIT_VIDEO");
   lua_pushinteger(L, SDL_WINDOW_VULKAN); lua_setfield(L, -2, "SDL_WINDOW_VULKAN");
+  lua_pushinteger(L, SDL_WINDOW_RESIZABLE); lua_setfield(L, -2, "SDL_WINDOW_RESIZABLE");
   lua_pushinteger(L, SDL_EVENT_QUIT); lua_setfield(L, -2, "SDL_EVENT_QUIT");
   lua_pushinteger(L, SDL_EVENT_KEY_DOWN); lua_setfield(L, -2, "SDL_EVENT_KEY_DOWN");
+  lua_pushinteger(L, SDL_EVENT_KEY_UP); lua_setfield(L, -2, "SDL_EVENT_KEY_UP");
+  lua_pushinteger(L, SDL_EVENT_MOUSE_MOTION); lua_setfield(L, -2, "SDL_EVENT_MOUSE_MOTION");
+  lua_pushinteger(L, SDL_EVENT_MOUSE_BUTTON_DOWN); lua_setfield(L, -2, "SDL_EVENT_MOUSE_BUTTON_DOWN");
+  lua_pushinteger(L, SDL_EVENT_MOUSE_BUTTON_UP); lua_setfield(L, -2, "SDL_EVENT_MOUSE_BUTTON_UP");
+  lua_pushinteger(L, SDL_EVENT_MOUSE_WHEEL); lua_setfield(L, -2, "SDL_EVENT_MOUSE_WHEEL");
+  lua_pushinteger(L, SDL_EVENT_WINDOW_CLOSE_REQUESTED); lua_setfield(L, -2, "SDL_EVENT_WINDOW_CLOSE_REQUESTED");
+  lua_pushinteger(L, SDL_EVENT_WINDOW_RESIZED); lua_setfield(L, -2, "SDL_EVENT_WINDOW_RESIZED");
+  lua_pushinteger(L, SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED); lua_setfield(L, -2, "SDL_EVENT_WINDOW_PIXEL_SIZE_CHANGED");
+  lua_pushinteger(L, SDL_EVENT_WINDOW_MINIMIZED); lua_setfield(L, -2, "SDL_EVENT_WINDOW_MINIMIZED");
+  lua_pushinteger(L, SDL_EVENT_WINDOW_RESTORED); lua_setfield(L, -2, "SDL_EVENT_WINDOW_RESTORED");
   lua_pushinteger(L, SDLK_LEFT); lua_setfield(L, -2, "SDLK_LEFT");
   lua_pushinteger(L, SDLK_RIGHT); lua_setfield(L, -2, "SDLK_RIGHT");
   lua_pushinteger(L, SDLK_UP); lua_setfield(L, -2, "SDLK_UP");
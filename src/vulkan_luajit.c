@@ -1,7 +1,136 @@
 #include "vulkan_luajit.h"
+#include "binding_stats.h"
 #include "lauxlib.h"
 #include "lualib.h"
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#if defined(_MSC_VER)
+#define VK_THREAD_LOCAL __declspec(thread)
+#else
+#define VK_THREAD_LOCAL _Thread_local
+#endif
+
+// Heap allocations made by this module on the current thread. Every malloc
+// and realloc goes through heap_alloc/heap_realloc so a frame loop can check
+// that it has stopped allocating (see vk_GetHeapAllocationCount).
+static VK_THREAD_LOCAL uint64_t heapAllocationCount = 0;
+
+static void *heap_alloc(size_t size) {
+  heapAllocationCount++;
+  return malloc(size);
+}
+
+static void *heap_realloc(void *ptr, size_t size) {
+  heapAllocationCount++;
+  return realloc(ptr, size);
+}
+
+// Scratch arena for the temporary arrays a binding builds while marshalling
+// Lua tables into Vulkan structs. Bindings call scratch_begin() on entry,
+// which throws away everything from the previous call; resetting on entry
+// rather than on exit keeps the arena sane when luaL_error unwinds a binding
+// halfway through. Requests that do not fit go to overflow blocks, and the
+// next scratch_begin() grows the arena to the high-water mark, so a steady
+// frame loop stops touching the heap after the first frame.
+#define SCRATCH_INITIAL_SIZE (16 * 1024)
+#define SCRATCH_ALIGNMENT 16
+
+typedef struct ScratchOverflow {
+  struct ScratchOverflow *next;
+} ScratchOverflow;
+
+typedef struct {
+  uint8_t *base;
+  size_t capacity;
+  size_t offset;
+  size_t used; // offset plus overflow bytes since scratch_begin
+  size_t highWater;
+  ScratchOverflow *overflow;
+} ScratchArena;
+
+static VK_THREAD_LOCAL ScratchArena scratch = {0};
+
+static void scratch_begin(void) {
+  if (scratch.overflow) {
+      while (scratch.overflow) {
+          ScratchOverflow *next = scratch.overflow->next;
+          free(scratch.overflow);
+          scratch.overflow = next;
+      }
+      size_t capacity = scratch.capacity ? scratch.capacity : SCRATCH_INITIAL_SIZE;
+      while (capacity < scratch.highWater) {
+          capacity *= 2;
+      }
+      uint8_t *base = heap_alloc(capacity);
+      if (base) {
+          free(scratch.base);
+          scratch.base = base;
+          scratch.capacity = capacity;
+      }
+  }
+  scratch.offset = 0;
+  scratch.used = 0;
+}
+
+// Frees the calling thread's arena; for threads that ran bindings before exiting
+static void scratch_release(void) {
+  while (scratch.overflow) {
+      ScratchOverflow *next = scratch.overflow->next;
+      free(scratch.overflow);
+      scratch.overflow = next;
+  }
+  free(scratch.base);
+  memset(&scratch, 0, sizeof(scratch));
+}
+
+// Never returns NULL for a zero-sized request, so callers can pass the result
+// straight to Vulkan alongside a zero count. Raises no Lua error; the callers
+// treat NULL as out of host memory.
+static void *scratch_alloc(size_t size) {
+  size = (size + SCRATCH_ALIGNMENT - 1) & ~(size_t)(SCRATCH_ALIGNMENT - 1);
+  scratch.used += size;
+  if (scratch.used > scratch.highWater) {
+      scratch.highWater = scratch.used;
+  }
+
+  if (!scratch.base) {
+      scratch.base = heap_alloc(SCRATCH_INITIAL_SIZE);
+      scratch.capacity = scratch.base ? SCRATCH_INITIAL_SIZE : 0;
+  }
+  if (scratch.offset + size <= scratch.capacity) {
+      void *ptr = scratch.base + scratch.offset;
+      scratch.offset += size;
+      return ptr;
+  }
+
+  ScratchOverflow *block = heap_alloc(SCRATCH_ALIGNMENT + size);
+  if (!block) {
+      return NULL;
+  }
+  block->next = scratch.overflow;
+  scratch.overflow = block;
+  return (uint8_t *)block + SCRATCH_ALIGNMENT;
+}
+
+static void *check_scratch_alloc(lua_State *L, size_t size) {
+  void *ptr = scratch_alloc(size);
+  if (!ptr) {
+      luaL_error(L, "Out of host memory");
+  }
+  return ptr;
+}
 
 static int l_vk_make_version(lua_State *L) {
   uint32_t major = (uint32_t)luaL_checkinteger(L, 1);
@@ -12,7 +141,130 @@ static int l_vk_make_version(lua_State *L) {
   return 1;
 }
 
+// nil, "<what> failed with result N", N
+static int push_vk_error(lua_State *L, const char *what, VkResult result) {
+  char errMsg[64];
+  snprintf(errMsg, sizeof(errMsg), "%s failed with result %d", what, result);
+  lua_pushnil(L);
+  lua_pushstring(L, errMsg);
+  lua_pushinteger(L, result);
+  return 3;
+}
+
+// The Vulkan loader is not linked. vkGetInstanceProcAddr comes from SDL once
+// it has loaded the loader for a Vulkan window, otherwise from the loader
+// library opened here (scripts may create an instance before any window, or
+// without one); everything else is looked up through it.
+#if defined(_WIN32)
+#define VULKAN_LOADER_LIBRARY "vulkan-1.dll"
+#elif defined(__APPLE__)
+#define VULKAN_LOADER_LIBRARY "libvulkan.1.dylib"
+#else
+#define VULKAN_LOADER_LIBRARY "libvulkan.so.1"
+#endif
+
+static PFN_vkGetInstanceProcAddr getInstanceProcAddr = NULL;
+static PFN_vkCreateInstance createInstance = NULL;
+static PFN_vkEnumerateInstanceLayerProperties enumerateInstanceLayerProperties = NULL;
+
+// NULL once the global entry points are loaded, otherwise why they are not
+static const char *load_vulkan_loader(void) {
+  if (getInstanceProcAddr) return NULL;
+  PFN_vkGetInstanceProcAddr gipa = (PFN_vkGetInstanceProcAddr)SDL_Vulkan_GetVkGetInstanceProcAddr();
+  if (!gipa) {
+      SDL_SharedObject *library = SDL_LoadObject(VULKAN_LOADER_LIBRARY); // Kept open for the process
+      if (!library) return "Vulkan loader " VULKAN_LOADER_LIBRARY " not found";
+      gipa = (PFN_vkGetInstanceProcAddr)SDL_LoadFunction(library, "vkGetInstanceProcAddr");
+      if (!gipa) {
+          SDL_UnloadObject(library);
+          return "vkGetInstanceProcAddr not found in " VULKAN_LOADER_LIBRARY;
+      }
+  }
+  createInstance = (PFN_vkCreateInstance)gipa(NULL, "vkCreateInstance");
+  enumerateInstanceLayerProperties =
+      (PFN_vkEnumerateInstanceLayerProperties)gipa(NULL, "vkEnumerateInstanceLayerProperties");
+  if (!createInstance || !enumerateInstanceLayerProperties) return "Vulkan loader is missing vkCreateInstance";
+  getInstanceProcAddr = gipa;
+  return NULL;
+}
+
+// Instance- and device-level functions are called through the table of the
+// instance or device that owns the object: VulkanInstance and VulkanDevice
+// hold it, and every wrapper that keeps a physical device or device handle
+// (queues and command buffers included) copies the pointer at creation.
+// Objects can outlive their owner, so a table is never freed or reused:
+// destroying the owner empties it, and a late call through it crashes on a
+// NULL entry point instead of reaching another instance or device.
+static VulkanInstanceDispatch *load_instance_dispatch(VkInstance instance) {
+  VulkanInstanceDispatch *table = heap_alloc(sizeof(VulkanInstanceDispatch));
+  if (!table) return NULL;
+#define VULKAN_DISPATCH_LOAD(name) \
+  table->name = (PFN_##name)getInstanceProcAddr(instance, #name);
+  VULKAN_INSTANCE_FUNCTIONS(VULKAN_DISPATCH_LOAD)
+#undef VULKAN_DISPATCH_LOAD
+  return table;
+}
+
+static void destroy_instance(VulkanInstance *iptr) {
+  VulkanInstanceDispatch *table = (VulkanInstanceDispatch *)iptr->vki;
+  table->vkDestroyInstance(iptr->instance, NULL);
+  iptr->instance = VK_NULL_HANDLE;
+  memset(table, 0, sizeof(*table)); // See above; never freed
+}
+
+// Entry points of extensions the device did not enable stay NULL.
+// Returns 0 if the table cannot be allocated.
+static int load_device_dispatch(VulkanDevice *dptr) {
+  VulkanDeviceDispatch *table = heap_alloc(sizeof(VulkanDeviceDispatch));
+  if (!table) return 0;
+  PFN_vkGetDeviceProcAddr getDeviceProcAddr = dptr->vki->vkGetDeviceProcAddr;
+#define VULKAN_DISPATCH_LOAD(name) \
+  table->name = (PFN_##name)getDeviceProcAddr(dptr->device, #name);
+  VULKAN_DEVICE_FUNCTIONS(VULKAN_DISPATCH_LOAD)
+#undef VULKAN_DISPATCH_LOAD
+  // Core in 1.3; older devices expose VK_KHR_dynamic_rendering under the KHR names
+  if (!table->vkCmdBeginRendering) {
+      table->vkCmdBeginRendering =
+          (PFN_vkCmdBeginRendering)getDeviceProcAddr(dptr->device, "vkCmdBeginRenderingKHR");
+      table->vkCmdEndRendering =
+          (PFN_vkCmdEndRendering)getDeviceProcAddr(dptr->device, "vkCmdEndRenderingKHR");
+  }
+  // Core in 1.2; VK_KHR_timeline_semaphore before that
+  if (!table->vkWaitSemaphores) {
+      table->vkGetSemaphoreCounterValue =
+          (PFN_vkGetSemaphoreCounterValue)getDeviceProcAddr(dptr->device, "vkGetSemaphoreCounterValueKHR");
+      table->vkWaitSemaphores =
+          (PFN_vkWaitSemaphores)getDeviceProcAddr(dptr->device, "vkWaitSemaphoresKHR");
+      table->vkSignalSemaphore =
+          (PFN_vkSignalSemaphore)getDeviceProcAddr(dptr->device, "vkSignalSemaphoreKHR");
+  }
+  // Core in 1.2; VK_KHR_draw_indirect_count before that
+  if (!table->vkCmdDrawIndirectCount) {
+      table->vkCmdDrawIndirectCount =
+          (PFN_vkCmdDrawIndirectCount)getDeviceProcAddr(dptr->device, "vkCmdDrawIndirectCountKHR");
+      table->vkCmdDrawIndexedIndirectCount =
+          (PFN_vkCmdDrawIndexedIndirectCount)getDeviceProcAddr(dptr->device, "vkCmdDrawIndexedIndirectCountKHR");
+  }
+  dptr->vkd = table;
+  return 1;
+}
+
+static void destroy_device(VulkanDevice *dptr) {
+  VulkanDeviceDispatch *table = (VulkanDeviceDispatch *)dptr->vkd;
+  table->vkDestroyDevice(dptr->device, NULL);
+  dptr->device = VK_NULL_HANDLE;
+  memset(table, 0, sizeof(*table)); // See above; never freed
+}
+
+// Cumulative count for the calling thread; sample it twice and subtract to get
+// the allocations made by a frame.
+static int l_vk_GetHeapAllocationCount(lua_State *L) {
+  lua_pushinteger(L, (lua_Integer)heapAllocationCount);
+  return 1;
+}
+
 static int l_vk_CreateInstance(lua_State *L) {
+  scratch_begin();
   luaL_checktype(L, 1, LUA_TTABLE);
 
   VkApplicationInfo appInfo = { .sType = VK_STRUCTURE_TYPE_APPLICATION_INFO };
@@ -46,7 +298,7 @@ static int l_vk_CreateInstance(lua_State *L) {
   if (lua_istable(L, -1)) {
       layerCount = (uint32_t)lua_objlen(L, -1);
       if (layerCount > 0) {
-          layerNames = malloc(layerCount * sizeof(const char *));
+          layerNames = check_scratch_alloc(L, layerCount * sizeof(const char *));
           for (uint32_t i = 0; i < layerCount; i++) {
               lua_rawgeti(L, -1, i + 1);
               layerNames[i] = luaL_checkstring(L, -1);
@@ -62,7 +314,7 @@ static int l_vk_CreateInstance(lua_State *L) {
   if (lua_istable(L, -1)) {
       extensionCount = (uint32_t)lua_objlen(L, -1);
       if (extensionCount > 0) {
-          extensionNames = malloc(extensionCount * sizeof(const char *));
+          extensionNames = check_scratch_alloc(L, extensionCount * sizeof(const char *));
           for (uint32_t i = 0; i < extensionCount; i++) {
               lua_rawgeti(L, -1, i + 1);
               extensionNames[i] = luaL_checkstring(L, -1);
@@ -81,11 +333,15 @@ static int l_vk_CreateInstance(lua_State *L) {
       .ppEnabledExtensionNames = extensionNames,
   };
 
-  VkInstance instance;
-  VkResult result = vkCreateInstance(&createInfo, NULL, &instance);
+  const char *loaderError = load_vulkan_loader();
+  if (loaderError) {
+      lua_pushnil(L);
+      lua_pushstring(L, loaderError);
+      return 2;
+  }
 
-  free(layerNames);
-  free(extensionNames);
+  VkInstance instance;
+  VkResult result = createInstance(&createInfo, NULL, &instance);
 
   if (result != VK_SUCCESS) {
       lua_pushnil(L);
@@ -93,17 +349,26 @@ static int l_vk_CreateInstance(lua_State *L) {
       return 2;
   }
 
+  VulkanInstanceDispatch *vki = load_instance_dispatch(instance);
+  if (!vki) {
+      PFN_vkDestroyInstance destroyInstance =
+          (PFN_vkDestroyInstance)getInstanceProcAddr(instance, "vkDestroyInstance");
+      destroyInstance(instance, NULL);
+      return luaL_error(L, "vk_CreateInstance: out of memory");
+  }
   VulkanInstance *iptr = (VulkanInstance *)lua_newuserdata(L, sizeof(VulkanInstance));
   iptr->instance = instance;
+  iptr->vki = vki;
   luaL_getmetatable(L, "VulkanInstance");
   lua_setmetatable(L, -2);
   return 1;
 }
 
 static int l_vk_EnumeratePhysicalDevices(lua_State *L) {
+  scratch_begin();
   VulkanInstance *iptr = (VulkanInstance *)luaL_checkudata(L, 1, "VulkanInstance");
   uint32_t deviceCount = 0;
-  vkEnumeratePhysicalDevices(iptr->instance, &deviceCount, NULL);
+  iptr->vki->vkEnumeratePhysicalDevices(iptr->instance, &deviceCount, NULL);
 
   if (deviceCount == 0) {
       lua_pushnil(L);
@@ -111,25 +376,25 @@ static int l_vk_EnumeratePhysicalDevices(lua_State *L) {
       return 2;
   }
 
-  VkPhysicalDevice *devices = malloc(deviceCount * sizeof(VkPhysicalDevice));
-  vkEnumeratePhysicalDevices(iptr->instance, &deviceCount, devices);
+  VkPhysicalDevice *devices = check_scratch_alloc(L, deviceCount * sizeof(VkPhysicalDevice));
+  iptr->vki->vkEnumeratePhysicalDevices(iptr->instance, &deviceCount, devices);
 
   lua_newtable(L);
   for (uint32_t i = 0; i < deviceCount; i++) {
       VulkanPhysicalDevice *dptr = (VulkanPhysicalDevice *)lua_newuserdata(L, sizeof(VulkanPhysicalDevice));
       dptr->physicalDevice = devices[i];
+      dptr->vki = iptr->vki;
       luaL_getmetatable(L, "VulkanPhysicalDevice");
       lua_setmetatable(L, -2);
       lua_rawseti(L, -2, i + 1);
   }
-  free(devices);
   return 1;
 }
 
 static int l_vk_GetPhysicalDeviceProperties(lua_State *L) {
     VulkanPhysicalDevice *dptr = (VulkanPhysicalDevice *)luaL_checkudata(L, 1, "VulkanPhysicalDevice");
     VkPhysicalDeviceProperties props;
-    vkGetPhysicalDeviceProperties(dptr->physicalDevice, &props);
+    dptr->vki->vkGetPhysicalDeviceProperties(dptr->physicalDevice, &props);
 
     lua_newtable(L);
     lua_pushstring(L, props.deviceName);
@@ -142,9 +407,10 @@ static int l_vk_GetPhysicalDeviceProperties(lua_State *L) {
 }
 
 static int l_vk_GetPhysicalDeviceQueueFamilyProperties(lua_State *L) {
+  scratch_begin();
   VulkanPhysicalDevice *dptr = (VulkanPhysicalDevice *)luaL_checkudata(L, 1, "VulkanPhysicalDevice");
   uint32_t queueFamilyCount = 0;
-  vkGetPhysicalDeviceQueueFamilyProperties(dptr->physicalDevice, &queueFamilyCount, NULL);
+  dptr->vki->vkGetPhysicalDeviceQueueFamilyProperties(dptr->physicalDevice, &queueFamilyCount, NULL);
 
   if (queueFamilyCount == 0) {
       lua_pushnil(L);
@@ -152,8 +418,8 @@ static int l_vk_GetPhysicalDeviceQueueFamilyProperties(lua_State *L) {
       return 2;
   }
 
-  VkQueueFamilyProperties *queueFamilies = malloc(queueFamilyCount * sizeof(VkQueueFamilyProperties));
-  vkGetPhysicalDeviceQueueFamilyProperties(dptr->physicalDevice, &queueFamilyCount, queueFamilies);
+  VkQueueFamilyProperties *queueFamilies = check_scratch_alloc(L, queueFamilyCount * sizeof(VkQueueFamilyProperties));
+  dptr->vki->vkGetPhysicalDeviceQueueFamilyProperties(dptr->physicalDevice, &queueFamilyCount, queueFamilies);
 
   lua_newtable(L);
   for (uint32_t i = 0; i < queueFamilyCount; i++) {
@@ -164,7 +430,6 @@ static int l_vk_GetPhysicalDeviceQueueFamilyProperties(lua_State *L) {
       lua_setfield(L, -2, "queueFlags");
       lua_rawseti(L, -2, i + 1); // 1-based indexing for Lua
   }
-  free(queueFamilies);
   return 1;
 }
 
@@ -174,7 +439,7 @@ static int l_vk_GetPhysicalDeviceSurfaceSupportKHR(lua_State *L) {
   VulkanSurface *sptr = (VulkanSurface *)luaL_checkudata(L, 3, "VulkanSurface");
 
   VkBool32 supported;
-  VkResult result = vkGetPhysicalDeviceSurfaceSupportKHR(dptr->physicalDevice, queueFamilyIndex, sptr->surface, &supported);
+  VkResult result = dptr->vki->vkGetPhysicalDeviceSurfaceSupportKHR(dptr->physicalDevice, queueFamilyIndex, sptr->surface, &supported);
 
   if (result != VK_SUCCESS) {
       lua_pushnil(L);
@@ -187,21 +452,23 @@ static int l_vk_GetPhysicalDeviceSurfaceSupportKHR(lua_State *L) {
 }
 
 static int l_vk_CreateDevice(lua_State *L) {
+  scratch_begin();
   VulkanPhysicalDevice *dptr = (VulkanPhysicalDevice *)luaL_checkudata(L, 1, "VulkanPhysicalDevice");
-  VulkanSurface *sptr = (VulkanSurface *)luaL_checkudata(L, 2, "VulkanSurface");
+  // A nil surface creates a headless device; the present family is then the graphics family
+  VulkanSurface *sptr = lua_isnil(L, 2) ? NULL : (VulkanSurface *)luaL_checkudata(L, 2, "VulkanSurface");
   luaL_checktype(L, 3, LUA_TTABLE); // Configuration table
 
   // Get queue family properties
   uint32_t queueFamilyCount = 0;
-  vkGetPhysicalDeviceQueueFamilyProperties(dptr->physicalDevice, &queueFamilyCount, NULL);
+  dptr->vki->vkGetPhysicalDeviceQueueFamilyProperties(dptr->physicalDevice, &queueFamilyCount, NULL);
   if (queueFamilyCount == 0) {
       lua_pushnil(L);
       lua_pushstring(L, "No queue families available");
       return 2;
   }
 
-  VkQueueFamilyProperties *queueFamilies = malloc(queueFamilyCount * sizeof(VkQueueFamilyProperties));
-  vkGetPhysicalDeviceQueueFamilyProperties(dptr->physicalDevice, &queueFamilyCount, queueFamilies);
+  VkQueueFamilyProperties *queueFamilies = check_scratch_alloc(L, queueFamilyCount * sizeof(VkQueueFamilyProperties));
+  dptr->vki->vkGetPhysicalDeviceQueueFamilyProperties(dptr->physicalDevice, &queueFamilyCount, queueFamilies);
 
   // Find graphics and present queue families
   uint32_t graphicsFamily = UINT32_MAX;
@@ -211,7 +478,9 @@ static int l_vk_CreateDevice(lua_State *L) {
           graphicsFamily = i;
       }
       VkBool32 presentSupport = VK_FALSE;
-      vkGetPhysicalDeviceSurfaceSupportKHR(dptr->physicalDevice, i, sptr->surface, &presentSupport);
+      if (sptr) {
+          dptr->vki->vkGetPhysicalDeviceSurfaceSupportKHR(dptr->physicalDevice, i, sptr->surface, &presentSupport);
+      }
       if (presentSupport) {
           presentFamily = i;
       }
@@ -219,13 +488,15 @@ static int l_vk_CreateDevice(lua_State *L) {
           break;
       }
   }
-  free(queueFamilies);
 
   if (graphicsFamily == UINT32_MAX) {
       lua_pushnil(L);
       lua_pushstring(L, "No graphics queue family found");
       return 2;
   }
+  if (!sptr) {
+      presentFamily = graphicsFamily;
+  }
   if (presentFamily == UINT32_MAX) {
       lua_pushnil(L);
       lua_pushstring(L, "No present queue family found");
@@ -262,7 +533,7 @@ static int l_vk_CreateDevice(lua_State *L) {
   if (lua_istable(L, -1)) {
       extensionCount = (uint32_t)lua_objlen(L, -1);
       if (extensionCount > 0) {
-          extensionNames = malloc(extensionCount * sizeof(const char *));
+          extensionNames = check_scratch_alloc(L, extensionCount * sizeof(const char *));
           for (uint32_t i = 0; i < extensionCount; i++) {
               lua_rawgeti(L, -1, i + 1);
               extensionNames[i] = luaL_checkstring(L, -1);
@@ -273,9 +544,101 @@ static int l_vk_CreateDevice(lua_State *L) {
   lua_pop(L, 1);
 
   VkPhysicalDeviceFeatures deviceFeatures = {0};
+  // pipelineStatisticsQuery = true allows vk_CreateGpuProfiler{pipelineStatistics = true}
+  lua_getfield(L, 3, "pipelineStatisticsQuery");
+  deviceFeatures.pipelineStatisticsQuery = lua_toboolean(L, -1) ? VK_TRUE : VK_FALSE;
+  // multiDrawIndirect allows drawCount > 1 in vk_CmdDraw*Indirect;
+  // drawIndirectFirstInstance lets indirect commands set firstInstance
+  lua_getfield(L, 3, "multiDrawIndirect");
+  deviceFeatures.multiDrawIndirect = lua_toboolean(L, -1) ? VK_TRUE : VK_FALSE;
+  lua_getfield(L, 3, "drawIndirectFirstInstance");
+  deviceFeatures.drawIndirectFirstInstance = lua_toboolean(L, -1) ? VK_TRUE : VK_FALSE;
+  lua_pop(L, 3);
+
+  // dynamicRendering = true enables vk_CmdBeginRendering; the device must be
+  // Vulkan 1.3 or have VK_KHR_dynamic_rendering in enabled_extension_names
+  VkPhysicalDeviceDynamicRenderingFeatures dynamicRenderingFeatures = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DYNAMIC_RENDERING_FEATURES,
+      .dynamicRendering = VK_TRUE
+  };
+  // timelineSemaphore = true enables vk_CreateTimelineSemaphore (Vulkan 1.2
+  // or VK_KHR_timeline_semaphore)
+  VkPhysicalDeviceTimelineSemaphoreFeatures timelineSemaphoreFeatures = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES,
+      .timelineSemaphore = VK_TRUE
+  };
+  // presentWait = true enables present ids and vkWaitForPresentKHR for
+  // vk_CreateFrameDriver{presentWait = true}; needs VK_KHR_present_id and
+  // VK_KHR_present_wait in enabled_extension_names
+  VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+      .presentId = VK_TRUE
+  };
+  VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+      .pNext = &presentIdFeatures,
+      .presentWait = VK_TRUE
+  };
+  void *featureChain = NULL;
+  lua_getfield(L, 3, "presentWait");
+  if (lua_toboolean(L, -1)) {
+      presentIdFeatures.pNext = featureChain;
+      featureChain = &presentWaitFeatures;
+  }
+  lua_pop(L, 1);
+  lua_getfield(L, 3, "dynamicRendering");
+  if (lua_toboolean(L, -1)) {
+      dynamicRenderingFeatures.pNext = featureChain;
+      featureChain = &dynamicRenderingFeatures;
+  }
+  lua_pop(L, 1);
+  // drawIndirectCount = true enables vk_CmdDraw*IndirectCount on a Vulkan 1.2
+  // device; older devices need VK_KHR_draw_indirect_count in
+  // enabled_extension_names instead, which has no feature bit. descriptorIndexing
+  // = true enables what vk_CreateBindlessTable needs: runtime descriptor
+  // arrays, partially bound, update-after-bind and variable-count bindings,
+  // and non-uniform indexing of sampled images and storage buffers. The 1.2
+  // feature struct may not be chained next to the timeline one, so it takes
+  // over timelineSemaphore as well.
+  VkPhysicalDeviceVulkan12Features vulkan12Features = {
+      .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES
+  };
+  lua_getfield(L, 3, "timelineSemaphore");
+  int timelineSemaphore = lua_toboolean(L, -1);
+  lua_getfield(L, 3, "drawIndirectCount");
+  int drawIndirectCount = lua_toboolean(L, -1);
+  lua_getfield(L, 3, "descriptorIndexing");
+  int descriptorIndexing = lua_toboolean(L, -1);
+  lua_pop(L, 3);
+  if (drawIndirectCount) {
+      VkPhysicalDeviceProperties props;
+      dptr->vki->vkGetPhysicalDeviceProperties(dptr->physicalDevice, &props);
+      drawIndirectCount = props.apiVersion >= VK_API_VERSION_1_2;
+  }
+  if (drawIndirectCount || descriptorIndexing) {
+      vulkan12Features.drawIndirectCount = drawIndirectCount ? VK_TRUE : VK_FALSE;
+      if (descriptorIndexing) {
+          vulkan12Features.descriptorIndexing = VK_TRUE;
+          vulkan12Features.runtimeDescriptorArray = VK_TRUE;
+          vulkan12Features.descriptorBindingPartiallyBound = VK_TRUE;
+          vulkan12Features.descriptorBindingVariableDescriptorCount = VK_TRUE;
+          vulkan12Features.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+          vulkan12Features.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+          vulkan12Features.descriptorBindingStorageBufferUpdateAfterBind = VK_TRUE;
+          vulkan12Features.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+          vulkan12Features.shaderStorageBufferArrayNonUniformIndexing = VK_TRUE;
+      }
+      vulkan12Features.timelineSemaphore = timelineSemaphore ? VK_TRUE : VK_FALSE;
+      vulkan12Features.pNext = featureChain;
+      featureChain = &vulkan12Features;
+  } else if (timelineSemaphore) {
+      timelineSemaphoreFeatures.pNext = featureChain;
+      featureChain = &timelineSemaphoreFeatures;
+  }
 
   VkDeviceCreateInfo createInfo = {
       .sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO,
+      .pNext = featureChain,
       .queueCreateInfoCount = queueCreateInfoCount,
       .pQueueCreateInfos = queueCreateInfos,
       .enabledExtensionCount = extensionCount,
@@ -284,9 +647,7 @@ static int l_vk_CreateDevice(lua_State *L) {
   };
 
   VkDevice device;
-  VkResult result = vkCreateDevice(dptr->physicalDevice, &createInfo, NULL, &device);
-
-  free(extensionNames);
+  VkResult result = dptr->vki->vkCreateDevice(dptr->physicalDevice, &createInfo, NULL, &device);
 
   if (result != VK_SUCCESS) {
       char errMsg[64];
@@ -298,8 +659,18 @@ static int l_vk_CreateDevice(lua_State *L) {
 
   VulkanDevice *devptr = (VulkanDevice *)lua_newuserdata(L, sizeof(VulkanDevice));
   devptr->device = device;
+  devptr->physicalDevice = dptr->physicalDevice;
+  devptr->vki = dptr->vki;
+  if (!load_device_dispatch(devptr)) {
+      PFN_vkDestroyDevice destroyDevice =
+          (PFN_vkDestroyDevice)dptr->vki->vkGetDeviceProcAddr(device, "vkDestroyDevice");
+      destroyDevice(device, NULL);
+      return luaL_error(L, "vk_CreateDevice: out of memory");
+  }
   luaL_getmetatable(L, "VulkanDevice");
   lua_setmetatable(L, -2);
+  lua_newtable(L); // Environment: per-device caches (see vk_CreateShaderModuleFromFile)
+  lua_setfenv(L, -2);
 
   lua_pushinteger(L, graphicsFamily);
   lua_pushinteger(L, presentFamily);
@@ -308,11 +679,12 @@ static int l_vk_CreateDevice(lua_State *L) {
 
 static int l_vk_GetDeviceQueue(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   uint32_t queueFamilyIndex = (uint32_t)luaL_checkinteger(L, 2);
   uint32_t queueIndex = (uint32_t)luaL_checkinteger(L, 3);
 
   VkQueue queue;
-  vkGetDeviceQueue(dptr->device, queueFamilyIndex, queueIndex, &queue);
+  vkd->vkGetDeviceQueue(dptr->device, queueFamilyIndex, queueIndex, &queue);
   if (queue == VK_NULL_HANDLE) {
       lua_pushnil(L);
       lua_pushstring(L, "Failed to get device queue");
@@ -321,6 +693,7 @@ static int l_vk_GetDeviceQueue(lua_State *L) {
 
   VulkanQueue *qptr = (VulkanQueue *)lua_newuserdata(L, sizeof(VulkanQueue));
   qptr->queue = queue;
+  qptr->vkd = dptr->vkd;
   luaL_getmetatable(L, "VulkanQueue");
   lua_setmetatable(L, -2);
   return 1;
@@ -331,7 +704,7 @@ static int l_vk_GetPhysicalDeviceSurfaceCapabilitiesKHR(lua_State *L) {
   VulkanSurface *sptr = (VulkanSurface *)luaL_checkudata(L, 2, "VulkanSurface");
 
   VkSurfaceCapabilitiesKHR caps;
-  VkResult result = vkGetPhysicalDeviceSurfaceCapabilitiesKHR(dptr->physicalDevice, sptr->surface, &caps);
+  VkResult result = dptr->vki->vkGetPhysicalDeviceSurfaceCapabilitiesKHR(dptr->physicalDevice, sptr->surface, &caps);
   if (result != VK_SUCCESS) {
       lua_pushnil(L);
       lua_pushstring(L, "Failed to get surface capabilities");
@@ -351,19 +724,20 @@ static int l_vk_GetPhysicalDeviceSurfaceCapabilitiesKHR(lua_State *L) {
 }
 
 static int l_vk_GetPhysicalDeviceSurfaceFormatsKHR(lua_State *L) {
+  scratch_begin();
   VulkanPhysicalDevice *dptr = (VulkanPhysicalDevice *)luaL_checkudata(L, 1, "VulkanPhysicalDevice");
   VulkanSurface *sptr = (VulkanSurface *)luaL_checkudata(L, 2, "VulkanSurface");
 
   uint32_t formatCount;
-  vkGetPhysicalDeviceSurfaceFormatsKHR(dptr->physicalDevice, sptr->surface, &formatCount, NULL);
+  dptr->vki->vkGetPhysicalDeviceSurfaceFormatsKHR(dptr->physicalDevice, sptr->surface, &formatCount, NULL);
   if (formatCount == 0) {
       lua_pushnil(L);
       lua_pushstring(L, "No surface formats available");
       return 2;
   }
 
-  VkSurfaceFormatKHR *formats = malloc(formatCount * sizeof(VkSurfaceFormatKHR));
-  vkGetPhysicalDeviceSurfaceFormatsKHR(dptr->physicalDevice, sptr->surface, &formatCount, formats);
+  VkSurfaceFormatKHR *formats = check_scratch_alloc(L, formatCount * sizeof(VkSurfaceFormatKHR));
+  dptr->vki->vkGetPhysicalDeviceSurfaceFormatsKHR(dptr->physicalDevice, sptr->surface, &formatCount, formats);
 
   lua_newtable(L);
   for (uint32_t i = 0; i < formatCount; i++) {
@@ -374,36 +748,104 @@ static int l_vk_GetPhysicalDeviceSurfaceFormatsKHR(lua_State *L) {
       lua_setfield(L, -2, "colorSpace");
       lua_rawseti(L, -2, i + 1);
   }
-  free(formats);
   return 1;
 }
 
 static int l_vk_GetPhysicalDeviceSurfacePresentModesKHR(lua_State *L) {
+  scratch_begin();
   VulkanPhysicalDevice *dptr = (VulkanPhysicalDevice *)luaL_checkudata(L, 1, "VulkanPhysicalDevice");
   VulkanSurface *sptr = (VulkanSurface *)luaL_checkudata(L, 2, "VulkanSurface");
 
   uint32_t modeCount;
-  vkGetPhysicalDeviceSurfacePresentModesKHR(dptr->physicalDevice, sptr->surface, &modeCount, NULL);
+  dptr->vki->vkGetPhysicalDeviceSurfacePresentModesKHR(dptr->physicalDevice, sptr->surface, &modeCount, NULL);
   if (modeCount == 0) {
       lua_pushnil(L);
       lua_pushstring(L, "No present modes available");
       return 2;
   }
 
-  VkPresentModeKHR *modes = malloc(modeCount * sizeof(VkPresentModeKHR));
-  vkGetPhysicalDeviceSurfacePresentModesKHR(dptr->physicalDevice, sptr->surface, &modeCount, modes);
+  VkPresentModeKHR *modes = check_scratch_alloc(L, modeCount * sizeof(VkPresentModeKHR));
+  dptr->vki->vkGetPhysicalDeviceSurfacePresentModesKHR(dptr->physicalDevice, sptr->surface, &modeCount, modes);
 
   lua_newtable(L);
   for (uint32_t i = 0; i < modeCount; i++) {
       lua_pushinteger(L, modes[i]);
       lua_rawseti(L, -2, i + 1);
   }
-  free(modes);
+  return 1;
+}
+
+// vk_EnumerateDeviceExtensionProperties(physicalDevice) -> { [extensionName] = specVersion }
+static int l_vk_EnumerateDeviceExtensionProperties(lua_State *L) {
+  scratch_begin();
+  VulkanPhysicalDevice *dptr = (VulkanPhysicalDevice *)luaL_checkudata(L, 1, "VulkanPhysicalDevice");
+
+  uint32_t count = 0;
+  VkResult result = dptr->vki->vkEnumerateDeviceExtensionProperties(dptr->physicalDevice, NULL, &count, NULL);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkEnumerateDeviceExtensionProperties", result);
+  }
+  VkExtensionProperties *properties = check_scratch_alloc(L, count * sizeof(VkExtensionProperties));
+  result = dptr->vki->vkEnumerateDeviceExtensionProperties(dptr->physicalDevice, NULL, &count, properties);
+  if (result != VK_SUCCESS && result != VK_INCOMPLETE) {
+      return push_vk_error(L, "vkEnumerateDeviceExtensionProperties", result);
+  }
+
+  lua_createtable(L, 0, (int)count);
+  for (uint32_t i = 0; i < count; i++) {
+      lua_pushinteger(L, properties[i].specVersion);
+      lua_setfield(L, -2, properties[i].extensionName);
+  }
+  return 1;
+}
+
+// Present mode policies for vk_ChoosePresentMode, each a preference list
+// ending in FIFO, the one mode every surface supports
+static const char *const presentPolicyNames[] = { "vsync", "lowLatency", "vsyncTearing", NULL };
+static const VkPresentModeKHR presentPolicyModes[][3] = {
+  // Never tears; queues up to swapchain image count frames behind the display
+  { VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR },
+  // Newest frame wins without tearing, else no vsync at all
+  { VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_FIFO_KHR },
+  // Vsync, but a late frame is shown immediately instead of waiting a refresh
+  { VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_FIFO_KHR, VK_PRESENT_MODE_FIFO_KHR },
+};
+
+// vk_ChoosePresentMode(physicalDevice, surface[, policy]) -> presentMode for
+// vk_CreateSwapchainKHR; policy is "vsync" (default), "lowLatency" or "vsyncTearing"
+static int l_vk_ChoosePresentMode(lua_State *L) {
+  scratch_begin();
+  VulkanPhysicalDevice *dptr = (VulkanPhysicalDevice *)luaL_checkudata(L, 1, "VulkanPhysicalDevice");
+  VulkanSurface *sptr = (VulkanSurface *)luaL_checkudata(L, 2, "VulkanSurface");
+  int policy = luaL_checkoption(L, 3, "vsync", presentPolicyNames);
+
+  uint32_t modeCount = 0;
+  VkResult result = dptr->vki->vkGetPhysicalDeviceSurfacePresentModesKHR(dptr->physicalDevice, sptr->surface, &modeCount, NULL);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkGetPhysicalDeviceSurfacePresentModesKHR", result);
+  }
+  VkPresentModeKHR *modes = check_scratch_alloc(L, modeCount * sizeof(VkPresentModeKHR));
+  result = dptr->vki->vkGetPhysicalDeviceSurfacePresentModesKHR(dptr->physicalDevice, sptr->surface, &modeCount, modes);
+  if (result != VK_SUCCESS && result != VK_INCOMPLETE) {
+      return push_vk_error(L, "vkGetPhysicalDeviceSurfacePresentModesKHR", result);
+  }
+
+  for (int p = 0; p < 3; p++) {
+      for (uint32_t i = 0; i < modeCount; i++) {
+          if (modes[i] == presentPolicyModes[policy][p]) {
+              lua_pushinteger(L, modes[i]);
+              return 1;
+          }
+      }
+  }
+  lua_pushinteger(L, VK_PRESENT_MODE_FIFO_KHR);
   return 1;
 }
 
 static int l_vk_CreateSwapchainKHR(lua_State *L) {
+  scratch_begin();
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   luaL_checktype(L, 2, LUA_TTABLE);
 
   VkSwapchainCreateInfoKHR createInfo = { .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_CREATE_INFO_KHR };
@@ -438,7 +880,10 @@ static int l_vk_CreateSwapchainKHR(lua_State *L) {
   lua_getfield(L, 2, "queueFamilyIndices");
   if (lua_istable(L, -1)) {
       uint32_t count = (uint32_t)lua_objlen(L, -1);
-      uint32_t *indices = malloc(count * sizeof(uint32_t));
+      if (count > VULKAN_MAX_SWAPCHAIN_QUEUE_FAMILIES) {
+          return luaL_error(L, "Too many swapchain queue families (max %d)", VULKAN_MAX_SWAPCHAIN_QUEUE_FAMILIES);
+      }
+      uint32_t *indices = check_scratch_alloc(L, count * sizeof(uint32_t));
       for (uint32_t i = 0; i < count; i++) {
           lua_rawgeti(L, -1, i + 1);
           indices[i] = (uint32_t)luaL_checkinteger(L, -1);
@@ -470,11 +915,7 @@ static int l_vk_CreateSwapchainKHR(lua_State *L) {
   createInfo.clipped = VK_TRUE;
 
   VkSwapchainKHR swapchain;
-  VkResult result = vkCreateSwapchainKHR(dptr->device, &createInfo, NULL, &swapchain);
-
-  if (createInfo.pQueueFamilyIndices) {
-      free((void *)createInfo.pQueueFamilyIndices);
-  }
+  VkResult result = vkd->vkCreateSwapchainKHR(dptr->device, &createInfo, NULL, &swapchain);
 
   if (result != VK_SUCCESS) {
       char errMsg[64];
@@ -487,27 +928,35 @@ static int l_vk_CreateSwapchainKHR(lua_State *L) {
   VulkanSwapchain *swptr = (VulkanSwapchain *)lua_newuserdata(L, sizeof(VulkanSwapchain));
   swptr->swapchain = swapchain;
   swptr->device = dptr->device;
+  swptr->vkd = dptr->vkd;
+  swptr->createInfo = createInfo;
+  if (createInfo.queueFamilyIndexCount > 0) {
+      memcpy(swptr->queueFamilyIndices, createInfo.pQueueFamilyIndices,
+          createInfo.queueFamilyIndexCount * sizeof(uint32_t));
+      swptr->createInfo.pQueueFamilyIndices = swptr->queueFamilyIndices;
+  }
   luaL_getmetatable(L, "VulkanSwapchain");
   lua_setmetatable(L, -2);
   return 1;
 }
 
 static int l_vk_GetSwapchainImagesKHR(lua_State *L) {
+  scratch_begin();
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   VulkanSwapchain *swptr = (VulkanSwapchain *)luaL_checkudata(L, 2, "VulkanSwapchain");
 
   uint32_t imageCount;
-  VkResult result = vkGetSwapchainImagesKHR(dptr->device, swptr->swapchain, &imageCount, NULL);
+  VkResult result = vkd->vkGetSwapchainImagesKHR(dptr->device, swptr->swapchain, &imageCount, NULL);
   if (result != VK_SUCCESS || imageCount == 0) {
       lua_pushnil(L);
       lua_pushstring(L, "Failed to get swapchain image count");
       return 2;
   }
 
-  VkImage *images = malloc(imageCount * sizeof(VkImage));
-  result = vkGetSwapchainImagesKHR(dptr->device, swptr->swapchain, &imageCount, images);
+  VkImage *images = check_scratch_alloc(L, imageCount * sizeof(VkImage));
+  result = vkd->vkGetSwapchainImagesKHR(dptr->device, swptr->swapchain, &imageCount, images);
   if (result != VK_SUCCESS) {
-      free(images);
       lua_pushnil(L);
       lua_pushstring(L, "Failed to retrieve swapchain images");
       return 2;
@@ -516,17 +965,200 @@ static int l_vk_GetSwapchainImagesKHR(lua_State *L) {
   lua_newtable(L);
   for (uint32_t i = 0; i < imageCount; i++) {
       VulkanImage *imgptr = (VulkanImage *)lua_newuserdata(L, sizeof(VulkanImage));
+      memset(imgptr, 0, sizeof(*imgptr));
       imgptr->image = images[i];
+      imgptr->format = swptr->createInfo.imageFormat;
+      imgptr->extent = swptr->createInfo.imageExtent;
       luaL_getmetatable(L, "VulkanImage");
       lua_setmetatable(L, -2);
       lua_rawseti(L, -2, i + 1);
   }
-  free(images);
   return 1;
 }
 
+static int l_vk_GetSwapchainExtent(lua_State *L) {
+  VulkanSwapchain *swptr = (VulkanSwapchain *)luaL_checkudata(L, 1, "VulkanSwapchain");
+  lua_pushinteger(L, swptr->createInfo.imageExtent.width);
+  lua_pushinteger(L, swptr->createInfo.imageExtent.height);
+  return 2;
+}
+
+// Returns the userdata at t[i] if it already has metatable tname, otherwise
+// stores a fresh one there. Lets recreation update Lua-visible objects in place.
+static void *table_slot_udata(lua_State *L, int tableIdx, int i, size_t size, const char *tname) {
+  lua_rawgeti(L, tableIdx, i);
+  void *ptr = luaL_testudata(L, -1, tname);
+  lua_pop(L, 1);
+  if (ptr) {
+      return ptr;
+  }
+  ptr = lua_newuserdata(L, size);
+  memset(ptr, 0, size);
+  luaL_getmetatable(L, tname);
+  lua_setmetatable(L, -2);
+  lua_rawseti(L, tableIdx, i);
+  return ptr;
+}
+
+// vk_RecreateSwapchainKHR(device, swapchain, width, height[, targets])
+// Builds a new swapchain from the stored creation parameters with oldSwapchain
+// set, then updates the swapchain userdata in place. targets may hold the
+// images, imageViews and framebuffers tables (plus the renderPass for the
+// framebuffers); their entries are rebuilt in place, so anything referencing
+// them, including pipelines, stays valid.
+static int l_vk_RecreateSwapchainKHR(lua_State *L) {
+  scratch_begin();
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
+  VulkanSwapchain *swptr = (VulkanSwapchain *)luaL_checkudata(L, 2, "VulkanSwapchain");
+  uint32_t width = (uint32_t)luaL_checkinteger(L, 3);
+  uint32_t height = (uint32_t)luaL_checkinteger(L, 4);
+  if (width == 0 || height == 0) {
+      lua_pushnil(L);
+      lua_pushstring(L, "Cannot create a swapchain with a zero extent");
+      return 2;
+  }
+
+  // The old images, views and framebuffers may still be in use
+  vkd->vkDeviceWaitIdle(dptr->device);
+
+  VkSwapchainCreateInfoKHR createInfo = swptr->createInfo;
+  createInfo.imageExtent.width = width;
+  createInfo.imageExtent.height = height;
+  createInfo.oldSwapchain = swptr->swapchain;
+
+  VkSwapchainKHR swapchain;
+  VkResult result = vkd->vkCreateSwapchainKHR(dptr->device, &createInfo, NULL, &swapchain);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkCreateSwapchainKHR", result);
+  }
+  vkd->vkDestroySwapchainKHR(dptr->device, swptr->swapchain, NULL);
+  swptr->swapchain = swapchain;
+  swptr->createInfo.imageExtent = createInfo.imageExtent;
+
+  if (!lua_istable(L, 5)) {
+      lua_pushboolean(L, true);
+      return 1;
+  }
+
+  uint32_t imageCount = 0;
+  vkd->vkGetSwapchainImagesKHR(dptr->device, swapchain, &imageCount, NULL);
+  VkImage *images = check_scratch_alloc(L, imageCount * sizeof(VkImage));
+  result = vkd->vkGetSwapchainImagesKHR(dptr->device, swapchain, &imageCount, images);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkGetSwapchainImagesKHR", result);
+  }
+
+  lua_getfield(L, 5, "images");
+  if (lua_istable(L, -1)) {
+      int t = lua_gettop(L);
+      for (uint32_t i = 0; i < imageCount; i++) {
+          VulkanImage *imgptr = table_slot_udata(L, t, i + 1, sizeof(VulkanImage), "VulkanImage");
+          imgptr->image = images[i];
+          imgptr->format = createInfo.imageFormat;
+          imgptr->extent = createInfo.imageExtent;
+      }
+      for (int i = (int)lua_objlen(L, t); i > (int)imageCount; i--) {
+          lua_pushnil(L);
+          lua_rawseti(L, t, i);
+      }
+  }
+  lua_pop(L, 1);
+
+  lua_getfield(L, 5, "imageViews");
+  if (lua_istable(L, -1)) {
+      int t = lua_gettop(L);
+      for (int i = (int)lua_objlen(L, t); i > 0; i--) {
+          lua_rawgeti(L, t, i);
+          VulkanImageView *viewptr = luaL_testudata(L, -1, "VulkanImageView");
+          if (viewptr && viewptr->imageView) {
+              vkd->vkDestroyImageView(dptr->device, viewptr->imageView, NULL);
+              viewptr->imageView = VK_NULL_HANDLE;
+          }
+          lua_pop(L, 1);
+          if (i > (int)imageCount) {
+              lua_pushnil(L);
+              lua_rawseti(L, t, i);
+          }
+      }
+      for (uint32_t i = 0; i < imageCount; i++) {
+          VulkanImageView *viewptr = table_slot_udata(L, t, i + 1, sizeof(VulkanImageView), "VulkanImageView");
+          VkImageViewCreateInfo viewInfo = {
+              .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+              .image = images[i],
+              .viewType = VK_IMAGE_VIEW_TYPE_2D,
+              .format = createInfo.imageFormat,
+              .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+          };
+          viewptr->device = dptr->device;
+          viewptr->vkd = dptr->vkd;
+          result = vkd->vkCreateImageView(dptr->device, &viewInfo, NULL, &viewptr->imageView);
+          if (result != VK_SUCCESS) {
+              return push_vk_error(L, "vkCreateImageView", result);
+          }
+      }
+  }
+  lua_pop(L, 1);
+
+  lua_getfield(L, 5, "framebuffers");
+  if (lua_istable(L, -1)) {
+      int t = lua_gettop(L);
+      lua_getfield(L, 5, "renderPass");
+      VulkanRenderPass *rpptr = (VulkanRenderPass *)luaL_checkudata(L, -1, "VulkanRenderPass");
+      lua_pop(L, 1);
+      lua_getfield(L, 5, "imageViews");
+      luaL_checktype(L, -1, LUA_TTABLE); // Framebuffers are rebuilt from the new views
+      int views = lua_gettop(L);
+
+      for (int i = (int)lua_objlen(L, t); i > 0; i--) {
+          lua_rawgeti(L, t, i);
+          VulkanFramebuffer *fbptr = luaL_testudata(L, -1, "VulkanFramebuffer");
+          if (fbptr && fbptr->framebuffer) {
+              vkd->vkDestroyFramebuffer(dptr->device, fbptr->framebuffer, NULL);
+              fbptr->framebuffer = VK_NULL_HANDLE;
+          }
+          lua_pop(L, 1);
+          if (i > (int)imageCount) {
+              lua_pushnil(L);
+              lua_rawseti(L, t, i);
+          }
+      }
+      for (uint32_t i = 0; i < imageCount; i++) {
+          lua_rawgeti(L, views, i + 1);
+          VulkanImageView *viewptr = (VulkanImageView *)luaL_checkudata(L, -1, "VulkanImageView");
+          lua_pop(L, 1);
+
+          VulkanFramebuffer *fbptr = table_slot_udata(L, t, i + 1, sizeof(VulkanFramebuffer), "VulkanFramebuffer");
+          VkFramebufferCreateInfo fbInfo = {
+              .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO,
+              .renderPass = rpptr->renderPass,
+              .attachmentCount = 1,
+              .pAttachments = &viewptr->imageView,
+              .width = width,
+              .height = height,
+              .layers = 1
+          };
+          fbptr->device = dptr->device;
+          fbptr->vkd = dptr->vkd;
+          fbptr->width = width;
+          fbptr->height = height;
+          result = vkd->vkCreateFramebuffer(dptr->device, &fbInfo, NULL, &fbptr->framebuffer);
+          if (result != VK_SUCCESS) {
+              return push_vk_error(L, "vkCreateFramebuffer", result);
+          }
+      }
+      lua_pop(L, 1); // imageViews
+  }
+  lua_pop(L, 1);
+
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+
 static int l_vk_CreateImageView(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   luaL_checktype(L, 2, LUA_TTABLE);
 
   VkImageViewCreateInfo createInfo = { .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO };
@@ -545,14 +1177,16 @@ static int l_vk_CreateImageView(lua_State *L) {
   createInfo.components.b = VK_COMPONENT_SWIZZLE_IDENTITY;
   createInfo.components.a = VK_COMPONENT_SWIZZLE_IDENTITY;
 
-  createInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+  lua_getfield(L, 2, "aspectMask");
+  createInfo.subresourceRange.aspectMask = (VkImageAspectFlags)luaL_optinteger(L, -1, VK_IMAGE_ASPECT_COLOR_BIT);
+  lua_pop(L, 1);
   createInfo.subresourceRange.baseMipLevel = 0;
   createInfo.subresourceRange.levelCount = 1;
   createInfo.subresourceRange.baseArrayLayer = 0;
   createInfo.subresourceRange.layerCount = 1;
 
   VkImageView imageView;
-  VkResult result = vkCreateImageView(dptr->device, &createInfo, NULL, &imageView);
+  VkResult result = vkd->vkCreateImageView(dptr->device, &createInfo, NULL, &imageView);
   if (result != VK_SUCCESS) {
       char errMsg[64];
       snprintf(errMsg, sizeof(errMsg), "vkCreateImageView failed with result %d", result);
@@ -564,6 +1198,7 @@ static int l_vk_CreateImageView(lua_State *L) {
   VulkanImageView *viewptr = (VulkanImageView *)lua_newuserdata(L, sizeof(VulkanImageView));
   viewptr->imageView = imageView;
   viewptr->device = dptr->device;
+  viewptr->vkd = dptr->vkd;
   luaL_getmetatable(L, "VulkanImageView");
   lua_setmetatable(L, -2);
   return 1;
@@ -571,6 +1206,7 @@ static int l_vk_CreateImageView(lua_State *L) {
 
 static int l_vk_CreateRenderPass(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   luaL_checktype(L, 2, LUA_TTABLE);
 
   VkAttachmentDescription colorAttachment = {0};
@@ -582,8 +1218,12 @@ static int l_vk_CreateRenderPass(lua_State *L) {
   colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
   colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
   colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-  colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-  colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+  // Swapchain rendering by default; offscreen targets pass their own layouts
+  lua_getfield(L, 2, "initialLayout");
+  colorAttachment.initialLayout = (VkImageLayout)luaL_optinteger(L, -1, VK_IMAGE_LAYOUT_UNDEFINED);
+  lua_getfield(L, 2, "finalLayout");
+  colorAttachment.finalLayout = (VkImageLayout)luaL_optinteger(L, -1, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
+  lua_pop(L, 2);
 
   VkAttachmentReference colorAttachmentRef = {
       .attachment = 0,
@@ -604,7 +1244,7 @@ static int l_vk_CreateRenderPass(lua_State *L) {
   };
 
   VkRenderPass renderPass;
-  VkResult result = vkCreateRenderPass(dptr->device, &createInfo, NULL, &renderPass);
+  VkResult result = vkd->vkCreateRenderPass(dptr->device, &createInfo, NULL, &renderPass);
   if (result != VK_SUCCESS) {
       char errMsg[64];
       snprintf(errMsg, sizeof(errMsg), "vkCreateRenderPass failed with result %d", result);
@@ -616,13 +1256,16 @@ static int l_vk_CreateRenderPass(lua_State *L) {
   VulkanRenderPass *rpptr = (VulkanRenderPass *)lua_newuserdata(L, sizeof(VulkanRenderPass));
   rpptr->renderPass = renderPass;
   rpptr->device = dptr->device;
+  rpptr->vkd = dptr->vkd;
   luaL_getmetatable(L, "VulkanRenderPass");
   lua_setmetatable(L, -2);
   return 1;
 }
 
 static int l_vk_CreateFramebuffer(lua_State *L) {
+  scratch_begin();
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   luaL_checktype(L, 2, LUA_TTABLE);
 
   VkFramebufferCreateInfo createInfo = { .sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO };
@@ -636,7 +1279,7 @@ static int l_vk_CreateFramebuffer(lua_State *L) {
   lua_getfield(L, 2, "attachments");
   if (lua_istable(L, -1)) {
       attachmentCount = (uint32_t)lua_objlen(L, -1);
-      attachments = malloc(attachmentCount * sizeof(VkImageView));
+      attachments = check_scratch_alloc(L, attachmentCount * sizeof(VkImageView));
       for (uint32_t i = 0; i < attachmentCount; i++) {
           lua_rawgeti(L, -1, i + 1);
           VulkanImageView *viewptr = (VulkanImageView *)luaL_checkudata(L, -1, "VulkanImageView");
@@ -659,8 +1302,7 @@ static int l_vk_CreateFramebuffer(lua_State *L) {
   createInfo.layers = 1;
 
   VkFramebuffer framebuffer;
-  VkResult result = vkCreateFramebuffer(dptr->device, &createInfo, NULL, &framebuffer);
-  free(attachments);
+  VkResult result = vkd->vkCreateFramebuffer(dptr->device, &createInfo, NULL, &framebuffer);
 
   if (result != VK_SUCCESS) {
       char errMsg[64];
@@ -673,16 +1315,37 @@ static int l_vk_CreateFramebuffer(lua_State *L) {
   VulkanFramebuffer *fbptr = (VulkanFramebuffer *)lua_newuserdata(L, sizeof(VulkanFramebuffer));
   fbptr->framebuffer = framebuffer;
   fbptr->device = dptr->device;
+  fbptr->vkd = dptr->vkd;
+  fbptr->width = createInfo.width;
+  fbptr->height = createInfo.height;
   luaL_getmetatable(L, "VulkanFramebuffer");
   lua_setmetatable(L, -2);
   return 1;
 }
 
+static void push_shader_module(lua_State *L, VkDevice device, const VulkanDeviceDispatch *vkd, VkShaderModule shaderModule) {
+  VulkanShaderModule *smptr = (VulkanShaderModule *)lua_newuserdata(L, sizeof(VulkanShaderModule));
+  smptr->shaderModule = shaderModule;
+  smptr->device = device;
+  smptr->vkd = vkd;
+  luaL_getmetatable(L, "VulkanShaderModule");
+  lua_setmetatable(L, -2);
+}
+
 static int l_vk_CreateShaderModule(lua_State *L) {
+  scratch_begin();
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   size_t codeSize;
   const char *code = luaL_checklstring(L, 2, &codeSize);
 
+  // pCode must be 4-byte aligned, which Lua strings do not promise
+  if ((uintptr_t)code % sizeof(uint32_t) != 0) {
+      char *aligned = check_scratch_alloc(L, codeSize);
+      memcpy(aligned, code, codeSize);
+      code = aligned;
+  }
+
   VkShaderModuleCreateInfo createInfo = {
       .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
       .codeSize = codeSize,
@@ -690,7 +1353,7 @@ static int l_vk_CreateShaderModule(lua_State *L) {
   };
 
   VkShaderModule shaderModule;
-  VkResult result = vkCreateShaderModule(dptr->device, &createInfo, NULL, &shaderModule);
+  VkResult result = vkd->vkCreateShaderModule(dptr->device, &createInfo, NULL, &shaderModule);
   if (result != VK_SUCCESS) {
       char errMsg[64];
       snprintf(errMsg, sizeof(errMsg), "vkCreateShaderModule failed with result %d", result);
@@ -699,25 +1362,280 @@ static int l_vk_CreateShaderModule(lua_State *L) {
       return 2;
   }
 
-  VulkanShaderModule *smptr = (VulkanShaderModule *)lua_newuserdata(L, sizeof(VulkanShaderModule));
-  smptr->shaderModule = shaderModule;
-  smptr->device = dptr->device;
-  luaL_getmetatable(L, "VulkanShaderModule");
-  lua_setmetatable(L, -2);
+  push_shader_module(L, dptr->device, dptr->vkd, shaderModule);
   return 1;
 }
 
+// Read-only view of a whole file. Mappings start on a page boundary, so the
+// contents can be handed to Vulkan as uint32_t words without a copy.
+typedef struct {
+  const uint8_t *data;
+  size_t size;
+} MappedFile;
+
+static const char *map_file(const char *path, MappedFile *file) {
+  file->data = NULL;
+  file->size = 0;
+#if defined(_WIN32)
+  HANDLE handle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+  if (handle == INVALID_HANDLE_VALUE) {
+      return "cannot open file";
+  }
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(handle, &size) || size.QuadPart == 0) {
+      CloseHandle(handle);
+      return "empty file";
+  }
+  HANDLE mapping = CreateFileMappingA(handle, NULL, PAGE_READONLY, 0, 0, NULL);
+  CloseHandle(handle);
+  if (!mapping) {
+      return "cannot map file";
+  }
+  void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  CloseHandle(mapping); // The view keeps the mapping alive
+  if (!view) {
+      return "cannot map file";
+  }
+  file->data = (const uint8_t *)view;
+  file->size = (size_t)size.QuadPart;
+#else
+  int fd = open(path, O_RDONLY);
+  if (fd < 0) {
+      return "cannot open file";
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+      close(fd);
+      return "empty file";
+  }
+  void *view = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); // The mapping holds its own reference to the file
+  if (view == MAP_FAILED) {
+      return "cannot map file";
+  }
+  file->data = (const uint8_t *)view;
+  file->size = (size_t)st.st_size;
+#endif
+  return NULL;
+}
+
+static void unmap_file(MappedFile *file) {
+#if defined(_WIN32)
+  UnmapViewOfFile((void *)file->data);
+#else
+  munmap((void *)file->data, file->size);
+#endif
+  file->data = NULL;
+}
+
+// SHA-256 of the module, so equal digests can be taken for equal bytes
+// without keeping the bytes around
+static const uint32_t sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+#define SHA256_ROTR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static void sha256_block(uint32_t state[8], const uint8_t *block) {
+  uint32_t w[64];
+  for (int i = 0; i < 16; i++) {
+      w[i] = (uint32_t)block[4 * i] << 24 | (uint32_t)block[4 * i + 1] << 16 |
+          (uint32_t)block[4 * i + 2] << 8 | block[4 * i + 3];
+  }
+  for (int i = 16; i < 64; i++) {
+      uint32_t s0 = SHA256_ROTR(w[i - 15], 7) ^ SHA256_ROTR(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      uint32_t s1 = SHA256_ROTR(w[i - 2], 17) ^ SHA256_ROTR(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+  }
+  uint32_t a = state[0], b = state[1], c = state[2], d = state[3];
+  uint32_t e = state[4], f = state[5], g = state[6], h = state[7];
+  for (int i = 0; i < 64; i++) {
+      uint32_t t1 = h + (SHA256_ROTR(e, 6) ^ SHA256_ROTR(e, 11) ^ SHA256_ROTR(e, 25)) +
+          ((e & f) ^ (~e & g)) + sha256_k[i] + w[i];
+      uint32_t t2 = (SHA256_ROTR(a, 2) ^ SHA256_ROTR(a, 13) ^ SHA256_ROTR(a, 22)) +
+          ((a & b) ^ (a & c) ^ (b & c));
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+  }
+  state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+  state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+}
+
+// Writes the digest of data as 64 hex digits and a terminator
+static void sha256_hex(const uint8_t *data, size_t size, char out[65]) {
+  uint32_t state[8] = {
+      0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+  size_t done = 0;
+  for (; size - done >= 64; done += 64) {
+      sha256_block(state, data + done);
+  }
+  uint8_t tail[128] = {0};
+  size_t rest = size - done;
+  memcpy(tail, data + done, rest);
+  tail[rest] = 0x80;
+  size_t tailSize = rest < 56 ? 64 : 128;
+  uint64_t bits = (uint64_t)size * 8;
+  for (int i = 0; i < 8; i++) {
+      tail[tailSize - 1 - i] = (uint8_t)(bits >> (8 * i));
+  }
+  sha256_block(state, tail);
+  if (tailSize == 128) {
+      sha256_block(state, tail + 64);
+  }
+  for (int i = 0; i < 8; i++) {
+      snprintf(out + 8 * i, 9, "%08x", state[i]);
+  }
+}
+
+#define SPIRV_MAGIC 0x07230203u
+
+// vk_CreateShaderModuleFromFile(device, path) maps the file, checks that it
+// is SPIR-V, and returns module, cached. Modules are cached per device by
+// their contents: loading the same bytes again, from any path, returns the
+// same VulkanShaderModule (cached = true) for as long as Lua still references
+// it. The cache is keyed by the SHA-256 of the bytes; nothing of the file is
+// kept once the module is created.
+static int l_vk_CreateShaderModuleFromFile(lua_State *L) {
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
+  const char *path = luaL_checkstring(L, 2);
+
+  MappedFile file;
+  const char *error = map_file(path, &file);
+  if (error) {
+      lua_pushnil(L);
+      lua_pushfstring(L, "%s: %s", path, error);
+      return 2;
+  }
+  if (file.size % sizeof(uint32_t) != 0 || file.size < 5 * sizeof(uint32_t)) {
+      unmap_file(&file);
+      lua_pushnil(L);
+      lua_pushfstring(L, "%s: size is not a whole number of SPIR-V words", path);
+      return 2;
+  }
+  const uint32_t *words = (const uint32_t *)file.data;
+  if (words[0] != SPIRV_MAGIC) {
+      unmap_file(&file);
+      lua_pushnil(L);
+      lua_pushfstring(L, "%s: not a SPIR-V module (bad magic number)", path);
+      return 2;
+  }
+
+  char key[65];
+  sha256_hex(file.data, file.size, key);
+
+  // Weak-valued cache in the device's environment table
+  lua_getfenv(L, 1);
+  lua_getfield(L, -1, "shaderModules");
+  if (lua_isnil(L, -1)) {
+      lua_pop(L, 1);
+      lua_newtable(L);
+      lua_newtable(L);
+      lua_pushstring(L, "v");
+      lua_setfield(L, -2, "__mode");
+      lua_setmetatable(L, -2);
+      lua_pushvalue(L, -1);
+      lua_setfield(L, -3, "shaderModules");
+  }
+  int cache = lua_gettop(L);
+  lua_getfield(L, cache, key);
+  VulkanShaderModule *cached = (VulkanShaderModule *)lua_touserdata(L, -1);
+  if (cached && cached->shaderModule) {
+      unmap_file(&file);
+      lua_pushboolean(L, true);
+      return 2;
+  }
+  lua_pop(L, 1);
+
+  VkShaderModuleCreateInfo createInfo = {
+      .sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO,
+      .codeSize = file.size,
+      .pCode = words
+  };
+  VkShaderModule shaderModule;
+  VkResult result = vkd->vkCreateShaderModule(dptr->device, &createInfo, NULL, &shaderModule);
+  if (result != VK_SUCCESS) {
+      unmap_file(&file);
+      return push_vk_error(L, "vkCreateShaderModule", result);
+  }
+
+  unmap_file(&file);
+  push_shader_module(L, dptr->device, dptr->vkd, shaderModule);
+  lua_pushvalue(L, -1);
+  lua_setfield(L, cache, key);
+  lua_pushboolean(L, false);
+  return 2;
+}
+
+#define PIPELINE_LAYOUT_MAX_SETS 4
+#define PIPELINE_LAYOUT_MAX_PUSH_RANGES 4
+
+// vk_CreatePipelineLayout(device[, {setLayouts = {bindlessTable, ...},
+// pushConstantRanges = {{stageFlags, offset, size}, ...}}]); set i of the
+// layout is the descriptor set layout of setLayouts[i + 1]
 static int l_vk_CreatePipelineLayout(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
+  VkDescriptorSetLayout setLayouts[PIPELINE_LAYOUT_MAX_SETS];
+  VkPushConstantRange ranges[PIPELINE_LAYOUT_MAX_PUSH_RANGES];
+  uint32_t setLayoutCount = 0;
+  uint32_t rangeCount = 0;
+  if (!lua_isnoneornil(L, 2)) {
+      luaL_checktype(L, 2, LUA_TTABLE);
+      lua_getfield(L, 2, "setLayouts");
+      if (!lua_isnil(L, -1)) {
+          luaL_checktype(L, -1, LUA_TTABLE);
+          setLayoutCount = (uint32_t)lua_objlen(L, -1);
+          luaL_argcheck(L, setLayoutCount <= PIPELINE_LAYOUT_MAX_SETS, 2, "too many setLayouts");
+          for (uint32_t i = 0; i < setLayoutCount; i++) {
+              lua_rawgeti(L, -1, i + 1);
+              VulkanBindlessTable *table = (VulkanBindlessTable *)luaL_checkudata(L, -1, "VulkanBindlessTable");
+              luaL_argcheck(L, table->setLayout != VK_NULL_HANDLE, 2, "bindless table has been destroyed");
+              setLayouts[i] = table->setLayout;
+              lua_pop(L, 1);
+          }
+      }
+      lua_pop(L, 1);
+      lua_getfield(L, 2, "pushConstantRanges");
+      if (!lua_isnil(L, -1)) {
+          luaL_checktype(L, -1, LUA_TTABLE);
+          rangeCount = (uint32_t)lua_objlen(L, -1);
+          luaL_argcheck(L, rangeCount <= PIPELINE_LAYOUT_MAX_PUSH_RANGES, 2, "too many pushConstantRanges");
+          for (uint32_t i = 0; i < rangeCount; i++) {
+              lua_rawgeti(L, -1, i + 1);
+              luaL_checktype(L, -1, LUA_TTABLE);
+              lua_getfield(L, -1, "stageFlags");
+              ranges[i].stageFlags = (VkShaderStageFlags)luaL_optinteger(L, -1,
+                  VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT);
+              lua_getfield(L, -2, "offset");
+              ranges[i].offset = (uint32_t)luaL_optinteger(L, -1, 0);
+              lua_getfield(L, -3, "size");
+              ranges[i].size = (uint32_t)luaL_checkinteger(L, -1);
+              lua_pop(L, 4);
+          }
+      }
+      lua_pop(L, 1);
+  }
 
   VkPipelineLayoutCreateInfo createInfo = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
-      .setLayoutCount = 0,
-      .pSetLayouts = NULL
+      .setLayoutCount = setLayoutCount,
+      .pSetLayouts = setLayouts,
+      .pushConstantRangeCount = rangeCount,
+      .pPushConstantRanges = ranges
   };
 
   VkPipelineLayout pipelineLayout;
-  VkResult result = vkCreatePipelineLayout(dptr->device, &createInfo, NULL, &pipelineLayout);
+  VkResult result = vkd->vkCreatePipelineLayout(dptr->device, &createInfo, NULL, &pipelineLayout);
   if (result != VK_SUCCESS) {
       char errMsg[64];
       snprintf(errMsg, sizeof(errMsg), "vkCreatePipelineLayout failed with result %d", result);
@@ -729,68 +1647,333 @@ static int l_vk_CreatePipelineLayout(lua_State *L) {
   VulkanPipelineLayout *plptr = (VulkanPipelineLayout *)lua_newuserdata(L, sizeof(VulkanPipelineLayout));
   plptr->pipelineLayout = pipelineLayout;
   plptr->device = dptr->device;
+  plptr->vkd = dptr->vkd;
   luaL_getmetatable(L, "VulkanPipelineLayout");
   lua_setmetatable(L, -2);
   return 1;
 }
 
-static int l_vk_CreateGraphicsPipelines(lua_State *L) {
-  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
-  luaL_checktype(L, 2, LUA_TTABLE);
+// Pipeline cache files start with this header, followed by the data from
+// vkGetPipelineCacheData. The driver version is not part of Vulkan's own
+// cache header, so it is recorded here to drop caches from an older driver.
+#define PIPELINE_CACHE_MAGIC "VKLJPC01"
+
+typedef struct {
+  char magic[8];
+  uint32_t vendorID;
+  uint32_t deviceID;
+  uint32_t driverVersion;
+  uint8_t pipelineCacheUUID[VK_UUID_SIZE];
+  uint64_t dataSize;
+} PipelineCacheFileHeader;
+
+static void fill_pipeline_cache_header(PipelineCacheFileHeader *header, const VkPhysicalDeviceProperties *props) {
+  memset(header, 0, sizeof(*header));
+  memcpy(header->magic, PIPELINE_CACHE_MAGIC, sizeof(header->magic));
+  header->vendorID = props->vendorID;
+  header->deviceID = props->deviceID;
+  header->driverVersion = props->driverVersion;
+  memcpy(header->pipelineCacheUUID, props->pipelineCacheUUID, VK_UUID_SIZE);
+}
 
-  VkPipelineShaderStageCreateInfo shaderStages[2];
-  memset(shaderStages, 0, sizeof(shaderStages));
-  shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
-  shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+// Returns NULL if the file content can seed a cache on this device, otherwise why not
+static const char *check_pipeline_cache_data(const uint8_t *file, size_t size, const VkPhysicalDeviceProperties *props) {
+  PipelineCacheFileHeader expected, header;
+  if (size < sizeof(header)) {
+      return "file too short";
+  }
+  memcpy(&header, file, sizeof(header));
+  fill_pipeline_cache_header(&expected, props);
+  if (memcmp(header.magic, expected.magic, sizeof(header.magic)) != 0) {
+      return "not a pipeline cache file";
+  }
+  if (header.vendorID != expected.vendorID || header.deviceID != expected.deviceID) {
+      return "different device";
+  }
+  if (header.driverVersion != expected.driverVersion) {
+      return "different driver version";
+  }
+  if (memcmp(header.pipelineCacheUUID, expected.pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+      return "different pipeline cache UUID";
+  }
+  if (header.dataSize != size - sizeof(header)) {
+      return "truncated file";
+  }
 
-  lua_getfield(L, 2, "vertexShader");
-  VulkanShaderModule *vertShader = (VulkanShaderModule *)luaL_checkudata(L, -1, "VulkanShaderModule");
-  shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
-  shaderStages[0].module = vertShader->shaderModule;
-  shaderStages[0].pName = "main";
+  VkPipelineCacheHeaderVersionOne vkHeader;
+  if (header.dataSize < sizeof(vkHeader)) {
+      return "missing Vulkan cache header";
+  }
+  memcpy(&vkHeader, file + sizeof(header), sizeof(vkHeader));
+  if (vkHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+      vkHeader.vendorID != props->vendorID || vkHeader.deviceID != props->deviceID ||
+      memcmp(vkHeader.pipelineCacheUUID, props->pipelineCacheUUID, VK_UUID_SIZE) != 0) {
+      return "Vulkan cache header mismatch";
+  }
+  return NULL;
+}
+
+// vk_CreatePipelineCache(device[, path]) seeds the cache from path when the
+// file matches this device and driver. Returns cache, loadedBytes and, for a
+// cold start, the reason the file was not used.
+static int l_vk_CreatePipelineCache(lua_State *L) {
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
+  const char *path = luaL_optstring(L, 2, NULL);
+
+  VkPhysicalDeviceProperties props;
+  dptr->vki->vkGetPhysicalDeviceProperties(dptr->physicalDevice, &props);
+
+  uint8_t *file = NULL;
+  size_t fileSize = 0;
+  const char *rejected = path ? NULL : "no path";
+  FILE *fp = path ? fopen(path, "rb") : NULL;
+  if (fp) {
+      fseek(fp, 0, SEEK_END);
+      long end = ftell(fp);
+      fseek(fp, 0, SEEK_SET);
+      file = end > 0 ? heap_alloc((size_t)end) : NULL;
+      if (file && fread(file, 1, (size_t)end, fp) == (size_t)end) {
+          fileSize = (size_t)end;
+          rejected = check_pipeline_cache_data(file, fileSize, &props);
+      } else {
+          rejected = "unreadable file";
+      }
+      fclose(fp);
+  } else if (path) {
+      rejected = "no cache file";
+  }
+
+  VkPipelineCacheCreateInfo cacheInfo = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+      .initialDataSize = rejected ? 0 : fileSize - sizeof(PipelineCacheFileHeader),
+      .pInitialData = rejected ? NULL : file + sizeof(PipelineCacheFileHeader)
+  };
+  VkPipelineCache cache;
+  VkResult result = vkd->vkCreatePipelineCache(dptr->device, &cacheInfo, NULL, &cache);
+  free(file);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkCreatePipelineCache", result);
+  }
+
+  VulkanPipelineCache *pcptr = (VulkanPipelineCache *)lua_newuserdata(L, sizeof(VulkanPipelineCache));
+  pcptr->pipelineCache = cache;
+  pcptr->device = dptr->device;
+  pcptr->vkd = dptr->vkd;
+  luaL_getmetatable(L, "VulkanPipelineCache");
+  lua_setmetatable(L, -2);
+  lua_pushinteger(L, (lua_Integer)cacheInfo.initialDataSize);
+  if (rejected) {
+      lua_pushstring(L, rejected);
+      return 3;
+  }
+  return 2;
+}
+
+// vk_SavePipelineCache(device, cache, path) writes to a temporary file and
+// renames it over path, so a crash mid-write never leaves a torn cache
+static int l_vk_SavePipelineCache(lua_State *L) {
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
+  VulkanPipelineCache *pcptr = (VulkanPipelineCache *)luaL_checkudata(L, 2, "VulkanPipelineCache");
+  const char *path = luaL_checkstring(L, 3);
+
+  size_t dataSize = 0;
+  VkResult result = vkd->vkGetPipelineCacheData(dptr->device, pcptr->pipelineCache, &dataSize, NULL);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkGetPipelineCacheData", result);
+  }
+  uint8_t *data = heap_alloc(sizeof(PipelineCacheFileHeader) + dataSize);
+  if (!data) {
+      return push_vk_error(L, "vk_SavePipelineCache", VK_ERROR_OUT_OF_HOST_MEMORY);
+  }
+  result = vkd->vkGetPipelineCacheData(dptr->device, pcptr->pipelineCache, &dataSize, data + sizeof(PipelineCacheFileHeader));
+  if (result != VK_SUCCESS) {
+      free(data);
+      return push_vk_error(L, "vkGetPipelineCacheData", result);
+  }
+  VkPhysicalDeviceProperties props;
+  dptr->vki->vkGetPhysicalDeviceProperties(dptr->physicalDevice, &props);
+  PipelineCacheFileHeader header;
+  fill_pipeline_cache_header(&header, &props);
+  header.dataSize = dataSize;
+  memcpy(data, &header, sizeof(header));
+
+  lua_pushfstring(L, "%s.tmp", path);
+  const char *tmpPath = lua_tostring(L, -1);
+  size_t total = sizeof(header) + dataSize;
+  FILE *fp = fopen(tmpPath, "wb");
+  int ok = fp && fwrite(data, 1, total, fp) == total;
+  if (fp && fclose(fp) != 0) {
+      ok = 0;
+  }
+  free(data);
+  if (!ok || !SDL_RenamePath(tmpPath, path)) {
+      remove(tmpPath);
+      lua_pushnil(L);
+      lua_pushfstring(L, "Failed to write pipeline cache to %s", path);
+      return 2;
+  }
+  lua_pushinteger(L, (lua_Integer)total);
+  return 1;
+}
+
+static int l_vk_DestroyPipelineCache(lua_State *L) {
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
+  VulkanPipelineCache *pcptr = (VulkanPipelineCache *)luaL_checkudata(L, 2, "VulkanPipelineCache");
+  if (pcptr->pipelineCache) {
+      vkd->vkDestroyPipelineCache(dptr->device, pcptr->pipelineCache, NULL);
+      pcptr->pipelineCache = VK_NULL_HANDLE;
+  }
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// vertexBindings = {{binding, stride, inputRate}, ...} and vertexAttributes =
+// {{location, binding, format, offset}, ...}; binding and location default to
+// the entry's position, inputRate to per-vertex, binding/offset to 0
+static void check_vertex_input(lua_State *L, int idx, VulkanGraphicsPipelineDesc *desc) {
+  lua_getfield(L, idx, "vertexBindings");
+  if (!lua_isnil(L, -1)) {
+      luaL_checktype(L, -1, LUA_TTABLE);
+      desc->vertexBindingCount = (uint32_t)lua_objlen(L, -1);
+      if (desc->vertexBindingCount > VULKAN_MAX_VERTEX_BINDINGS) {
+          luaL_error(L, "At most %d vertex bindings are supported", VULKAN_MAX_VERTEX_BINDINGS);
+      }
+      for (uint32_t i = 0; i < desc->vertexBindingCount; i++) {
+          VkVertexInputBindingDescription *binding = &desc->vertexBindings[i];
+          lua_rawgeti(L, -1, i + 1);
+          luaL_checktype(L, -1, LUA_TTABLE);
+          lua_getfield(L, -1, "binding");
+          binding->binding = (uint32_t)luaL_optinteger(L, -1, i);
+          lua_getfield(L, -2, "stride");
+          binding->stride = (uint32_t)luaL_checkinteger(L, -1);
+          lua_getfield(L, -3, "inputRate");
+          binding->inputRate = (VkVertexInputRate)luaL_optinteger(L, -1, VK_VERTEX_INPUT_RATE_VERTEX);
+          lua_pop(L, 4);
+      }
+  }
+  lua_pop(L, 1);
+
+  lua_getfield(L, idx, "vertexAttributes");
+  if (!lua_isnil(L, -1)) {
+      luaL_checktype(L, -1, LUA_TTABLE);
+      desc->vertexAttributeCount = (uint32_t)lua_objlen(L, -1);
+      if (desc->vertexAttributeCount > VULKAN_MAX_VERTEX_ATTRIBUTES) {
+          luaL_error(L, "At most %d vertex attributes are supported", VULKAN_MAX_VERTEX_ATTRIBUTES);
+      }
+      for (uint32_t i = 0; i < desc->vertexAttributeCount; i++) {
+          VkVertexInputAttributeDescription *attribute = &desc->vertexAttributes[i];
+          lua_rawgeti(L, -1, i + 1);
+          luaL_checktype(L, -1, LUA_TTABLE);
+          lua_getfield(L, -1, "location");
+          attribute->location = (uint32_t)luaL_optinteger(L, -1, i);
+          lua_getfield(L, -2, "binding");
+          attribute->binding = (uint32_t)luaL_optinteger(L, -1, 0);
+          lua_getfield(L, -3, "format");
+          attribute->format = (VkFormat)luaL_checkinteger(L, -1);
+          lua_getfield(L, -4, "offset");
+          attribute->offset = (uint32_t)luaL_optinteger(L, -1, 0);
+          lua_pop(L, 5);
+      }
+  }
+  lua_pop(L, 1);
+
+  lua_getfield(L, idx, "topology");
+  desc->topology = (VkPrimitiveTopology)luaL_optinteger(L, -1, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+  lua_pop(L, 1);
+}
+
+// Reads a pipeline description table (vertexShader, fragmentShader,
+// pipelineLayout, renderPass, optional pipelineCache, vertex input and
+// topology). Only handles are kept, so the description can be compiled off
+// the Lua thread.
+static void check_graphics_pipeline_desc(lua_State *L, int idx, VulkanGraphicsPipelineDesc *desc) {
+  if (idx < 0) {
+      idx = lua_gettop(L) + idx + 1; // Fields are pushed while reading
+  }
+  luaL_checktype(L, idx, LUA_TTABLE);
+  memset(desc, 0, sizeof(*desc));
+
+  lua_getfield(L, idx, "vertexShader");
+  desc->vertexShader = ((VulkanShaderModule *)luaL_checkudata(L, -1, "VulkanShaderModule"))->shaderModule;
+  lua_getfield(L, idx, "fragmentShader");
+  desc->fragmentShader = ((VulkanShaderModule *)luaL_checkudata(L, -1, "VulkanShaderModule"))->shaderModule;
+  lua_getfield(L, idx, "pipelineLayout");
+  desc->pipelineLayout = ((VulkanPipelineLayout *)luaL_checkudata(L, -1, "VulkanPipelineLayout"))->pipelineLayout;
+  lua_getfield(L, idx, "pipelineCache");
+  desc->pipelineCache = lua_isnil(L, -1) ? VK_NULL_HANDLE
+      : ((VulkanPipelineCache *)luaL_checkudata(L, -1, "VulkanPipelineCache"))->pipelineCache;
+  lua_pop(L, 4);
+  check_vertex_input(L, idx, desc);
+
+  // Either a render pass, or the attachment formats for dynamic rendering
+  lua_getfield(L, idx, "renderPass");
+  if (!lua_isnil(L, -1)) {
+      desc->renderPass = ((VulkanRenderPass *)luaL_checkudata(L, -1, "VulkanRenderPass"))->renderPass;
+      lua_pop(L, 1);
+      return;
+  }
   lua_pop(L, 1);
+  lua_getfield(L, idx, "colorFormats");
+  if (!lua_istable(L, -1)) {
+      luaL_error(L, "Pipeline description needs renderPass or colorFormats");
+  }
+  desc->colorFormatCount = (uint32_t)lua_objlen(L, -1);
+  if (desc->colorFormatCount > VULKAN_MAX_COLOR_ATTACHMENTS) {
+      luaL_error(L, "At most %d color formats are supported", VULKAN_MAX_COLOR_ATTACHMENTS);
+  }
+  for (uint32_t i = 0; i < desc->colorFormatCount; i++) {
+      lua_rawgeti(L, -1, i + 1);
+      desc->colorFormats[i] = (VkFormat)luaL_checkinteger(L, -1);
+      lua_pop(L, 1);
+  }
+  lua_getfield(L, idx, "depthFormat");
+  desc->depthFormat = (VkFormat)luaL_optinteger(L, -1, VK_FORMAT_UNDEFINED);
+  lua_pop(L, 2);
+}
 
-  lua_getfield(L, 2, "fragmentShader");
-  VulkanShaderModule *fragShader = (VulkanShaderModule *)luaL_checkudata(L, -1, "VulkanShaderModule");
+// Touches no Lua state, so it is safe to call from compiler worker threads
+static VkResult build_graphics_pipeline(const VulkanDeviceDispatch *vkd, VkDevice device, const VulkanGraphicsPipelineDesc *desc, VkPipeline *pipeline) {
+  VkPipelineShaderStageCreateInfo shaderStages[2];
+  memset(shaderStages, 0, sizeof(shaderStages));
+  shaderStages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+  shaderStages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+  shaderStages[0].module = desc->vertexShader;
+  shaderStages[0].pName = "main";
+  shaderStages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
   shaderStages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
-  shaderStages[1].module = fragShader->shaderModule;
+  shaderStages[1].module = desc->fragmentShader;
   shaderStages[1].pName = "main";
-  lua_pop(L, 1);
 
   VkPipelineVertexInputStateCreateInfo vertexInputInfo = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
-      .vertexBindingDescriptionCount = 0,
-      .pVertexBindingDescriptions = NULL,
-      .vertexAttributeDescriptionCount = 0,
-      .pVertexAttributeDescriptions = NULL
+      .vertexBindingDescriptionCount = desc->vertexBindingCount,
+      .pVertexBindingDescriptions = desc->vertexBindings,
+      .vertexAttributeDescriptionCount = desc->vertexAttributeCount,
+      .pVertexAttributeDescriptions = desc->vertexAttributes
   };
 
   VkPipelineInputAssemblyStateCreateInfo inputAssembly = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
-      .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST,
+      .topology = desc->topology,
       .primitiveRestartEnable = VK_FALSE
   };
 
-  VkViewport viewport = {
-      .x = 0.0f,
-      .y = 0.0f,
-      .width = 800.0f,
-      .height = 600.0f,
-      .minDepth = 0.0f,
-      .maxDepth = 1.0f
-  };
-
-  VkRect2D scissor = {
-      .offset = {0, 0},
-      .extent = {800, 600}
-  };
-
+  // Viewport and scissor are dynamic (vk_CmdSetViewport/vk_CmdSetScissor), so
+  // pipelines survive swapchain resizes
   VkPipelineViewportStateCreateInfo viewportState = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
       .viewportCount = 1,
-      .pViewports = &viewport,
-      .scissorCount = 1,
-      .pScissors = &scissor
+      .scissorCount = 1
+  };
+
+  VkDynamicState dynamicStates[] = { VK_DYNAMIC_STATE_VIEWPORT, VK_DYNAMIC_STATE_SCISSOR };
+  VkPipelineDynamicStateCreateInfo dynamicState = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+      .dynamicStateCount = 2,
+      .pDynamicStates = dynamicStates
   };
 
   VkPipelineRasterizationStateCreateInfo rasterizer = {
@@ -810,28 +1993,41 @@ static int l_vk_CreateGraphicsPipelines(lua_State *L) {
       .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
   };
 
-  VkPipelineColorBlendAttachmentState colorBlendAttachment = {
-      .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
-      .blendEnable = VK_FALSE
-  };
+  // One blend state per color attachment; a render pass here always has one
+  uint32_t colorAttachmentCount = desc->renderPass ? 1 : desc->colorFormatCount;
+  VkPipelineColorBlendAttachmentState colorBlendAttachments[VULKAN_MAX_COLOR_ATTACHMENTS];
+  for (uint32_t i = 0; i < colorAttachmentCount; i++) {
+      colorBlendAttachments[i] = (VkPipelineColorBlendAttachmentState){
+          .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT,
+          .blendEnable = VK_FALSE
+      };
+  }
 
   VkPipelineColorBlendStateCreateInfo colorBlending = {
       .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
       .logicOpEnable = VK_FALSE,
-      .attachmentCount = 1,
-      .pAttachments = &colorBlendAttachment
+      .attachmentCount = colorAttachmentCount,
+      .pAttachments = colorBlendAttachments
   };
 
-  lua_getfield(L, 2, "pipelineLayout");
-  VulkanPipelineLayout *plptr = (VulkanPipelineLayout *)luaL_checkudata(L, -1, "VulkanPipelineLayout");
-  lua_pop(L, 1);
+  VkPipelineDepthStencilStateCreateInfo depthStencil = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_DEPTH_STENCIL_STATE_CREATE_INFO,
+      .depthTestEnable = VK_TRUE,
+      .depthWriteEnable = VK_TRUE,
+      .depthCompareOp = VK_COMPARE_OP_LESS
+  };
 
-  lua_getfield(L, 2, "renderPass");
-  VulkanRenderPass *rpptr = (VulkanRenderPass *)luaL_checkudata(L, -1, "VulkanRenderPass");
-  lua_pop(L, 1);
+  // Dynamic rendering: attachment formats replace the render pass
+  VkPipelineRenderingCreateInfo renderingInfo = {
+      .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+      .colorAttachmentCount = desc->colorFormatCount,
+      .pColorAttachmentFormats = desc->colorFormats,
+      .depthAttachmentFormat = desc->depthFormat
+  };
 
   VkGraphicsPipelineCreateInfo pipelineInfo = {
       .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+      .pNext = desc->renderPass ? NULL : &renderingInfo,
       .stageCount = 2,
       .pStages = shaderStages,
       .pVertexInputState = &vertexInputInfo,
@@ -839,14 +2035,36 @@ static int l_vk_CreateGraphicsPipelines(lua_State *L) {
       .pViewportState = &viewportState,
       .pRasterizationState = &rasterizer,
       .pMultisampleState = &multisampling,
+      .pDepthStencilState = desc->depthFormat != VK_FORMAT_UNDEFINED ? &depthStencil : NULL,
       .pColorBlendState = &colorBlending,
-      .layout = plptr->pipelineLayout,
-      .renderPass = rpptr->renderPass,
+      .pDynamicState = &dynamicState,
+      .layout = desc->pipelineLayout,
+      .renderPass = desc->renderPass,
       .subpass = 0
   };
+  return vkd->vkCreateGraphicsPipelines(device, desc->pipelineCache, 1, &pipelineInfo, NULL, pipeline);
+}
+
+static void push_pipeline(lua_State *L, VkDevice device, const VulkanDeviceDispatch *vkd, VkPipeline pipeline) {
+  VulkanPipeline *pptr = (VulkanPipeline *)lua_newuserdata(L, sizeof(VulkanPipeline));
+  pptr->pipeline = pipeline;
+  pptr->device = device;
+  pptr->vkd = vkd;
+  luaL_getmetatable(L, "VulkanPipeline");
+  lua_setmetatable(L, -2);
+}
+
+// The optional pipelineCache field takes a cache from vk_CreatePipelineCache.
+// Returns the pipeline and the milliseconds spent creating it.
+static int l_vk_CreateGraphicsPipelines(lua_State *L) {
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  VulkanGraphicsPipelineDesc desc;
+  check_graphics_pipeline_desc(L, 2, &desc);
 
   VkPipeline graphicsPipeline;
-  VkResult result = vkCreateGraphicsPipelines(dptr->device, VK_NULL_HANDLE, 1, &pipelineInfo, NULL, &graphicsPipeline);
+  uint64_t start = SDL_GetPerformanceCounter();
+  VkResult result = build_graphics_pipeline(dptr->vkd, dptr->device, &desc, &graphicsPipeline);
+  uint64_t end = SDL_GetPerformanceCounter();
   if (result != VK_SUCCESS) {
       char errMsg[64];
       snprintf(errMsg, sizeof(errMsg), "vkCreateGraphicsPipelines failed with result %d", result);
@@ -855,23 +2073,300 @@ static int l_vk_CreateGraphicsPipelines(lua_State *L) {
       return 2;
   }
 
-  VulkanPipeline *pptr = (VulkanPipeline *)lua_newuserdata(L, sizeof(VulkanPipeline));
-  pptr->pipeline = graphicsPipeline;
-  pptr->device = dptr->device;
-  luaL_getmetatable(L, "VulkanPipeline");
+  push_pipeline(L, dptr->device, dptr->vkd, graphicsPipeline);
+  lua_pushnumber(L, (double)(end - start) * 1000.0 / (double)SDL_GetPerformanceFrequency());
+  return 2;
+}
+
+// Pipeline compiler: a pool of SDL worker threads draining a queue of
+// pipeline descriptions. vkCreateGraphicsPipelines may be called from any
+// thread, and pipeline caches are internally synchronized. Lua gets one
+// future per description and polls or waits on it.
+static void release_pipeline_job_locked(VulkanPipelineJob *job) {
+  const VulkanDeviceDispatch *vkd = job->vkd;
+  if (--job->refs == 0) {
+      if (job->result == VK_SUCCESS && !job->taken) {
+          vkd->vkDestroyPipeline(job->device, job->pipeline, NULL); // Future collected unclaimed
+      }
+      free(job);
+  }
+}
+
+static int pipeline_compiler_worker(void *data) {
+  VulkanPipelineCompiler *compiler = (VulkanPipelineCompiler *)data;
+  SDL_LockMutex(compiler->mutex);
+  for (;;) {
+      while (!compiler->head && !compiler->shutdown) {
+          SDL_WaitCondition(compiler->workAvailable, compiler->mutex);
+      }
+      VulkanPipelineJob *job = compiler->head;
+      if (!job) {
+          break; // Shut down with the queue drained
+      }
+      compiler->head = job->next;
+      if (!compiler->head) {
+          compiler->tail = NULL;
+      }
+      job->started = 1;
+      SDL_UnlockMutex(compiler->mutex);
+
+      uint64_t start = SDL_GetPerformanceCounter();
+      VkResult result = build_graphics_pipeline(job->vkd, job->device, &job->desc, &job->pipeline);
+      uint64_t end = SDL_GetPerformanceCounter();
+      double ms = (double)(end - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+
+      SDL_LockMutex(compiler->mutex);
+      job->result = result;
+      job->ms = ms;
+      job->done = 1;
+      release_pipeline_job_locked(job);
+      SDL_BroadcastCondition(compiler->jobDone);
+  }
+  SDL_UnlockMutex(compiler->mutex);
+  return 0;
+}
+
+// Finishes the queued jobs and joins the workers; futures stay valid
+static void stop_pipeline_compiler(VulkanPipelineCompiler *compiler) {
+  SDL_LockMutex(compiler->mutex);
+  compiler->shutdown = 1;
+  SDL_BroadcastCondition(compiler->workAvailable);
+  SDL_UnlockMutex(compiler->mutex);
+  for (int i = 0; i < compiler->threadCount; i++) {
+      SDL_WaitThread(compiler->threads[i], NULL);
+  }
+  compiler->threadCount = 0;
+}
+
+// The owning handle and every future hold a reference
+static void pipeline_compiler_unref(VulkanPipelineCompiler *compiler) {
+  if (--compiler->refs == 0) {
+      stop_pipeline_compiler(compiler);
+      SDL_DestroyCondition(compiler->jobDone);
+      SDL_DestroyCondition(compiler->workAvailable);
+      SDL_DestroyMutex(compiler->mutex);
+      free(compiler);
+  }
+}
+
+// vk_CreatePipelineCompiler(device[, threadCount]); threadCount defaults to
+// one less than the number of logical cores
+static int l_vk_CreatePipelineCompiler(lua_State *L) {
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  int threadCount = (int)luaL_optinteger(L, 2, SDL_GetNumLogicalCPUCores() - 1);
+  if (threadCount < 1) threadCount = 1;
+  if (threadCount > VULKAN_PIPELINE_COMPILER_MAX_THREADS) threadCount = VULKAN_PIPELINE_COMPILER_MAX_THREADS;
+
+  VulkanPipelineCompiler *compiler = heap_alloc(sizeof(VulkanPipelineCompiler));
+  if (!compiler) {
+      return push_vk_error(L, "vk_CreatePipelineCompiler", VK_ERROR_OUT_OF_HOST_MEMORY);
+  }
+  memset(compiler, 0, sizeof(*compiler));
+  compiler->device = dptr->device;
+  compiler->vkd = dptr->vkd;
+  compiler->refs = 1;
+  compiler->mutex = SDL_CreateMutex();
+  compiler->workAvailable = SDL_CreateCondition();
+  compiler->jobDone = SDL_CreateCondition();
+  if (!compiler->mutex || !compiler->workAvailable || !compiler->jobDone) {
+      pipeline_compiler_unref(compiler);
+      lua_pushnil(L);
+      lua_pushstring(L, SDL_GetError());
+      return 2;
+  }
+  for (int i = 0; i < threadCount; i++) {
+      SDL_Thread *thread = SDL_CreateThread(pipeline_compiler_worker, "vk_pipeline_compiler", compiler);
+      if (!thread) {
+          break;
+      }
+      compiler->threads[compiler->threadCount++] = thread;
+  }
+  if (compiler->threadCount == 0) {
+      pipeline_compiler_unref(compiler);
+      lua_pushnil(L);
+      lua_pushstring(L, SDL_GetError());
+      return 2;
+  }
+
+  VulkanPipelineCompilerHandle *handle =
+      (VulkanPipelineCompilerHandle *)lua_newuserdata(L, sizeof(VulkanPipelineCompilerHandle));
+  handle->compiler = compiler;
+  luaL_getmetatable(L, "VulkanPipelineCompiler");
   lua_setmetatable(L, -2);
+  lua_pushinteger(L, compiler->threadCount);
+  return 2;
+}
+
+static int l_vk_DestroyPipelineCompiler(lua_State *L) {
+  VulkanPipelineCompilerHandle *handle =
+      (VulkanPipelineCompilerHandle *)luaL_checkudata(L, 1, "VulkanPipelineCompiler");
+  if (handle->compiler) {
+      stop_pipeline_compiler(handle->compiler);
+      pipeline_compiler_unref(handle->compiler);
+      handle->compiler = NULL;
+  }
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// vk_CompileGraphicsPipelines(compiler, {desc, ...}) queues every description
+// (same fields as vk_CreateGraphicsPipelines) and returns a future for each
+static int l_vk_CompileGraphicsPipelines(lua_State *L) {
+  VulkanPipelineCompilerHandle *handle =
+      (VulkanPipelineCompilerHandle *)luaL_checkudata(L, 1, "VulkanPipelineCompiler");
+  VulkanPipelineCompiler *compiler = handle->compiler;
+  if (!compiler) {
+      return luaL_error(L, "Pipeline compiler has been destroyed");
+  }
+  luaL_checktype(L, 2, LUA_TTABLE);
+  int count = (int)lua_objlen(L, 2);
+
+  // Descriptions are validated before anything is queued, so a bad entry
+  // raises without leaving half a batch in flight
+  lua_newtable(L);
+  int futures = lua_gettop(L);
+  for (int i = 1; i <= count; i++) {
+      lua_rawgeti(L, 2, i);
+      int descIdx = lua_gettop(L);
+      VulkanGraphicsPipelineDesc desc;
+      check_graphics_pipeline_desc(L, descIdx, &desc);
+
+      VulkanPipelineFuture *future = (VulkanPipelineFuture *)lua_newuserdata(L, sizeof(VulkanPipelineFuture));
+      memset(future, 0, sizeof(*future));
+      future->descRef = LUA_NOREF;
+      luaL_getmetatable(L, "VulkanPipelineFuture");
+      lua_setmetatable(L, -2);
+      lua_newtable(L); // Environment: the pipeline once taken
+      lua_setfenv(L, -2);
+      // A copy of the description keeps its shaders and layout alive until
+      // the job is done; it is held in the registry, not by the future, so it
+      // outlives a future collected while a worker still reads the handles
+      lua_newtable(L);
+      lua_pushnil(L);
+      while (lua_next(L, descIdx)) {
+          lua_pushvalue(L, -2);
+          lua_insert(L, -2);
+          lua_rawset(L, -4);
+      }
+      future->descRef = luaL_ref(L, LUA_REGISTRYINDEX);
+
+      VulkanPipelineJob *job = heap_alloc(sizeof(VulkanPipelineJob));
+      if (!job) {
+          return luaL_error(L, "Out of memory queueing pipeline %d", i);
+      }
+      memset(job, 0, sizeof(*job));
+      job->device = compiler->device;
+      job->vkd = compiler->vkd;
+      job->desc = desc;
+      job->refs = 1; // The future's; the queue's is added when the batch is queued
+      future->job = job;
+      lua_rawseti(L, futures, i);
+      lua_pop(L, 1);
+  }
+
+  SDL_LockMutex(compiler->mutex);
+  for (int i = 1; i <= count; i++) {
+      lua_rawgeti(L, futures, i);
+      VulkanPipelineFuture *future = (VulkanPipelineFuture *)lua_touserdata(L, -1);
+      lua_pop(L, 1);
+      VulkanPipelineJob *job = future->job;
+      job->refs++;
+      if (compiler->tail) {
+          compiler->tail->next = job;
+      } else {
+          compiler->head = job;
+      }
+      compiler->tail = job;
+      future->compiler = compiler;
+      compiler->refs++;
+  }
+  SDL_BroadcastCondition(compiler->workAvailable);
+  SDL_UnlockMutex(compiler->mutex);
+  return 1;
+}
+
+// Drops the description once the job no longer reads it; Lua thread only
+static void release_pipeline_desc(lua_State *L, VulkanPipelineFuture *future) {
+  luaL_unref(L, LUA_REGISTRYINDEX, future->descRef);
+  future->descRef = LUA_NOREF;
+}
+
+static VulkanPipelineFuture *check_pipeline_future(lua_State *L, int idx) {
+  VulkanPipelineFuture *future = (VulkanPipelineFuture *)luaL_checkudata(L, idx, "VulkanPipelineFuture");
+  if (!future->job) {
+      luaL_error(L, "Pipeline future has been released");
+  }
+  return future;
+}
+
+static int l_vk_PipelineFutureReady(lua_State *L) {
+  VulkanPipelineFuture *future = check_pipeline_future(L, 1);
+  VulkanPipelineCompiler *compiler = future->compiler;
+  int done = 1;
+  if (compiler) {
+      SDL_LockMutex(compiler->mutex);
+      done = future->job->done;
+      SDL_UnlockMutex(compiler->mutex);
+  }
+  if (done) {
+      release_pipeline_desc(L, future);
+  }
+  lua_pushboolean(L, done);
   return 1;
 }
 
+// vk_PipelineFutureWait(future) blocks until the pipeline is compiled and
+// returns pipeline, ms (compile time on the worker) or nil, errMsg, result.
+// Later calls return the same pipeline.
+static int l_vk_PipelineFutureWait(lua_State *L) {
+  VulkanPipelineFuture *future = check_pipeline_future(L, 1);
+  VulkanPipelineJob *job = future->job;
+  VulkanPipelineCompiler *compiler = future->compiler;
+  if (compiler) {
+      SDL_LockMutex(compiler->mutex);
+      while (!job->done) {
+          SDL_WaitCondition(compiler->jobDone, compiler->mutex);
+      }
+      SDL_UnlockMutex(compiler->mutex);
+  }
+  release_pipeline_desc(L, future);
+  if (job->result != VK_SUCCESS) {
+      return push_vk_error(L, "vkCreateGraphicsPipelines", job->result);
+  }
+
+  lua_getfenv(L, 1);
+  lua_getfield(L, -1, "pipeline");
+  if (lua_isnil(L, -1)) {
+      lua_pop(L, 1);
+      push_pipeline(L, job->device, job->vkd, job->pipeline);
+      job->taken = 1;
+      lua_pushvalue(L, -1);
+      lua_setfield(L, -3, "pipeline");
+  }
+  lua_pushnumber(L, job->ms);
+  return 2;
+}
+
+static void push_semaphore(lua_State *L, VkDevice device, const VulkanDeviceDispatch *vkd, VkSemaphore semaphore, int timeline) {
+  VulkanSemaphore *sptr = (VulkanSemaphore *)lua_newuserdata(L, sizeof(VulkanSemaphore));
+  sptr->semaphore = semaphore;
+  sptr->device = device;
+  sptr->vkd = vkd;
+  sptr->timeline = timeline;
+  luaL_getmetatable(L, "VulkanSemaphore");
+  lua_setmetatable(L, -2);
+}
+
 static int l_vk_CreateSemaphore(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
 
   VkSemaphoreCreateInfo createInfo = {
       .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO
   };
 
   VkSemaphore semaphore;
-  VkResult result = vkCreateSemaphore(dptr->device, &createInfo, NULL, &semaphore);
+  VkResult result = vkd->vkCreateSemaphore(dptr->device, &createInfo, NULL, &semaphore);
   if (result != VK_SUCCESS) {
       char errMsg[64];
       snprintf(errMsg, sizeof(errMsg), "vkCreateSemaphore failed with result %d", result);
@@ -880,16 +2375,127 @@ static int l_vk_CreateSemaphore(lua_State *L) {
       return 2;
   }
 
-  VulkanSemaphore *sptr = (VulkanSemaphore *)lua_newuserdata(L, sizeof(VulkanSemaphore));
-  sptr->semaphore = semaphore;
-  sptr->device = dptr->device;
-  luaL_getmetatable(L, "VulkanSemaphore");
-  lua_setmetatable(L, -2);
+  push_semaphore(L, dptr->device, dptr->vkd, semaphore, 0);
+  return 1;
+}
+
+// vk_CreateTimelineSemaphore(device[, initialValue]). The device needs
+// timelineSemaphore = true in vk_CreateDevice.
+static int l_vk_CreateTimelineSemaphore(lua_State *L) {
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
+  VkSemaphoreTypeCreateInfo typeInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+      .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+      .initialValue = (uint64_t)luaL_optinteger(L, 2, 0)
+  };
+  VkSemaphoreCreateInfo createInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+      .pNext = &typeInfo
+  };
+
+  VkSemaphore semaphore;
+  VkResult result = vkd->vkCreateSemaphore(dptr->device, &createInfo, NULL, &semaphore);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkCreateSemaphore", result);
+  }
+  push_semaphore(L, dptr->device, dptr->vkd, semaphore, 1);
+  return 1;
+}
+
+static VulkanSemaphore *check_timeline_semaphore(lua_State *L, int idx) {
+  VulkanSemaphore *sptr = (VulkanSemaphore *)luaL_checkudata(L, idx, "VulkanSemaphore");
+  if (!sptr->timeline) {
+      luaL_argerror(L, idx, "timeline semaphore expected");
+  }
+  return sptr;
+}
+
+// vk_GetSemaphoreCounterValue(device, semaphore) returns the counter without
+// blocking, i.e. how far the GPU has progressed
+static int l_vk_GetSemaphoreCounterValue(lua_State *L) {
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
+  VulkanSemaphore *sptr = check_timeline_semaphore(L, 2);
+  uint64_t value = 0;
+  VkResult result = vkd->vkGetSemaphoreCounterValue(dptr->device, sptr->semaphore, &value);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkGetSemaphoreCounterValue", result);
+  }
+  lua_pushinteger(L, (lua_Integer)value);
+  return 1;
+}
+
+// vk_SignalSemaphore(device, semaphore, value) sets the counter from the CPU
+static int l_vk_SignalSemaphore(lua_State *L) {
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
+  VulkanSemaphore *sptr = check_timeline_semaphore(L, 2);
+  VkSemaphoreSignalInfo signalInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO,
+      .semaphore = sptr->semaphore,
+      .value = (uint64_t)luaL_checkinteger(L, 3)
+  };
+  VkResult result = vkd->vkSignalSemaphore(dptr->device, &signalInfo);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkSignalSemaphore", result);
+  }
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// vk_WaitSemaphores(device, semaphore, value[, timeoutNs]) or
+// vk_WaitSemaphores(device, {semaphore, ...}, {value, ...}[, timeoutNs[, waitAny]]).
+// Returns true once the counters reach the values, false on timeout. The
+// timeout defaults to forever; 0 polls.
+static int l_vk_WaitSemaphores(lua_State *L) {
+  scratch_begin();
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
+  uint32_t count = 1;
+  VkSemaphore *semaphores;
+  uint64_t *values;
+  if (lua_istable(L, 2)) {
+      luaL_checktype(L, 3, LUA_TTABLE);
+      count = (uint32_t)lua_objlen(L, 2);
+      if (lua_objlen(L, 3) != count) {
+          return luaL_error(L, "vk_WaitSemaphores needs one value per semaphore");
+      }
+      semaphores = check_scratch_alloc(L, count * sizeof(VkSemaphore));
+      values = check_scratch_alloc(L, count * sizeof(uint64_t));
+      for (uint32_t i = 0; i < count; i++) {
+          lua_rawgeti(L, 2, i + 1);
+          semaphores[i] = check_timeline_semaphore(L, -1)->semaphore;
+          lua_rawgeti(L, 3, i + 1);
+          values[i] = (uint64_t)luaL_checkinteger(L, -1);
+          lua_pop(L, 2);
+      }
+  } else {
+      semaphores = check_scratch_alloc(L, sizeof(VkSemaphore));
+      values = check_scratch_alloc(L, sizeof(uint64_t));
+      semaphores[0] = check_timeline_semaphore(L, 2)->semaphore;
+      values[0] = (uint64_t)luaL_checkinteger(L, 3);
+  }
+  uint64_t timeout = lua_isnoneornil(L, 4) ? UINT64_MAX : (uint64_t)luaL_checkinteger(L, 4);
+
+  VkSemaphoreWaitInfo waitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+      .flags = lua_toboolean(L, 5) ? VK_SEMAPHORE_WAIT_ANY_BIT : 0,
+      .semaphoreCount = count,
+      .pSemaphores = semaphores,
+      .pValues = values
+  };
+  VkResult result = vkd->vkWaitSemaphores(dptr->device, &waitInfo, timeout);
+  if (result != VK_SUCCESS && result != VK_TIMEOUT) {
+      return push_vk_error(L, "vkWaitSemaphores", result);
+  }
+  lua_pushboolean(L, result == VK_SUCCESS);
   return 1;
 }
 
 static int l_vk_CreateFence(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   int signaled = lua_toboolean(L, 2);
 
   VkFenceCreateInfo createInfo = {
@@ -898,7 +2504,7 @@ static int l_vk_CreateFence(lua_State *L) {
   };
 
   VkFence fence;
-  VkResult result = vkCreateFence(dptr->device, &createInfo, NULL, &fence);
+  VkResult result = vkd->vkCreateFence(dptr->device, &createInfo, NULL, &fence);
   if (result != VK_SUCCESS) {  // Fixed typo: removed duplicate "result"
       char errMsg[64];
       snprintf(errMsg, sizeof(errMsg), "vkCreateFence failed with result %d", result);
@@ -910,6 +2516,7 @@ static int l_vk_CreateFence(lua_State *L) {
   VulkanFence *fptr = (VulkanFence *)lua_newuserdata(L, sizeof(VulkanFence));
   fptr->fence = fence;
   fptr->device = dptr->device;
+  fptr->vkd = dptr->vkd;
   luaL_getmetatable(L, "VulkanFence");
   lua_setmetatable(L, -2);
   return 1;
@@ -917,6 +2524,7 @@ static int l_vk_CreateFence(lua_State *L) {
 
 static int l_vk_AcquireNextImageKHR(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   VulkanSwapchain *swptr = (VulkanSwapchain *)luaL_checkudata(L, 2, "VulkanSwapchain");
   uint64_t timeout = luaL_optinteger(L, 3, UINT64_MAX);
 
@@ -931,46 +2539,339 @@ static int l_vk_AcquireNextImageKHR(lua_State *L) {
   }
 
   uint32_t imageIndex;
-  VkResult result = vkAcquireNextImageKHR(dptr->device, swptr->swapchain, timeout,
+  VkResult result = vkd->vkAcquireNextImageKHR(dptr->device, swptr->swapchain, timeout,
       semaphore ? semaphore->semaphore : VK_NULL_HANDLE,
       fence ? fence->fence : VK_NULL_HANDLE,
       &imageIndex);
 
+  // VK_ERROR_OUT_OF_DATE_KHR (third value) and VK_SUBOPTIMAL_KHR (second
+  // value) both mean the swapchain should be recreated
   if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-      char errMsg[64];
-      snprintf(errMsg, sizeof(errMsg), "vkAcquireNextImageKHR failed with result %d", result);
-      lua_pushnil(L);
-      lua_pushstring(L, errMsg);
-      return 2;
+      return push_vk_error(L, "vkAcquireNextImageKHR", result);
   }
 
   lua_pushinteger(L, imageIndex);
-  return 1;
+  lua_pushinteger(L, result);
+  return 2;
 }
 
-static int l_vk_QueueSubmit(lua_State *L) {
-  VulkanQueue *qptr = (VulkanQueue *)luaL_checkudata(L, 1, "VulkanQueue");
-  luaL_checktype(L, 2, LUA_TTABLE);
-  VulkanFence *fence = NULL;
-  if (lua_type(L, 3) == LUA_TUSERDATA) {
-      fence = (VulkanFence *)luaL_checkudata(L, 3, "VulkanFence");
+// Length of the array at t[field], 0 if it is not a table
+static uint32_t field_len(lua_State *L, int idx, const char *field) {
+  lua_getfield(L, idx, field);
+  uint32_t len = lua_istable(L, -1) ? (uint32_t)lua_objlen(L, -1) : 0;
+  lua_pop(L, 1);
+  return len;
+}
+
+// The arrays referenced by a prebuilt info are carved out of the same userdata
+static void *info_array(uint8_t **cursor, size_t size) {
+  void *ptr = *cursor;
+  *cursor += (size + 7) & ~(size_t)7;
+  return ptr;
+}
+
+// A prebuilt info only copies raw handles, so the userdata they came from is
+// kept in its environment: env[field][index] (env[field] when index is 0) is
+// set to the value on top of the stack, which is left in place
+static void info_keep(lua_State *L, int info, const char *field, uint32_t index) {
+  int value = lua_gettop(L);
+  lua_getfenv(L, info);
+  if (index == 0) {
+      lua_pushvalue(L, value);
+      lua_setfield(L, -2, field);
+  } else {
+      lua_getfield(L, -1, field);
+      if (lua_isnil(L, -1)) {
+          lua_pop(L, 1);
+          lua_newtable(L);
+          lua_pushvalue(L, -1);
+          lua_setfield(L, -3, field);
+      }
+      lua_pushvalue(L, value);
+      lua_rawseti(L, -2, (int)index);
+      lua_pop(L, 1);
   }
+  lua_pop(L, 1);
+}
 
-  uint32_t submitCount = (uint32_t)lua_objlen(L, 2);
-  VkSubmitInfo *submitInfos = malloc(submitCount * sizeof(VkSubmitInfo));
-  for (uint32_t i = 0; i < submitCount; i++) {
-      lua_rawgeti(L, 2, i + 1);
-      luaL_checktype(L, -1, LUA_TTABLE);
+static int l_vk_CreateSubmitInfo(lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
 
-      submitInfos[i].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
-      submitInfos[i].pNext = NULL;
+  uint32_t waitSemaphoreCount = field_len(L, 1, "waitSemaphores");
+  uint32_t commandBufferCount = field_len(L, 1, "commandBuffers");
+  uint32_t signalSemaphoreCount = field_len(L, 1, "signalSemaphores");
 
-      uint32_t waitSemaphoreCount = 0;
+  size_t size = ((sizeof(VulkanSubmitInfo) + 7) & ~(size_t)7)
+      + ((waitSemaphoreCount * sizeof(VkSemaphore) + 7) & ~(size_t)7)
+      + ((waitSemaphoreCount * sizeof(VkPipelineStageFlags) + 7) & ~(size_t)7)
+      + ((commandBufferCount * sizeof(VkCommandBuffer) + 7) & ~(size_t)7)
+      + ((signalSemaphoreCount * sizeof(VkSemaphore) + 7) & ~(size_t)7);
+
+  VulkanSubmitInfo *info = (VulkanSubmitInfo *)lua_newuserdata(L, size);
+  memset(info, 0, size);
+  luaL_getmetatable(L, "VulkanSubmitInfo");
+  lua_setmetatable(L, -2);
+  lua_newtable(L);
+  lua_setfenv(L, -2);
+  int infoIdx = lua_gettop(L);
+
+  uint8_t *cursor = (uint8_t *)info + ((sizeof(VulkanSubmitInfo) + 7) & ~(size_t)7);
+  info->waitSemaphores = info_array(&cursor, waitSemaphoreCount * sizeof(VkSemaphore));
+  info->waitStages = info_array(&cursor, waitSemaphoreCount * sizeof(VkPipelineStageFlags));
+  info->commandBuffers = info_array(&cursor, commandBufferCount * sizeof(VkCommandBuffer));
+  info->signalSemaphores = info_array(&cursor, signalSemaphoreCount * sizeof(VkSemaphore));
+
+  lua_getfield(L, 1, "waitSemaphores");
+  for (uint32_t i = 0; i < waitSemaphoreCount; i++) {
+      lua_rawgeti(L, -1, i + 1);
+      VulkanSemaphore *sptr = (VulkanSemaphore *)luaL_checkudata(L, -1, "VulkanSemaphore");
+      info->waitSemaphores[i] = sptr->semaphore;
+      info_keep(L, infoIdx, "waitSemaphores", i + 1);
+      lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+
+  lua_getfield(L, 1, "waitStages");
+  for (uint32_t i = 0; i < waitSemaphoreCount; i++) {
+      info->waitStages[i] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+      if (lua_istable(L, -1)) {
+          lua_rawgeti(L, -1, i + 1);
+          info->waitStages[i] = (VkPipelineStageFlags)luaL_optinteger(L, -1, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
+          lua_pop(L, 1);
+      }
+  }
+  lua_pop(L, 1);
+
+  lua_getfield(L, 1, "commandBuffers");
+  for (uint32_t i = 0; i < commandBufferCount; i++) {
+      lua_rawgeti(L, -1, i + 1);
+      VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, -1, "VulkanCommandBuffer");
+      info->commandBuffers[i] = cptr->commandBuffer;
+      info_keep(L, infoIdx, "commandBuffers", i + 1);
+      lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+
+  lua_getfield(L, 1, "signalSemaphores");
+  for (uint32_t i = 0; i < signalSemaphoreCount; i++) {
+      lua_rawgeti(L, -1, i + 1);
+      VulkanSemaphore *sptr = (VulkanSemaphore *)luaL_checkudata(L, -1, "VulkanSemaphore");
+      info->signalSemaphores[i] = sptr->semaphore;
+      info_keep(L, infoIdx, "signalSemaphores", i + 1);
+      lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+
+  lua_getfield(L, 1, "fence");
+  if (!lua_isnil(L, -1)) {
+      VulkanFence *fptr = (VulkanFence *)luaL_checkudata(L, -1, "VulkanFence");
+      info->fence = fptr->fence;
+      info_keep(L, infoIdx, "fence", 0);
+  }
+  lua_pop(L, 1);
+
+  info->submitInfo = (VkSubmitInfo){
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .waitSemaphoreCount = waitSemaphoreCount,
+      .pWaitSemaphores = info->waitSemaphores,
+      .pWaitDstStageMask = info->waitStages,
+      .commandBufferCount = commandBufferCount,
+      .pCommandBuffers = info->commandBuffers,
+      .signalSemaphoreCount = signalSemaphoreCount,
+      .pSignalSemaphores = info->signalSemaphores
+  };
+  return 1;
+}
+
+// vk_SubmitInfoSetCommandBuffer(info, cmdBuffer[, index]) patches one command buffer slot
+static int l_vk_SubmitInfoSetCommandBuffer(lua_State *L) {
+  VulkanSubmitInfo *info = (VulkanSubmitInfo *)luaL_checkudata(L, 1, "VulkanSubmitInfo");
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 2, "VulkanCommandBuffer");
+  lua_Integer index = luaL_optinteger(L, 3, 1);
+  luaL_argcheck(L, index >= 1 && index <= info->submitInfo.commandBufferCount, 3, "command buffer index out of range");
+  info->commandBuffers[index - 1] = cptr->commandBuffer;
+  lua_pushvalue(L, 2);
+  info_keep(L, 1, "commandBuffers", (uint32_t)index);
+  return 0;
+}
+
+static int l_vk_SubmitInfoSetFence(lua_State *L) {
+  VulkanSubmitInfo *info = (VulkanSubmitInfo *)luaL_checkudata(L, 1, "VulkanSubmitInfo");
+  if (lua_isnoneornil(L, 2)) {
+      info->fence = VK_NULL_HANDLE;
+  } else {
+      VulkanFence *fptr = (VulkanFence *)luaL_checkudata(L, 2, "VulkanFence");
+      info->fence = fptr->fence;
+  }
+  lua_settop(L, 2);
+  info_keep(L, 1, "fence", 0);
+  return 0;
+}
+
+static int l_vk_CreatePresentInfo(lua_State *L) {
+  luaL_checktype(L, 1, LUA_TTABLE);
+
+  uint32_t waitSemaphoreCount = field_len(L, 1, "waitSemaphores");
+  uint32_t swapchainCount = field_len(L, 1, "swapchains");
+  if (swapchainCount == 0) {
+      lua_pushnil(L);
+      lua_pushstring(L, "Present info needs at least one swapchain");
+      return 2;
+  }
+
+  size_t size = ((sizeof(VulkanPresentInfo) + 7) & ~(size_t)7)
+      + ((waitSemaphoreCount * sizeof(VkSemaphore) + 7) & ~(size_t)7)
+      + ((swapchainCount * sizeof(VkSwapchainKHR) + 7) & ~(size_t)7)
+      + ((swapchainCount * sizeof(uint32_t) + 7) & ~(size_t)7)
+      + ((swapchainCount * sizeof(VkResult) + 7) & ~(size_t)7);
+
+  VulkanPresentInfo *info = (VulkanPresentInfo *)lua_newuserdata(L, size);
+  memset(info, 0, size);
+  luaL_getmetatable(L, "VulkanPresentInfo");
+  lua_setmetatable(L, -2);
+  lua_newtable(L);
+  lua_setfenv(L, -2);
+  int infoIdx = lua_gettop(L);
+
+  uint8_t *cursor = (uint8_t *)info + ((sizeof(VulkanPresentInfo) + 7) & ~(size_t)7);
+  info->waitSemaphores = info_array(&cursor, waitSemaphoreCount * sizeof(VkSemaphore));
+  info->swapchains = info_array(&cursor, swapchainCount * sizeof(VkSwapchainKHR));
+  info->imageIndices = info_array(&cursor, swapchainCount * sizeof(uint32_t));
+  info->results = info_array(&cursor, swapchainCount * sizeof(VkResult));
+
+  lua_getfield(L, 1, "waitSemaphores");
+  for (uint32_t i = 0; i < waitSemaphoreCount; i++) {
+      lua_rawgeti(L, -1, i + 1);
+      VulkanSemaphore *sptr = (VulkanSemaphore *)luaL_checkudata(L, -1, "VulkanSemaphore");
+      info->waitSemaphores[i] = sptr->semaphore;
+      info_keep(L, infoIdx, "waitSemaphores", i + 1);
+      lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+
+  // Entries are swapchains, or { swapchain = ..., imageIndex = ... } as in
+  // vk_QueuePresentKHR; image indices are normally patched every frame
+  lua_getfield(L, 1, "swapchains");
+  for (uint32_t i = 0; i < swapchainCount; i++) {
+      lua_rawgeti(L, -1, i + 1);
+      if (lua_istable(L, -1)) {
+          lua_getfield(L, -1, "imageIndex");
+          info->imageIndices[i] = (uint32_t)luaL_optinteger(L, -1, 0);
+          lua_pop(L, 1);
+          lua_getfield(L, -1, "swapchain");
+          lua_replace(L, -2);
+      }
+      VulkanSwapchain *swptr = (VulkanSwapchain *)luaL_checkudata(L, -1, "VulkanSwapchain");
+      info->swapchains[i] = swptr->swapchain;
+      info_keep(L, infoIdx, "swapchains", i + 1);
+      lua_pop(L, 1);
+  }
+  lua_pop(L, 1);
+
+  info->presentInfo = (VkPresentInfoKHR){
+      .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+      .waitSemaphoreCount = waitSemaphoreCount,
+      .pWaitSemaphores = info->waitSemaphores,
+      .swapchainCount = swapchainCount,
+      .pSwapchains = info->swapchains,
+      .pImageIndices = info->imageIndices,
+      .pResults = info->results
+  };
+  return 1;
+}
+
+// vk_PresentInfoSetImageIndex(info, imageIndex[, swapchainIndex])
+static int l_vk_PresentInfoSetImageIndex(lua_State *L) {
+  VulkanPresentInfo *info = (VulkanPresentInfo *)luaL_checkudata(L, 1, "VulkanPresentInfo");
+  uint32_t imageIndex = (uint32_t)luaL_checkinteger(L, 2);
+  lua_Integer index = luaL_optinteger(L, 3, 1);
+  luaL_argcheck(L, index >= 1 && index <= info->presentInfo.swapchainCount, 3, "swapchain index out of range");
+  info->imageIndices[index - 1] = imageIndex;
+  return 0;
+}
+
+static int queue_submit_prebuilt(lua_State *L, const VulkanDeviceDispatch *vkd, VkQueue queue) {
+  VulkanSubmitInfo *info = (VulkanSubmitInfo *)luaL_checkudata(L, 2, "VulkanSubmitInfo");
+  VkFence fence = info->fence;
+  if (lua_type(L, 3) == LUA_TUSERDATA) {
+      fence = ((VulkanFence *)luaL_checkudata(L, 3, "VulkanFence"))->fence;
+  }
+
+  VkResult result = vkd->vkQueueSubmit(queue, 1, &info->submitInfo, fence);
+  if (result != VK_SUCCESS) {
+      char errMsg[64];
+      snprintf(errMsg, sizeof(errMsg), "vkQueueSubmit failed with result %d", result);
+      lua_pushnil(L);
+      lua_pushstring(L, errMsg);
+      return 2;
+  }
+
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+static int queue_present_prebuilt(lua_State *L, const VulkanDeviceDispatch *vkd, VkQueue queue) {
+  VulkanPresentInfo *info = (VulkanPresentInfo *)luaL_checkudata(L, 2, "VulkanPresentInfo");
+  if (!lua_isnoneornil(L, 3)) {
+      info->imageIndices[0] = (uint32_t)luaL_checkinteger(L, 3);
+  }
+
+  VkResult result = vkd->vkQueuePresentKHR(queue, &info->presentInfo);
+  if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+      return push_vk_error(L, "vkQueuePresentKHR", result);
+  }
+
+  lua_pushboolean(L, true);
+  lua_pushinteger(L, result);
+  return 2;
+}
+
+// Reads field of the table on top of the stack as count counter values, or
+// returns NULL if it is absent
+static uint64_t *opt_semaphore_values(lua_State *L, const char *field, uint32_t count) {
+  uint64_t *values = NULL;
+  lua_getfield(L, -1, field);
+  if (!lua_isnil(L, -1)) {
+      luaL_checktype(L, -1, LUA_TTABLE);
+      values = check_scratch_alloc(L, (count ? count : 1) * sizeof(uint64_t));
+      for (uint32_t j = 0; j < count; j++) {
+          lua_rawgeti(L, -1, j + 1);
+          values[j] = (uint64_t)luaL_optinteger(L, -1, 0);
+          lua_pop(L, 1);
+      }
+  }
+  lua_pop(L, 1);
+  return values;
+}
+
+static int l_vk_QueueSubmit(lua_State *L) {
+  scratch_begin();
+  VulkanQueue *qptr = (VulkanQueue *)luaL_checkudata(L, 1, "VulkanQueue");
+  const VulkanDeviceDispatch *vkd = qptr->vkd;
+  if (lua_type(L, 2) == LUA_TUSERDATA) {
+      return queue_submit_prebuilt(L, qptr->vkd, qptr->queue);
+  }
+  luaL_checktype(L, 2, LUA_TTABLE);
+  VulkanFence *fence = NULL;
+  if (lua_type(L, 3) == LUA_TUSERDATA) {
+      fence = (VulkanFence *)luaL_checkudata(L, 3, "VulkanFence");
+  }
+
+  uint32_t submitCount = (uint32_t)lua_objlen(L, 2);
+  VkSubmitInfo *submitInfos = check_scratch_alloc(L, submitCount * sizeof(VkSubmitInfo));
+  for (uint32_t i = 0; i < submitCount; i++) {
+      lua_rawgeti(L, 2, i + 1);
+      luaL_checktype(L, -1, LUA_TTABLE);
+
+      submitInfos[i].sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+      submitInfos[i].pNext = NULL;
+
+      uint32_t waitSemaphoreCount = 0;
       VkSemaphore *waitSemaphores = NULL;
       lua_getfield(L, -1, "waitSemaphores");
       if (lua_istable(L, -1)) {
           waitSemaphoreCount = (uint32_t)lua_objlen(L, -1);
-          waitSemaphores = malloc(waitSemaphoreCount * sizeof(VkSemaphore));
+          waitSemaphores = check_scratch_alloc(L, waitSemaphoreCount * sizeof(VkSemaphore));
           for (uint32_t j = 0; j < waitSemaphoreCount; j++) {
               lua_rawgeti(L, -1, j + 1);
               VulkanSemaphore *sptr = (VulkanSemaphore *)luaL_checkudata(L, -1, "VulkanSemaphore");
@@ -982,7 +2883,19 @@ static int l_vk_QueueSubmit(lua_State *L) {
       submitInfos[i].waitSemaphoreCount = waitSemaphoreCount;
       submitInfos[i].pWaitSemaphores = waitSemaphores;
 
-      VkPipelineStageFlags waitStages[] = { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };
+      // One stage mask per wait semaphore; must outlive the loop, so it lives in the arena too.
+      // Defaults to color attachment output, the stage a swapchain acquire gates.
+      VkPipelineStageFlags *waitStages = check_scratch_alloc(L, waitSemaphoreCount * sizeof(VkPipelineStageFlags));
+      lua_getfield(L, -1, "waitStages");
+      for (uint32_t j = 0; j < waitSemaphoreCount; j++) {
+          waitStages[j] = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+          if (lua_istable(L, -1)) {
+              lua_rawgeti(L, -1, j + 1);
+              waitStages[j] = (VkPipelineStageFlags)luaL_optinteger(L, -1, waitStages[j]);
+              lua_pop(L, 1);
+          }
+      }
+      lua_pop(L, 1);
       submitInfos[i].pWaitDstStageMask = waitStages;
 
       uint32_t commandBufferCount = 0;
@@ -990,7 +2903,7 @@ static int l_vk_QueueSubmit(lua_State *L) {
       lua_getfield(L, -1, "commandBuffers");
       if (lua_istable(L, -1)) {
           commandBufferCount = (uint32_t)lua_objlen(L, -1);
-          commandBuffers = malloc(commandBufferCount * sizeof(VkCommandBuffer));
+          commandBuffers = check_scratch_alloc(L, commandBufferCount * sizeof(VkCommandBuffer));
           for (uint32_t j = 0; j < commandBufferCount; j++) {
               lua_rawgeti(L, -1, j + 1);
               VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, -1, "VulkanCommandBuffer");
@@ -1007,7 +2920,7 @@ static int l_vk_QueueSubmit(lua_State *L) {
       lua_getfield(L, -1, "signalSemaphores");
       if (lua_istable(L, -1)) {
           signalSemaphoreCount = (uint32_t)lua_objlen(L, -1);
-          signalSemaphores = malloc(signalSemaphoreCount * sizeof(VkSemaphore));
+          signalSemaphores = check_scratch_alloc(L, signalSemaphoreCount * sizeof(VkSemaphore));
           for (uint32_t j = 0; j < signalSemaphoreCount; j++) {
               lua_rawgeti(L, -1, j + 1);
               VulkanSemaphore *sptr = (VulkanSemaphore *)luaL_checkudata(L, -1, "VulkanSemaphore");
@@ -1019,17 +2932,26 @@ static int l_vk_QueueSubmit(lua_State *L) {
       submitInfos[i].signalSemaphoreCount = signalSemaphoreCount;
       submitInfos[i].pSignalSemaphores = signalSemaphores;
 
+      // waitValues/signalValues give timeline semaphores their counter values,
+      // one entry per semaphore (ignored for binary ones)
+      uint64_t *waitValues = opt_semaphore_values(L, "waitValues", waitSemaphoreCount);
+      uint64_t *signalValues = opt_semaphore_values(L, "signalValues", signalSemaphoreCount);
+      if (waitValues || signalValues) {
+          VkTimelineSemaphoreSubmitInfo *timelineInfo = check_scratch_alloc(L, sizeof(VkTimelineSemaphoreSubmitInfo));
+          *timelineInfo = (VkTimelineSemaphoreSubmitInfo){
+              .sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO,
+              .waitSemaphoreValueCount = waitValues ? waitSemaphoreCount : 0,
+              .pWaitSemaphoreValues = waitValues,
+              .signalSemaphoreValueCount = signalValues ? signalSemaphoreCount : 0,
+              .pSignalSemaphoreValues = signalValues
+          };
+          submitInfos[i].pNext = timelineInfo;
+      }
+
       lua_pop(L, 1); // Pop the submit info table
   }
 
-  VkResult result = vkQueueSubmit(qptr->queue, submitCount, submitInfos, fence ? fence->fence : VK_NULL_HANDLE);
-
-  for (uint32_t i = 0; i < submitCount; i++) {
-      free((void *)submitInfos[i].pWaitSemaphores);
-      free((void *)submitInfos[i].pCommandBuffers);
-      free((void *)submitInfos[i].pSignalSemaphores);
-  }
-  free(submitInfos);
+  VkResult result = vkd->vkQueueSubmit(qptr->queue, submitCount, submitInfos, fence ? fence->fence : VK_NULL_HANDLE);
 
   if (result != VK_SUCCESS) {
       char errMsg[64];
@@ -1044,7 +2966,12 @@ static int l_vk_QueueSubmit(lua_State *L) {
 }
 
 static int l_vk_QueuePresentKHR(lua_State *L) {
+  scratch_begin();
   VulkanQueue *qptr = (VulkanQueue *)luaL_checkudata(L, 1, "VulkanQueue");
+  const VulkanDeviceDispatch *vkd = qptr->vkd;
+  if (lua_type(L, 2) == LUA_TUSERDATA) {
+      return queue_present_prebuilt(L, qptr->vkd, qptr->queue);
+  }
   luaL_checktype(L, 2, LUA_TTABLE);
 
   VkPresentInfoKHR presentInfo = { .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR };
@@ -1054,7 +2981,7 @@ static int l_vk_QueuePresentKHR(lua_State *L) {
   lua_getfield(L, 2, "waitSemaphores");
   if (lua_istable(L, -1)) {
       waitSemaphoreCount = (uint32_t)lua_objlen(L, -1);
-      waitSemaphores = malloc(waitSemaphoreCount * sizeof(VkSemaphore));
+      waitSemaphores = check_scratch_alloc(L, waitSemaphoreCount * sizeof(VkSemaphore));
       for (uint32_t i = 0; i < waitSemaphoreCount; i++) {
           lua_rawgeti(L, -1, i + 1);
           VulkanSemaphore *sptr = (VulkanSemaphore *)luaL_checkudata(L, -1, "VulkanSemaphore");
@@ -1072,8 +2999,8 @@ static int l_vk_QueuePresentKHR(lua_State *L) {
   lua_getfield(L, 2, "swapchains");
   if (lua_istable(L, -1)) {
       swapchainCount = (uint32_t)lua_objlen(L, -1);
-      swapchains = malloc(swapchainCount * sizeof(VkSwapchainKHR));
-      imageIndices = malloc(swapchainCount * sizeof(uint32_t));
+      swapchains = check_scratch_alloc(L, swapchainCount * sizeof(VkSwapchainKHR));
+      imageIndices = check_scratch_alloc(L, swapchainCount * sizeof(uint32_t));
       for (uint32_t i = 0; i < swapchainCount; i++) {
           lua_rawgeti(L, -1, i + 1);
           luaL_checktype(L, -1, LUA_TTABLE);
@@ -1092,26 +3019,20 @@ static int l_vk_QueuePresentKHR(lua_State *L) {
   presentInfo.pSwapchains = swapchains;
   presentInfo.pImageIndices = imageIndices;
 
-  VkResult result = vkQueuePresentKHR(qptr->queue, &presentInfo);
-
-  free(waitSemaphores);
-  free(swapchains);
-  free(imageIndices);
+  VkResult result = vkd->vkQueuePresentKHR(qptr->queue, &presentInfo);
 
   if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
-      char errMsg[64];
-      snprintf(errMsg, sizeof(errMsg), "vkQueuePresentKHR failed with result %d", result);
-      lua_pushnil(L);
-      lua_pushstring(L, errMsg);
-      return 2;
+      return push_vk_error(L, "vkQueuePresentKHR", result);
   }
 
   lua_pushboolean(L, true);
-  return 1;
+  lua_pushinteger(L, result);
+  return 2;
 }
 
 static int l_vk_CreateCommandPool(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   uint32_t queueFamilyIndex = (uint32_t)luaL_checkinteger(L, 2);
 
   VkCommandPoolCreateInfo createInfo = {
@@ -1121,7 +3042,7 @@ static int l_vk_CreateCommandPool(lua_State *L) {
   };
 
   VkCommandPool commandPool;
-  VkResult result = vkCreateCommandPool(dptr->device, &createInfo, NULL, &commandPool);
+  VkResult result = vkd->vkCreateCommandPool(dptr->device, &createInfo, NULL, &commandPool);
   if (result != VK_SUCCESS) {
       char errMsg[64];
       snprintf(errMsg, sizeof(errMsg), "vkCreateCommandPool failed with result %d", result);
@@ -1133,27 +3054,32 @@ static int l_vk_CreateCommandPool(lua_State *L) {
   VulkanCommandPool *cpptr = (VulkanCommandPool *)lua_newuserdata(L, sizeof(VulkanCommandPool));
   cpptr->commandPool = commandPool;
   cpptr->device = dptr->device;
+  cpptr->vkd = dptr->vkd;
   luaL_getmetatable(L, "VulkanCommandPool");
   lua_setmetatable(L, -2);
   return 1;
 }
 
+// vk_AllocateCommandBuffers(device, pool, count[, level]); level defaults to
+// VK_COMMAND_BUFFER_LEVEL_PRIMARY
 static int l_vk_AllocateCommandBuffers(lua_State *L) {
+  scratch_begin();
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   VulkanCommandPool *cpool = (VulkanCommandPool *)luaL_checkudata(L, 2, "VulkanCommandPool");
   int count = luaL_checkinteger(L, 3);
+  VkCommandBufferLevel level = (VkCommandBufferLevel)luaL_optinteger(L, 4, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
 
   VkCommandBufferAllocateInfo allocInfo = {
       .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
       .commandPool = cpool->commandPool,
-      .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+      .level = level,
       .commandBufferCount = (uint32_t)count
   };
 
-  VkCommandBuffer *commandBuffers = malloc(count * sizeof(VkCommandBuffer));
-  VkResult result = vkAllocateCommandBuffers(dptr->device, &allocInfo, commandBuffers);
+  VkCommandBuffer *commandBuffers = check_scratch_alloc(L, count * sizeof(VkCommandBuffer));
+  VkResult result = vkd->vkAllocateCommandBuffers(dptr->device, &allocInfo, commandBuffers);
   if (result != VK_SUCCESS) {
-      free(commandBuffers);
       char errMsg[64];
       snprintf(errMsg, sizeof(errMsg), "vkAllocateCommandBuffers failed with result %d", result);
       lua_pushnil(L);
@@ -1165,24 +3091,103 @@ static int l_vk_AllocateCommandBuffers(lua_State *L) {
   for (int i = 0; i < count; i++) {
       VulkanCommandBuffer *cbuf = (VulkanCommandBuffer *)lua_newuserdata(L, sizeof(VulkanCommandBuffer));
       cbuf->commandBuffer = commandBuffers[i];
+      cbuf->vkd = vkd;
       luaL_getmetatable(L, "VulkanCommandBuffer");
       lua_setmetatable(L, -2); // Set metatable for the userdata
       lua_rawseti(L, -2, i + 1); // Store in table at index i+1
   }
-  free(commandBuffers); // Free the temporary array
 
   return 1; // Return the table
 }
 
-static int l_vk_BeginCommandBuffer(lua_State *L) {
-  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+// vk_ResetCommandPool(device, pool) recycles every command buffer of the pool
+static int l_vk_ResetCommandPool(lua_State *L) {
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
+  VulkanCommandPool *cpool = (VulkanCommandPool *)luaL_checkudata(L, 2, "VulkanCommandPool");
+  VkResult result = vkd->vkResetCommandPool(dptr->device, cpool->commandPool, 0);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkResetCommandPool", result);
+  }
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// Reads {renderPass, subpass, framebuffer} or {colorFormats, depthFormat}.
+// An empty table is a secondary recorded outside any render pass.
+static void check_inheritance(lua_State *L, int idx, VulkanInheritance *inh) {
+  luaL_checktype(L, idx, LUA_TTABLE);
+  memset(inh, 0, sizeof(*inh));
+  inh->info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+  inh->rendering.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_RENDERING_INFO;
+  inh->rendering.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+  lua_getfield(L, idx, "renderPass");
+  if (!lua_isnil(L, -1)) {
+      inh->info.renderPass = ((VulkanRenderPass *)luaL_checkudata(L, -1, "VulkanRenderPass"))->renderPass;
+      inh->flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+  }
+  lua_getfield(L, idx, "subpass");
+  inh->info.subpass = (uint32_t)luaL_optinteger(L, -1, 0);
+  lua_getfield(L, idx, "framebuffer");
+  if (!lua_isnil(L, -1)) {
+      inh->info.framebuffer = ((VulkanFramebuffer *)luaL_checkudata(L, -1, "VulkanFramebuffer"))->framebuffer;
+  }
+  lua_pop(L, 3);
+
+  lua_getfield(L, idx, "colorFormats");
+  if (!lua_isnil(L, -1)) {
+      luaL_checktype(L, -1, LUA_TTABLE);
+      uint32_t count = (uint32_t)lua_objlen(L, -1);
+      if (count > VULKAN_MAX_COLOR_ATTACHMENTS) {
+          luaL_error(L, "At most %d color attachments are supported", VULKAN_MAX_COLOR_ATTACHMENTS);
+      }
+      for (uint32_t i = 0; i < count; i++) {
+          lua_rawgeti(L, -1, i + 1);
+          inh->colorFormats[i] = (VkFormat)luaL_checkinteger(L, -1);
+          lua_pop(L, 1);
+      }
+      inh->rendering.colorAttachmentCount = count;
+  }
+  lua_getfield(L, idx, "depthFormat");
+  inh->rendering.depthAttachmentFormat = (VkFormat)luaL_optinteger(L, -1, VK_FORMAT_UNDEFINED);
+  lua_pop(L, 2);
+  if (inh->rendering.colorAttachmentCount > 0 || inh->rendering.depthAttachmentFormat != VK_FORMAT_UNDEFINED) {
+      if (inh->info.renderPass) {
+          luaL_error(L, "Inheritance takes a renderPass or attachment formats, not both");
+      }
+      inh->flags |= VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+  }
+}
 
+static VkResult begin_secondary(const VulkanDeviceDispatch *vkd, VkCommandBuffer commandBuffer, VulkanInheritance *inh) {
+  inh->rendering.pColorAttachmentFormats = inh->colorFormats;
+  inh->info.pNext = (inh->flags && !inh->info.renderPass) ? &inh->rendering : NULL;
   VkCommandBufferBeginInfo beginInfo = {
       .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
-      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | inh->flags,
+      .pInheritanceInfo = &inh->info
   };
+  return vkd->vkBeginCommandBuffer(commandBuffer, &beginInfo);
+}
+
+// vk_BeginCommandBuffer(cmd[, inheritance]); secondaries pass their inheritance table
+static int l_vk_BeginCommandBuffer(lua_State *L) {
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
 
-  VkResult result = vkBeginCommandBuffer(cptr->commandBuffer, &beginInfo);
+  VkResult result;
+  if (!lua_isnoneornil(L, 2)) {
+      VulkanInheritance inh;
+      check_inheritance(L, 2, &inh);
+      result = begin_secondary(cptr->vkd, cptr->commandBuffer, &inh);
+  } else {
+      VkCommandBufferBeginInfo beginInfo = {
+          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+          .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+      };
+      result = vkd->vkBeginCommandBuffer(cptr->commandBuffer, &beginInfo);
+  }
   if (result != VK_SUCCESS) {
       char errMsg[64];
       snprintf(errMsg, sizeof(errMsg), "vkBeginCommandBuffer failed with result %d", result);
@@ -1197,6 +3202,7 @@ static int l_vk_BeginCommandBuffer(lua_State *L) {
 
 static int l_vk_CmdBeginRenderPass(lua_State *L) {
   VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
   VulkanRenderPass *rpptr = (VulkanRenderPass *)luaL_checkudata(L, 2, "VulkanRenderPass");
   VulkanFramebuffer *fbptr = (VulkanFramebuffer *)luaL_checkudata(L, 3, "VulkanFramebuffer");
 
@@ -1205,113 +3211,405 @@ static int l_vk_CmdBeginRenderPass(lua_State *L) {
       .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
       .renderPass = rpptr->renderPass,
       .framebuffer = fbptr->framebuffer,
-      .renderArea = {{0, 0}, {800, 600}},
+      .renderArea = {{0, 0}, {fbptr->width, fbptr->height}},
       .clearValueCount = 1,
       .pClearValues = &clearColor
   };
 
-  vkCmdBeginRenderPass(cptr->commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+  VkSubpassContents contents = (VkSubpassContents)luaL_optinteger(L, 4, VK_SUBPASS_CONTENTS_INLINE);
+  vkd->vkCmdBeginRenderPass(cptr->commandBuffer, &renderPassInfo, contents);
+  return 0;
+}
+
+static int l_vk_CmdSetViewport(lua_State *L) {
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  VkViewport viewport = {
+      .x = (float)luaL_checknumber(L, 2),
+      .y = (float)luaL_checknumber(L, 3),
+      .width = (float)luaL_checknumber(L, 4),
+      .height = (float)luaL_checknumber(L, 5),
+      .minDepth = (float)luaL_optnumber(L, 6, 0.0),
+      .maxDepth = (float)luaL_optnumber(L, 7, 1.0)
+  };
+  vkd->vkCmdSetViewport(cptr->commandBuffer, 0, 1, &viewport);
+  return 0;
+}
+
+static int l_vk_CmdSetScissor(lua_State *L) {
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  VkRect2D scissor = {
+      .offset = { (int32_t)luaL_checkinteger(L, 2), (int32_t)luaL_checkinteger(L, 3) },
+      .extent = { (uint32_t)luaL_checkinteger(L, 4), (uint32_t)luaL_checkinteger(L, 5) }
+  };
+  vkd->vkCmdSetScissor(cptr->commandBuffer, 0, 1, &scissor);
   return 0;
 }
 
 static int l_vk_CmdBindPipeline(lua_State *L) {
   VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
   VulkanPipeline *pptr = (VulkanPipeline *)luaL_checkudata(L, 2, "VulkanPipeline");
 
-  vkCmdBindPipeline(cptr->commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pptr->pipeline);
+  vkd->vkCmdBindPipeline(cptr->commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pptr->pipeline);
   return 0;
 }
 
 static int l_vk_CmdDraw(lua_State *L) {
   VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
   uint32_t vertexCount = (uint32_t)luaL_checkinteger(L, 2);
   uint32_t instanceCount = (uint32_t)luaL_checkinteger(L, 3);
   uint32_t firstVertex = (uint32_t)luaL_checkinteger(L, 4);
   uint32_t firstInstance = (uint32_t)luaL_checkinteger(L, 5);
 
-  vkCmdDraw(cptr->commandBuffer, vertexCount, instanceCount, firstVertex, firstInstance);
+  vkd->vkCmdDraw(cptr->commandBuffer, vertexCount, instanceCount, firstVertex, firstInstance);
   return 0;
 }
 
-static int l_vk_CmdEndRenderPass(lua_State *L) {
+// vk_CmdBindVertexBuffers(cmd, firstBinding, {buffer, ...}[, {offset, ...}])
+static int l_vk_CmdBindVertexBuffers(lua_State *L) {
   VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
-  vkCmdEndRenderPass(cptr->commandBuffer);
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  uint32_t firstBinding = (uint32_t)luaL_checkinteger(L, 2);
+  luaL_checktype(L, 3, LUA_TTABLE);
+  int hasOffsets = !lua_isnoneornil(L, 4);
+  if (hasOffsets) {
+      luaL_checktype(L, 4, LUA_TTABLE);
+  }
+  uint32_t count = (uint32_t)lua_objlen(L, 3);
+  if (count == 0 || count > VULKAN_MAX_VERTEX_BINDINGS) {
+      return luaL_error(L, "Expected 1 to %d vertex buffers", VULKAN_MAX_VERTEX_BINDINGS);
+  }
+
+  VkBuffer buffers[VULKAN_MAX_VERTEX_BINDINGS];
+  VkDeviceSize offsets[VULKAN_MAX_VERTEX_BINDINGS];
+  for (uint32_t i = 0; i < count; i++) {
+      lua_rawgeti(L, 3, i + 1);
+      buffers[i] = ((VulkanBuffer *)luaL_checkudata(L, -1, "VulkanBuffer"))->buffer;
+      lua_pop(L, 1);
+      offsets[i] = 0;
+      if (hasOffsets) {
+          lua_rawgeti(L, 4, i + 1);
+          offsets[i] = (VkDeviceSize)luaL_optinteger(L, -1, 0);
+          lua_pop(L, 1);
+      }
+  }
+  vkd->vkCmdBindVertexBuffers(cptr->commandBuffer, firstBinding, count, buffers, offsets);
   return 0;
 }
 
-static int l_vk_EndCommandBuffer(lua_State *L) {
+// vk_CmdBindIndexBuffer(cmd, buffer[, offset[, indexType]]); indexType
+// defaults to VK_INDEX_TYPE_UINT32
+static int l_vk_CmdBindIndexBuffer(lua_State *L) {
   VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  VulkanBuffer *bptr = (VulkanBuffer *)luaL_checkudata(L, 2, "VulkanBuffer");
+  VkDeviceSize offset = (VkDeviceSize)luaL_optinteger(L, 3, 0);
+  VkIndexType indexType = (VkIndexType)luaL_optinteger(L, 4, VK_INDEX_TYPE_UINT32);
 
-  VkResult result = vkEndCommandBuffer(cptr->commandBuffer);
-  if (result != VK_SUCCESS) {
-      char errMsg[64];
-      snprintf(errMsg, sizeof(errMsg), "vkEndCommandBuffer failed with result %d", result);
-      lua_pushnil(L);
-      lua_pushstring(L, errMsg);
-      return 2;
-  }
-
-  lua_pushboolean(L, true);
-  return 1;
+  vkd->vkCmdBindIndexBuffer(cptr->commandBuffer, bptr->buffer, offset, indexType);
+  return 0;
 }
 
-static int l_vk_ResetCommandBuffer(lua_State *L) {
+static int l_vk_CmdDrawIndexed(lua_State *L) {
   VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
-  VkResult result = vkResetCommandBuffer(cptr->commandBuffer, 0);
-  if (result != VK_SUCCESS) {
-      char errMsg[64];
-      snprintf(errMsg, sizeof(errMsg), "vkResetCommandBuffer failed with result %d", result);
-      lua_pushnil(L);
-      lua_pushstring(L, errMsg);
-      return 2;
-  }
-  lua_pushboolean(L, true);
-  return 1;
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  uint32_t indexCount = (uint32_t)luaL_checkinteger(L, 2);
+  uint32_t instanceCount = (uint32_t)luaL_checkinteger(L, 3);
+  uint32_t firstIndex = (uint32_t)luaL_checkinteger(L, 4);
+  int32_t vertexOffset = (int32_t)luaL_checkinteger(L, 5);
+  uint32_t firstInstance = (uint32_t)luaL_checkinteger(L, 6);
+
+  vkd->vkCmdDrawIndexed(cptr->commandBuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+  return 0;
 }
 
-static int l_vk_CmdPipelineBarrier(lua_State *L) {
+// Indirect draws read their parameters from a buffer created with
+// VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT: drawCount packed VkDrawIndirectCommand
+// (4 uint32) or VkDrawIndexedIndirectCommand (5 x 32 bit) records, stride
+// bytes apart. drawCount > 1 needs the multiDrawIndirect feature.
+static void check_indirect_args(lua_State *L, VkBuffer *buffer, VkDeviceSize *offset, uint32_t *drawCount,
+    uint32_t *stride, uint32_t defaultStride) {
+  *buffer = ((VulkanBuffer *)luaL_checkudata(L, 2, "VulkanBuffer"))->buffer;
+  *offset = (VkDeviceSize)luaL_checkinteger(L, 3);
+  *drawCount = (uint32_t)luaL_checkinteger(L, 4);
+  *stride = (uint32_t)luaL_optinteger(L, 5, defaultStride);
+}
+
+// vk_CmdDrawIndirect(cmd, buffer, offset, drawCount[, stride])
+static int l_vk_CmdDrawIndirect(lua_State *L) {
   VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
-  VkPipelineStageFlags srcStageMask = luaL_checkinteger(L, 2);
-  VkPipelineStageFlags dstStageMask = luaL_checkinteger(L, 3);
-  VkDependencyFlags dependencyFlags = luaL_checkinteger(L, 4);
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  VkBuffer buffer;
+  VkDeviceSize offset;
+  uint32_t drawCount, stride;
+  check_indirect_args(L, &buffer, &offset, &drawCount, &stride, sizeof(VkDrawIndirectCommand));
 
-  uint32_t memoryBarrierCount = 0;
-  const VkMemoryBarrier *pMemoryBarriers = NULL;
-  if (!lua_isnil(L, 5)) {
-      luaL_error(L, "Memory barriers not yet supported");
-  }
+  vkd->vkCmdDrawIndirect(cptr->commandBuffer, buffer, offset, drawCount, stride);
+  return 0;
+}
 
-  uint32_t bufferMemoryBarrierCount = 0;
-  const VkBufferMemoryBarrier *pBufferMemoryBarriers = NULL;
-  if (!lua_isnil(L, 6)) {
-      luaL_error(L, "Buffer memory barriers not yet supported");
-  }
+// vk_CmdDrawIndexedIndirect(cmd, buffer, offset, drawCount[, stride])
+static int l_vk_CmdDrawIndexedIndirect(lua_State *L) {
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  VkBuffer buffer;
+  VkDeviceSize offset;
+  uint32_t drawCount, stride;
+  check_indirect_args(L, &buffer, &offset, &drawCount, &stride, sizeof(VkDrawIndexedIndirectCommand));
 
-  uint32_t imageMemoryBarrierCount = 0;
-  VkImageMemoryBarrier *pImageMemoryBarriers = NULL;
-  if (!lua_isnil(L, 7)) {
-      luaL_checktype(L, 7, LUA_TTABLE);
-      imageMemoryBarrierCount = lua_objlen(L, 7);
-      pImageMemoryBarriers = malloc(imageMemoryBarrierCount * sizeof(VkImageMemoryBarrier));
-      for (uint32_t i = 0; i < imageMemoryBarrierCount; i++) {
-          lua_rawgeti(L, 7, i + 1);
-          luaL_checktype(L, -1, LUA_TTABLE);
+  vkd->vkCmdDrawIndexedIndirect(cptr->commandBuffer, buffer, offset, drawCount, stride);
+  return 0;
+}
 
-          VkImageMemoryBarrier *barrier = &pImageMemoryBarriers[i];
-          barrier->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-          barrier->pNext = NULL;
+// The *Count variants take the draw count from a uint32 in countBuffer, so a
+// compute pass can cull without a CPU round trip; maxDrawCount caps it.
+// Needs Vulkan 1.2 with drawIndirectCount, or VK_KHR_draw_indirect_count.
+static void check_indirect_count_args(lua_State *L, VkBuffer *buffer, VkDeviceSize *offset,
+    VkBuffer *countBuffer, VkDeviceSize *countOffset, uint32_t *maxDrawCount, uint32_t *stride,
+    uint32_t defaultStride) {
+  *buffer = ((VulkanBuffer *)luaL_checkudata(L, 2, "VulkanBuffer"))->buffer;
+  *offset = (VkDeviceSize)luaL_checkinteger(L, 3);
+  *countBuffer = ((VulkanBuffer *)luaL_checkudata(L, 4, "VulkanBuffer"))->buffer;
+  *countOffset = (VkDeviceSize)luaL_checkinteger(L, 5);
+  *maxDrawCount = (uint32_t)luaL_checkinteger(L, 6);
+  *stride = (uint32_t)luaL_optinteger(L, 7, defaultStride);
+}
 
-          lua_getfield(L, -1, "oldLayout");
-          barrier->oldLayout = luaL_checkinteger(L, -1);
-          lua_pop(L, 1);
+// vk_CmdDrawIndirectCount(cmd, buffer, offset, countBuffer, countOffset, maxDrawCount[, stride])
+static int l_vk_CmdDrawIndirectCount(lua_State *L) {
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  VkBuffer buffer, countBuffer;
+  VkDeviceSize offset, countOffset;
+  uint32_t maxDrawCount, stride;
+  check_indirect_count_args(L, &buffer, &offset, &countBuffer, &countOffset, &maxDrawCount, &stride,
+      sizeof(VkDrawIndirectCommand));
+  if (!vkd->vkCmdDrawIndirectCount) {
+      return luaL_error(L, "vk_CmdDrawIndirectCount: needs Vulkan 1.2 or VK_KHR_draw_indirect_count");
+  }
 
-          lua_getfield(L, -1, "newLayout");
-          barrier->newLayout = luaL_checkinteger(L, -1);
-          lua_pop(L, 1);
+  vkd->vkCmdDrawIndirectCount(cptr->commandBuffer, buffer, offset, countBuffer, countOffset, maxDrawCount, stride);
+  return 0;
+}
 
-          lua_getfield(L, -1, "srcQueueFamilyIndex");
-          barrier->srcQueueFamilyIndex = luaL_checkinteger(L, -1);
-          lua_pop(L, 1);
+// vk_CmdDrawIndexedIndirectCount(cmd, buffer, offset, countBuffer, countOffset, maxDrawCount[, stride])
+static int l_vk_CmdDrawIndexedIndirectCount(lua_State *L) {
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  VkBuffer buffer, countBuffer;
+  VkDeviceSize offset, countOffset;
+  uint32_t maxDrawCount, stride;
+  check_indirect_count_args(L, &buffer, &offset, &countBuffer, &countOffset, &maxDrawCount, &stride,
+      sizeof(VkDrawIndexedIndirectCommand));
+  if (!vkd->vkCmdDrawIndexedIndirectCount) {
+      return luaL_error(L, "vk_CmdDrawIndexedIndirectCount: needs Vulkan 1.2 or VK_KHR_draw_indirect_count");
+  }
+
+  vkd->vkCmdDrawIndexedIndirectCount(cptr->commandBuffer, buffer, offset, countBuffer, countOffset,
+      maxDrawCount, stride);
+  return 0;
+}
+
+static int l_vk_CmdEndRenderPass(lua_State *L) {
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  vkd->vkCmdEndRenderPass(cptr->commandBuffer);
+  return 0;
+}
+
+static void check_rendering_attachment(lua_State *L, int idx, VkImageLayout defaultLayout,
+    VkRenderingAttachmentInfo *attachment) {
+  luaL_checktype(L, idx, LUA_TTABLE);
+  memset(attachment, 0, sizeof(*attachment));
+  attachment->sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO;
+  lua_getfield(L, idx, "imageView");
+  attachment->imageView = ((VulkanImageView *)luaL_checkudata(L, -1, "VulkanImageView"))->imageView;
+  lua_getfield(L, idx, "imageLayout");
+  attachment->imageLayout = (VkImageLayout)luaL_optinteger(L, -1, defaultLayout);
+  lua_getfield(L, idx, "loadOp");
+  attachment->loadOp = (VkAttachmentLoadOp)luaL_optinteger(L, -1, VK_ATTACHMENT_LOAD_OP_CLEAR);
+  lua_getfield(L, idx, "storeOp");
+  attachment->storeOp = (VkAttachmentStoreOp)luaL_optinteger(L, -1, VK_ATTACHMENT_STORE_OP_STORE);
+  lua_pop(L, 4);
+  if (defaultLayout == VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL) {
+      lua_getfield(L, idx, "clearDepth");
+      attachment->clearValue.depthStencil.depth = (float)luaL_optnumber(L, -1, 1.0);
+      lua_pop(L, 1);
+      return;
+  }
+  attachment->clearValue.color.float32[3] = 1.0f; // Opaque black, as vk_CmdBeginRenderPass clears
+  lua_getfield(L, idx, "clearColor");
+  if (lua_istable(L, -1)) {
+      for (int c = 0; c < 4; c++) {
+          lua_rawgeti(L, -1, c + 1);
+          attachment->clearValue.color.float32[c] = (float)luaL_optnumber(L, -1, c == 3 ? 1.0 : 0.0);
+          lua_pop(L, 1);
+      }
+  }
+  lua_pop(L, 1);
+}
+
+// vk_CmdBeginRendering(cmd, {width, height, x, y, colorAttachments = {{imageView,
+// imageLayout, loadOp, storeOp, clearColor = {r, g, b, a}}, ...}, depthAttachment =
+// {imageView, imageLayout, loadOp, storeOp, clearDepth}}). Attachments must
+// already be in their attachment layout; there is no render pass to do it.
+static int l_vk_CmdBeginRendering(lua_State *L) {
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  luaL_checktype(L, 2, LUA_TTABLE);
+
+  VkRenderingInfo renderingInfo = { .sType = VK_STRUCTURE_TYPE_RENDERING_INFO, .layerCount = 1 };
+  lua_getfield(L, 2, "width");
+  renderingInfo.renderArea.extent.width = (uint32_t)luaL_checkinteger(L, -1);
+  lua_getfield(L, 2, "height");
+  renderingInfo.renderArea.extent.height = (uint32_t)luaL_checkinteger(L, -1);
+  lua_getfield(L, 2, "x");
+  renderingInfo.renderArea.offset.x = (int32_t)luaL_optinteger(L, -1, 0);
+  lua_getfield(L, 2, "y");
+  renderingInfo.renderArea.offset.y = (int32_t)luaL_optinteger(L, -1, 0);
+  lua_getfield(L, 2, "secondaryCommandBuffers");
+  if (lua_toboolean(L, -1)) {
+      renderingInfo.flags = VK_RENDERING_CONTENTS_SECONDARY_COMMAND_BUFFERS_BIT;
+  }
+  lua_pop(L, 5);
+
+  VkRenderingAttachmentInfo colorAttachments[VULKAN_MAX_COLOR_ATTACHMENTS];
+  lua_getfield(L, 2, "colorAttachments");
+  if (!lua_isnil(L, -1)) {
+      luaL_checktype(L, -1, LUA_TTABLE);
+      uint32_t count = (uint32_t)lua_objlen(L, -1);
+      if (count > VULKAN_MAX_COLOR_ATTACHMENTS) {
+          return luaL_error(L, "At most %d color attachments are supported", VULKAN_MAX_COLOR_ATTACHMENTS);
+      }
+      for (uint32_t i = 0; i < count; i++) {
+          lua_rawgeti(L, -1, i + 1);
+          check_rendering_attachment(L, lua_gettop(L), VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, &colorAttachments[i]);
+          lua_pop(L, 1);
+      }
+      renderingInfo.colorAttachmentCount = count;
+      renderingInfo.pColorAttachments = colorAttachments;
+  }
+  lua_pop(L, 1);
+
+  VkRenderingAttachmentInfo depthAttachment;
+  lua_getfield(L, 2, "depthAttachment");
+  if (!lua_isnil(L, -1)) {
+      check_rendering_attachment(L, lua_gettop(L), VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, &depthAttachment);
+      renderingInfo.pDepthAttachment = &depthAttachment;
+  }
+  lua_pop(L, 1);
+
+  vkd->vkCmdBeginRendering(cptr->commandBuffer, &renderingInfo);
+  return 0;
+}
+
+static int l_vk_CmdEndRendering(lua_State *L) {
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  vkd->vkCmdEndRendering(cptr->commandBuffer);
+  return 0;
+}
+
+// vk_CmdExecuteCommands(cmd, {secondary, ...})
+static int l_vk_CmdExecuteCommands(lua_State *L) {
+  scratch_begin();
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  luaL_checktype(L, 2, LUA_TTABLE);
+  uint32_t count = (uint32_t)lua_objlen(L, 2);
+  if (count == 0) {
+      return 0;
+  }
+  VkCommandBuffer *secondaries = check_scratch_alloc(L, count * sizeof(VkCommandBuffer));
+  for (uint32_t i = 0; i < count; i++) {
+      lua_rawgeti(L, 2, i + 1);
+      secondaries[i] = ((VulkanCommandBuffer *)luaL_checkudata(L, -1, "VulkanCommandBuffer"))->commandBuffer;
+      lua_pop(L, 1);
+  }
+  vkd->vkCmdExecuteCommands(cptr->commandBuffer, count, secondaries);
+  return 0;
+}
+
+static int l_vk_EndCommandBuffer(lua_State *L) {
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+
+  VkResult result = vkd->vkEndCommandBuffer(cptr->commandBuffer);
+  if (result != VK_SUCCESS) {
+      char errMsg[64];
+      snprintf(errMsg, sizeof(errMsg), "vkEndCommandBuffer failed with result %d", result);
+      lua_pushnil(L);
+      lua_pushstring(L, errMsg);
+      return 2;
+  }
+
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+static int l_vk_ResetCommandBuffer(lua_State *L) {
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  VkResult result = vkd->vkResetCommandBuffer(cptr->commandBuffer, 0);
+  if (result != VK_SUCCESS) {
+      char errMsg[64];
+      snprintf(errMsg, sizeof(errMsg), "vkResetCommandBuffer failed with result %d", result);
+      lua_pushnil(L);
+      lua_pushstring(L, errMsg);
+      return 2;
+  }
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+static int l_vk_CmdPipelineBarrier(lua_State *L) {
+  scratch_begin();
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  VkPipelineStageFlags srcStageMask = luaL_checkinteger(L, 2);
+  VkPipelineStageFlags dstStageMask = luaL_checkinteger(L, 3);
+  VkDependencyFlags dependencyFlags = luaL_checkinteger(L, 4);
+
+  uint32_t memoryBarrierCount = 0;
+  const VkMemoryBarrier *pMemoryBarriers = NULL;
+  if (!lua_isnil(L, 5)) {
+      luaL_error(L, "Memory barriers not yet supported");
+  }
+
+  uint32_t bufferMemoryBarrierCount = 0;
+  const VkBufferMemoryBarrier *pBufferMemoryBarriers = NULL;
+  if (!lua_isnil(L, 6)) {
+      luaL_error(L, "Buffer memory barriers not yet supported");
+  }
+
+  uint32_t imageMemoryBarrierCount = 0;
+  VkImageMemoryBarrier *pImageMemoryBarriers = NULL;
+  if (!lua_isnil(L, 7)) {
+      luaL_checktype(L, 7, LUA_TTABLE);
+      imageMemoryBarrierCount = lua_objlen(L, 7);
+      pImageMemoryBarriers = check_scratch_alloc(L, imageMemoryBarrierCount * sizeof(VkImageMemoryBarrier));
+      for (uint32_t i = 0; i < imageMemoryBarrierCount; i++) {
+          lua_rawgeti(L, 7, i + 1);
+          luaL_checktype(L, -1, LUA_TTABLE);
+
+          VkImageMemoryBarrier *barrier = &pImageMemoryBarriers[i];
+          barrier->sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+          barrier->pNext = NULL;
+
+          lua_getfield(L, -1, "oldLayout");
+          barrier->oldLayout = luaL_checkinteger(L, -1);
+          lua_pop(L, 1);
+
+          lua_getfield(L, -1, "newLayout");
+          barrier->newLayout = luaL_checkinteger(L, -1);
+          lua_pop(L, 1);
+
+          lua_getfield(L, -1, "srcQueueFamilyIndex");
+          barrier->srcQueueFamilyIndex = luaL_checkinteger(L, -1);
+          lua_pop(L, 1);
 
           lua_getfield(L, -1, "dstQueueFamilyIndex");
           barrier->dstQueueFamilyIndex = luaL_checkinteger(L, -1);
@@ -1353,7 +3651,7 @@ static int l_vk_CmdPipelineBarrier(lua_State *L) {
       }
   }
 
-  vkCmdPipelineBarrier(
+  vkd->vkCmdPipelineBarrier(
       cptr->commandBuffer,
       srcStageMask,
       dstStageMask,
@@ -1363,65 +3661,4177 @@ static int l_vk_CmdPipelineBarrier(lua_State *L) {
       imageMemoryBarrierCount, pImageMemoryBarriers
   );
 
-  if (pImageMemoryBarriers) free(pImageMemoryBarriers);
+  return 0;
+}
+
+static int l_vk_WaitForFences(lua_State *L) {
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
+  VulkanFence *fptr = (VulkanFence *)luaL_checkudata(L, 2, "VulkanFence");
+
+  VkResult result = vkd->vkWaitForFences(dptr->device, 1, &fptr->fence, VK_TRUE, UINT64_MAX);
+  if (result != VK_SUCCESS) {
+      char errMsg[64];
+      snprintf(errMsg, sizeof(errMsg), "vkWaitForFences failed with result %d", result);
+      lua_pushnil(L);
+      lua_pushstring(L, errMsg);
+      return 2;
+  }
+
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+static int l_vk_ResetFences(lua_State *L) {
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
+  VulkanFence *fptr = (VulkanFence *)luaL_checkudata(L, 2, "VulkanFence");
+
+  VkResult result = vkd->vkResetFences(dptr->device, 1, &fptr->fence);
+  if (result != VK_SUCCESS) {
+      char errMsg[64];
+      snprintf(errMsg, sizeof(errMsg), "vkResetFences failed with result %d", result);
+      lua_pushnil(L);
+      lua_pushstring(L, errMsg);
+      return 2;
+  }
+
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// Update vk_QueueWaitIdle to return true on success
+static int l_vk_QueueWaitIdle(lua_State *L) {
+  VulkanQueue *qptr = (VulkanQueue *)luaL_checkudata(L, 1, "VulkanQueue");
+  const VulkanDeviceDispatch *vkd = qptr->vkd;
+  VkResult result = vkd->vkQueueWaitIdle(qptr->queue);
+  if (result != VK_SUCCESS) {
+      char errMsg[64];
+      snprintf(errMsg, sizeof(errMsg), "vkQueueWaitIdle failed with result %d", result);
+      lua_pushnil(L);
+      lua_pushstring(L, errMsg);
+      return 2;
+  }
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// Device memory sub-allocator. Resources are placed in large VkDeviceMemory
+// blocks owned by pools: one free-list pool per memory type by default, plus
+// linear and ring pools created explicitly. Allocators and pools are heap
+// allocated and reference counted by their live allocations, so the Lua
+// objects can be collected in any order.
+#define ALLOCATOR_DEFAULT_BLOCK_SIZE (64u * 1024 * 1024)
+
+static VkDeviceSize align_up(VkDeviceSize value, VkDeviceSize alignment) {
+  return alignment > 1 ? (value + alignment - 1) / alignment * alignment : value;
+}
+
+static int find_memory_type(const VkPhysicalDeviceMemoryProperties *props, uint32_t typeBits,
+    VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred) {
+  for (int pass = 0; pass < 2; pass++) {
+      VkMemoryPropertyFlags flags = pass == 0 ? required | preferred : required;
+      for (uint32_t i = 0; i < props->memoryTypeCount; i++) {
+          if ((typeBits & (1u << i)) && (props->memoryTypes[i].propertyFlags & flags) == flags) {
+              return (int)i;
+          }
+      }
+  }
+  return -1;
+}
+
+static void free_memory_block(const VulkanAllocator *allocator, VulkanMemoryBlock *block) {
+  const VulkanDeviceDispatch *vkd = allocator->vkd;
+  if (block->mapped) vkd->vkUnmapMemory(allocator->device, block->memory);
+  vkd->vkFreeMemory(allocator->device, block->memory, NULL);
+  free(block->freeRanges);
+  free(block);
+}
+
+static void free_allocator(VulkanAllocator *allocator);
+
+static void allocator_unref(VulkanAllocator *allocator) {
+  if (--allocator->refs == 0) {
+      free_allocator(allocator);
+  }
+}
+
+static void free_memory_pool(VulkanMemoryPool *pool) {
+  for (uint32_t i = 0; i < pool->blockCount; i++) {
+      free_memory_block(pool->allocator, pool->blocks[i]);
+  }
+  free(pool->blocks);
+  free(pool);
+}
+
+// Custom pools hand their reference on the allocator back when they go away
+static void pool_unref(VulkanMemoryPool *pool) {
+  if (--pool->refs == 0) {
+      VulkanAllocator *allocator = pool->allocator;
+      free_memory_pool(pool);
+      allocator_unref(allocator);
+  }
+}
+
+static void free_allocator(VulkanAllocator *allocator) {
+  for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++) {
+      for (int j = 0; j < 2; j++) {
+          if (allocator->defaultPools[i][j]) free_memory_pool(allocator->defaultPools[i][j]);
+      }
+  }
+  free(allocator);
+}
+
+static VulkanMemoryPool *new_memory_pool(VulkanAllocator *allocator, uint32_t memoryTypeIndex,
+    int kind, VkDeviceSize blockSize, int custom) {
+  VulkanMemoryPool *pool = heap_alloc(sizeof(VulkanMemoryPool));
+  if (!pool) {
+      return NULL;
+  }
+  memset(pool, 0, sizeof(*pool));
+  pool->allocator = allocator;
+  pool->memoryTypeIndex = memoryTypeIndex;
+  pool->kind = kind;
+  pool->custom = custom;
+  pool->blockSize = blockSize;
+  pool->granularity = custom ? allocator->bufferImageGranularity : 1;
+  pool->refs = custom ? 1 : 0;
+  return pool;
+}
+
+static VkResult pool_add_block(VulkanMemoryPool *pool, VkDeviceSize size, VulkanMemoryBlock **out) {
+  VulkanAllocator *allocator = pool->allocator;
+  const VulkanDeviceDispatch *vkd = allocator->vkd;
+  if (pool->blockCount == pool->blockCapacity) {
+      uint32_t capacity = pool->blockCapacity ? pool->blockCapacity * 2 : 4;
+      VulkanMemoryBlock **blocks = heap_realloc(pool->blocks, capacity * sizeof(VulkanMemoryBlock *));
+      if (!blocks) {
+          return VK_ERROR_OUT_OF_HOST_MEMORY;
+      }
+      pool->blocks = blocks;
+      pool->blockCapacity = capacity;
+  }
+  VulkanMemoryBlock *block = heap_alloc(sizeof(VulkanMemoryBlock));
+  if (!block) {
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+  }
+  memset(block, 0, sizeof(*block));
+  block->size = size;
+  if (pool->kind != VULKAN_POOL_LINEAR) {
+      block->freeRanges = heap_alloc(4 * sizeof(VulkanMemoryRange));
+      if (!block->freeRanges) {
+          free(block);
+          return VK_ERROR_OUT_OF_HOST_MEMORY;
+      }
+      block->freeRanges[0].offset = 0;
+      block->freeRanges[0].size = size;
+      block->freeCount = 1;
+      block->freeCapacity = 4;
+  }
+
+  VkMemoryAllocateInfo allocInfo = {
+      .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+      .allocationSize = size,
+      .memoryTypeIndex = pool->memoryTypeIndex
+  };
+  VkResult result = vkd->vkAllocateMemory(allocator->device, &allocInfo, NULL, &block->memory);
+  if (result == VK_SUCCESS &&
+      (allocator->memoryProperties.memoryTypes[pool->memoryTypeIndex].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)) {
+      result = vkd->vkMapMemory(allocator->device, block->memory, 0, VK_WHOLE_SIZE, 0, &block->mapped);
+      if (result != VK_SUCCESS) {
+          vkd->vkFreeMemory(allocator->device, block->memory, NULL);
+      }
+  }
+  if (result != VK_SUCCESS) {
+      free(block->freeRanges);
+      free(block);
+      return result;
+  }
+  pool->blocks[pool->blockCount++] = block;
+  *out = block;
+  return VK_SUCCESS;
+}
+
+static void pool_remove_block(VulkanMemoryPool *pool, VulkanMemoryBlock *block) {
+  for (uint32_t i = 0; i < pool->blockCount; i++) {
+      if (pool->blocks[i] == block) {
+          pool->blocks[i] = pool->blocks[--pool->blockCount];
+          break;
+      }
+  }
+  free_memory_block(pool->allocator, block);
+}
+
+static int block_insert_range(VulkanMemoryBlock *block, uint32_t index, VkDeviceSize offset, VkDeviceSize size) {
+  if (block->freeCount == block->freeCapacity) {
+      uint32_t capacity = block->freeCapacity * 2;
+      VulkanMemoryRange *ranges = heap_realloc(block->freeRanges, capacity * sizeof(VulkanMemoryRange));
+      if (!ranges) {
+          return 0;
+      }
+      block->freeRanges = ranges;
+      block->freeCapacity = capacity;
+  }
+  memmove(&block->freeRanges[index + 1], &block->freeRanges[index],
+      (block->freeCount - index) * sizeof(VulkanMemoryRange));
+  block->freeRanges[index].offset = offset;
+  block->freeRanges[index].size = size;
+  block->freeCount++;
+  return 1;
+}
+
+// Takes [start, start + size) out of free range i, which must contain it
+static int block_carve_range(VulkanMemoryBlock *block, uint32_t i, VkDeviceSize start, VkDeviceSize size) {
+  VulkanMemoryRange *range = &block->freeRanges[i];
+  VkDeviceSize tailOffset = start + size;
+  VkDeviceSize tailSize = range->offset + range->size - tailOffset;
+  if (start > range->offset) {
+      range->size = start - range->offset;
+      if (tailSize > 0 && !block_insert_range(block, i + 1, tailOffset, tailSize)) {
+          range->size += size + tailSize;
+          return 0;
+      }
+  } else if (tailSize > 0) {
+      range->offset = tailOffset;
+      range->size = tailSize;
+  } else {
+      memmove(range, range + 1, (block->freeCount - i - 1) * sizeof(VulkanMemoryRange));
+      block->freeCount--;
+  }
+  return 1;
+}
+
+// First fit. Alignment padding in front of the allocation stays free.
+static int block_alloc_free_list(VulkanMemoryBlock *block, VkDeviceSize size, VkDeviceSize alignment,
+    VkDeviceSize *offset) {
+  for (uint32_t i = 0; i < block->freeCount; i++) {
+      VulkanMemoryRange *range = &block->freeRanges[i];
+      VkDeviceSize start = align_up(range->offset, alignment);
+      if (start + size > range->offset + range->size) {
+          continue;
+      }
+      if (!block_carve_range(block, i, start, size)) {
+          return 0;
+      }
+      *offset = start;
+      return 1;
+  }
+  return 0;
+}
+
+// Ring pools: allocates exactly at offset if that space is free
+static int block_alloc_at(VulkanMemoryBlock *block, VkDeviceSize offset, VkDeviceSize size) {
+  for (uint32_t i = 0; i < block->freeCount && block->freeRanges[i].offset <= offset; i++) {
+      const VulkanMemoryRange *range = &block->freeRanges[i];
+      if (offset + size <= range->offset + range->size) {
+          return block_carve_range(block, i, offset, size);
+      }
+  }
+  return 0;
+}
+
+static void block_free_range(VulkanMemoryBlock *block, VkDeviceSize offset, VkDeviceSize size) {
+  uint32_t i = 0;
+  while (i < block->freeCount && block->freeRanges[i].offset < offset) {
+      i++;
+  }
+  VulkanMemoryRange *prev = i > 0 ? &block->freeRanges[i - 1] : NULL;
+  VulkanMemoryRange *next = i < block->freeCount ? &block->freeRanges[i] : NULL;
+  int joinPrev = prev && prev->offset + prev->size == offset;
+  int joinNext = next && offset + size == next->offset;
+  if (joinPrev && joinNext) {
+      prev->size += size + next->size;
+      memmove(next, next + 1, (block->freeCount - i - 1) * sizeof(VulkanMemoryRange));
+      block->freeCount--;
+  } else if (joinPrev) {
+      prev->size += size;
+  } else if (joinNext) {
+      next->offset = offset;
+      next->size += size;
+  } else if (!block_insert_range(block, i, offset, size)) {
+      // Out of host memory for the free list: the range leaks until the
+      // block empties and is reset below
+  }
+  if (block->allocationCount == 0) {
+      block->freeRanges[0].offset = 0;
+      block->freeRanges[0].size = block->size;
+      block->freeCount = 1;
+  }
+}
+
+static VkResult pool_allocate(VulkanMemoryPool *pool, const VkMemoryRequirements *req, VulkanAllocation *out) {
+  if (!(req->memoryTypeBits & (1u << pool->memoryTypeIndex))) {
+      return VK_ERROR_FEATURE_NOT_PRESENT; // Resource cannot live in this pool's memory type
+  }
+  VkDeviceSize alignment = req->alignment > pool->granularity ? req->alignment : pool->granularity;
+  VkDeviceSize size = align_up(req->size, pool->granularity);
+  VulkanMemoryBlock *block = NULL;
+  VkDeviceSize offset = 0;
+  VkResult result;
+
+  if (pool->kind == VULKAN_POOL_FREE_LIST) {
+      if (size > pool->blockSize / 2) {
+          // Oversized resources get a block of their own instead of wasting most of a shared one
+          result = pool_add_block(pool, size, &block);
+          if (result != VK_SUCCESS) {
+              return result;
+          }
+          block->dedicated = 1;
+          block->freeCount = 0;
+      } else {
+          for (uint32_t i = 0; i < pool->blockCount && !block; i++) {
+              if (!pool->blocks[i]->dedicated && block_alloc_free_list(pool->blocks[i], size, alignment, &offset)) {
+                  block = pool->blocks[i];
+              }
+          }
+          if (!block) {
+              result = pool_add_block(pool, pool->blockSize, &block);
+              if (result != VK_SUCCESS) {
+                  return result;
+              }
+              if (!block_alloc_free_list(block, size, alignment, &offset)) {
+                  return VK_ERROR_OUT_OF_HOST_MEMORY;
+              }
+          }
+      }
+  } else if (pool->kind == VULKAN_POOL_RING) {
+      if (size > pool->blockSize) {
+          return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+      }
+      if (pool->blockCount == 0) {
+          result = pool_add_block(pool, pool->blockSize, &block);
+          if (result != VK_SUCCESS) {
+              return result;
+          }
+      }
+      // Continue at the head, or wrap around to the start. Either way only
+      // memory whose resources have been destroyed is reused: callers destroy
+      // a frame's resources once its fence has signalled, and a ring still
+      // full of live ones is out of memory rather than silently aliased.
+      block = pool->blocks[0];
+      offset = align_up(block->head, alignment);
+      if (offset + size > block->size || !block_alloc_at(block, offset, size)) {
+          offset = 0;
+          if (!block_alloc_at(block, 0, size)) {
+              return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+          }
+      }
+      block->head = offset + size;
+  } else {
+      if (size > pool->blockSize) {
+          return VK_ERROR_OUT_OF_DEVICE_MEMORY;
+      }
+      for (uint32_t i = 0; i < pool->blockCount && !block; i++) {
+          VkDeviceSize start = align_up(pool->blocks[i]->head, alignment);
+          if (start + size <= pool->blocks[i]->size) {
+              block = pool->blocks[i];
+              offset = start;
+          }
+      }
+      if (!block) {
+          result = pool_add_block(pool, pool->blockSize, &block);
+          if (result != VK_SUCCESS) {
+              return result;
+          }
+          offset = 0;
+      }
+      block->head = offset + size;
+  }
+
+  block->usedBytes += size;
+  block->allocationCount++;
+  pool->refs++;
+  pool->allocator->refs++;
+  out->pool = pool;
+  out->block = block;
+  out->offset = offset;
+  out->size = size;
+  return VK_SUCCESS;
+}
+
+static void free_allocation(VulkanAllocation *allocation) {
+  VulkanMemoryPool *pool = allocation->pool;
+  if (!pool) {
+      return;
+  }
+  VulkanMemoryBlock *block = allocation->block;
+  VulkanAllocator *allocator = pool->allocator;
+  block->usedBytes -= allocation->size;
+  block->allocationCount--;
+  if (block->dedicated) {
+      pool_remove_block(pool, block);
+  } else if (pool->kind == VULKAN_POOL_FREE_LIST) {
+      block_free_range(block, allocation->offset, allocation->size);
+      if (block->allocationCount == 0 && pool->blockCount > 1) {
+          pool_remove_block(pool, block); // Keep one empty block around to avoid churn
+      }
+  } else if (pool->kind == VULKAN_POOL_RING) {
+      block_free_range(block, allocation->offset, allocation->size);
+  } else if (block->allocationCount == 0) {
+      block->head = 0;
+  }
+  memset(allocation, 0, sizeof(*allocation));
+  if (pool->custom) {
+      pool_unref(pool);
+  } else {
+      pool->refs--;
+  }
+  allocator_unref(allocator);
+}
+
+// Picks the pool for a resource: the explicit pool if given, otherwise the
+// default free-list pool of the first memory type matching the flags
+static VkResult allocate_memory(VulkanAllocator *allocator, VulkanMemoryPool *pool, const VkMemoryRequirements *req,
+    VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred, int optimalImage, VulkanAllocation *out) {
+  if (!pool) {
+      int typeIndex = find_memory_type(&allocator->memoryProperties, req->memoryTypeBits, required, preferred);
+      if (typeIndex < 0) {
+          return VK_ERROR_FEATURE_NOT_PRESENT;
+      }
+      VulkanMemoryPool **slot = &allocator->defaultPools[typeIndex][optimalImage ? 1 : 0];
+      if (!*slot) {
+          *slot = new_memory_pool(allocator, (uint32_t)typeIndex, VULKAN_POOL_FREE_LIST, allocator->blockSize, 0);
+          if (!*slot) {
+              return VK_ERROR_OUT_OF_HOST_MEMORY;
+          }
+      }
+      pool = *slot;
+  }
+  return pool_allocate(pool, req, out);
+}
+
+static VulkanAllocator *check_allocator(lua_State *L, int idx) {
+  VulkanAllocatorHandle *handle = (VulkanAllocatorHandle *)luaL_checkudata(L, idx, "VulkanAllocator");
+  if (!handle->allocator) {
+      luaL_error(L, "Allocator has been destroyed");
+  }
+  return handle->allocator;
+}
+
+static VulkanMemoryPool *check_memory_pool(lua_State *L, int idx) {
+  VulkanMemoryPoolHandle *handle = (VulkanMemoryPoolHandle *)luaL_checkudata(L, idx, "VulkanMemoryPool");
+  if (!handle->pool) {
+      luaL_error(L, "Memory pool has been destroyed");
+  }
+  return handle->pool;
+}
+
+// VK_ERROR_FEATURE_NOT_PRESENT is what allocate_memory returns when no memory
+// type (or not the pool's) can hold the resource
+static int push_allocation_error(lua_State *L, const char *what, VkResult result) {
+  if (result == VK_ERROR_FEATURE_NOT_PRESENT) {
+      lua_pushnil(L);
+      lua_pushstring(L, "No compatible memory type for the requested properties or pool");
+      lua_pushinteger(L, result);
+      return 3;
+  }
+  return push_vk_error(L, what, result);
+}
+
+static const char *pool_kind_names[] = { "freelist", "linear", "ring", NULL };
+
+// vk_CreateAllocator(physicalDevice, device[, {blockSize}])
+static int l_vk_CreateAllocator(lua_State *L) {
+  VulkanPhysicalDevice *pdptr = (VulkanPhysicalDevice *)luaL_checkudata(L, 1, "VulkanPhysicalDevice");
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 2, "VulkanDevice");
+  VkDeviceSize blockSize = ALLOCATOR_DEFAULT_BLOCK_SIZE;
+  if (lua_istable(L, 3)) {
+      lua_getfield(L, 3, "blockSize");
+      blockSize = (VkDeviceSize)luaL_optinteger(L, -1, ALLOCATOR_DEFAULT_BLOCK_SIZE);
+      lua_pop(L, 1);
+  }
+
+  VulkanAllocator *allocator = heap_alloc(sizeof(VulkanAllocator));
+  if (!allocator) {
+      return push_vk_error(L, "vk_CreateAllocator", VK_ERROR_OUT_OF_HOST_MEMORY);
+  }
+  memset(allocator, 0, sizeof(*allocator));
+  VkPhysicalDeviceProperties props;
+  pdptr->vki->vkGetPhysicalDeviceProperties(pdptr->physicalDevice, &props);
+  pdptr->vki->vkGetPhysicalDeviceMemoryProperties(pdptr->physicalDevice, &allocator->memoryProperties);
+  allocator->device = dptr->device;
+  allocator->vkd = dptr->vkd;
+  allocator->bufferImageGranularity = props.limits.bufferImageGranularity;
+  allocator->nonCoherentAtomSize = props.limits.nonCoherentAtomSize;
+  allocator->blockSize = blockSize;
+  allocator->refs = 1;
+
+  VulkanAllocatorHandle *handle = (VulkanAllocatorHandle *)lua_newuserdata(L, sizeof(VulkanAllocatorHandle));
+  handle->allocator = allocator;
+  luaL_getmetatable(L, "VulkanAllocator");
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+static int l_vk_DestroyAllocator(lua_State *L) {
+  VulkanAllocatorHandle *handle = (VulkanAllocatorHandle *)luaL_checkudata(L, 1, "VulkanAllocator");
+  if (handle->allocator) {
+      allocator_unref(handle->allocator);
+      handle->allocator = NULL;
+  }
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// vk_CreateMemoryPool(allocator, {kind, memoryProperties, memoryTypeBits, blockSize})
+static int l_vk_CreateMemoryPool(lua_State *L) {
+  VulkanAllocator *allocator = check_allocator(L, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  lua_getfield(L, 2, "kind");
+  int kind = luaL_checkoption(L, -1, "freelist", pool_kind_names);
+  lua_getfield(L, 2, "memoryProperties");
+  VkMemoryPropertyFlags required = (VkMemoryPropertyFlags)luaL_optinteger(L, -1, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  lua_getfield(L, 2, "memoryTypeBits");
+  uint32_t typeBits = (uint32_t)luaL_optinteger(L, -1, 0xffffffff);
+  lua_getfield(L, 2, "blockSize");
+  VkDeviceSize blockSize = (VkDeviceSize)luaL_optinteger(L, -1, (lua_Integer)allocator->blockSize);
+  lua_pop(L, 4);
+
+  int typeIndex = find_memory_type(&allocator->memoryProperties, typeBits, required, 0);
+  if (typeIndex < 0) {
+      lua_pushnil(L);
+      lua_pushstring(L, "No memory type with the requested properties");
+      return 2;
+  }
+  VulkanMemoryPool *pool = new_memory_pool(allocator, (uint32_t)typeIndex, kind, blockSize, 1);
+  if (!pool) {
+      return push_vk_error(L, "vk_CreateMemoryPool", VK_ERROR_OUT_OF_HOST_MEMORY);
+  }
+  allocator->refs++;
+
+  VulkanMemoryPoolHandle *handle = (VulkanMemoryPoolHandle *)lua_newuserdata(L, sizeof(VulkanMemoryPoolHandle));
+  handle->pool = pool;
+  luaL_getmetatable(L, "VulkanMemoryPool");
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+// Linear and ring pools only: rewinds every block. Resources still placed in
+// a linear pool keep their memory but will be overwritten by new allocations;
+// a ring only moves its write position back to the start and still never
+// reuses the memory of live resources.
+static int l_vk_ResetMemoryPool(lua_State *L) {
+  VulkanMemoryPool *pool = check_memory_pool(L, 1);
+  if (pool->kind == VULKAN_POOL_FREE_LIST) {
+      lua_pushnil(L);
+      lua_pushstring(L, "Free-list pools cannot be reset");
+      return 2;
+  }
+  for (uint32_t i = 0; i < pool->blockCount; i++) {
+      pool->blocks[i]->head = 0;
+  }
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+static int l_vk_DestroyMemoryPool(lua_State *L) {
+  VulkanMemoryPoolHandle *handle = (VulkanMemoryPoolHandle *)luaL_checkudata(L, 1, "VulkanMemoryPool");
+  if (handle->pool) {
+      pool_unref(handle->pool); // Blocks are freed once the last resource in the pool is
+      handle->pool = NULL;
+  }
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+static void push_pool_stats(lua_State *L, const VulkanMemoryPool *pool) {
+  VkDeviceSize blockBytes = 0, usedBytes = 0, freeBytes = 0, largestFree = 0;
+  uint32_t allocationCount = 0, freeRangeCount = 0;
+  for (uint32_t i = 0; i < pool->blockCount; i++) {
+      const VulkanMemoryBlock *block = pool->blocks[i];
+      blockBytes += block->size;
+      usedBytes += block->usedBytes;
+      allocationCount += block->allocationCount;
+      if (pool->kind != VULKAN_POOL_LINEAR) {
+          for (uint32_t j = 0; j < block->freeCount; j++) {
+              freeBytes += block->freeRanges[j].size;
+              if (block->freeRanges[j].size > largestFree) largestFree = block->freeRanges[j].size;
+          }
+          freeRangeCount += block->freeCount;
+      } else if (block->head < block->size) {
+          freeBytes += block->size - block->head;
+          if (block->size - block->head > largestFree) largestFree = block->size - block->head;
+          freeRangeCount++;
+      }
+  }
+
+  lua_newtable(L);
+  lua_pushstring(L, pool_kind_names[pool->kind]);
+  lua_setfield(L, -2, "kind");
+  lua_pushboolean(L, pool->custom);
+  lua_setfield(L, -2, "custom");
+  lua_pushinteger(L, pool->memoryTypeIndex);
+  lua_setfield(L, -2, "memoryTypeIndex");
+  lua_pushinteger(L, pool->blockCount);
+  lua_setfield(L, -2, "blockCount");
+  lua_pushinteger(L, (lua_Integer)blockBytes);
+  lua_setfield(L, -2, "blockBytes");
+  lua_pushinteger(L, (lua_Integer)usedBytes);
+  lua_setfield(L, -2, "usedBytes");
+  lua_pushinteger(L, allocationCount);
+  lua_setfield(L, -2, "allocationCount");
+  lua_pushinteger(L, (lua_Integer)freeBytes);
+  lua_setfield(L, -2, "freeBytes");
+  lua_pushinteger(L, freeRangeCount);
+  lua_setfield(L, -2, "freeRangeCount");
+  lua_pushinteger(L, (lua_Integer)largestFree);
+  lua_setfield(L, -2, "largestFreeRange");
+  // 0 when all free memory is contiguous, approaching 1 as it splinters
+  lua_pushnumber(L, freeBytes > 0 ? 1.0 - (double)largestFree / (double)freeBytes : 0.0);
+  lua_setfield(L, -2, "fragmentation");
+}
+
+// vk_GetAllocatorStats(allocator) returns one table per default pool in use
+static int l_vk_GetAllocatorStats(lua_State *L) {
+  VulkanAllocator *allocator = check_allocator(L, 1);
+  lua_newtable(L);
+  int n = 0;
+  for (uint32_t i = 0; i < VK_MAX_MEMORY_TYPES; i++) {
+      for (int j = 0; j < 2; j++) {
+          if (allocator->defaultPools[i][j]) {
+              push_pool_stats(L, allocator->defaultPools[i][j]);
+              lua_pushboolean(L, j == 1);
+              lua_setfield(L, -2, "optimalImages");
+              lua_rawseti(L, -2, ++n);
+          }
+      }
+  }
+  return 1;
+}
+
+static int l_vk_GetMemoryPoolStats(lua_State *L) {
+  push_pool_stats(L, check_memory_pool(L, 1));
+  return 1;
+}
+
+// Reads the memory fields shared by vk_CreateBuffer and vk_CreateImage
+static VulkanMemoryPool *opt_pool_field(lua_State *L, int idx, VkMemoryPropertyFlags *required,
+    VkMemoryPropertyFlags *preferred) {
+  lua_getfield(L, idx, "memoryProperties");
+  *required = (VkMemoryPropertyFlags)luaL_optinteger(L, -1, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+  lua_getfield(L, idx, "preferredMemoryProperties");
+  *preferred = (VkMemoryPropertyFlags)luaL_optinteger(L, -1, 0);
+  lua_getfield(L, idx, "pool");
+  VulkanMemoryPool *pool = lua_isnil(L, -1) ? NULL : check_memory_pool(L, -1);
+  lua_pop(L, 3);
+  return pool;
+}
+
+// vk_CreateBuffer(allocator, {size, usage, memoryProperties, preferredMemoryProperties, pool})
+static int l_vk_CreateBuffer(lua_State *L) {
+  VulkanAllocator *allocator = check_allocator(L, 1);
+  const VulkanDeviceDispatch *vkd = allocator->vkd;
+  luaL_checktype(L, 2, LUA_TTABLE);
+  lua_getfield(L, 2, "size");
+  VkDeviceSize size = (VkDeviceSize)luaL_checkinteger(L, -1);
+  lua_getfield(L, 2, "usage");
+  VkBufferUsageFlags usage = (VkBufferUsageFlags)luaL_checkinteger(L, -1);
+  lua_pop(L, 2);
+  VkMemoryPropertyFlags required, preferred;
+  VulkanMemoryPool *pool = opt_pool_field(L, 2, &required, &preferred);
+
+  VkBufferCreateInfo bufferInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .size = size,
+      .usage = usage,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+  };
+  VkBuffer buffer;
+  VkResult result = vkd->vkCreateBuffer(allocator->device, &bufferInfo, NULL, &buffer);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkCreateBuffer", result);
+  }
+  VkMemoryRequirements req;
+  vkd->vkGetBufferMemoryRequirements(allocator->device, buffer, &req);
+  VulkanAllocation allocation;
+  result = allocate_memory(allocator, pool, &req, required, preferred, 0, &allocation);
+  if (result == VK_SUCCESS) {
+      result = vkd->vkBindBufferMemory(allocator->device, buffer, allocation.block->memory, allocation.offset);
+      if (result != VK_SUCCESS) {
+          free_allocation(&allocation);
+      }
+  }
+  if (result != VK_SUCCESS) {
+      vkd->vkDestroyBuffer(allocator->device, buffer, NULL);
+      return push_allocation_error(L, "vk_CreateBuffer", result);
+  }
+
+  VulkanBuffer *bptr = (VulkanBuffer *)lua_newuserdata(L, sizeof(VulkanBuffer));
+  bptr->buffer = buffer;
+  bptr->device = allocator->device;
+  bptr->vkd = allocator->vkd;
+  bptr->size = size;
+  bptr->allocation = allocation;
+  luaL_getmetatable(L, "VulkanBuffer");
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+static void destroy_buffer(VulkanBuffer *bptr) {
+  const VulkanDeviceDispatch *vkd = bptr->vkd;
+  if (bptr->buffer) {
+      vkd->vkDestroyBuffer(bptr->device, bptr->buffer, NULL);
+      bptr->buffer = VK_NULL_HANDLE;
+      free_allocation(&bptr->allocation);
+  }
+}
+
+static int l_vk_DestroyBuffer(lua_State *L) {
+  luaL_checkudata(L, 1, "VulkanDevice");
+  destroy_buffer((VulkanBuffer *)luaL_checkudata(L, 2, "VulkanBuffer"));
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// vk_WriteBuffer(buffer, data[, offset]) copies a string into a host-visible buffer
+static int l_vk_WriteBuffer(lua_State *L) {
+  VulkanBuffer *bptr = (VulkanBuffer *)luaL_checkudata(L, 1, "VulkanBuffer");
+  const VulkanDeviceDispatch *vkd = bptr->vkd;
+  size_t len;
+  const char *data = luaL_checklstring(L, 2, &len);
+  VkDeviceSize offset = (VkDeviceSize)luaL_optinteger(L, 3, 0);
+  VulkanAllocation *allocation = &bptr->allocation;
+  if (!allocation->pool || !allocation->block->mapped) {
+      lua_pushnil(L);
+      lua_pushstring(L, "Buffer memory is not host visible");
+      return 2;
+  }
+  if (offset + len > bptr->size) {
+      lua_pushnil(L);
+      lua_pushstring(L, "Write exceeds buffer size");
+      return 2;
+  }
+  memcpy((uint8_t *)allocation->block->mapped + allocation->offset + offset, data, len);
+
+  VulkanAllocator *allocator = allocation->pool->allocator;
+  if (!(allocator->memoryProperties.memoryTypes[allocation->pool->memoryTypeIndex].propertyFlags &
+        VK_MEMORY_PROPERTY_HOST_COHERENT_BIT)) {
+      VkDeviceSize atom = allocator->nonCoherentAtomSize;
+      VkDeviceSize start = (allocation->offset + offset) / atom * atom;
+      VkDeviceSize end = align_up(allocation->offset + offset + len, atom);
+      VkMappedMemoryRange range = {
+          .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+          .memory = allocation->block->memory,
+          .offset = start,
+          .size = end > allocation->block->size ? VK_WHOLE_SIZE : end - start
+      };
+      vkd->vkFlushMappedMemoryRanges(allocator->device, 1, &range);
+  }
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// vk_CreateImage(allocator, {width, height, format, usage, tiling, mipLevels,
+// memoryProperties, preferredMemoryProperties, pool})
+static void destroy_image(VulkanImage *imgptr);
+
+// Creates the image, binds memory from the allocator and pushes the VulkanImage,
+// or nil and an error
+static int push_new_image(lua_State *L, VulkanAllocator *allocator, VulkanMemoryPool *pool,
+    const VkImageCreateInfo *imageInfo, VkMemoryPropertyFlags required, VkMemoryPropertyFlags preferred,
+    const char *what) {
+  const VulkanDeviceDispatch *vkd = allocator->vkd;
+  VkImage image;
+  VkResult result = vkd->vkCreateImage(allocator->device, imageInfo, NULL, &image);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkCreateImage", result);
+  }
+  VkMemoryRequirements req;
+  vkd->vkGetImageMemoryRequirements(allocator->device, image, &req);
+  VulkanAllocation allocation;
+  result = allocate_memory(allocator, pool, &req, required, preferred,
+      imageInfo->tiling == VK_IMAGE_TILING_OPTIMAL, &allocation);
+  if (result == VK_SUCCESS) {
+      result = vkd->vkBindImageMemory(allocator->device, image, allocation.block->memory, allocation.offset);
+      if (result != VK_SUCCESS) {
+          free_allocation(&allocation);
+      }
+  }
+  if (result != VK_SUCCESS) {
+      vkd->vkDestroyImage(allocator->device, image, NULL);
+      return push_allocation_error(L, what, result);
+  }
+
+  VulkanImage *imgptr = (VulkanImage *)lua_newuserdata(L, sizeof(VulkanImage));
+  memset(imgptr, 0, sizeof(*imgptr));
+  imgptr->image = image;
+  imgptr->device = allocator->device;
+  imgptr->vkd = allocator->vkd;
+  imgptr->allocation = allocation;
+  imgptr->format = imageInfo->format;
+  imgptr->extent.width = imageInfo->extent.width;
+  imgptr->extent.height = imageInfo->extent.height;
+  luaL_getmetatable(L, "VulkanImage");
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+static int l_vk_CreateImage(lua_State *L) {
+  VulkanAllocator *allocator = check_allocator(L, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
+  lua_getfield(L, 2, "width");
+  uint32_t width = (uint32_t)luaL_checkinteger(L, -1);
+  lua_getfield(L, 2, "height");
+  uint32_t height = (uint32_t)luaL_checkinteger(L, -1);
+  lua_getfield(L, 2, "format");
+  VkFormat format = (VkFormat)luaL_checkinteger(L, -1);
+  lua_getfield(L, 2, "usage");
+  VkImageUsageFlags usage = (VkImageUsageFlags)luaL_checkinteger(L, -1);
+  lua_getfield(L, 2, "tiling");
+  VkImageTiling tiling = (VkImageTiling)luaL_optinteger(L, -1, VK_IMAGE_TILING_OPTIMAL);
+  lua_getfield(L, 2, "mipLevels");
+  uint32_t mipLevels = (uint32_t)luaL_optinteger(L, -1, 1);
+  lua_pop(L, 6);
+  VkMemoryPropertyFlags required, preferred;
+  VulkanMemoryPool *pool = opt_pool_field(L, 2, &required, &preferred);
+
+  VkImageCreateInfo imageInfo = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+      .imageType = VK_IMAGE_TYPE_2D,
+      .format = format,
+      .extent = { width, height, 1 },
+      .mipLevels = mipLevels,
+      .arrayLayers = 1,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .tiling = tiling,
+      .usage = usage,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+  };
+  return push_new_image(L, allocator, pool, &imageInfo, required, preferred, "vk_CreateImage");
+}
+
+// vk_CreateRenderTarget(allocator, {width, height, format[, usage]}) -> image, imageView
+// A device-local color image with its own memory, usable as a color
+// attachment and as the source of vk_CmdReadbackImage
+static int l_vk_CreateRenderTarget(lua_State *L) {
+  VulkanAllocator *allocator = check_allocator(L, 1);
+  const VulkanDeviceDispatch *vkd = allocator->vkd;
+  luaL_checktype(L, 2, LUA_TTABLE);
+  lua_getfield(L, 2, "width");
+  uint32_t width = (uint32_t)luaL_checkinteger(L, -1);
+  lua_getfield(L, 2, "height");
+  uint32_t height = (uint32_t)luaL_checkinteger(L, -1);
+  lua_getfield(L, 2, "format");
+  VkFormat format = (VkFormat)luaL_optinteger(L, -1, VK_FORMAT_R8G8B8A8_UNORM);
+  lua_getfield(L, 2, "usage");
+  VkImageUsageFlags usage = (VkImageUsageFlags)luaL_optinteger(L, -1,
+      VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_SAMPLED_BIT);
+  lua_pop(L, 4);
+
+  VkImageCreateInfo imageInfo = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+      .imageType = VK_IMAGE_TYPE_2D,
+      .format = format,
+      .extent = { width, height, 1 },
+      .mipLevels = 1,
+      .arrayLayers = 1,
+      .samples = VK_SAMPLE_COUNT_1_BIT,
+      .tiling = VK_IMAGE_TILING_OPTIMAL,
+      .usage = usage,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+      .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+  };
+  int pushed = push_new_image(L, allocator, NULL, &imageInfo, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0,
+      "vk_CreateRenderTarget");
+  if (pushed != 1) {
+      return pushed;
+  }
+  VulkanImage *imgptr = (VulkanImage *)lua_touserdata(L, -1);
+
+  VkImageViewCreateInfo viewInfo = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+      .image = imgptr->image,
+      .viewType = VK_IMAGE_VIEW_TYPE_2D,
+      .format = format,
+      .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+  };
+  VkImageView imageView;
+  VkResult result = vkd->vkCreateImageView(allocator->device, &viewInfo, NULL, &imageView);
+  if (result != VK_SUCCESS) {
+      destroy_image(imgptr);
+      return push_vk_error(L, "vkCreateImageView", result);
+  }
+  VulkanImageView *viewptr = (VulkanImageView *)lua_newuserdata(L, sizeof(VulkanImageView));
+  viewptr->imageView = imageView;
+  viewptr->device = allocator->device;
+  viewptr->vkd = allocator->vkd;
+  luaL_getmetatable(L, "VulkanImageView");
+  lua_setmetatable(L, -2);
+  return 2;
+}
+
+static void destroy_image(VulkanImage *imgptr) {
+  const VulkanDeviceDispatch *vkd = imgptr->vkd;
+  if (imgptr->image && imgptr->allocation.pool) {
+      vkd->vkDestroyImage(imgptr->device, imgptr->image, NULL);
+      imgptr->image = VK_NULL_HANDLE;
+      free_allocation(&imgptr->allocation);
+  }
+}
+
+// Swapchain images are owned by the swapchain and left alone
+static int l_vk_DestroyImage(lua_State *L) {
+  luaL_checkudata(L, 1, "VulkanDevice");
+  destroy_image((VulkanImage *)luaL_checkudata(L, 2, "VulkanImage"));
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// Frame driver: owns the per-frame command buffers and sync objects and runs
+// wait -> acquire -> record -> submit -> present natively. Lua is only entered
+// to record the frame. The command buffer userdata handed to the callback and
+// the objects the driver depends on are kept alive in its environment table.
+static double elapsed_ms(uint64_t from, uint64_t to) {
+  return (double)(to - from) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+static void destroy_frame_driver(VulkanFrameDriver *fd) {
+  const VulkanDeviceDispatch *vkd = fd->vkd;
+  if (!fd->device) {
+      return;
+  }
+  for (uint32_t i = 0; i < fd->framesInFlight; i++) {
+      VulkanFrameSlot *frame = &fd->frames[i];
+      if (frame->inFlight) {
+          vkd->vkWaitForFences(fd->device, 1, &frame->inFlight, VK_TRUE, UINT64_MAX);
+          vkd->vkDestroyFence(fd->device, frame->inFlight, NULL);
+      }
+      if (frame->imageAvailable) vkd->vkDestroySemaphore(fd->device, frame->imageAvailable, NULL);
+      if (frame->commandBuffer) vkd->vkFreeCommandBuffers(fd->device, fd->commandPool, 1, &frame->commandBuffer);
+  }
+  for (uint32_t i = 0; i < VULKAN_FRAME_DRIVER_MAX_IMAGES; i++) {
+      if (fd->renderFinished[i]) vkd->vkDestroySemaphore(fd->device, fd->renderFinished[i], NULL);
+  }
+  memset(fd->frames, 0, sizeof(fd->frames));
+  memset(fd->renderFinished, 0, sizeof(fd->renderFinished));
+  memset(fd->imagesInFlight, 0, sizeof(fd->imagesInFlight));
+  fd->device = VK_NULL_HANDLE;
+}
+
+static int l_vk_CreateFrameDriver(lua_State *L) {
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
+  luaL_checktype(L, 2, LUA_TTABLE);
+
+  lua_getfield(L, 2, "swapchain");
+  VulkanSwapchain *swptr = (VulkanSwapchain *)luaL_checkudata(L, -1, "VulkanSwapchain");
+  lua_getfield(L, 2, "graphicsQueue");
+  VulkanQueue *gqptr = (VulkanQueue *)luaL_checkudata(L, -1, "VulkanQueue");
+  lua_getfield(L, 2, "presentQueue");
+  VulkanQueue *pqptr = lua_isnil(L, -1) ? gqptr : (VulkanQueue *)luaL_checkudata(L, -1, "VulkanQueue");
+  lua_getfield(L, 2, "commandPool");
+  VulkanCommandPool *cpool = (VulkanCommandPool *)luaL_checkudata(L, -1, "VulkanCommandPool");
+  lua_getfield(L, 2, "framesInFlight");
+  lua_Integer framesInFlight = luaL_optinteger(L, -1, 2);
+  lua_getfield(L, 2, "onDemand");
+  int onDemand = lua_toboolean(L, -1);
+  lua_getfield(L, 2, "presentWait");
+  int presentWait = lua_toboolean(L, -1);
+  lua_getfield(L, 2, "maxFrameLatency");
+  lua_Integer maxFrameLatency = luaL_optinteger(L, -1, 1);
+  lua_getfield(L, 2, "targetFps");
+  lua_Number targetFps = luaL_optnumber(L, -1, 0);
+  lua_pop(L, 9);
+
+  if (framesInFlight < 1 || framesInFlight > VULKAN_FRAME_DRIVER_MAX_FRAMES) {
+      lua_pushnil(L);
+      lua_pushfstring(L, "framesInFlight must be between 1 and %d", VULKAN_FRAME_DRIVER_MAX_FRAMES);
+      return 2;
+  }
+  if (maxFrameLatency < 1 || maxFrameLatency >= VULKAN_FRAME_TIMING_HISTORY) {
+      lua_pushnil(L);
+      lua_pushfstring(L, "maxFrameLatency must be between 1 and %d", VULKAN_FRAME_TIMING_HISTORY - 1);
+      return 2;
+  }
+  PFN_vkWaitForPresentKHR waitForPresent = NULL;
+  if (presentWait) {
+      waitForPresent = vkd->vkWaitForPresentKHR;
+      if (!waitForPresent) {
+          lua_pushnil(L);
+          lua_pushstring(L, "presentWait needs a device created with presentWait and VK_KHR_present_wait");
+          return 2;
+      }
+  }
+  uint32_t imageCount = 0;
+  VkResult result = vkd->vkGetSwapchainImagesKHR(dptr->device, swptr->swapchain, &imageCount, NULL);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkGetSwapchainImagesKHR", result);
+  }
+  if (imageCount == 0 || imageCount > VULKAN_FRAME_DRIVER_MAX_IMAGES) {
+      lua_pushnil(L);
+      lua_pushstring(L, "Unsupported swapchain image count");
+      return 2;
+  }
+
+  VulkanFrameDriver *fd = (VulkanFrameDriver *)lua_newuserdata(L, sizeof(VulkanFrameDriver));
+  memset(fd, 0, sizeof(*fd));
+  fd->device = dptr->device;
+  fd->vkd = dptr->vkd;
+  fd->swapchain = swptr;
+  fd->graphicsQueue = gqptr->queue;
+  fd->presentQueue = pqptr->queue;
+  fd->commandPool = cpool->commandPool;
+  fd->framesInFlight = (uint32_t)framesInFlight;
+  fd->onDemand = onDemand;
+  fd->dirtyFrames = 1; // The first frame always renders
+  fd->waitForPresent = waitForPresent;
+  fd->maxFrameLatency = (uint32_t)maxFrameLatency;
+  fd->presentIdSwapchain = swptr->swapchain;
+  fd->framePeriod = targetFps > 0 ? (uint64_t)((double)SDL_GetPerformanceFrequency() / targetFps) : 0;
+  luaL_getmetatable(L, "VulkanFrameDriver");
+  lua_setmetatable(L, -2);
+
+  VkSemaphoreCreateInfo semaphoreInfo = { .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+  for (uint32_t i = 0; i < imageCount; i++) {
+      result = vkd->vkCreateSemaphore(fd->device, &semaphoreInfo, NULL, &fd->renderFinished[i]);
+      if (result != VK_SUCCESS) {
+          destroy_frame_driver(fd);
+          return push_vk_error(L, "vkCreateSemaphore", result);
+      }
+  }
+
+  lua_newtable(L); // Environment: command buffer userdata by slot, plus keep-alive references
+  for (uint32_t i = 0; i < fd->framesInFlight; i++) {
+      VulkanFrameSlot *frame = &fd->frames[i];
+      VkFenceCreateInfo fenceInfo = {
+          .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+          .flags = VK_FENCE_CREATE_SIGNALED_BIT
+      };
+      VkCommandBufferAllocateInfo allocInfo = {
+          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+          .commandPool = fd->commandPool,
+          .level = VK_COMMAND_BUFFER_LEVEL_PRIMARY,
+          .commandBufferCount = 1
+      };
+
+      const char *what = "vkCreateSemaphore";
+      result = vkd->vkCreateSemaphore(fd->device, &semaphoreInfo, NULL, &frame->imageAvailable);
+      if (result == VK_SUCCESS) {
+          what = "vkCreateFence";
+          result = vkd->vkCreateFence(fd->device, &fenceInfo, NULL, &frame->inFlight);
+      }
+      if (result == VK_SUCCESS) {
+          what = "vkAllocateCommandBuffers";
+          result = vkd->vkAllocateCommandBuffers(fd->device, &allocInfo, &frame->commandBuffer);
+      }
+      if (result != VK_SUCCESS) {
+          destroy_frame_driver(fd);
+          return push_vk_error(L, what, result);
+      }
+
+      VulkanCommandBuffer *cbuf = (VulkanCommandBuffer *)lua_newuserdata(L, sizeof(VulkanCommandBuffer));
+      cbuf->commandBuffer = frame->commandBuffer;
+      cbuf->vkd = fd->vkd;
+      luaL_getmetatable(L, "VulkanCommandBuffer");
+      lua_setmetatable(L, -2);
+      lua_rawseti(L, -2, i + 1);
+  }
+  lua_pushvalue(L, 1);
+  lua_setfield(L, -2, "device");
+  lua_getfield(L, 2, "swapchain");
+  lua_setfield(L, -2, "swapchain");
+  lua_getfield(L, 2, "commandPool");
+  lua_setfield(L, -2, "commandPool");
+  lua_setfenv(L, -2);
+  return 1;
+}
+
+// After a failed submit nothing waits on the slot's acquire semaphore, which
+// stays signaled, and the fence reset for the submit would never signal
+// again; both are replaced (the fence by a signaled one so the next wait on
+// the slot returns). The acquired image is never presented, so the swapchain
+// is marked stale and the next run asks for it to be recreated.
+static void frame_driver_abandon_frame(VulkanFrameDriver *fd, VulkanFrameSlot *frame, uint32_t imageIndex) {
+  const VulkanDeviceDispatch *vkd = fd->vkd;
+  VkFenceCreateInfo fenceInfo = {
+      .sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO,
+      .flags = VK_FENCE_CREATE_SIGNALED_BIT
+  };
+  VkFence fence = VK_NULL_HANDLE;
+  vkd->vkCreateFence(fd->device, &fenceInfo, NULL, &fence);
+  for (uint32_t i = 0; i < VULKAN_FRAME_DRIVER_MAX_IMAGES; i++) {
+      if (fd->imagesInFlight[i] == frame->inFlight) {
+          fd->imagesInFlight[i] = fence;
+      }
+  }
+  fd->imagesInFlight[imageIndex] = VK_NULL_HANDLE; // Nothing was submitted for it
+  vkd->vkDestroyFence(fd->device, frame->inFlight, NULL);
+  frame->inFlight = fence;
+
+  VkSemaphoreCreateInfo semaphoreInfo = { .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+  VkSemaphore semaphore = VK_NULL_HANDLE;
+  vkd->vkCreateSemaphore(fd->device, &semaphoreInfo, NULL, &semaphore);
+  vkd->vkDestroySemaphore(fd->device, frame->imageAvailable, NULL);
+  frame->imageAvailable = semaphore;
+
+  fd->staleSwapchain = fd->swapchain->swapchain;
+  if (fd->dirtyFrames == 0) {
+      fd->dirtyFrames = 1;
+  }
+}
+
+// vk_FrameDriverRunFrame(driver, record) calls record(cmdBuffer, imageIndex, frameIndex)
+// with cmdBuffer already begun. Returns true, result (VK_SUBOPTIMAL_KHR if the
+// swapchain should be recreated) or nil, errMsg, result. An onDemand driver
+// with nothing dirty returns true, VK_NOT_READY before waiting or acquiring.
+static int l_vk_FrameDriverRunFrame(lua_State *L) {
+  VulkanFrameDriver *fd = (VulkanFrameDriver *)luaL_checkudata(L, 1, "VulkanFrameDriver");
+  const VulkanDeviceDispatch *vkd = fd->vkd;
+  luaL_checktype(L, 2, LUA_TFUNCTION);
+  if (!fd->device) {
+      return luaL_error(L, "Frame driver has been destroyed");
+  }
+  if (fd->staleSwapchain != VK_NULL_HANDLE) {
+      if (fd->staleSwapchain == fd->swapchain->swapchain) {
+          lua_pushnil(L);
+          lua_pushstring(L, "Swapchain must be recreated after a failed submit");
+          lua_pushinteger(L, VK_ERROR_OUT_OF_DATE_KHR);
+          return 3;
+      }
+      fd->staleSwapchain = VK_NULL_HANDLE;
+  }
+  if (fd->onDemand && fd->dirtyFrames == 0) {
+      fd->stats.skippedFrames++;
+      fd->lastFrameStart = 0; // Idle time is not a frame interval
+      fd->nextDeadline = 0;
+      lua_pushboolean(L, true);
+      lua_pushinteger(L, VK_NOT_READY);
+      return 2;
+  }
+
+  VulkanFrameSlot *frame = &fd->frames[fd->currentFrame];
+  uint64_t start = SDL_GetPerformanceCounter();
+
+  VkResult result = vkd->vkWaitForFences(fd->device, 1, &frame->inFlight, VK_TRUE, UINT64_MAX);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkWaitForFences", result);
+  }
+  uint64_t waited = SDL_GetPerformanceCounter();
+
+  uint32_t imageIndex;
+  result = vkd->vkAcquireNextImageKHR(fd->device, fd->swapchain->swapchain, UINT64_MAX, frame->imageAvailable,
+      VK_NULL_HANDLE, &imageIndex);
+  if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+      return push_vk_error(L, "vkAcquireNextImageKHR", result);
+  }
+  VkResult acquireResult = result;
+  if (imageIndex >= VULKAN_FRAME_DRIVER_MAX_IMAGES) {
+      return luaL_error(L, "Swapchain image index %d exceeds the frame driver limit", (int)imageIndex);
+  }
+
+  // With fewer frames in flight than images, the image may still be in use
+  // by an older frame submitted from a different slot
+  VkFence imageFence = fd->imagesInFlight[imageIndex];
+  uint64_t imageWaitTicks = 0;
+  if (imageFence != VK_NULL_HANDLE && imageFence != frame->inFlight) {
+      uint64_t imageWaitStart = SDL_GetPerformanceCounter();
+      vkd->vkWaitForFences(fd->device, 1, &imageFence, VK_TRUE, UINT64_MAX);
+      imageWaitTicks = SDL_GetPerformanceCounter() - imageWaitStart;
+  }
+  fd->imagesInFlight[imageIndex] = frame->inFlight;
+
+  // Recreation can grow the image count
+  VkSemaphore *renderFinished = &fd->renderFinished[imageIndex];
+  if (*renderFinished == VK_NULL_HANDLE) {
+      VkSemaphoreCreateInfo semaphoreInfo = { .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+      result = vkd->vkCreateSemaphore(fd->device, &semaphoreInfo, NULL, renderFinished);
+      if (result != VK_SUCCESS) {
+          return push_vk_error(L, "vkCreateSemaphore", result);
+      }
+  }
+  uint64_t acquired = SDL_GetPerformanceCounter();
+
+  VkCommandBufferBeginInfo beginInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+  };
+  vkd->vkResetCommandBuffer(frame->commandBuffer, 0);
+  vkd->vkBeginCommandBuffer(frame->commandBuffer, &beginInfo);
+
+  lua_pushvalue(L, 2);
+  lua_getfenv(L, 1);
+  lua_rawgeti(L, -1, fd->currentFrame + 1);
+  lua_remove(L, -2);
+  lua_pushinteger(L, imageIndex);
+  lua_pushinteger(L, fd->currentFrame + 1);
+  fd->recording = 1;
+  int status = lua_pcall(L, 3, 0, 0);
+  fd->recording = 0;
+
+  vkd->vkEndCommandBuffer(frame->commandBuffer);
+  uint64_t recorded = SDL_GetPerformanceCounter();
+
+  // If the callback failed, still submit (without the command buffer) and
+  // present, so the acquire semaphore is waited on, the fence signals and the
+  // image goes back to the swapchain; otherwise the next use of this slot
+  // would deadlock, and enough failed frames would leave every image acquired
+  VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  VkSubmitInfo submitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .waitSemaphoreCount = 1,
+      .pWaitSemaphores = &frame->imageAvailable,
+      .pWaitDstStageMask = &waitStage,
+      .commandBufferCount = status == 0 ? 1 : 0,
+      .pCommandBuffers = &frame->commandBuffer,
+      .signalSemaphoreCount = 1,
+      .pSignalSemaphores = renderFinished
+  };
+  vkd->vkResetFences(fd->device, 1, &frame->inFlight);
+  result = vkd->vkQueueSubmit(fd->graphicsQueue, 1, &submitInfo, frame->inFlight);
+  if (result != VK_SUCCESS) {
+      frame_driver_abandon_frame(fd, frame, imageIndex);
+      if (status != 0) {
+          return lua_error(L); // Rethrow the callback's error
+      }
+      return push_vk_error(L, "vkQueueSubmit", result);
+  }
+  frame->submits++;
+  uint64_t submitted = SDL_GetPerformanceCounter();
+
+  // Present ids only mean something on the swapchain they were issued for;
+  // frames still pending on a replaced swapchain are never waited for
+  VkPresentIdKHR presentId = { .sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR, .swapchainCount = 1 };
+  uint64_t id = 0;
+  if (fd->waitForPresent && status == 0) {
+      if (fd->presentIdSwapchain != fd->swapchain->swapchain) {
+          fd->presentIdSwapchain = fd->swapchain->swapchain;
+          fd->displayedId = fd->presentId;
+      }
+      id = ++fd->presentId;
+      presentId.pPresentIds = &id;
+  }
+  VkPresentInfoKHR presentInfo = {
+      .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+      .pNext = id ? &presentId : NULL,
+      .waitSemaphoreCount = 1,
+      .pWaitSemaphores = renderFinished,
+      .swapchainCount = 1,
+      .pSwapchains = &fd->swapchain->swapchain,
+      .pImageIndices = &imageIndex
+  };
+  result = vkd->vkQueuePresentKHR(fd->presentQueue, &presentInfo);
+  uint64_t presented = SDL_GetPerformanceCounter();
+
+  fd->currentFrame = (fd->currentFrame + 1) % fd->framesInFlight;
+  if (status != 0) {
+      return lua_error(L); // Rethrow the callback's error
+  }
+  if (fd->dirtyFrames > 0) {
+      fd->dirtyFrames--;
+  }
+
+  VulkanFrameStats *stats = &fd->stats;
+  VulkanFrameTiming *timing = &fd->timings[stats->frameCount % VULKAN_FRAME_TIMING_HISTORY];
+  timing->presentId = id;
+  timing->cpuStart = start;
+  timing->submitted = submitted;
+  timing->presented = presented;
+  timing->displayed = 0;
+  stats->waitMs = elapsed_ms(start, waited + imageWaitTicks);
+  stats->acquireMs = elapsed_ms(waited + imageWaitTicks, acquired);
+  stats->recordMs = elapsed_ms(acquired, recorded);
+  stats->submitMs = elapsed_ms(recorded, presented);
+  stats->frameMs = elapsed_ms(start, presented);
+  if (stats->frameCount > 0 && fd->lastFrameStart != 0) {
+      stats->intervalMs = elapsed_ms(fd->lastFrameStart, start);
+      stats->avgIntervalMs = stats->frameCount > 1
+          ? stats->avgIntervalMs * 0.95 + stats->intervalMs * 0.05
+          : stats->intervalMs;
+  }
+  stats->frameCount++;
+  fd->lastFrameStart = start;
+
+  if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+      return push_vk_error(L, "vkQueuePresentKHR", result);
+  }
+  lua_pushboolean(L, true);
+  lua_pushinteger(L, result == VK_SUCCESS ? acquireResult : result);
+  return 2;
+}
+
+static int l_vk_FrameDriverGetStats(lua_State *L) {
+  VulkanFrameDriver *fd = (VulkanFrameDriver *)luaL_checkudata(L, 1, "VulkanFrameDriver");
+  const VulkanFrameStats *stats = &fd->stats;
+  lua_newtable(L);
+  lua_pushinteger(L, (lua_Integer)stats->frameCount);
+  lua_setfield(L, -2, "frameCount");
+  lua_pushnumber(L, stats->frameMs);
+  lua_setfield(L, -2, "frameMs");
+  lua_pushnumber(L, stats->waitMs);
+  lua_setfield(L, -2, "waitMs");
+  lua_pushnumber(L, stats->acquireMs);
+  lua_setfield(L, -2, "acquireMs");
+  lua_pushnumber(L, stats->recordMs);
+  lua_setfield(L, -2, "recordMs");
+  lua_pushnumber(L, stats->submitMs);
+  lua_setfield(L, -2, "submitMs");
+  lua_pushnumber(L, stats->intervalMs);
+  lua_setfield(L, -2, "intervalMs");
+  lua_pushnumber(L, stats->avgIntervalMs);
+  lua_setfield(L, -2, "avgIntervalMs");
+  lua_pushinteger(L, (lua_Integer)stats->skippedFrames);
+  lua_setfield(L, -2, "skippedFrames");
+  lua_pushnumber(L, stats->paceMs);
+  lua_setfield(L, -2, "paceMs");
+  lua_pushnumber(L, stats->latencyMs);
+  lua_setfield(L, -2, "latencyMs");
+  lua_pushnumber(L, stats->avgLatencyMs);
+  lua_setfield(L, -2, "avgLatencyMs");
+  return 1;
+}
+
+// vk_FrameDriverSetDirty(driver[, frames]) asks an onDemand driver to render
+// the next frames runs (default 1); animations call it every frame they move
+static int l_vk_FrameDriverSetDirty(lua_State *L) {
+  VulkanFrameDriver *fd = (VulkanFrameDriver *)luaL_checkudata(L, 1, "VulkanFrameDriver");
+  lua_Integer frames = luaL_optinteger(L, 2, 1);
+  luaL_argcheck(L, frames >= 0 && frames <= UINT32_MAX, 2, "frame count out of range");
+  if ((uint32_t)frames > fd->dirtyFrames) {
+      fd->dirtyFrames = (uint32_t)frames;
+  }
+  return 0;
+}
+
+// vk_FrameDriverIsDirty(driver) -> whether the next run renders; always true
+// without onDemand. Loops use it to choose between polling and waiting on events.
+static int l_vk_FrameDriverIsDirty(lua_State *L) {
+  VulkanFrameDriver *fd = (VulkanFrameDriver *)luaL_checkudata(L, 1, "VulkanFrameDriver");
+  lua_pushboolean(L, !fd->onDemand || fd->dirtyFrames > 0);
+  return 1;
+}
+
+// Pacing. vk_FrameDriverPace is called at the top of the loop, before input is
+// sampled, so the time it spends blocked comes off input-to-display latency
+// instead of piling up in the swapchain queue behind the display.
+#define VULKAN_FRAME_PACE_SPIN_NS 1500000 // OS sleeps can overshoot; spin the last stretch
+
+static void sleep_until(uint64_t deadline) {
+  double ticksPerNs = (double)SDL_GetPerformanceFrequency() / 1e9;
+  uint64_t spinTicks = (uint64_t)(VULKAN_FRAME_PACE_SPIN_NS * ticksPerNs);
+  uint64_t now = SDL_GetPerformanceCounter();
+  if (now + spinTicks < deadline) {
+      SDL_DelayNS((Uint64)((double)(deadline - spinTicks - now) / ticksPerNs));
+  }
+  while (SDL_GetPerformanceCounter() < deadline) {
+  }
+}
+
+// Stamps every frame up to id as displayed at now (present wait guarantees
+// earlier ids are on screen or were replaced by the time id is) and updates
+// the latency stats from the newest of them
+static void mark_displayed(VulkanFrameDriver *fd, uint64_t id, uint64_t now) {
+  const VulkanFrameTiming *newest = NULL;
+  for (int i = 0; i < VULKAN_FRAME_TIMING_HISTORY; i++) {
+      VulkanFrameTiming *timing = &fd->timings[i];
+      if (timing->presentId > fd->displayedId && timing->presentId <= id && timing->displayed == 0) {
+          timing->displayed = now;
+          if (!newest || timing->presentId > newest->presentId) {
+              newest = timing;
+          }
+      }
+  }
+  fd->displayedId = id;
+  if (newest) {
+      VulkanFrameStats *stats = &fd->stats;
+      stats->latencyMs = elapsed_ms(newest->cpuStart, now);
+      stats->avgLatencyMs = stats->avgLatencyMs > 0
+          ? stats->avgLatencyMs * 0.95 + stats->latencyMs * 0.05
+          : stats->latencyMs;
+  }
+}
+
+// Waits up to timeoutNs for id to reach the screen; errors (an out of date
+// swapchain) give up on every pending id rather than stall later frames
+static int wait_displayed(VulkanFrameDriver *fd, uint64_t id, uint64_t timeoutNs) {
+  VkResult result = fd->waitForPresent(fd->device, fd->presentIdSwapchain, id, timeoutNs);
+  if (result == VK_TIMEOUT) {
+      return 0;
+  }
+  if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+      fd->displayedId = fd->presentId;
+      return 0;
+  }
+  mark_displayed(fd, id, SDL_GetPerformanceCounter());
+  return 1;
+}
+
+// vk_FrameDriverPace(driver) -> ms blocked. With presentWait it stamps the
+// frames that reached the screen and blocks until at most maxFrameLatency
+// presents are ahead of the display; with a frame limit it then sleeps and
+// spins until the next frame's start time.
+static int l_vk_FrameDriverPace(lua_State *L) {
+  VulkanFrameDriver *fd = (VulkanFrameDriver *)luaL_checkudata(L, 1, "VulkanFrameDriver");
+  if (!fd->device) {
+      return luaL_error(L, "Frame driver has been destroyed");
+  }
+  uint64_t start = SDL_GetPerformanceCounter();
+
+  if (fd->waitForPresent && fd->presentIdSwapchain == fd->swapchain->swapchain) {
+      while (fd->displayedId < fd->presentId && wait_displayed(fd, fd->displayedId + 1, 0)) {
+      }
+      if (fd->presentId > fd->displayedId + fd->maxFrameLatency) {
+          // Bounded so a window that stops presenting (occluded, minimized) cannot hang the loop
+          wait_displayed(fd, fd->presentId - fd->maxFrameLatency, 100000000);
+      }
+  }
+
+  if (fd->framePeriod) {
+      uint64_t now = SDL_GetPerformanceCounter();
+      if (fd->nextDeadline == 0 || now > fd->nextDeadline + fd->framePeriod) {
+          fd->nextDeadline = now; // First frame, or too far behind to catch up
+      }
+      sleep_until(fd->nextDeadline);
+      fd->nextDeadline += fd->framePeriod;
+  }
+
+  fd->stats.paceMs = elapsed_ms(start, SDL_GetPerformanceCounter());
+  lua_pushnumber(L, fd->stats.paceMs);
+  return 1;
+}
+
+// vk_FrameDriverSetFrameLimit(driver, fps) caps vk_FrameDriverPace to fps
+// frames per second; 0 or nil removes the cap
+static int l_vk_FrameDriverSetFrameLimit(lua_State *L) {
+  VulkanFrameDriver *fd = (VulkanFrameDriver *)luaL_checkudata(L, 1, "VulkanFrameDriver");
+  lua_Number fps = luaL_optnumber(L, 2, 0);
+  luaL_argcheck(L, fps >= 0, 2, "frame rate must not be negative");
+  fd->framePeriod = fps > 0 ? (uint64_t)((double)SDL_GetPerformanceFrequency() / fps) : 0;
+  fd->nextDeadline = 0;
+  return 0;
+}
+
+// vk_FrameDriverGetFrameTimings(driver) -> the last VULKAN_FRAME_TIMING_HISTORY
+// frames, oldest first: { presentId, startMs, submitMs, presentMs, displayMs }.
+// startMs is on the SDL performance counter clock; the others are offsets from
+// it, and displayMs (input-to-display latency) is nil until present wait saw it.
+static int l_vk_FrameDriverGetFrameTimings(lua_State *L) {
+  VulkanFrameDriver *fd = (VulkanFrameDriver *)luaL_checkudata(L, 1, "VulkanFrameDriver");
+  uint64_t frameCount = fd->stats.frameCount;
+  uint64_t first = frameCount > VULKAN_FRAME_TIMING_HISTORY ? frameCount - VULKAN_FRAME_TIMING_HISTORY : 0;
+  lua_createtable(L, (int)(frameCount - first), 0);
+  for (uint64_t f = first; f < frameCount; f++) {
+      const VulkanFrameTiming *timing = &fd->timings[f % VULKAN_FRAME_TIMING_HISTORY];
+      lua_createtable(L, 0, 5);
+      lua_pushinteger(L, (lua_Integer)timing->presentId);
+      lua_setfield(L, -2, "presentId");
+      lua_pushnumber(L, elapsed_ms(0, timing->cpuStart));
+      lua_setfield(L, -2, "startMs");
+      lua_pushnumber(L, elapsed_ms(timing->cpuStart, timing->submitted));
+      lua_setfield(L, -2, "submitMs");
+      lua_pushnumber(L, elapsed_ms(timing->cpuStart, timing->presented));
+      lua_setfield(L, -2, "presentMs");
+      if (timing->displayed) {
+          lua_pushnumber(L, elapsed_ms(timing->cpuStart, timing->displayed));
+          lua_setfield(L, -2, "displayMs");
+      }
+      lua_rawseti(L, -2, (int)(f - first + 1));
+  }
+  return 1;
+}
+
+static int l_vk_DestroyFrameDriver(lua_State *L) {
+  VulkanFrameDriver *fd = (VulkanFrameDriver *)luaL_checkudata(L, 1, "VulkanFrameDriver");
+  destroy_frame_driver(fd);
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+VULKAN_LUAJIT_API const VulkanFrameStats *vkffi_GetFrameStats(const VulkanFrameDriver *driver) {
+  return &driver->stats;
+}
+
+// Frame fences. Work that holds a resource is tagged with a VulkanFrameFence
+// and owners release resources in submit order once the tag is complete.
+
+// A VulkanFence, or a VulkanFrameDriver standing for the frame being recorded
+// (the last submitted one outside the record callback). The driver is kept in
+// the environment of the userdata at owner (if non-zero), which holds the tag.
+static void check_frame_fence(lua_State *L, int idx, int owner, VulkanFrameFence *out) {
+  memset(out, 0, sizeof(*out));
+  VulkanFrameDriver *fd = (VulkanFrameDriver *)luaL_testudata(L, idx, "VulkanFrameDriver");
+  if (!fd) {
+      out->fence = ((VulkanFence *)luaL_checkudata(L, idx, "VulkanFence"))->fence;
+      return;
+  }
+  if (!fd->device) {
+      luaL_error(L, "Frame driver has been destroyed");
+  }
+  out->driver = fd;
+  if (fd->recording) {
+      out->slot = fd->currentFrame;
+      out->submit = fd->frames[out->slot].submits + 1;
+  } else {
+      out->slot = (fd->currentFrame + fd->framesInFlight - 1) % fd->framesInFlight;
+      out->submit = fd->frames[out->slot].submits;
+  }
+  if (owner) {
+      idx = idx < 0 ? lua_gettop(L) + idx + 1 : idx;
+      lua_getfenv(L, owner);
+      lua_pushvalue(L, idx);
+      lua_pushboolean(L, 1);
+      lua_rawset(L, -3);
+      lua_pop(L, 1);
+  }
+}
+
+// The fence a tag stands for right now
+static VkFence frame_fence_handle(const VulkanFrameFence *ff) {
+  return ff->driver ? ff->driver->frames[ff->slot].inFlight : ff->fence;
+}
+
+// Whether the tagged work is known complete, without blocking. A plain fence
+// is never queried: it only completes through retire_fence_done.
+static int frame_fence_complete(const VulkanFrameFence *ff) {
+  const VulkanFrameDriver *fd = ff->driver;
+  if (!fd) {
+      return 0;
+  }
+  if (!fd->device) {
+      return 1; // Destroying the driver waited for all of its frames
+  }
+  const VulkanFrameSlot *slot = &fd->frames[ff->slot];
+  if (slot->submits != ff->submit) {
+      return slot->submits > ff->submit; // A later submit of the slot waited for it
+  }
+  return fd->vkd->vkGetFenceStatus(fd->device, slot->inFlight) == VK_SUCCESS;
+}
+
+// Blocks until the tagged work is complete. Only submitted driver frames can
+// be waited for: the driver resets a slot fence right before submitting with
+// it, so the fence is signaled or pending. Returns 0 for anything else.
+static int frame_fence_wait(const VulkanFrameFence *ff) {
+  if (frame_fence_complete(ff)) {
+      return 1;
+  }
+  const VulkanFrameDriver *fd = ff->driver;
+  if (!fd || fd->frames[ff->slot].submits < ff->submit) {
+      return 0;
+  }
+  fd->vkd->vkWaitForFences(fd->device, 1, &fd->frames[ff->slot].inFlight, VK_TRUE, UINT64_MAX);
+  return 1;
+}
+
+typedef void (*RetireRelease)(void *owner, const VulkanRetireFrame *frame);
+
+// The owner has waited on fence: everything tagged with it is complete, even
+// if the fence has been reset since
+static void retire_fence_done(VulkanRetireQueue *queue, VkFence fence) {
+  for (uint32_t i = 0; i < queue->count; i++) {
+      VulkanRetireFrame *frame = &queue->pending[(queue->first + i) % VULKAN_RETIRE_MAX_PENDING];
+      if (frame->fence.fence == fence && !frame->fence.driver) {
+          frame->done = 1;
+      }
+  }
+}
+
+// Releases the complete frames at the front of the queue
+static void retire_collect(VulkanRetireQueue *queue, RetireRelease release, void *owner) {
+  while (queue->count > 0) {
+      VulkanRetireFrame *frame = &queue->pending[queue->first];
+      if (!frame->done && !frame_fence_complete(&frame->fence)) {
+          break;
+      }
+      release(owner, frame);
+      queue->first = (queue->first + 1) % VULKAN_RETIRE_MAX_PENDING;
+      queue->count--;
+  }
+}
+
+// Blocks on the oldest frame and releases it. Returns 0 if it cannot be
+// waited for (see frame_fence_wait).
+static int retire_wait_oldest(VulkanRetireQueue *queue, RetireRelease release, void *owner) {
+  VulkanRetireFrame *frame = &queue->pending[queue->first];
+  if (!frame->done && !frame_fence_wait(&frame->fence)) {
+      return 0;
+  }
+  frame->done = 1;
+  retire_collect(queue, release, owner);
+  return 1;
+}
+
+// Releases what is complete as of a fence the owner hands in again, which
+// means it has been waited on (see retire_fence_done)
+static void retire_begin_frame(VulkanRetireQueue *queue, const VulkanFrameFence *fence,
+    RetireRelease release, void *owner) {
+  if (!fence->driver) {
+      retire_fence_done(queue, fence->fence);
+  }
+  retire_collect(queue, release, owner);
+}
+
+// Starts a frame tagged with fence at the back of the queue; its data is the
+// caller's to fill. Returns NULL if the queue is full and its oldest frame
+// cannot be waited for.
+static VulkanRetireFrame *retire_push(VulkanRetireQueue *queue, const VulkanFrameFence *fence,
+    RetireRelease release, void *owner) {
+  retire_begin_frame(queue, fence, release, owner);
+  if (queue->count == VULKAN_RETIRE_MAX_PENDING && !retire_wait_oldest(queue, release, owner)) {
+      return NULL;
+  }
+  VulkanRetireFrame *frame = &queue->pending[(queue->first + queue->count) % VULKAN_RETIRE_MAX_PENDING];
+  memset(frame, 0, sizeof(*frame));
+  frame->fence = *fence;
+  queue->count++;
+  return frame;
+}
+
+// Staging ring: one persistently mapped host-visible buffer that uploads are
+// sub-allocated from. Each frame's reservations are tagged with the fence of
+// the submit that consumes them (vk_StagingEndFrame) and reclaimed in order
+// once that work is complete.
+static void staging_release(void *owner, const VulkanRetireFrame *frame) {
+  VulkanStagingRing *ring = owner;
+  ring->tail = (VkDeviceSize)frame->data[0];
+  ring->used -= (VkDeviceSize)frame->data[1];
+}
+
+// Returns the offset of size bytes in the ring, or VK_WHOLE_SIZE if the
+// current frame alone would overflow it, or the rest is held by frames not
+// known to be complete that cannot be waited for
+static VkDeviceSize staging_reserve(VulkanStagingRing *ring, VkDeviceSize size, VkDeviceSize alignment) {
+  if (size == 0 || size > ring->size) {
+      return VK_WHOLE_SIZE;
+  }
+  retire_collect(&ring->retire, staging_release, ring);
+  for (;;) {
+      if (ring->used == 0) {
+          ring->head = ring->tail = ring->frameStart = 0;
+      }
+      VkDeviceSize start = align_up(ring->head, alignment);
+      VkDeviceSize consumed = 0;
+      if (ring->used == 0 || ring->head > ring->tail) { // Otherwise head == tail means full
+          if (start + size <= ring->size) {
+              consumed = start + size - ring->head;
+          } else if (size <= ring->tail) {
+              start = 0; // Wrap; the skipped tail end counts as used until retired
+              consumed = ring->size - ring->head + size;
+          }
+      } else if (start + size <= ring->tail) {
+          consumed = start + size - ring->head;
+      }
+      if (consumed > 0) {
+          ring->head = start + size;
+          ring->used += consumed;
+          ring->frameBytes += consumed;
+          ring->stats.reserveCount++;
+          ring->stats.bytesReserved += size;
+          if (ring->used > ring->stats.highWater) {
+              ring->stats.highWater = ring->used;
+          }
+          return start;
+      }
+      if (ring->retire.count == 0) {
+          return VK_WHOLE_SIZE; // Everything in use belongs to the frame being recorded
+      }
+      uint64_t stallStart = SDL_GetPerformanceCounter();
+      if (!retire_wait_oldest(&ring->retire, staging_release, ring)) {
+          return VK_WHOLE_SIZE;
+      }
+      ring->stats.stallCount++;
+      ring->stats.stallMs += elapsed_ms(stallStart, SDL_GetPerformanceCounter());
+  }
+}
+
+// Closes the current frame's reservations; they are reclaimed once the
+// tagged work is complete. Returns 0 if too many frames are pending.
+static int staging_end_frame(VulkanStagingRing *ring, const VulkanFrameFence *fence) {
+  const VulkanDeviceDispatch *vkd = ring->vkd;
+  if (ring->frameBytes == 0) {
+      retire_begin_frame(&ring->retire, fence, staging_release, ring);
+      return 1;
+  }
+  VulkanRetireFrame *frame = retire_push(&ring->retire, fence, staging_release, ring);
+  if (!frame) {
+      return 0;
+  }
+  frame->data[0] = ring->head;
+  frame->data[1] = ring->frameBytes;
+  ring->frameBytes = 0;
+  ring->frameStart = ring->head;
+
+  if (!ring->coherent) {
+      VkMappedMemoryRange range = {
+          .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+          .memory = ring->allocation.block->memory,
+          .offset = 0,
+          .size = VK_WHOLE_SIZE
+      };
+      vkd->vkFlushMappedMemoryRanges(ring->device, 1, &range);
+  }
+  return 1;
+}
+
+static VulkanStagingRing *check_staging_ring(lua_State *L, int idx) {
+  VulkanStagingRing *ring = (VulkanStagingRing *)luaL_checkudata(L, idx, "VulkanStagingRing");
+  if (!ring->buffer) {
+      luaL_error(L, "Staging ring has been destroyed");
+  }
+  return ring;
+}
+
+// vk_CreateStagingRing(allocator, {size, usage})
+static int l_vk_CreateStagingRing(lua_State *L) {
+  VulkanAllocator *allocator = check_allocator(L, 1);
+  const VulkanDeviceDispatch *vkd = allocator->vkd;
+  luaL_checktype(L, 2, LUA_TTABLE);
+  lua_getfield(L, 2, "size");
+  VkDeviceSize size = (VkDeviceSize)luaL_checkinteger(L, -1);
+  lua_getfield(L, 2, "usage");
+  VkBufferUsageFlags usage = (VkBufferUsageFlags)luaL_optinteger(L, -1, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+  lua_pop(L, 2);
+
+  VkBufferCreateInfo bufferInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .size = size,
+      .usage = usage,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+  };
+  VkBuffer buffer;
+  VkResult result = vkd->vkCreateBuffer(allocator->device, &bufferInfo, NULL, &buffer);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkCreateBuffer", result);
+  }
+  VkMemoryRequirements req;
+  vkd->vkGetBufferMemoryRequirements(allocator->device, buffer, &req);
+  VulkanAllocation allocation;
+  result = allocate_memory(allocator, NULL, &req, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0, &allocation);
+  if (result == VK_SUCCESS) {
+      result = vkd->vkBindBufferMemory(allocator->device, buffer, allocation.block->memory, allocation.offset);
+      if (result != VK_SUCCESS) {
+          free_allocation(&allocation);
+      }
+  }
+  if (result != VK_SUCCESS) {
+      vkd->vkDestroyBuffer(allocator->device, buffer, NULL);
+      return push_allocation_error(L, "vk_CreateStagingRing", result);
+  }
+
+  VulkanStagingRing *ring = (VulkanStagingRing *)lua_newuserdata(L, sizeof(VulkanStagingRing));
+  memset(ring, 0, sizeof(*ring));
+  lua_newtable(L); // Environment: frame drivers standing for fences
+  lua_setfenv(L, -2);
+  ring->buffer = buffer;
+  ring->device = allocator->device;
+  ring->vkd = allocator->vkd;
+  ring->allocation = allocation;
+  ring->mapped = (uint8_t *)allocation.block->mapped + allocation.offset;
+  ring->size = size;
+  ring->coherent = (allocator->memoryProperties.memoryTypes[allocation.pool->memoryTypeIndex].propertyFlags &
+      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+  luaL_getmetatable(L, "VulkanStagingRing");
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+// The GPU must be done with the ring, as with every vk_Destroy*: its fences
+// may have been reset or destroyed, so none is waited on here
+static void destroy_staging_ring(VulkanStagingRing *ring) {
+  const VulkanDeviceDispatch *vkd = ring->vkd;
+  if (ring->buffer) {
+      vkd->vkDestroyBuffer(ring->device, ring->buffer, NULL);
+      ring->buffer = VK_NULL_HANDLE;
+      free_allocation(&ring->allocation);
+  }
+}
+
+static int l_vk_DestroyStagingRing(lua_State *L) {
+  luaL_checkudata(L, 1, "VulkanDevice");
+  destroy_staging_ring((VulkanStagingRing *)luaL_checkudata(L, 2, "VulkanStagingRing"));
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+static int push_staging_full(lua_State *L) {
+  lua_pushnil(L);
+  lua_pushstring(L, "Staging ring too small for this frame's uploads");
+  return 2;
+}
+
+// vk_StagingReserve(ring, size[, alignment]) returns the byte offset to write at
+static int l_vk_StagingReserve(lua_State *L) {
+  VulkanStagingRing *ring = check_staging_ring(L, 1);
+  VkDeviceSize size = (VkDeviceSize)luaL_checkinteger(L, 2);
+  VkDeviceSize alignment = (VkDeviceSize)luaL_optinteger(L, 3, 16);
+  VkDeviceSize offset = staging_reserve(ring, size, alignment);
+  if (offset == VK_WHOLE_SIZE) {
+      return push_staging_full(L);
+  }
+  lua_pushinteger(L, (lua_Integer)offset);
+  return 1;
+}
+
+// Whether [offset, offset + len) lies in the reservations of the frame being
+// recorded; older frames' bytes may still be read by the GPU
+static int staging_in_frame(const VulkanStagingRing *ring, VkDeviceSize offset, VkDeviceSize len) {
+  if (ring->frameBytes == 0 || offset > ring->size || len > ring->size - offset) {
+      return 0;
+  }
+  VkDeviceSize end = offset + len;
+  if (ring->frameStart < ring->head) {
+      return offset >= ring->frameStart && end <= ring->head;
+  }
+  if (ring->frameBytes == ring->size) {
+      return 1;
+  }
+  // The frame wrapped: it holds [frameStart, size) and [0, head)
+  return offset >= ring->frameStart || end <= ring->head;
+}
+
+// vk_StagingWrite(ring, offset, data) copies a string into a region reserved
+// since the last vk_StagingEndFrame; anything else raises an error
+static int l_vk_StagingWrite(lua_State *L) {
+  VulkanStagingRing *ring = check_staging_ring(L, 1);
+  lua_Integer offset = luaL_checkinteger(L, 2);
+  size_t len;
+  const char *data = luaL_checklstring(L, 3, &len);
+  if (offset < 0 || !staging_in_frame(ring, (VkDeviceSize)offset, len)) {
+      return luaL_error(L, "vk_StagingWrite: %d bytes at offset %d are outside this frame's reservations",
+          (int)len, (int)offset);
+  }
+  memcpy(ring->mapped + offset, data, len);
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// vk_StagingUpload(ring, data[, alignment]) reserves and writes in one call
+static int l_vk_StagingUpload(lua_State *L) {
+  VulkanStagingRing *ring = check_staging_ring(L, 1);
+  size_t len;
+  const char *data = luaL_checklstring(L, 2, &len);
+  VkDeviceSize alignment = (VkDeviceSize)luaL_optinteger(L, 3, 16);
+  VkDeviceSize offset = staging_reserve(ring, len, alignment);
+  if (offset == VK_WHOLE_SIZE) {
+      return push_staging_full(L);
+  }
+  memcpy(ring->mapped + offset, data, len);
+  lua_pushinteger(L, (lua_Integer)offset);
+  return 1;
+}
+
+// vk_StagingEndFrame(ring, fence) tags this frame's reservations with the
+// fence of the submit that reads them. A frame driver can stand in for the
+// fence: inside the record callback it is the frame being recorded,
+// otherwise the frame submitted last.
+static int l_vk_StagingEndFrame(lua_State *L) {
+  VulkanStagingRing *ring = check_staging_ring(L, 1);
+  VulkanFrameFence fence;
+  check_frame_fence(L, 2, 1, &fence);
+  if (!staging_end_frame(ring, &fence)) {
+      lua_pushnil(L);
+      lua_pushstring(L, "Too many staging frames pending; call vk_StagingBeginFrame once their fences have been waited on");
+      return 2;
+  }
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// vk_StagingBeginFrame(ring, fence) tells the ring that fence has been waited
+// on, so frames tagged with it are complete even if it is reset before the
+// next vk_StagingEndFrame. Not needed for frame drivers, which track this.
+static int l_vk_StagingBeginFrame(lua_State *L) {
+  VulkanStagingRing *ring = check_staging_ring(L, 1);
+  VulkanFrameFence fence;
+  check_frame_fence(L, 2, 0, &fence);
+  retire_begin_frame(&ring->retire, &fence, staging_release, ring);
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+static int l_vk_GetStagingRingStats(lua_State *L) {
+  VulkanStagingRing *ring = check_staging_ring(L, 1);
+  lua_newtable(L);
+  lua_pushinteger(L, (lua_Integer)ring->size);
+  lua_setfield(L, -2, "size");
+  lua_pushinteger(L, (lua_Integer)ring->used);
+  lua_setfield(L, -2, "usedBytes");
+  lua_pushinteger(L, (lua_Integer)ring->stats.highWater);
+  lua_setfield(L, -2, "highWater");
+  retire_collect(&ring->retire, staging_release, ring);
+  lua_pushinteger(L, ring->retire.count);
+  lua_setfield(L, -2, "pendingFrames");
+  lua_pushinteger(L, (lua_Integer)ring->stats.reserveCount);
+  lua_setfield(L, -2, "reserveCount");
+  lua_pushinteger(L, (lua_Integer)ring->stats.bytesReserved);
+  lua_setfield(L, -2, "bytesReserved");
+  lua_pushinteger(L, (lua_Integer)ring->stats.stallCount);
+  lua_setfield(L, -2, "stallCount");
+  lua_pushnumber(L, ring->stats.stallMs);
+  lua_setfield(L, -2, "stallMs");
+  return 1;
+}
+
+// vk_CmdCopyBuffer(cmdBuffer, src, dst, size[, srcOffset, dstOffset]); src may be a staging ring
+static int l_vk_CmdCopyBuffer(lua_State *L) {
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  VkBuffer src;
+  VulkanStagingRing *ring = (VulkanStagingRing *)luaL_testudata(L, 2, "VulkanStagingRing");
+  if (ring) {
+      src = ring->buffer;
+  } else {
+      src = ((VulkanBuffer *)luaL_checkudata(L, 2, "VulkanBuffer"))->buffer;
+  }
+  VulkanBuffer *dst = (VulkanBuffer *)luaL_checkudata(L, 3, "VulkanBuffer");
+  VkBufferCopy region = {
+      .srcOffset = (VkDeviceSize)luaL_optinteger(L, 5, 0),
+      .dstOffset = (VkDeviceSize)luaL_optinteger(L, 6, 0),
+      .size = (VkDeviceSize)luaL_checkinteger(L, 4)
+  };
+  vkd->vkCmdCopyBuffer(cptr->commandBuffer, src, dst->buffer, 1, &region);
+  return 0;
+}
+
+VULKAN_LUAJIT_API VkDeviceSize vkffi_StagingReserve(VulkanStagingRing *ring, VkDeviceSize size, VkDeviceSize alignment) {
+  return staging_reserve(ring, size, alignment);
+}
+
+VULKAN_LUAJIT_API void *vkffi_StagingData(const VulkanStagingRing *ring) {
+  return ring->mapped;
+}
+
+VULKAN_LUAJIT_API void vkffi_CmdCopyBuffer(const VulkanCommandBuffer *cbuf, VkBuffer src, VkBuffer dst,
+    VkDeviceSize srcOffset, VkDeviceSize dstOffset, VkDeviceSize size) {
+  VkBufferCopy region = { srcOffset, dstOffset, size };
+  cbuf->vkd->vkCmdCopyBuffer(cbuf->commandBuffer, src, dst, 1, &region);
+}
+
+// Readback: an image copied into a persistently mapped, host-visible buffer.
+// The copy is recorded into the caller's command buffer and tagged with the
+// fence of the submission that carries it; the data becomes readable once
+// that fence is seen signalled, so nothing on the CPU waits for the queue.
+static uint32_t format_texel_size(VkFormat format) {
+  switch (format) {
+  case VK_FORMAT_R8_UNORM:
+      return 1;
+  case VK_FORMAT_R8G8B8A8_UNORM:
+  case VK_FORMAT_R8G8B8A8_SRGB:
+  case VK_FORMAT_R8G8B8A8_UINT:
+  case VK_FORMAT_B8G8R8A8_UNORM:
+  case VK_FORMAT_B8G8R8A8_SRGB:
+  case VK_FORMAT_R32_SFLOAT:
+  case VK_FORMAT_R32_UINT:
+  case VK_FORMAT_D32_SFLOAT:
+      return 4;
+  case VK_FORMAT_R16G16B16A16_SFLOAT:
+  case VK_FORMAT_R32G32_SFLOAT:
+      return 8;
+  case VK_FORMAT_R32G32B32A32_SFLOAT:
+      return 16;
+  default:
+      return 0;
+  }
+}
+
+static VulkanReadback *check_readback(lua_State *L, int idx) {
+  VulkanReadback *rb = (VulkanReadback *)luaL_checkudata(L, idx, "VulkanReadback");
+  if (!rb->buffer) {
+      luaL_error(L, "Readback has been destroyed");
+  }
+  return rb;
+}
+
+// Pushes a new VulkanReadback with capacity bytes, or nil and an error
+static int push_new_readback(lua_State *L, VulkanAllocator *allocator, VkDeviceSize capacity) {
+  const VulkanDeviceDispatch *vkd = allocator->vkd;
+  VkBufferCreateInfo bufferInfo = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+      .size = capacity,
+      .usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+      .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+  };
+  VkBuffer buffer;
+  VkResult result = vkd->vkCreateBuffer(allocator->device, &bufferInfo, NULL, &buffer);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkCreateBuffer", result);
+  }
+  VkMemoryRequirements req;
+  vkd->vkGetBufferMemoryRequirements(allocator->device, buffer, &req);
+  // Cached memory makes the CPU reads fast; it is usually not coherent
+  VulkanAllocation allocation;
+  result = allocate_memory(allocator, NULL, &req, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT,
+      VK_MEMORY_PROPERTY_HOST_CACHED_BIT, 0, &allocation);
+  if (result == VK_SUCCESS) {
+      result = vkd->vkBindBufferMemory(allocator->device, buffer, allocation.block->memory, allocation.offset);
+      if (result != VK_SUCCESS) {
+          free_allocation(&allocation);
+      }
+  }
+  if (result != VK_SUCCESS) {
+      vkd->vkDestroyBuffer(allocator->device, buffer, NULL);
+      return push_allocation_error(L, "vk_CreateReadback", result);
+  }
+
+  VulkanReadback *rb = (VulkanReadback *)lua_newuserdata(L, sizeof(VulkanReadback));
+  memset(rb, 0, sizeof(*rb));
+  rb->buffer = buffer;
+  rb->device = allocator->device;
+  rb->vkd = allocator->vkd;
+  rb->allocation = allocation;
+  rb->mapped = (const uint8_t *)allocation.block->mapped + allocation.offset;
+  rb->coherent = (allocator->memoryProperties.memoryTypes[allocation.pool->memoryTypeIndex].propertyFlags &
+      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+  rb->capacity = capacity;
+  luaL_getmetatable(L, "VulkanReadback");
+  lua_setmetatable(L, -2);
+  lua_newtable(L); // Environment: frame drivers its copies are tagged with
+  lua_setfenv(L, -2);
+  return 1;
+}
+
+// A copy has been recorded into the readback
+static int readback_pending(const VulkanReadback *rb) {
+  return rb->fence.fence || rb->fence.driver;
+}
+
+// Non-blocking: checks the tag once and latches the result. A plain fence is
+// queried directly, so it must not be reset before the readback is seen
+// ready; a frame driver tag only completes once its frame has been submitted.
+static int readback_poll(VulkanReadback *rb) {
+  const VulkanDeviceDispatch *vkd = rb->vkd;
+  if (rb->ready || !readback_pending(rb)) {
+      return rb->ready;
+  }
+  if (rb->fence.driver ? !frame_fence_complete(&rb->fence) :
+      vkd->vkGetFenceStatus(rb->device, rb->fence.fence) != VK_SUCCESS) {
+      return 0;
+  }
+  if (!rb->coherent) {
+      VkMappedMemoryRange range = {
+          .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
+          .memory = rb->allocation.block->memory,
+          .offset = 0,
+          .size = VK_WHOLE_SIZE
+      };
+      vkd->vkInvalidateMappedMemoryRanges(rb->device, 1, &range);
+  }
+  rb->ready = 1;
+  return 1;
+}
+
+static void destroy_readback(VulkanReadback *rb) {
+  const VulkanDeviceDispatch *vkd = rb->vkd;
+  if (rb->buffer) {
+      // The fence may have been reset for reuse, so don't wait on it
+      if (readback_pending(rb) && !readback_poll(rb)) vkd->vkDeviceWaitIdle(rb->device);
+      vkd->vkDestroyBuffer(rb->device, rb->buffer, NULL);
+      rb->buffer = VK_NULL_HANDLE;
+      free_allocation(&rb->allocation);
+  }
+}
+
+// vk_CreateReadback(allocator, size) -> readback, for reuse with vk_CmdReadbackImage
+static int l_vk_CreateReadback(lua_State *L) {
+  VulkanAllocator *allocator = check_allocator(L, 1);
+  VkDeviceSize size = (VkDeviceSize)luaL_checkinteger(L, 2);
+  luaL_argcheck(L, size > 0, 2, "size must be positive");
+  return push_new_readback(L, allocator, size);
+}
+
+// vk_CmdReadbackImage(cmdBuffer, image, readback | allocator, fence | frameDriver[, {layout, finalLayout}])
+// Records a copy of the image into the readback, a new one when given the
+// allocator, and returns it. layout is the image's current layout (default
+// COLOR_ATTACHMENT_OPTIMAL); it is returned to finalLayout (default layout).
+static int l_vk_CmdReadbackImage(lua_State *L) {
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  VulkanImage *imgptr = (VulkanImage *)luaL_checkudata(L, 2, "VulkanImage");
+  if (!luaL_testudata(L, 4, "VulkanFrameDriver")) {
+      luaL_checkudata(L, 4, "VulkanFence");
+  }
+  VkImageLayout layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+  VkImageLayout finalLayout;
+  if (!lua_isnoneornil(L, 5)) {
+      luaL_checktype(L, 5, LUA_TTABLE);
+      lua_getfield(L, 5, "layout");
+      layout = (VkImageLayout)luaL_optinteger(L, -1, layout);
+      lua_getfield(L, 5, "finalLayout");
+      finalLayout = (VkImageLayout)luaL_optinteger(L, -1, layout);
+      lua_pop(L, 2);
+  } else {
+      finalLayout = layout;
+  }
+  luaL_argcheck(L, imgptr->image && imgptr->extent.width > 0, 2, "image has no known extent");
+  uint32_t texelSize = format_texel_size(imgptr->format);
+  if (texelSize == 0) {
+      lua_pushnil(L);
+      lua_pushfstring(L, "vk_CmdReadbackImage: unsupported format %d", (int)imgptr->format);
+      return 2;
+  }
+  VkDeviceSize size = (VkDeviceSize)imgptr->extent.width * imgptr->extent.height * texelSize;
+
+  VulkanReadback *rb = (VulkanReadback *)luaL_testudata(L, 3, "VulkanReadback");
+  if (rb) {
+      check_readback(L, 3);
+      if (rb->capacity < size) {
+          lua_pushnil(L);
+          lua_pushstring(L, "vk_CmdReadbackImage: readback is smaller than the image");
+          return 2;
+      }
+      lua_pushvalue(L, 3);
+  } else {
+      int pushed = push_new_readback(L, check_allocator(L, 3), size);
+      if (pushed != 1) {
+          return pushed;
+      }
+      rb = (VulkanReadback *)lua_touserdata(L, -1);
+  }
+  VulkanFrameFence fence;
+  check_frame_fence(L, 4, lua_gettop(L), &fence);
+
+  int depth = imgptr->format == VK_FORMAT_D32_SFLOAT;
+  VkImageAspectFlags aspect = depth ? VK_IMAGE_ASPECT_DEPTH_BIT : VK_IMAGE_ASPECT_COLOR_BIT;
+  VkImageMemoryBarrier toTransfer = {
+      .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+      .srcAccessMask = (depth ? VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT : VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT) |
+          VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT,
+      .oldLayout = layout,
+      .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .image = imgptr->image,
+      .subresourceRange = { aspect, 0, 1, 0, 1 }
+  };
+  vkd->vkCmdPipelineBarrier(cptr->commandBuffer, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, NULL, 0, NULL, 1, &toTransfer);
+
+  VkBufferImageCopy region = {
+      .bufferOffset = 0,
+      .bufferRowLength = 0, // Tightly packed
+      .bufferImageHeight = 0,
+      .imageSubresource = { aspect, 0, 0, 1 },
+      .imageOffset = { 0, 0, 0 },
+      .imageExtent = { imgptr->extent.width, imgptr->extent.height, 1 }
+  };
+  vkd->vkCmdCopyImageToBuffer(cptr->commandBuffer, imgptr->image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      rb->buffer, 1, &region);
+
+  // Make the copy visible to host reads, and hand the image back
+  VkBufferMemoryBarrier toHost = {
+      .sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER,
+      .srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT,
+      .dstAccessMask = VK_ACCESS_HOST_READ_BIT,
+      .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+      .buffer = rb->buffer,
+      .offset = 0,
+      .size = size
+  };
+  VkImageMemoryBarrier fromTransfer = toTransfer;
+  fromTransfer.srcAccessMask = 0;
+  fromTransfer.dstAccessMask = 0;
+  fromTransfer.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+  fromTransfer.newLayout = finalLayout;
+  vkd->vkCmdPipelineBarrier(cptr->commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT | VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 0, NULL, 1, &toHost, 1, &fromTransfer);
+
+  rb->size = size;
+  rb->width = imgptr->extent.width;
+  rb->height = imgptr->extent.height;
+  rb->format = imgptr->format;
+  rb->fence = fence;
+  rb->ready = 0;
+  return 1;
+}
+
+// vk_ReadbackReady(readback) -> true once the copy has landed; never blocks
+static int l_vk_ReadbackReady(lua_State *L) {
+  lua_pushboolean(L, readback_poll(check_readback(L, 1)));
+  return 1;
+}
+
+// vk_WaitReadback(readback[, timeoutNs]) -> true, or false on timeout
+static int l_vk_WaitReadback(lua_State *L) {
+  VulkanReadback *rb = check_readback(L, 1);
+  uint64_t timeout = lua_isnoneornil(L, 2) ? UINT64_MAX : (uint64_t)luaL_checkinteger(L, 2);
+  if (!readback_pending(rb)) {
+      return luaL_error(L, "vk_WaitReadback: no copy recorded");
+  }
+  if (!readback_poll(rb)) {
+      const VulkanFrameDriver *fd = rb->fence.driver;
+      if (fd && fd->frames[rb->fence.slot].submits < rb->fence.submit) {
+          return luaL_error(L, "vk_WaitReadback: the frame carrying the copy has not been submitted");
+      }
+      VkFence fence = frame_fence_handle(&rb->fence);
+      VkResult result = rb->vkd->vkWaitForFences(rb->device, 1, &fence, VK_TRUE, timeout);
+      if (result == VK_TIMEOUT) {
+          lua_pushboolean(L, false);
+          return 1;
+      }
+      if (result != VK_SUCCESS) {
+          return push_vk_error(L, "vkWaitForFences", result);
+      }
+  }
+  lua_pushboolean(L, readback_poll(rb));
+  return 1;
+}
+
+// vk_GetReadbackData(readback) -> string, width, height; nil, "Readback not ready" until the fence signals
+static int l_vk_GetReadbackData(lua_State *L) {
+  VulkanReadback *rb = check_readback(L, 1);
+  if (!readback_poll(rb)) {
+      lua_pushnil(L);
+      lua_pushstring(L, "Readback not ready");
+      return 2;
+  }
+  lua_pushlstring(L, (const char *)rb->mapped, (size_t)rb->size);
+  lua_pushinteger(L, rb->width);
+  lua_pushinteger(L, rb->height);
+  return 3;
+}
+
+static int l_vk_DestroyReadback(lua_State *L) {
+  luaL_checkudata(L, 1, "VulkanDevice");
+  destroy_readback((VulkanReadback *)luaL_checkudata(L, 2, "VulkanReadback"));
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// Mapped copy once it has landed, NULL before; valid until the next copy into the readback
+VULKAN_LUAJIT_API const void *vkffi_ReadbackData(VulkanReadback *readback) {
+  return readback_poll(readback) ? readback->mapped : NULL;
+}
+
+VULKAN_LUAJIT_API VkDeviceSize vkffi_ReadbackSize(const VulkanReadback *readback) {
+  return readback->size;
+}
+
+// Parallel recording: vk_CreateRecordWorkers starts threads that each own a
+// lua_State and a command pool per frame slot. A dispatch splits the scene
+// into slices; every slice is recorded by the worker's record function into
+// a secondary command buffer, and the primary runs them with
+// vk_CmdExecuteCommands.
+//
+// Worker states load only the vulkan module and the standard libraries.
+// Arguments of a dispatch are copied into them: numbers, strings, booleans,
+// tables (deeply) and the handle types in record_worker_shared_types, which
+// arrive as borrowed copies. Those types hold nothing the copy could change
+// or reallocate behind the original; command streams and bindless tables
+// own growable or mutable memory, so they can't be passed. Borrowed copies
+// are marked in their environment and skipped by the worker's finalizers,
+// which still destroy the objects the record function creates itself.
+#define RECORD_WORKER_MAX_DEPTH 16
+
+static const char *const record_worker_shared_types[] = {
+  "VulkanDevice", "VulkanImage", "VulkanBuffer", "VulkanImageView", "VulkanRenderPass",
+  "VulkanFramebuffer", "VulkanPipelineLayout", "VulkanPipeline", NULL
+};
+
+static const char record_worker_borrowed = 0; // Address is the environment key marking borrowed copies
+
+// __gc of a worker state's metatables: the original finalizer (upvalue 1),
+// unless the userdata is borrowed from the main state
+static int record_worker_gc(lua_State *L) {
+  lua_getfenv(L, 1);
+  if (lua_istable(L, -1)) {
+      lua_pushlightuserdata(L, (void *)&record_worker_borrowed);
+      lua_rawget(L, -2);
+      if (lua_toboolean(L, -1)) {
+          return 0;
+      }
+  }
+  lua_settop(L, 1);
+  lua_pushvalue(L, lua_upvalueindex(1));
+  lua_insert(L, 1);
+  lua_call(L, 1, 0);
+  return 0;
+}
+
+// Copies the value at idx of L onto W's stack; returns NULL, or the name of
+// the type that can't be copied
+static const char *copy_to_worker(lua_State *L, int idx, lua_State *W, int depth) {
+  switch (lua_type(L, idx)) {
+  case LUA_TNIL:
+      lua_pushnil(W);
+      return NULL;
+  case LUA_TBOOLEAN:
+      lua_pushboolean(W, lua_toboolean(L, idx));
+      return NULL;
+  case LUA_TNUMBER:
+      lua_pushnumber(W, lua_tonumber(L, idx));
+      return NULL;
+  case LUA_TSTRING: {
+      size_t len;
+      const char *str = lua_tolstring(L, idx, &len);
+      lua_pushlstring(W, str, len);
+      return NULL;
+  }
+  case LUA_TLIGHTUSERDATA:
+      lua_pushlightuserdata(W, lua_touserdata(L, idx));
+      return NULL;
+  case LUA_TTABLE: {
+      if (depth >= RECORD_WORKER_MAX_DEPTH) {
+          return "deeply nested table";
+      }
+      if (idx < 0) idx = lua_gettop(L) + idx + 1;
+      lua_newtable(W);
+      lua_pushnil(L);
+      while (lua_next(L, idx)) {
+          const char *bad = copy_to_worker(L, -2, W, depth + 1);
+          if (!bad) bad = copy_to_worker(L, -1, W, depth + 1);
+          if (bad) {
+              lua_pop(L, 2);
+              return bad;
+          }
+          lua_rawset(W, -3);
+          lua_pop(L, 1);
+      }
+      return NULL;
+  }
+  case LUA_TUSERDATA:
+      for (int i = 0; record_worker_shared_types[i]; i++) {
+          const void *src = luaL_testudata(L, idx, record_worker_shared_types[i]);
+          if (src) {
+              size_t size = lua_objlen(L, idx);
+              memcpy(lua_newuserdata(W, size), src, size);
+              luaL_getmetatable(W, record_worker_shared_types[i]);
+              lua_setmetatable(W, -2);
+              lua_newtable(W); // Fresh environment; the original's caches stay in the main state
+              lua_pushlightuserdata(W, (void *)&record_worker_borrowed);
+              lua_pushboolean(W, 1);
+              lua_rawset(W, -3);
+              lua_setfenv(W, -2);
+              return NULL;
+          }
+      }
+      if (luaL_testudata(L, idx, "VulkanCommandStream")) {
+          return "VulkanCommandStream";
+      }
+      if (luaL_testudata(L, idx, "VulkanBindlessTable")) {
+          return "VulkanBindlessTable";
+      }
+      return "userdata";
+  default:
+      return luaL_typename(L, idx);
+  }
+}
+
+// Creates a worker state, runs the script chunk with the worker index and
+// leaves the record function it returns at stack index 1
+static lua_State *new_worker_state(lua_State *L, const char *script, const char *source, int index) {
+  lua_State *W = luaL_newstate();
+  if (!W) {
+      lua_pushstring(L, "vk_CreateRecordWorkers: out of memory");
+      return NULL;
+  }
+  luaL_openlibs(W);
+  lua_getglobal(W, "package");
+  lua_getfield(W, -1, "loaded");
+  lua_pushcfunction(W, luaopen_vulkan);
+  lua_call(W, 0, 1);
+  lua_setfield(W, -2, "vulkan");
+  lua_pop(W, 2);
+  // Finalizers of the module skip borrowed copies, see above
+  lua_pushnil(W);
+  while (lua_next(W, LUA_REGISTRYINDEX)) {
+      if (lua_type(W, -2) == LUA_TSTRING && lua_istable(W, -1) &&
+          strncmp(lua_tostring(W, -2), "Vulkan", 6) == 0) {
+          lua_getfield(W, -1, "__gc");
+          if (lua_isfunction(W, -1)) {
+              lua_pushcclosure(W, record_worker_gc, 1);
+              lua_setfield(W, -2, "__gc");
+          } else {
+              lua_pop(W, 1);
+          }
+      }
+      lua_pop(W, 1);
+  }
+
+  int status = script ? luaL_loadfile(W, script)
+      : luaL_loadbuffer(W, source, strlen(source), "=record worker");
+  if (status == 0) {
+      lua_pushinteger(W, index);
+      status = lua_pcall(W, 1, 1, 0);
+  }
+  if (status == 0 && !lua_isfunction(W, -1)) {
+      lua_pushstring(W, "record worker script must return a function");
+      status = -1;
+  }
+  if (status != 0) {
+      lua_pushfstring(L, "vk_CreateRecordWorkers: %s", lua_tostring(W, -1));
+      lua_close(W);
+      return NULL;
+  }
+  lua_settop(W, 1);
+  lua_newtable(W); // Command buffer userdata by handle
+  return W;
+}
+
+// Next secondary from the worker's pool for the slot, allocating one the first
+// time the worker records that many slices
+static VkResult acquire_secondary(VulkanRecordWorker *worker, uint32_t frame, uint32_t used, VkCommandBuffer *out) {
+  if (used == worker->bufferCounts[frame]) {
+      VkCommandBuffer *grown = heap_realloc(worker->buffers[frame], (used + 1) * sizeof(VkCommandBuffer));
+      if (!grown) {
+          return VK_ERROR_OUT_OF_HOST_MEMORY;
+      }
+      worker->buffers[frame] = grown;
+      VkCommandBufferAllocateInfo allocInfo = {
+          .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+          .commandPool = worker->pools[frame],
+          .level = VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+          .commandBufferCount = 1
+      };
+      VkResult result = worker->owner->vkd->vkAllocateCommandBuffers(worker->owner->device, &allocInfo, &grown[used]);
+      if (result != VK_SUCCESS) {
+          return result;
+      }
+      worker->bufferCounts[frame]++;
+  }
+  *out = worker->buffers[frame][used];
+  return VK_SUCCESS;
+}
+
+// Records one slice on the worker thread; returns 0, or 1 with message set
+static int record_slice(VulkanRecordWorker *worker, uint32_t frame, uint32_t used, uint32_t slice,
+    uint32_t sliceCount, VkCommandBuffer *out, char *message, size_t messageSize) {
+  VulkanRecordWorkers *rw = worker->owner;
+  const VulkanDeviceDispatch *vkd = rw->vkd;
+  lua_State *W = worker->L;
+  VkCommandBuffer commandBuffer;
+  VkResult result = acquire_secondary(worker, frame, used, &commandBuffer);
+  if (result == VK_SUCCESS) {
+      VulkanInheritance inh = rw->inheritance;
+      result = begin_secondary(vkd, commandBuffer, &inh);
+  }
+  if (result != VK_SUCCESS) {
+      snprintf(message, messageSize, "slice %u: command buffer failed with result %d", slice + 1, result);
+      return 1;
+  }
+
+  int argCount = lua_gettop(W) - 2;
+  lua_pushvalue(W, 1);
+  lua_pushlightuserdata(W, commandBuffer);
+  lua_rawget(W, 2);
+  if (lua_isnil(W, -1)) {
+      lua_pop(W, 1);
+      VulkanCommandBuffer *cbuf = (VulkanCommandBuffer *)lua_newuserdata(W, sizeof(VulkanCommandBuffer));
+      cbuf->commandBuffer = commandBuffer;
+      cbuf->vkd = vkd;
+      luaL_getmetatable(W, "VulkanCommandBuffer");
+      lua_setmetatable(W, -2);
+      lua_pushlightuserdata(W, commandBuffer);
+      lua_pushvalue(W, -2);
+      lua_rawset(W, 2);
+  }
+  lua_pushinteger(W, slice + 1);
+  lua_pushinteger(W, sliceCount);
+  for (int i = 0; i < argCount; i++) {
+      lua_pushvalue(W, 3 + i);
+  }
+  int failed = 0;
+  if (lua_pcall(W, 3 + argCount, 0, 0) != 0) {
+      const char *error = lua_tostring(W, -1);
+      snprintf(message, messageSize, "slice %u: %s", slice + 1, error ? error : "(error object is not a string)");
+      lua_pop(W, 1);
+      failed = 1;
+  }
+  // Ended even after an error, so the buffer is never left recording
+  result = vkd->vkEndCommandBuffer(commandBuffer);
+  if (!failed && result != VK_SUCCESS) {
+      snprintf(message, messageSize, "slice %u: vkEndCommandBuffer failed with result %d", slice + 1, result);
+      failed = 1;
+  }
+  *out = commandBuffer;
+  return failed;
+}
+
+static int record_worker_thread(void *data) {
+  VulkanRecordWorker *worker = (VulkanRecordWorker *)data;
+  VulkanRecordWorkers *rw = worker->owner;
+  SDL_LockMutex(rw->mutex);
+  for (;;) {
+      while (worker->seenDispatch == rw->dispatchCount && !rw->shutdown) {
+          SDL_WaitCondition(rw->workAvailable, rw->mutex);
+      }
+      if (rw->shutdown) {
+          break;
+      }
+      worker->seenDispatch = rw->dispatchCount;
+      uint32_t frame = rw->frame;
+      uint64_t epoch = rw->slotEpoch[frame];
+      while (rw->nextSlice < rw->sliceCount) {
+          uint32_t slice = rw->nextSlice++;
+          uint32_t sliceCount = rw->sliceCount;
+          SDL_UnlockMutex(rw->mutex);
+
+          // Only once per frame: earlier dispatches of the same frame may have
+          // recorded secondaries the primary already executes. The new frame's
+          // dispatch vouches that the slot's last submission is complete.
+          if (worker->poolEpoch[frame] != epoch) {
+              rw->vkd->vkResetCommandPool(rw->device, worker->pools[frame], 0);
+              worker->poolEpoch[frame] = epoch;
+              worker->used[frame] = 0;
+          }
+          VkCommandBuffer commandBuffer = VK_NULL_HANDLE;
+          char message[sizeof(rw->error)];
+          int failed = record_slice(worker, frame, worker->used[frame], slice, sliceCount, &commandBuffer,
+              message, sizeof(message));
+          worker->used[frame]++;
+
+          SDL_LockMutex(rw->mutex);
+          rw->results[slice] = commandBuffer;
+          if (failed && !rw->failed) {
+              memcpy(rw->error, message, sizeof(message));
+              rw->failed = 1;
+          }
+          if (++rw->slicesDone == rw->sliceCount) {
+              SDL_SignalCondition(rw->sliceDone);
+          }
+      }
+  }
+  SDL_UnlockMutex(rw->mutex);
+  scratch_release(); // The record function called bindings on this thread
+  return 0;
+}
+
+static VulkanRecordWorkers *check_record_workers(lua_State *L, int idx) {
+  VulkanRecordWorkers *rw = (VulkanRecordWorkers *)luaL_checkudata(L, idx, "VulkanRecordWorkers");
+  if (!rw->mutex) {
+      luaL_error(L, "Record workers have been destroyed");
+  }
+  return rw;
+}
+
+// Joins the threads, then releases the states and pools. Callers make sure the
+// GPU is done with the secondaries, as for vk_DestroyCommandPool.
+static void destroy_record_workers(VulkanRecordWorkers *rw) {
+  const VulkanDeviceDispatch *vkd = rw->vkd;
+  if (!rw->mutex) {
+      return;
+  }
+  SDL_LockMutex(rw->mutex);
+  while (rw->slicesDone < rw->sliceCount) {
+      SDL_WaitCondition(rw->sliceDone, rw->mutex);
+  }
+  rw->shutdown = 1;
+  SDL_BroadcastCondition(rw->workAvailable);
+  SDL_UnlockMutex(rw->mutex);
+  for (int i = 0; i < VULKAN_RECORD_WORKERS_MAX_THREADS; i++) {
+      VulkanRecordWorker *worker = &rw->workers[i];
+      if (worker->thread) {
+          SDL_WaitThread(worker->thread, NULL);
+      }
+      if (worker->L) {
+          lua_close(worker->L);
+      }
+      for (uint32_t f = 0; f < VULKAN_RECORD_WORKERS_MAX_FRAMES; f++) {
+          if (worker->pools[f]) {
+              vkd->vkDestroyCommandPool(rw->device, worker->pools[f], NULL);
+          }
+          free(worker->buffers[f]);
+      }
+      memset(worker, 0, sizeof(*worker));
+  }
+  rw->threadCount = 0;
+  free(rw->results);
+  rw->results = NULL;
+  SDL_DestroyCondition(rw->sliceDone);
+  SDL_DestroyCondition(rw->workAvailable);
+  SDL_DestroyMutex(rw->mutex);
+  rw->mutex = NULL;
+}
+
+// vk_CreateRecordWorkers(device, queueFamily, {script | source, threads, framesInFlight}) -> workers, threadCount
+// The script (a file path) or source is run once per worker with the worker
+// index and returns the record function:
+//   function(cmd, slice, sliceCount, ...) -- ... are the dispatch arguments
+// threads defaults to one less than the number of logical cores and
+// framesInFlight to 2.
+static int l_vk_CreateRecordWorkers(lua_State *L) {
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
+  uint32_t queueFamilyIndex = (uint32_t)luaL_checkinteger(L, 2);
+  luaL_checktype(L, 3, LUA_TTABLE);
+  lua_getfield(L, 3, "script");
+  const char *script = luaL_optstring(L, -1, NULL);
+  lua_getfield(L, 3, "source");
+  const char *source = luaL_optstring(L, -1, NULL);
+  lua_getfield(L, 3, "threads");
+  int threadCount = (int)luaL_optinteger(L, -1, SDL_GetNumLogicalCPUCores() - 1);
+  lua_getfield(L, 3, "framesInFlight");
+  lua_Integer framesInFlight = luaL_optinteger(L, -1, 2);
+  lua_pop(L, 2); // script and source stay referenced on the stack
+  luaL_argcheck(L, (script != NULL) != (source != NULL), 3, "exactly one of script and source is required");
+  luaL_argcheck(L, framesInFlight >= 1 && framesInFlight <= VULKAN_RECORD_WORKERS_MAX_FRAMES, 3,
+      "framesInFlight out of range");
+  if (threadCount < 1) threadCount = 1;
+  if (threadCount > VULKAN_RECORD_WORKERS_MAX_THREADS) threadCount = VULKAN_RECORD_WORKERS_MAX_THREADS;
+
+  VulkanRecordWorkers *rw = (VulkanRecordWorkers *)lua_newuserdata(L, sizeof(VulkanRecordWorkers));
+  memset(rw, 0, sizeof(*rw));
+  rw->device = dptr->device;
+  rw->vkd = dptr->vkd;
+  rw->framesInFlight = (uint32_t)framesInFlight;
+  rw->mutex = SDL_CreateMutex();
+  rw->workAvailable = SDL_CreateCondition();
+  rw->sliceDone = SDL_CreateCondition();
+  luaL_getmetatable(L, "VulkanRecordWorkers");
+  lua_setmetatable(L, -2);
+  lua_newtable(L);
+  lua_newtable(L);
+  lua_setfield(L, -2, "commandBuffers"); // Main-state userdata of each secondary, by handle
+  lua_newtable(L);
+  lua_setfield(L, -2, "results"); // Reused by every vk_WaitRecordWorkers
+  lua_setfenv(L, -2);
+  if (!rw->mutex || !rw->workAvailable || !rw->sliceDone) {
+      lua_pushnil(L);
+      lua_pushstring(L, SDL_GetError());
+      SDL_DestroyCondition(rw->sliceDone);
+      SDL_DestroyCondition(rw->workAvailable);
+      SDL_DestroyMutex(rw->mutex);
+      rw->mutex = NULL;
+      return 2;
+  }
+
+  VkCommandPoolCreateInfo poolInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
+      .flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT,
+      .queueFamilyIndex = queueFamilyIndex
+  };
+  for (int i = 0; i < threadCount; i++) {
+      VulkanRecordWorker *worker = &rw->workers[i];
+      worker->owner = rw;
+      worker->L = new_worker_state(L, script, source, i + 1);
+      if (!worker->L) {
+          lua_pushnil(L);
+          lua_insert(L, -2);
+          destroy_record_workers(rw);
+          return 2;
+      }
+      for (uint32_t f = 0; f < rw->framesInFlight; f++) {
+          VkResult result = vkd->vkCreateCommandPool(rw->device, &poolInfo, NULL, &worker->pools[f]);
+          if (result != VK_SUCCESS) {
+              destroy_record_workers(rw);
+              return push_vk_error(L, "vkCreateCommandPool", result);
+          }
+      }
+  }
+  for (int i = 0; i < threadCount; i++) {
+      VulkanRecordWorker *worker = &rw->workers[i];
+      worker->thread = SDL_CreateThread(record_worker_thread, "vk_record_worker", worker);
+      if (!worker->thread) {
+          lua_pushnil(L);
+          lua_pushstring(L, SDL_GetError());
+          destroy_record_workers(rw);
+          return 2;
+      }
+      rw->threadCount++;
+  }
+  lua_pushinteger(L, rw->threadCount);
+  return 2;
+}
+
+// vk_DispatchRecordWorkers(workers, frame, inheritance, sliceCount, ...)
+// starts recording sliceCount slices; the workers share them out. The
+// arguments after sliceCount are copied to every worker. frame picks the pool
+// slot: a frame driver inside its record callback (the slot of the frame being
+// recorded, whose fence the driver has waited on), or the caller's frame
+// number n, recorded into slot n % framesInFlight, once the caller has waited
+// on the fence of frame n - framesInFlight. Dispatches of the same frame add
+// secondaries to the slot; the first dispatch of a new frame recycles the
+// slot's previous ones.
+static int l_vk_DispatchRecordWorkers(lua_State *L) {
+  VulkanRecordWorkers *rw = check_record_workers(L, 1);
+  uint32_t frame;
+  uint64_t frameTag; // Tells the frames sharing a slot apart
+  VulkanFrameDriver *fd = (VulkanFrameDriver *)luaL_testudata(L, 2, "VulkanFrameDriver");
+  if (fd) {
+      luaL_argcheck(L, fd->device && fd->recording, 2, "frame driver is not recording a frame");
+      luaL_argcheck(L, fd->framesInFlight <= rw->framesInFlight, 2,
+          "frame driver has more frames in flight than the workers");
+      frame = fd->currentFrame;
+      frameTag = (fd->frames[frame].submits + 1) << 1 | 1;
+  } else {
+      lua_Integer n = luaL_checkinteger(L, 2);
+      luaL_argcheck(L, n >= 0, 2, "frame number must not be negative");
+      frame = (uint32_t)(n % rw->framesInFlight);
+      frameTag = (uint64_t)n << 1;
+  }
+  VulkanInheritance inh;
+  check_inheritance(L, 3, &inh);
+  lua_Integer sliceCount = luaL_checkinteger(L, 4);
+  luaL_argcheck(L, sliceCount >= 0 && sliceCount <= UINT32_MAX, 4, "sliceCount out of range");
+  if (rw->busy) {
+      return luaL_error(L, "vk_DispatchRecordWorkers: previous dispatch was not waited for");
+  }
+  if ((uint32_t)sliceCount > rw->resultCapacity) {
+      VkCommandBuffer *results = heap_realloc(rw->results, (size_t)sliceCount * sizeof(VkCommandBuffer));
+      if (!results) {
+          return push_vk_error(L, "vk_DispatchRecordWorkers", VK_ERROR_OUT_OF_HOST_MEMORY);
+      }
+      rw->results = results;
+      rw->resultCapacity = (uint32_t)sliceCount;
+  }
+
+  // The workers are idle until the broadcast below, so their states are ours
+  int argCount = lua_gettop(L) - 4;
+  for (int i = 0; i < rw->threadCount; i++) {
+      lua_State *W = rw->workers[i].L;
+      lua_settop(W, 2);
+      for (int a = 0; a < argCount; a++) {
+          const char *bad = copy_to_worker(L, 5 + a, W, 0);
+          if (bad) {
+              lua_settop(W, 2);
+              return luaL_error(L, "vk_DispatchRecordWorkers: argument %d: can't pass a %s to a worker", 5 + a, bad);
+          }
+      }
+  }
+
+  SDL_LockMutex(rw->mutex);
+  rw->inheritance = inh;
+  rw->frame = frame;
+  if (rw->slotFrame[frame] != frameTag) {
+      rw->slotFrame[frame] = frameTag;
+      rw->slotEpoch[frame]++;
+  }
+  rw->sliceCount = (uint32_t)sliceCount;
+  rw->nextSlice = 0;
+  rw->slicesDone = 0;
+  rw->dispatchCount++;
+  rw->busy = 1;
+  SDL_BroadcastCondition(rw->workAvailable);
+  SDL_UnlockMutex(rw->mutex);
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// vk_WaitRecordWorkers(workers) -> {secondary, ...} in slice order, or nil and
+// the first error. The table is reused by the next wait.
+static int l_vk_WaitRecordWorkers(lua_State *L) {
+  VulkanRecordWorkers *rw = check_record_workers(L, 1);
+  if (!rw->busy) {
+      return luaL_error(L, "vk_WaitRecordWorkers: nothing was dispatched");
+  }
+  SDL_LockMutex(rw->mutex);
+  while (rw->slicesDone < rw->sliceCount) {
+      SDL_WaitCondition(rw->sliceDone, rw->mutex);
+  }
+  rw->busy = 0;
+  int failed = rw->failed;
+  rw->failed = 0;
+  SDL_UnlockMutex(rw->mutex);
+  if (failed) {
+      lua_pushnil(L);
+      lua_pushstring(L, rw->error);
+      return 2;
+  }
+
+  lua_getfenv(L, 1);
+  lua_getfield(L, -1, "commandBuffers");
+  lua_getfield(L, -2, "results");
+  int cacheIdx = lua_gettop(L) - 1;
+  for (uint32_t i = 0; i < rw->sliceCount; i++) {
+      lua_pushlightuserdata(L, rw->results[i]);
+      lua_rawget(L, cacheIdx);
+      if (lua_isnil(L, -1)) {
+          lua_pop(L, 1);
+          VulkanCommandBuffer *cbuf = (VulkanCommandBuffer *)lua_newuserdata(L, sizeof(VulkanCommandBuffer));
+          cbuf->commandBuffer = rw->results[i];
+          cbuf->vkd = rw->vkd;
+          luaL_getmetatable(L, "VulkanCommandBuffer");
+          lua_setmetatable(L, -2);
+          lua_pushlightuserdata(L, rw->results[i]);
+          lua_pushvalue(L, -2);
+          lua_rawset(L, cacheIdx);
+      }
+      lua_rawseti(L, -2, (int)i + 1);
+  }
+  int previous = (int)lua_objlen(L, -1);
+  for (int i = (int)rw->sliceCount + 1; i <= previous; i++) {
+      lua_pushnil(L);
+      lua_rawseti(L, -2, i);
+  }
+  return 1;
+}
+
+static int l_vk_DestroyRecordWorkers(lua_State *L) {
+  destroy_record_workers((VulkanRecordWorkers *)luaL_checkudata(L, 1, "VulkanRecordWorkers"));
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// GPU profiler: named regions bracketed by timestamp (and, for top-level
+// regions, pipeline statistics) queries. Each frame in flight has its own
+// query range; a frame's results are read back when its slot comes around
+// again, by which time the caller has waited on that frame's fence, so the
+// read never stalls.
+static VulkanGpuProfiler *check_gpu_profiler(lua_State *L, int idx) {
+  VulkanGpuProfiler *prof = (VulkanGpuProfiler *)luaL_checkudata(L, idx, "VulkanGpuProfiler");
+  if (!prof->timestampPool) {
+      luaL_error(L, "GPU profiler has been destroyed");
+  }
+  return prof;
+}
+
+static void destroy_gpu_profiler(VulkanGpuProfiler *prof) {
+  const VulkanDeviceDispatch *vkd = prof->vkd;
+  if (prof->timestampPool) {
+      vkd->vkDestroyQueryPool(prof->device, prof->timestampPool, NULL);
+      prof->timestampPool = VK_NULL_HANDLE;
+  }
+  if (prof->statisticsPool) {
+      vkd->vkDestroyQueryPool(prof->device, prof->statisticsPool, NULL);
+      prof->statisticsPool = VK_NULL_HANDLE;
+  }
+  free(prof->regions);
+  prof->regions = NULL;
+  free(prof->readback);
+  prof->readback = NULL;
+}
+
+// vk_CreateGpuProfiler(device, queueFamily[, {framesInFlight, maxRegions, pipelineStatistics}])
+// pipelineStatistics needs pipelineStatisticsQuery = true in vk_CreateDevice.
+static int l_vk_CreateGpuProfiler(lua_State *L) {
+  scratch_begin();
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
+  uint32_t queueFamily = (uint32_t)luaL_checkinteger(L, 2);
+  uint32_t framesInFlight = 2;
+  uint32_t maxRegions = 64;
+  int statistics = 0;
+  if (!lua_isnoneornil(L, 3)) {
+      luaL_checktype(L, 3, LUA_TTABLE);
+      lua_getfield(L, 3, "framesInFlight");
+      framesInFlight = (uint32_t)luaL_optinteger(L, -1, framesInFlight);
+      lua_getfield(L, 3, "maxRegions");
+      maxRegions = (uint32_t)luaL_optinteger(L, -1, maxRegions);
+      lua_getfield(L, 3, "pipelineStatistics");
+      statistics = lua_toboolean(L, -1);
+      lua_pop(L, 3);
+  }
+  luaL_argcheck(L, framesInFlight >= 1 && framesInFlight <= VULKAN_GPU_PROFILER_MAX_FRAMES, 3,
+      "framesInFlight out of range");
+  luaL_argcheck(L, maxRegions >= 1, 3, "maxRegions must be positive");
+
+  uint32_t familyCount = 0;
+  dptr->vki->vkGetPhysicalDeviceQueueFamilyProperties(dptr->physicalDevice, &familyCount, NULL);
+  VkQueueFamilyProperties *families = check_scratch_alloc(L, familyCount * sizeof(VkQueueFamilyProperties));
+  dptr->vki->vkGetPhysicalDeviceQueueFamilyProperties(dptr->physicalDevice, &familyCount, families);
+  luaL_argcheck(L, queueFamily < familyCount, 2, "invalid queue family");
+  uint32_t validBits = families[queueFamily].timestampValidBits;
+  if (validBits == 0) {
+      lua_pushnil(L);
+      lua_pushstring(L, "Queue family does not support timestamps");
+      return 2;
+  }
+  VkPhysicalDeviceProperties props;
+  dptr->vki->vkGetPhysicalDeviceProperties(dptr->physicalDevice, &props);
+
+  VkQueryPoolCreateInfo poolInfo = {
+      .sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO,
+      .queryType = VK_QUERY_TYPE_TIMESTAMP,
+      .queryCount = framesInFlight * maxRegions * 2
+  };
+  VkQueryPool timestampPool;
+  VkResult result = vkd->vkCreateQueryPool(dptr->device, &poolInfo, NULL, &timestampPool);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkCreateQueryPool", result);
+  }
+  VkQueryPool statisticsPool = VK_NULL_HANDLE;
+  if (statistics) {
+      poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+      poolInfo.queryCount = framesInFlight * maxRegions;
+      poolInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+          VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+      result = vkd->vkCreateQueryPool(dptr->device, &poolInfo, NULL, &statisticsPool);
+      if (result != VK_SUCCESS) {
+          vkd->vkDestroyQueryPool(dptr->device, timestampPool, NULL);
+          return push_vk_error(L, "vkCreateQueryPool", result);
+      }
+  }
+
+  VulkanGpuProfiler *prof = (VulkanGpuProfiler *)lua_newuserdata(L, sizeof(VulkanGpuProfiler));
+  memset(prof, 0, sizeof(*prof));
+  prof->timestampPool = timestampPool;
+  prof->statisticsPool = statisticsPool;
+  prof->device = dptr->device;
+  prof->vkd = dptr->vkd;
+  prof->timestampPeriod = props.limits.timestampPeriod;
+  prof->timestampMask = validBits >= 64 ? UINT64_MAX : (((uint64_t)1 << validBits) - 1);
+  prof->framesInFlight = framesInFlight;
+  prof->maxRegions = maxRegions;
+  prof->regions = heap_alloc((size_t)framesInFlight * maxRegions * sizeof(VulkanGpuRegion));
+  prof->readback = heap_alloc((size_t)maxRegions * 4 * sizeof(uint64_t));
+  luaL_getmetatable(L, "VulkanGpuProfiler");
+  lua_setmetatable(L, -2);
+  if (!prof->regions || !prof->readback) {
+      destroy_gpu_profiler(prof);
+      lua_pushnil(L);
+      lua_pushstring(L, "Out of memory");
+      return 2;
+  }
+  // Environment: region names by slot * maxRegions + region + 1, and the
+  // most recent results under "results"
+  lua_newtable(L);
+  lua_setfenv(L, -2);
+  return 1;
+}
+
+// Reads back a pending frame into a results table, pushed onto the stack.
+// Pushes nil when the queries are not available, i.e. the frame's command
+// buffer was not submitted or its fence not waited on.
+static void push_gpu_profiler_frame(lua_State *L, VulkanGpuProfiler *prof, int envIdx, uint32_t slot) {
+  const VulkanDeviceDispatch *vkd = prof->vkd;
+  VulkanGpuProfilerFrame *frame = &prof->frames[slot];
+  uint32_t count = frame->regionCount;
+  uint64_t *timestamps = prof->readback;
+  uint64_t *stats = prof->readback + 2 * prof->maxRegions;
+  if (count > 0) {
+      VkResult result = vkd->vkGetQueryPoolResults(prof->device, prof->timestampPool,
+          slot * prof->maxRegions * 2, count * 2, count * 2 * sizeof(uint64_t), timestamps,
+          sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+      if (result == VK_SUCCESS && prof->statisticsPool) {
+          // Statistics queries exist only for top-level regions; read them one by one
+          for (uint32_t i = 0; i < count && result == VK_SUCCESS; i++) {
+              const VulkanGpuRegion *region = &prof->regions[slot * prof->maxRegions + i];
+              if (!region->statistics) continue;
+              result = vkd->vkGetQueryPoolResults(prof->device, prof->statisticsPool,
+                  slot * prof->maxRegions + i, 1, 2 * sizeof(uint64_t), &stats[2 * i],
+                  2 * sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+          }
+      }
+      if (result != VK_SUCCESS) {
+          prof->droppedFrames++;
+          lua_pushnil(L);
+          return;
+      }
+  }
+
+  double totalMs = 0.0;
+  lua_createtable(L, 0, 3);
+  lua_pushinteger(L, (lua_Integer)frame->frame);
+  lua_setfield(L, -2, "frame");
+  lua_createtable(L, (int)count, 0);
+  for (uint32_t i = 0; i < count; i++) {
+      const VulkanGpuRegion *region = &prof->regions[slot * prof->maxRegions + i];
+      uint64_t ticks = (timestamps[2 * i + 1] - timestamps[2 * i]) & prof->timestampMask;
+      double ms = (double)ticks * prof->timestampPeriod / 1e6;
+      if (region->depth == 0) totalMs += ms;
+      lua_createtable(L, 0, 5);
+      lua_rawgeti(L, envIdx, (int)(slot * prof->maxRegions + i + 1));
+      lua_setfield(L, -2, "name");
+      lua_pushnumber(L, ms);
+      lua_setfield(L, -2, "ms");
+      lua_pushinteger(L, region->depth);
+      lua_setfield(L, -2, "depth");
+      if (region->statistics) {
+          lua_pushinteger(L, (lua_Integer)stats[2 * i]);
+          lua_setfield(L, -2, "vertexInvocations");
+          lua_pushinteger(L, (lua_Integer)stats[2 * i + 1]);
+          lua_setfield(L, -2, "fragmentInvocations");
+      }
+      lua_rawseti(L, -2, (int)i + 1);
+  }
+  lua_setfield(L, -2, "regions");
+  lua_pushnumber(L, totalMs);
+  lua_setfield(L, -2, "gpuMs");
+}
+
+// vk_GpuProfilerBeginFrame(profiler, cmdBuffer) reads back the frame recorded
+// framesInFlight frames ago, then resets this frame's queries. Call it
+// outside a render pass, after waiting on the fence that guards cmdBuffer.
+static int l_vk_GpuProfilerBeginFrame(lua_State *L) {
+  VulkanGpuProfiler *prof = check_gpu_profiler(L, 1);
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 2, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  if (prof->inFrame) {
+      return luaL_error(L, "vk_GpuProfilerBeginFrame: previous frame was not ended");
+  }
+  lua_getfenv(L, 1);
+  int envIdx = lua_gettop(L);
+  uint32_t slot = (uint32_t)(prof->frameCount % prof->framesInFlight);
+  VulkanGpuProfilerFrame *frame = &prof->frames[slot];
+  if (frame->pending) {
+      push_gpu_profiler_frame(L, prof, envIdx, slot);
+      if (lua_isnil(L, -1)) {
+          lua_pop(L, 1);
+      } else {
+          lua_setfield(L, envIdx, "results");
+      }
+      frame->pending = 0;
+  }
+
+  vkd->vkCmdResetQueryPool(cptr->commandBuffer, prof->timestampPool,
+      slot * prof->maxRegions * 2, prof->maxRegions * 2);
+  if (prof->statisticsPool) {
+      vkd->vkCmdResetQueryPool(cptr->commandBuffer, prof->statisticsPool,
+          slot * prof->maxRegions, prof->maxRegions);
+  }
+  frame->frame = prof->frameCount++;
+  frame->regionCount = 0;
+  frame->depth = 0;
+  prof->inFrame = 1;
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// vk_GpuProfilerBeginRegion(profiler, cmdBuffer, name); regions nest, and
+// must begin and end in the same command buffer and render pass instance
+static int l_vk_GpuProfilerBeginRegion(lua_State *L) {
+  VulkanGpuProfiler *prof = check_gpu_profiler(L, 1);
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 2, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  luaL_checkstring(L, 3);
+  if (!prof->inFrame) {
+      return luaL_error(L, "vk_GpuProfilerBeginRegion: no frame begun");
+  }
+  uint32_t slot = (uint32_t)((prof->frameCount - 1) % prof->framesInFlight);
+  VulkanGpuProfilerFrame *frame = &prof->frames[slot];
+  if (frame->depth >= VULKAN_GPU_PROFILER_MAX_DEPTH) {
+      return luaL_error(L, "vk_GpuProfilerBeginRegion: regions nested deeper than %d",
+          VULKAN_GPU_PROFILER_MAX_DEPTH);
+  }
+  if (frame->regionCount >= prof->maxRegions) {
+      // Out of queries: keep nesting balanced but don't time the region
+      prof->droppedRegions++;
+      frame->stack[frame->depth++] = UINT32_MAX;
+      return 0;
+  }
+  uint32_t index = frame->regionCount++;
+  VulkanGpuRegion *region = &prof->regions[slot * prof->maxRegions + index];
+  region->depth = frame->depth;
+  region->statistics = prof->statisticsPool && frame->depth == 0;
+  frame->stack[frame->depth++] = index;
+
+  lua_getfenv(L, 1);
+  lua_pushvalue(L, 3);
+  lua_rawseti(L, -2, (int)(slot * prof->maxRegions + index + 1));
+  lua_pop(L, 1);
+
+  vkd->vkCmdWriteTimestamp(cptr->commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+      prof->timestampPool, (slot * prof->maxRegions + index) * 2);
+  if (region->statistics) {
+      vkd->vkCmdBeginQuery(cptr->commandBuffer, prof->statisticsPool, slot * prof->maxRegions + index, 0);
+  }
+  return 0;
+}
+
+// vk_GpuProfilerEndRegion(profiler, cmdBuffer) closes the innermost open region
+static int l_vk_GpuProfilerEndRegion(lua_State *L) {
+  VulkanGpuProfiler *prof = check_gpu_profiler(L, 1);
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 2, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  if (!prof->inFrame) {
+      return luaL_error(L, "vk_GpuProfilerEndRegion: no frame begun");
+  }
+  uint32_t slot = (uint32_t)((prof->frameCount - 1) % prof->framesInFlight);
+  VulkanGpuProfilerFrame *frame = &prof->frames[slot];
+  if (frame->depth == 0) {
+      return luaL_error(L, "vk_GpuProfilerEndRegion: no open region");
+  }
+  uint32_t index = frame->stack[--frame->depth];
+  if (index == UINT32_MAX) {
+      return 0;
+  }
+  const VulkanGpuRegion *region = &prof->regions[slot * prof->maxRegions + index];
+  if (region->statistics) {
+      vkd->vkCmdEndQuery(cptr->commandBuffer, prof->statisticsPool, slot * prof->maxRegions + index);
+  }
+  vkd->vkCmdWriteTimestamp(cptr->commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+      prof->timestampPool, (slot * prof->maxRegions + index) * 2 + 1);
+  return 0;
+}
+
+// vk_GpuProfilerEndFrame(profiler); the frame's results become available
+// framesInFlight frames later, from vk_GpuProfilerGetResults
+static int l_vk_GpuProfilerEndFrame(lua_State *L) {
+  VulkanGpuProfiler *prof = check_gpu_profiler(L, 1);
+  if (!prof->inFrame) {
+      return luaL_error(L, "vk_GpuProfilerEndFrame: no frame begun");
+  }
+  VulkanGpuProfilerFrame *frame = &prof->frames[(prof->frameCount - 1) % prof->framesInFlight];
+  if (frame->depth != 0) {
+      return luaL_error(L, "vk_GpuProfilerEndFrame: %d region(s) still open", (int)frame->depth);
+  }
+  frame->pending = 1;
+  prof->inFrame = 0;
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// vk_GpuProfilerGetResults(profiler) returns the most recently read back frame:
+// {frame, gpuMs, regions = {{name, ms, depth[, vertexInvocations, fragmentInvocations]}}},
+// or nil before the first frame has come back. Never waits on the GPU.
+static int l_vk_GpuProfilerGetResults(lua_State *L) {
+  check_gpu_profiler(L, 1);
+  lua_getfenv(L, 1);
+  lua_getfield(L, -1, "results");
+  return 1;
+}
+
+static int l_vk_GetGpuProfilerStats(lua_State *L) {
+  VulkanGpuProfiler *prof = check_gpu_profiler(L, 1);
+  lua_newtable(L);
+  lua_pushinteger(L, (lua_Integer)prof->frameCount);
+  lua_setfield(L, -2, "frameCount");
+  lua_pushinteger(L, (lua_Integer)prof->droppedRegions);
+  lua_setfield(L, -2, "droppedRegions");
+  lua_pushinteger(L, (lua_Integer)prof->droppedFrames);
+  lua_setfield(L, -2, "droppedFrames");
+  lua_pushnumber(L, prof->timestampPeriod);
+  lua_setfield(L, -2, "timestampPeriod");
+  return 1;
+}
+
+static int l_vk_DestroyGpuProfiler(lua_State *L) {
+  luaL_checkudata(L, 1, "VulkanDevice");
+  destroy_gpu_profiler((VulkanGpuProfiler *)luaL_checkudata(L, 2, "VulkanGpuProfiler"));
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// Samplers, for the textures of a bindless table
+// vk_CreateSampler(device[, {filter, mipmapMode, addressMode}]); filter
+// defaults to VK_FILTER_LINEAR, mipmapMode follows the filter, addressMode
+// defaults to VK_SAMPLER_ADDRESS_MODE_REPEAT
+static int l_vk_CreateSampler(lua_State *L) {
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
+  VkFilter filter = VK_FILTER_LINEAR;
+  VkSamplerAddressMode addressMode = VK_SAMPLER_ADDRESS_MODE_REPEAT;
+  VkSamplerMipmapMode mipmapMode;
+  if (!lua_isnoneornil(L, 2)) {
+      luaL_checktype(L, 2, LUA_TTABLE);
+      lua_getfield(L, 2, "filter");
+      filter = (VkFilter)luaL_optinteger(L, -1, filter);
+      lua_getfield(L, 2, "addressMode");
+      addressMode = (VkSamplerAddressMode)luaL_optinteger(L, -1, addressMode);
+      lua_pop(L, 2);
+  }
+  mipmapMode = filter == VK_FILTER_NEAREST ? VK_SAMPLER_MIPMAP_MODE_NEAREST : VK_SAMPLER_MIPMAP_MODE_LINEAR;
+  if (!lua_isnoneornil(L, 2)) {
+      lua_getfield(L, 2, "mipmapMode");
+      mipmapMode = (VkSamplerMipmapMode)luaL_optinteger(L, -1, mipmapMode);
+      lua_pop(L, 1);
+  }
+
+  VkSamplerCreateInfo samplerInfo = {
+      .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+      .magFilter = filter,
+      .minFilter = filter,
+      .mipmapMode = mipmapMode,
+      .addressModeU = addressMode,
+      .addressModeV = addressMode,
+      .addressModeW = addressMode,
+      .maxLod = VK_LOD_CLAMP_NONE,
+      .borderColor = VK_BORDER_COLOR_FLOAT_TRANSPARENT_BLACK
+  };
+  VkSampler sampler;
+  VkResult result = vkd->vkCreateSampler(dptr->device, &samplerInfo, NULL, &sampler);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkCreateSampler", result);
+  }
+
+  VulkanSampler *samptr = (VulkanSampler *)lua_newuserdata(L, sizeof(VulkanSampler));
+  samptr->sampler = sampler;
+  samptr->device = dptr->device;
+  samptr->vkd = dptr->vkd;
+  luaL_getmetatable(L, "VulkanSampler");
+  lua_setmetatable(L, -2);
+  return 1;
+}
+
+static void destroy_sampler(VulkanSampler *samptr) {
+  const VulkanDeviceDispatch *vkd = samptr->vkd;
+  if (samptr->sampler) {
+      vkd->vkDestroySampler(samptr->device, samptr->sampler, NULL);
+      samptr->sampler = VK_NULL_HANDLE;
+  }
+}
+
+static int l_vk_DestroySampler(lua_State *L) {
+  luaL_checkudata(L, 1, "VulkanDevice");
+  destroy_sampler((VulkanSampler *)luaL_checkudata(L, 2, "VulkanSampler"));
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// Bindless tables: one descriptor set with large arrays of buffers and
+// textures, bound once per command buffer. Resources are registered into
+// slots and shaders index the arrays by slot number, passed in push
+// constants or read from other buffers, so draws need no descriptor changes.
+// The bindings are update-after-bind and partially bound: slots can be
+// written while the set is bound, and slots that are never read need not
+// hold a valid descriptor.
+static VulkanBindlessTable *check_bindless_table(lua_State *L, int idx) {
+  VulkanBindlessTable *table = (VulkanBindlessTable *)luaL_checkudata(L, idx, "VulkanBindlessTable");
+  if (!table->pool) {
+      luaL_error(L, "Bindless table has been destroyed");
+  }
+  return table;
+}
+
+// Moves the slots a completed frame freed from the retired rings to the free stacks
+static void bindless_release(void *owner, const VulkanRetireFrame *frame) {
+  VulkanBindlessTable *table = owner;
+  for (int a = 0; a < VULKAN_BINDLESS_ARRAYS; a++) {
+      VulkanBindlessArray *arr = &table->arrays[a];
+      uint32_t count = (uint32_t)frame->data[a];
+      for (uint32_t i = 0; i < count; i++) {
+          arr->free[arr->freeCount++] = arr->retired[arr->retiredFirst];
+          arr->retiredFirst = (arr->retiredFirst + 1) % arr->capacity;
+      }
+      arr->retiredCount -= count;
+  }
+}
+
+// Returns a free slot of the array, or UINT32_MAX when every slot is live or
+// retired in a frame not known to be complete. When only retired slots are
+// left, waits for the oldest frame if it is a submitted frame driver frame.
+static uint32_t bindless_alloc(VulkanBindlessTable *table, int array) {
+  VulkanBindlessArray *arr = &table->arrays[array];
+  if (arr->freeCount == 0 && arr->next == arr->capacity) {
+      retire_collect(&table->retire, bindless_release, table);
+      while (arr->freeCount == 0 && arr->retiredCount > arr->frameRetired) {
+          if (!retire_wait_oldest(&table->retire, bindless_release, table)) {
+              break;
+          }
+      }
+  }
+  uint32_t slot;
+  if (arr->freeCount > 0) {
+      slot = arr->free[--arr->freeCount];
+  } else if (arr->next < arr->capacity) {
+      slot = arr->next++;
+  } else {
+      return UINT32_MAX;
+  }
+  arr->live[slot] = 1;
+  arr->used++;
+  return slot;
+}
+
+static void bindless_free(VulkanBindlessTable *table, int array, uint32_t slot) {
+  VulkanBindlessArray *arr = &table->arrays[array];
+  arr->live[slot] = 0;
+  arr->used--;
+  arr->retired[(arr->retiredFirst + arr->retiredCount) % arr->capacity] = slot;
+  arr->retiredCount++;
+  arr->frameRetired++;
+}
+
+// Tags the slots freed since the last call with fence. Returns 0 if too many
+// frames are pending.
+static int bindless_end_frame(VulkanBindlessTable *table, const VulkanFrameFence *fence) {
+  uint32_t freed = 0;
+  for (int a = 0; a < VULKAN_BINDLESS_ARRAYS; a++) {
+      freed += table->arrays[a].frameRetired;
+  }
+  if (freed == 0) {
+      retire_begin_frame(&table->retire, fence, bindless_release, table);
+      return 1;
+  }
+  VulkanRetireFrame *frame = retire_push(&table->retire, fence, bindless_release, table);
+  if (!frame) {
+      return 0;
+  }
+  for (int a = 0; a < VULKAN_BINDLESS_ARRAYS; a++) {
+      frame->data[a] = table->arrays[a].frameRetired;
+      table->arrays[a].frameRetired = 0;
+  }
+  return 1;
+}
+
+// Called by vk_DestroyBindlessTable and __gc once the device no longer uses
+// the table. Retired slots are simply dropped: their fences are not waited
+// on, as they may have been reset or destroyed by now.
+static void destroy_bindless_table(VulkanBindlessTable *table) {
+  const VulkanDeviceDispatch *vkd = table->vkd;
+  if (table->pool) {
+      vkd->vkDestroyDescriptorPool(table->device, table->pool, NULL); // Frees the set
+      table->pool = VK_NULL_HANDLE;
+      table->set = VK_NULL_HANDLE;
+  }
+  if (table->setLayout) {
+      vkd->vkDestroyDescriptorSetLayout(table->device, table->setLayout, NULL);
+      table->setLayout = VK_NULL_HANDLE;
+  }
+  for (int a = 0; a < VULKAN_BINDLESS_ARRAYS; a++) {
+      free(table->arrays[a].free); // One block per array, see l_vk_CreateBindlessTable
+      table->arrays[a].free = NULL;
+  }
+}
+
+// vk_CreateBindlessTable(device[, {buffers, textures, maxTextures, stageFlags}])
+// buffers (default 1024) storage buffer slots at binding 0 and textures
+// (default 4096) combined image sampler slots at binding 1. The texture
+// array has a variable count: the set layout declares maxTextures (default
+// textures), so tables of different sizes with the same buffers and
+// maxTextures can share pipeline layouts. stageFlags defaults to all stages.
+// Needs vk_CreateDevice{descriptorIndexing = true}.
+static int l_vk_CreateBindlessTable(lua_State *L) {
+  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
+  uint32_t capacities[VULKAN_BINDLESS_ARRAYS] = {1024, 4096};
+  uint32_t maxTextures = 0;
+  VkShaderStageFlags stageFlags = VK_SHADER_STAGE_ALL;
+  if (!lua_isnoneornil(L, 2)) {
+      luaL_checktype(L, 2, LUA_TTABLE);
+      lua_getfield(L, 2, "buffers");
+      capacities[VULKAN_BINDLESS_BUFFERS] = (uint32_t)luaL_optinteger(L, -1, capacities[VULKAN_BINDLESS_BUFFERS]);
+      lua_getfield(L, 2, "textures");
+      capacities[VULKAN_BINDLESS_TEXTURES] = (uint32_t)luaL_optinteger(L, -1, capacities[VULKAN_BINDLESS_TEXTURES]);
+      lua_getfield(L, 2, "maxTextures");
+      maxTextures = (uint32_t)luaL_optinteger(L, -1, 0);
+      lua_getfield(L, 2, "stageFlags");
+      stageFlags = (VkShaderStageFlags)luaL_optinteger(L, -1, stageFlags);
+      lua_pop(L, 4);
+  }
+  if (maxTextures == 0) {
+      maxTextures = capacities[VULKAN_BINDLESS_TEXTURES];
+  }
+  luaL_argcheck(L, capacities[VULKAN_BINDLESS_BUFFERS] >= 1 && capacities[VULKAN_BINDLESS_TEXTURES] >= 1, 2,
+      "buffers and textures must be positive");
+  luaL_argcheck(L, capacities[VULKAN_BINDLESS_TEXTURES] <= maxTextures, 2, "textures exceeds maxTextures");
+
+  VkDescriptorSetLayoutBinding bindings[VULKAN_BINDLESS_ARRAYS] = {
+      {
+          .binding = VULKAN_BINDLESS_BUFFERS,
+          .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+          .descriptorCount = capacities[VULKAN_BINDLESS_BUFFERS],
+          .stageFlags = stageFlags
+      },
+      {
+          .binding = VULKAN_BINDLESS_TEXTURES,
+          .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+          .descriptorCount = maxTextures,
+          .stageFlags = stageFlags
+      }
+  };
+  // Only the last binding of a set may have a variable count
+  VkDescriptorBindingFlags bindingFlags[VULKAN_BINDLESS_ARRAYS] = {
+      VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+          VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT,
+      VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+          VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT | VK_DESCRIPTOR_BINDING_VARIABLE_DESCRIPTOR_COUNT_BIT
+  };
+  VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO,
+      .bindingCount = VULKAN_BINDLESS_ARRAYS,
+      .pBindingFlags = bindingFlags
+  };
+  VkDescriptorSetLayoutCreateInfo layoutInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+      .pNext = &flagsInfo,
+      .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT,
+      .bindingCount = VULKAN_BINDLESS_ARRAYS,
+      .pBindings = bindings
+  };
+
+  VulkanBindlessTable *table = (VulkanBindlessTable *)lua_newuserdata(L, sizeof(VulkanBindlessTable));
+  memset(table, 0, sizeof(*table));
+  table->device = dptr->device;
+  table->vkd = dptr->vkd;
+  luaL_getmetatable(L, "VulkanBindlessTable");
+  lua_setmetatable(L, -2);
+  lua_newtable(L); // Environment: frame drivers standing for fences
+  lua_setfenv(L, -2);
+
+  VkDescriptorSetLayout setLayout;
+  VkResult result = vkd->vkCreateDescriptorSetLayout(dptr->device, &layoutInfo, NULL, &setLayout);
+  if (result != VK_SUCCESS) {
+      return push_vk_error(L, "vkCreateDescriptorSetLayout", result);
+  }
+  table->setLayout = setLayout;
+  VkDescriptorPoolSize poolSizes[VULKAN_BINDLESS_ARRAYS] = {
+      {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, capacities[VULKAN_BINDLESS_BUFFERS]},
+      {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, capacities[VULKAN_BINDLESS_TEXTURES]}
+  };
+  VkDescriptorPoolCreateInfo poolInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO,
+      .flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT,
+      .maxSets = 1,
+      .poolSizeCount = VULKAN_BINDLESS_ARRAYS,
+      .pPoolSizes = poolSizes
+  };
+  VkDescriptorPool pool;
+  result = vkd->vkCreateDescriptorPool(dptr->device, &poolInfo, NULL, &pool);
+  if (result != VK_SUCCESS) {
+      destroy_bindless_table(table);
+      return push_vk_error(L, "vkCreateDescriptorPool", result);
+  }
+  table->pool = pool;
+  VkDescriptorSetVariableDescriptorCountAllocateInfo countInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_VARIABLE_DESCRIPTOR_COUNT_ALLOCATE_INFO,
+      .descriptorSetCount = 1,
+      .pDescriptorCounts = &capacities[VULKAN_BINDLESS_TEXTURES]
+  };
+  VkDescriptorSetAllocateInfo allocInfo = {
+      .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO,
+      .pNext = &countInfo,
+      .descriptorPool = table->pool,
+      .descriptorSetCount = 1,
+      .pSetLayouts = &table->setLayout
+  };
+  result = vkd->vkAllocateDescriptorSets(dptr->device, &allocInfo, &table->set);
+  if (result != VK_SUCCESS) {
+      destroy_bindless_table(table);
+      return push_vk_error(L, "vkAllocateDescriptorSets", result);
+  }
+
+  // Per array, one block: the free stack, the retired ring, then the live flags
+  for (int a = 0; a < VULKAN_BINDLESS_ARRAYS; a++) {
+      VulkanBindlessArray *arr = &table->arrays[a];
+      uint32_t capacity = capacities[a];
+      uint32_t *block = heap_alloc((size_t)capacity * (2 * sizeof(uint32_t) + 1));
+      if (!block) {
+          destroy_bindless_table(table);
+          lua_pushnil(L);
+          lua_pushstring(L, "Out of memory");
+          return 2;
+      }
+      arr->capacity = capacity;
+      arr->free = block;
+      arr->retired = block + capacity;
+      arr->live = (uint8_t *)(block + 2 * (size_t)capacity);
+      memset(arr->live, 0, capacity);
+  }
+  return 1;
+}
+
+static void bindless_write(VulkanBindlessTable *table, int array, uint32_t slot,
+    const VkDescriptorImageInfo *imageInfo, const VkDescriptorBufferInfo *bufferInfo) {
+  VkWriteDescriptorSet write = {
+      .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+      .dstSet = table->set,
+      .dstBinding = (uint32_t)array,
+      .dstArrayElement = slot,
+      .descriptorCount = 1,
+      .descriptorType = array == VULKAN_BINDLESS_TEXTURES ? VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER
+          : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+      .pImageInfo = imageInfo,
+      .pBufferInfo = bufferInfo
+  };
+  table->vkd->vkUpdateDescriptorSets(table->device, 1, &write, 0, NULL);
+}
+
+static int push_bindless_full(lua_State *L, const char *what) {
+  lua_pushnil(L);
+  lua_pushfstring(L, "Bindless table has no free %s slot", what);
+  return 2;
+}
+
+// vk_BindlessAddTexture(table, imageView, sampler[, layout]) -> slot; layout
+// is the image's layout when shaders sample it (default
+// VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+static int l_vk_BindlessAddTexture(lua_State *L) {
+  VulkanBindlessTable *table = check_bindless_table(L, 1);
+  VulkanImageView *viewptr = (VulkanImageView *)luaL_checkudata(L, 2, "VulkanImageView");
+  VulkanSampler *samptr = (VulkanSampler *)luaL_checkudata(L, 3, "VulkanSampler");
+  VkImageLayout layout = (VkImageLayout)luaL_optinteger(L, 4, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+  uint32_t slot = bindless_alloc(table, VULKAN_BINDLESS_TEXTURES);
+  if (slot == UINT32_MAX) {
+      return push_bindless_full(L, "texture");
+  }
+  VkDescriptorImageInfo imageInfo = {
+      .sampler = samptr->sampler,
+      .imageView = viewptr->imageView,
+      .imageLayout = layout
+  };
+  bindless_write(table, VULKAN_BINDLESS_TEXTURES, slot, &imageInfo, NULL);
+  lua_pushinteger(L, slot);
+  return 1;
+}
+
+// vk_BindlessAddBuffer(table, buffer[, offset[, range]]) -> slot; the buffer
+// needs VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, range defaults to the rest of it
+static int l_vk_BindlessAddBuffer(lua_State *L) {
+  VulkanBindlessTable *table = check_bindless_table(L, 1);
+  VulkanBuffer *bptr = (VulkanBuffer *)luaL_checkudata(L, 2, "VulkanBuffer");
+  VkDeviceSize offset = (VkDeviceSize)luaL_optinteger(L, 3, 0);
+  VkDeviceSize range = lua_isnoneornil(L, 4) ? VK_WHOLE_SIZE : (VkDeviceSize)luaL_checkinteger(L, 4);
+  luaL_argcheck(L, offset < bptr->size, 3, "offset past the end of the buffer");
+  uint32_t slot = bindless_alloc(table, VULKAN_BINDLESS_BUFFERS);
+  if (slot == UINT32_MAX) {
+      return push_bindless_full(L, "buffer");
+  }
+  VkDescriptorBufferInfo bufferInfo = {
+      .buffer = bptr->buffer,
+      .offset = offset,
+      .range = range
+  };
+  bindless_write(table, VULKAN_BINDLESS_BUFFERS, slot, NULL, &bufferInfo);
+  lua_pushinteger(L, slot);
+  return 1;
+}
+
+static int bindless_free_slot(lua_State *L, int array) {
+  VulkanBindlessTable *table = check_bindless_table(L, 1);
+  lua_Integer slot = luaL_checkinteger(L, 2);
+  VulkanBindlessArray *arr = &table->arrays[array];
+  luaL_argcheck(L, slot >= 0 && slot < (lua_Integer)arr->capacity && arr->live[slot], 2, "slot is not in use");
+  bindless_free(table, array, (uint32_t)slot);
+  return 0;
+}
+
+// vk_BindlessFreeTexture(table, slot) / vk_BindlessFreeBuffer(table, slot):
+// the slot is handed out again once the frame passed to the next
+// vk_BindlessEndFrame is complete. The resource itself must stay alive
+// until then too.
+static int l_vk_BindlessFreeTexture(lua_State *L) {
+  return bindless_free_slot(L, VULKAN_BINDLESS_TEXTURES);
+}
+
+static int l_vk_BindlessFreeBuffer(lua_State *L) {
+  return bindless_free_slot(L, VULKAN_BINDLESS_BUFFERS);
+}
+
+// vk_BindlessEndFrame(table, fence) tags the slots freed since the last call
+// with the submit that last reads them: a fence, or a frame driver as for
+// vk_StagingEndFrame
+static int l_vk_BindlessEndFrame(lua_State *L) {
+  VulkanBindlessTable *table = check_bindless_table(L, 1);
+  VulkanFrameFence fence;
+  check_frame_fence(L, 2, 1, &fence);
+  if (!bindless_end_frame(table, &fence)) {
+      lua_pushnil(L);
+      lua_pushstring(L, "Too many bindless frames pending; call vk_BindlessBeginFrame once their fences have been waited on");
+      return 2;
+  }
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// vk_BindlessBeginFrame(table, fence) tells the table that fence has been
+// waited on, so slots retired against it are reused even if it is reset
+// before the next vk_BindlessEndFrame. Not needed for frame drivers.
+static int l_vk_BindlessBeginFrame(lua_State *L) {
+  VulkanBindlessTable *table = check_bindless_table(L, 1);
+  VulkanFrameFence fence;
+  check_frame_fence(L, 2, 0, &fence);
+  retire_begin_frame(&table->retire, &fence, bindless_release, table);
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// vk_GetBindlessTableStats(table) -> {buffers = {used, capacity, retired}, textures = {...}};
+// retired slots are freed but their frame is not known to be complete yet
+static int l_vk_GetBindlessTableStats(lua_State *L) {
+  VulkanBindlessTable *table = check_bindless_table(L, 1);
+  static const char *const names[VULKAN_BINDLESS_ARRAYS] = {"buffers", "textures"};
+  retire_collect(&table->retire, bindless_release, table);
+  lua_createtable(L, 0, VULKAN_BINDLESS_ARRAYS);
+  for (int a = 0; a < VULKAN_BINDLESS_ARRAYS; a++) {
+      const VulkanBindlessArray *arr = &table->arrays[a];
+      lua_createtable(L, 0, 3);
+      lua_pushinteger(L, arr->used);
+      lua_setfield(L, -2, "used");
+      lua_pushinteger(L, arr->capacity);
+      lua_setfield(L, -2, "capacity");
+      lua_pushinteger(L, arr->retiredCount);
+      lua_setfield(L, -2, "retired");
+      lua_setfield(L, -2, names[a]);
+  }
+  return 1;
+}
+
+static int l_vk_DestroyBindlessTable(lua_State *L) {
+  luaL_checkudata(L, 1, "VulkanDevice");
+  destroy_bindless_table((VulkanBindlessTable *)luaL_checkudata(L, 2, "VulkanBindlessTable"));
+  lua_pushboolean(L, true);
+  return 1;
+}
+
+// vk_CmdBindBindlessTable(cmd, pipelineLayout, table[, set[, bindPoint]]);
+// set defaults to 0, bindPoint to VK_PIPELINE_BIND_POINT_GRAPHICS
+static int l_vk_CmdBindBindlessTable(lua_State *L) {
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  VulkanPipelineLayout *plptr = (VulkanPipelineLayout *)luaL_checkudata(L, 2, "VulkanPipelineLayout");
+  VulkanBindlessTable *table = check_bindless_table(L, 3);
+  uint32_t set = (uint32_t)luaL_optinteger(L, 4, 0);
+  VkPipelineBindPoint bindPoint = (VkPipelineBindPoint)luaL_optinteger(L, 5, VK_PIPELINE_BIND_POINT_GRAPHICS);
+  vkd->vkCmdBindDescriptorSets(cptr->commandBuffer, bindPoint, plptr->pipelineLayout, set, 1, &table->set, 0, NULL);
+  return 0;
+}
+
+// vk_CmdPushConstants(cmd, pipelineLayout, stageFlags, offset, data); data is
+// a string of packed bytes, e.g. from ffi.string
+static int l_vk_CmdPushConstants(lua_State *L) {
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  const VulkanDeviceDispatch *vkd = cptr->vkd;
+  VulkanPipelineLayout *plptr = (VulkanPipelineLayout *)luaL_checkudata(L, 2, "VulkanPipelineLayout");
+  VkShaderStageFlags stageFlags = (VkShaderStageFlags)luaL_checkinteger(L, 3);
+  uint32_t offset = (uint32_t)luaL_checkinteger(L, 4);
+  size_t size;
+  const char *data = luaL_checklstring(L, 5, &size);
+  vkd->vkCmdPushConstants(cptr->commandBuffer, plptr->pipelineLayout, stageFlags, offset, (uint32_t)size, data);
+  return 0;
+}
+
+VULKAN_LUAJIT_API void vkffi_CmdBindDescriptorSet(const VulkanCommandBuffer *cbuf, VkPipelineLayout layout,
+    uint32_t firstSet, VkDescriptorSet set) {
+  cbuf->vkd->vkCmdBindDescriptorSets(cbuf->commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, layout, firstSet, 1, &set, 0, NULL);
+}
+
+VULKAN_LUAJIT_API void vkffi_CmdPushConstants(const VulkanCommandBuffer *cbuf, VkPipelineLayout layout,
+    uint32_t stageFlags, uint32_t offset, uint32_t size, const void *data) {
+  cbuf->vkd->vkCmdPushConstants(cbuf->commandBuffer, layout, stageFlags, offset, size, data);
+}
+
+// Command stream: opcodes plus packed arguments, decoded into vkCmd* calls by a
+// single replay call instead of one Lua/C crossing per command.
+enum {
+  VK_STREAM_OP_BIND_PIPELINE = 1,
+  VK_STREAM_OP_BIND_VERTEX_BUFFER,
+  VK_STREAM_OP_BIND_INDEX_BUFFER,
+  VK_STREAM_OP_PUSH_CONSTANTS,
+  VK_STREAM_OP_DRAW,
+  VK_STREAM_OP_DRAW_INDEXED,
+  VK_STREAM_OP_MEMORY_BARRIER,
+  VK_STREAM_OP_IMAGE_BARRIER,
+  VK_STREAM_OP_DRAW_INDIRECT,
+  VK_STREAM_OP_DRAW_INDEXED_INDIRECT,
+  VK_STREAM_OP_BIND_DESCRIPTOR_SET
+};
+
+typedef struct {
+  uint32_t opcode;
+  uint32_t size; // Header plus arguments, rounded up to 8 bytes
+} StreamCmdHeader;
+
+typedef struct {
+  StreamCmdHeader header;
+  VkPipeline pipeline;
+} StreamBindPipeline;
+
+typedef struct {
+  StreamCmdHeader header;
+  VkBuffer buffer;
+  VkDeviceSize offset;
+  uint32_t binding;
+} StreamBindVertexBuffer;
+
+typedef struct {
+  StreamCmdHeader header;
+  VkBuffer buffer;
+  VkDeviceSize offset;
+  uint32_t indexType;
+} StreamBindIndexBuffer;
+
+typedef struct {
+  StreamCmdHeader header;
+  VkPipelineLayout layout;
+  VkDescriptorSet set;
+  uint32_t firstSet;
+} StreamBindDescriptorSet;
+
+typedef struct {
+  StreamCmdHeader header;
+  VkPipelineLayout layout;
+  uint32_t stageFlags;
+  uint32_t offset;
+  uint32_t size;
+  // size bytes of constant data follow
+} StreamPushConstants;
+
+typedef struct {
+  StreamCmdHeader header;
+  uint32_t vertexCount;
+  uint32_t instanceCount;
+  uint32_t firstVertex;
+  uint32_t firstInstance;
+} StreamDraw;
+
+typedef struct {
+  StreamCmdHeader header;
+  uint32_t indexCount;
+  uint32_t instanceCount;
+  uint32_t firstIndex;
+  int32_t vertexOffset;
+  uint32_t firstInstance;
+} StreamDrawIndexed;
+
+typedef struct {
+  StreamCmdHeader header;
+  VkBuffer buffer;
+  VkDeviceSize offset;
+  uint32_t drawCount;
+  uint32_t stride;
+} StreamDrawIndirect; // Both indirect opcodes
+
+typedef struct {
+  StreamCmdHeader header;
+  uint32_t srcStageMask;
+  uint32_t dstStageMask;
+  uint32_t srcAccessMask;
+  uint32_t dstAccessMask;
+} StreamMemoryBarrier;
+
+typedef struct {
+  StreamCmdHeader header;
+  VkImage image;
+  uint32_t oldLayout;
+  uint32_t newLayout;
+  uint32_t srcStageMask;
+  uint32_t dstStageMask;
+  uint32_t srcAccessMask;
+  uint32_t dstAccessMask;
+  uint32_t aspectMask;
+} StreamImageBarrier;
+
+// Reserve room for one command, growing the buffer geometrically. Once a stream
+// has reached its steady-state size, recording does no further allocations.
+static void *stream_push(VulkanCommandStream *stream, uint32_t opcode, size_t size) {
+  size = (size + 7) & ~(size_t)7;
+  if (stream->size + size > stream->capacity) {
+      size_t capacity = stream->capacity ? stream->capacity : 1024;
+      while (capacity < stream->size + size) {
+          capacity *= 2;
+      }
+      uint8_t *data = heap_realloc(stream->data, capacity);
+      if (!data) {
+          stream->failed = 1;
+          return NULL;
+      }
+      stream->data = data;
+      stream->capacity = capacity;
+  }
+
+  StreamCmdHeader *header = (StreamCmdHeader *)(stream->data + stream->size);
+  header->opcode = opcode;
+  header->size = (uint32_t)size;
+  stream->size += size;
+  stream->commandCount++;
+  return header;
+}
+
+static VkResult replay_command_stream(const VulkanDeviceDispatch *vkd, VkCommandBuffer commandBuffer, const VulkanCommandStream *stream) {
+  if (stream->failed) {
+      return VK_ERROR_OUT_OF_HOST_MEMORY;
+  }
+
+  const uint8_t *p = stream->data;
+  const uint8_t *end = stream->data + stream->size;
+  while (p < end) {
+      const StreamCmdHeader *header = (const StreamCmdHeader *)p;
+      switch (header->opcode) {
+      case VK_STREAM_OP_BIND_PIPELINE: {
+          const StreamBindPipeline *cmd = (const StreamBindPipeline *)p;
+          vkd->vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, cmd->pipeline);
+          break;
+      }
+      case VK_STREAM_OP_BIND_VERTEX_BUFFER: {
+          const StreamBindVertexBuffer *cmd = (const StreamBindVertexBuffer *)p;
+          vkd->vkCmdBindVertexBuffers(commandBuffer, cmd->binding, 1, &cmd->buffer, &cmd->offset);
+          break;
+      }
+      case VK_STREAM_OP_BIND_INDEX_BUFFER: {
+          const StreamBindIndexBuffer *cmd = (const StreamBindIndexBuffer *)p;
+          vkd->vkCmdBindIndexBuffer(commandBuffer, cmd->buffer, cmd->offset, (VkIndexType)cmd->indexType);
+          break;
+      }
+      case VK_STREAM_OP_BIND_DESCRIPTOR_SET: {
+          const StreamBindDescriptorSet *cmd = (const StreamBindDescriptorSet *)p;
+          vkd->vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, cmd->layout, cmd->firstSet, 1,
+              &cmd->set, 0, NULL);
+          break;
+      }
+      case VK_STREAM_OP_PUSH_CONSTANTS: {
+          const StreamPushConstants *cmd = (const StreamPushConstants *)p;
+          vkd->vkCmdPushConstants(commandBuffer, cmd->layout, cmd->stageFlags, cmd->offset, cmd->size, cmd + 1);
+          break;
+      }
+      case VK_STREAM_OP_DRAW: {
+          const StreamDraw *cmd = (const StreamDraw *)p;
+          vkd->vkCmdDraw(commandBuffer, cmd->vertexCount, cmd->instanceCount, cmd->firstVertex, cmd->firstInstance);
+          break;
+      }
+      case VK_STREAM_OP_DRAW_INDEXED: {
+          const StreamDrawIndexed *cmd = (const StreamDrawIndexed *)p;
+          vkd->vkCmdDrawIndexed(commandBuffer, cmd->indexCount, cmd->instanceCount, cmd->firstIndex,
+              cmd->vertexOffset, cmd->firstInstance);
+          break;
+      }
+      case VK_STREAM_OP_DRAW_INDIRECT: {
+          const StreamDrawIndirect *cmd = (const StreamDrawIndirect *)p;
+          vkd->vkCmdDrawIndirect(commandBuffer, cmd->buffer, cmd->offset, cmd->drawCount, cmd->stride);
+          break;
+      }
+      case VK_STREAM_OP_DRAW_INDEXED_INDIRECT: {
+          const StreamDrawIndirect *cmd = (const StreamDrawIndirect *)p;
+          vkd->vkCmdDrawIndexedIndirect(commandBuffer, cmd->buffer, cmd->offset, cmd->drawCount, cmd->stride);
+          break;
+      }
+      case VK_STREAM_OP_MEMORY_BARRIER: {
+          const StreamMemoryBarrier *cmd = (const StreamMemoryBarrier *)p;
+          VkMemoryBarrier barrier = {
+              .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER,
+              .srcAccessMask = cmd->srcAccessMask,
+              .dstAccessMask = cmd->dstAccessMask
+          };
+          vkd->vkCmdPipelineBarrier(commandBuffer, cmd->srcStageMask, cmd->dstStageMask, 0,
+              1, &barrier, 0, NULL, 0, NULL);
+          break;
+      }
+      case VK_STREAM_OP_IMAGE_BARRIER: {
+          const StreamImageBarrier *cmd = (const StreamImageBarrier *)p;
+          VkImageMemoryBarrier barrier = {
+              .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER,
+              .srcAccessMask = cmd->srcAccessMask,
+              .dstAccessMask = cmd->dstAccessMask,
+              .oldLayout = (VkImageLayout)cmd->oldLayout,
+              .newLayout = (VkImageLayout)cmd->newLayout,
+              .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+              .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+              .image = cmd->image,
+              .subresourceRange = { cmd->aspectMask, 0, VK_REMAINING_MIP_LEVELS, 0, VK_REMAINING_ARRAY_LAYERS }
+          };
+          vkd->vkCmdPipelineBarrier(commandBuffer, cmd->srcStageMask, cmd->dstStageMask, 0,
+              0, NULL, 0, NULL, 1, &barrier);
+          break;
+      }
+      default:
+          return VK_ERROR_INITIALIZATION_FAILED; // Corrupt stream
+      }
+      p += header->size;
+  }
+  return VK_SUCCESS;
+}
+
+VULKAN_LUAJIT_API VkResult vkffi_QueueSubmitInfo(const VulkanQueue *qptr, const VulkanSubmitInfo *info) {
+  return qptr->vkd->vkQueueSubmit(qptr->queue, 1, &info->submitInfo, info->fence);
+}
+
+// Patches the first swapchain's image index, then presents
+VULKAN_LUAJIT_API VkResult vkffi_QueuePresentInfo(const VulkanQueue *qptr, VulkanPresentInfo *info, uint32_t imageIndex) {
+  info->imageIndices[0] = imageIndex;
+  return qptr->vkd->vkQueuePresentKHR(qptr->queue, &info->presentInfo);
+}
+
+VULKAN_LUAJIT_API void vkffi_ResetCommandStream(VulkanCommandStream *stream) {
+  stream->size = 0;
+  stream->commandCount = 0;
+  stream->failed = 0;
+}
+
+VULKAN_LUAJIT_API void vkffi_StreamBindPipeline(VulkanCommandStream *stream, VkPipeline pipeline) {
+  StreamBindPipeline *cmd = stream_push(stream, VK_STREAM_OP_BIND_PIPELINE, sizeof(*cmd));
+  if (!cmd) return;
+  cmd->pipeline = pipeline;
+}
+
+VULKAN_LUAJIT_API void vkffi_StreamBindVertexBuffer(VulkanCommandStream *stream, uint32_t binding,
+    VkBuffer buffer, VkDeviceSize offset) {
+  StreamBindVertexBuffer *cmd = stream_push(stream, VK_STREAM_OP_BIND_VERTEX_BUFFER, sizeof(*cmd));
+  if (!cmd) return;
+  cmd->buffer = buffer;
+  cmd->offset = offset;
+  cmd->binding = binding;
+}
+
+VULKAN_LUAJIT_API void vkffi_StreamBindIndexBuffer(VulkanCommandStream *stream, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t indexType) {
+  StreamBindIndexBuffer *cmd = stream_push(stream, VK_STREAM_OP_BIND_INDEX_BUFFER, sizeof(*cmd));
+  if (!cmd) return;
+  cmd->buffer = buffer;
+  cmd->offset = offset;
+  cmd->indexType = indexType;
+}
+
+VULKAN_LUAJIT_API void vkffi_StreamBindDescriptorSet(VulkanCommandStream *stream, VkPipelineLayout layout,
+    uint32_t firstSet, VkDescriptorSet set) {
+  StreamBindDescriptorSet *cmd = stream_push(stream, VK_STREAM_OP_BIND_DESCRIPTOR_SET, sizeof(*cmd));
+  if (!cmd) return;
+  cmd->layout = layout;
+  cmd->set = set;
+  cmd->firstSet = firstSet;
+}
+
+VULKAN_LUAJIT_API void vkffi_StreamPushConstants(VulkanCommandStream *stream, VkPipelineLayout layout,
+    uint32_t stageFlags, uint32_t offset, uint32_t size, const void *data) {
+  StreamPushConstants *cmd = stream_push(stream, VK_STREAM_OP_PUSH_CONSTANTS, sizeof(*cmd) + size);
+  if (!cmd) return;
+  cmd->layout = layout;
+  cmd->stageFlags = stageFlags;
+  cmd->offset = offset;
+  cmd->size = size;
+  memcpy(cmd + 1, data, size);
+}
+
+VULKAN_LUAJIT_API void vkffi_StreamDraw(VulkanCommandStream *stream, uint32_t vertexCount,
+    uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance) {
+  StreamDraw *cmd = stream_push(stream, VK_STREAM_OP_DRAW, sizeof(*cmd));
+  if (!cmd) return;
+  cmd->vertexCount = vertexCount;
+  cmd->instanceCount = instanceCount;
+  cmd->firstVertex = firstVertex;
+  cmd->firstInstance = firstInstance;
+}
+
+VULKAN_LUAJIT_API void vkffi_StreamDrawIndexed(VulkanCommandStream *stream, uint32_t indexCount,
+    uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance) {
+  StreamDrawIndexed *cmd = stream_push(stream, VK_STREAM_OP_DRAW_INDEXED, sizeof(*cmd));
+  if (!cmd) return;
+  cmd->indexCount = indexCount;
+  cmd->instanceCount = instanceCount;
+  cmd->firstIndex = firstIndex;
+  cmd->vertexOffset = vertexOffset;
+  cmd->firstInstance = firstInstance;
+}
+
+static void stream_draw_indirect(VulkanCommandStream *stream, uint32_t opcode, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t drawCount, uint32_t stride) {
+  StreamDrawIndirect *cmd = stream_push(stream, opcode, sizeof(*cmd));
+  if (!cmd) return;
+  cmd->buffer = buffer;
+  cmd->offset = offset;
+  cmd->drawCount = drawCount;
+  cmd->stride = stride;
+}
+
+VULKAN_LUAJIT_API void vkffi_StreamDrawIndirect(VulkanCommandStream *stream, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t drawCount, uint32_t stride) {
+  stream_draw_indirect(stream, VK_STREAM_OP_DRAW_INDIRECT, buffer, offset, drawCount, stride);
+}
+
+VULKAN_LUAJIT_API void vkffi_StreamDrawIndexedIndirect(VulkanCommandStream *stream, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t drawCount, uint32_t stride) {
+  stream_draw_indirect(stream, VK_STREAM_OP_DRAW_INDEXED_INDIRECT, buffer, offset, drawCount, stride);
+}
+
+VULKAN_LUAJIT_API void vkffi_StreamMemoryBarrier(VulkanCommandStream *stream, uint32_t srcStageMask,
+    uint32_t dstStageMask, uint32_t srcAccessMask, uint32_t dstAccessMask) {
+  StreamMemoryBarrier *cmd = stream_push(stream, VK_STREAM_OP_MEMORY_BARRIER, sizeof(*cmd));
+  if (!cmd) return;
+  cmd->srcStageMask = srcStageMask;
+  cmd->dstStageMask = dstStageMask;
+  cmd->srcAccessMask = srcAccessMask;
+  cmd->dstAccessMask = dstAccessMask;
+}
+
+VULKAN_LUAJIT_API void vkffi_StreamImageBarrier(VulkanCommandStream *stream, VkImage image,
+    uint32_t oldLayout, uint32_t newLayout, uint32_t srcStageMask, uint32_t dstStageMask,
+    uint32_t srcAccessMask, uint32_t dstAccessMask, uint32_t aspectMask) {
+  StreamImageBarrier *cmd = stream_push(stream, VK_STREAM_OP_IMAGE_BARRIER, sizeof(*cmd));
+  if (!cmd) return;
+  cmd->image = image;
+  cmd->oldLayout = oldLayout;
+  cmd->newLayout = newLayout;
+  cmd->srcStageMask = srcStageMask;
+  cmd->dstStageMask = dstStageMask;
+  cmd->srcAccessMask = srcAccessMask;
+  cmd->dstAccessMask = dstAccessMask;
+  cmd->aspectMask = aspectMask;
+}
+
+VULKAN_LUAJIT_API VkResult vkffi_ReplayCommandStream(const VulkanCommandBuffer *cbuf,
+    const VulkanCommandStream *stream) {
+  return replay_command_stream(cbuf->vkd, cbuf->commandBuffer, stream);
+}
+
+static VulkanCommandStream *check_stream(lua_State *L, int idx) {
+  VulkanCommandStream *stream = (VulkanCommandStream *)luaL_checkudata(L, idx, "VulkanCommandStream");
+  if (stream->failed) {
+      luaL_error(L, "Command stream is out of memory");
+  }
+  return stream;
+}
+
+static int l_vk_CreateCommandStream(lua_State *L) {
+  size_t capacity = (size_t)luaL_optinteger(L, 1, 4096);
+
+  VulkanCommandStream *stream = (VulkanCommandStream *)lua_newuserdata(L, sizeof(VulkanCommandStream));
+  memset(stream, 0, sizeof(*stream));
+  luaL_getmetatable(L, "VulkanCommandStream");
+  lua_setmetatable(L, -2);
+
+  if (capacity > 0) {
+      stream->data = heap_alloc(capacity);
+      if (!stream->data) {
+          lua_pushnil(L);
+          lua_pushstring(L, "Failed to allocate command stream");
+          return 2;
+      }
+      stream->capacity = capacity;
+  }
+  return 1;
+}
+
+static int l_vk_ResetCommandStream(lua_State *L) {
+  VulkanCommandStream *stream = (VulkanCommandStream *)luaL_checkudata(L, 1, "VulkanCommandStream");
+  vkffi_ResetCommandStream(stream);
+  return 0;
+}
+
+static int l_vk_GetCommandStreamInfo(lua_State *L) {
+  VulkanCommandStream *stream = (VulkanCommandStream *)luaL_checkudata(L, 1, "VulkanCommandStream");
+  lua_newtable(L);
+  lua_pushinteger(L, stream->commandCount);
+  lua_setfield(L, -2, "commandCount");
+  lua_pushinteger(L, (lua_Integer)stream->size);
+  lua_setfield(L, -2, "size");
+  lua_pushinteger(L, (lua_Integer)stream->capacity);
+  lua_setfield(L, -2, "capacity");
+  return 1;
+}
+
+static int l_vk_StreamBindPipeline(lua_State *L) {
+  VulkanCommandStream *stream = check_stream(L, 1);
+  VulkanPipeline *pptr = (VulkanPipeline *)luaL_checkudata(L, 2, "VulkanPipeline");
+  vkffi_StreamBindPipeline(stream, pptr->pipeline);
+  return 0;
+}
+
+static int l_vk_StreamBindVertexBuffer(lua_State *L) {
+  VulkanCommandStream *stream = check_stream(L, 1);
+  uint32_t binding = (uint32_t)luaL_checkinteger(L, 2);
+  VulkanBuffer *bptr = (VulkanBuffer *)luaL_checkudata(L, 3, "VulkanBuffer");
+  VkDeviceSize offset = (VkDeviceSize)luaL_optinteger(L, 4, 0);
+  vkffi_StreamBindVertexBuffer(stream, binding, bptr->buffer, offset);
+  return 0;
+}
+
+static int l_vk_StreamBindIndexBuffer(lua_State *L) {
+  VulkanCommandStream *stream = check_stream(L, 1);
+  VulkanBuffer *bptr = (VulkanBuffer *)luaL_checkudata(L, 2, "VulkanBuffer");
+  VkDeviceSize offset = (VkDeviceSize)luaL_optinteger(L, 3, 0);
+  uint32_t indexType = (uint32_t)luaL_optinteger(L, 4, VK_INDEX_TYPE_UINT32);
+  vkffi_StreamBindIndexBuffer(stream, bptr->buffer, offset, indexType);
+  return 0;
+}
+
+// vk_StreamBindBindlessTable(stream, pipelineLayout, table[, set])
+static int l_vk_StreamBindBindlessTable(lua_State *L) {
+  VulkanCommandStream *stream = check_stream(L, 1);
+  VulkanPipelineLayout *plptr = (VulkanPipelineLayout *)luaL_checkudata(L, 2, "VulkanPipelineLayout");
+  VulkanBindlessTable *table = check_bindless_table(L, 3);
+  uint32_t set = (uint32_t)luaL_optinteger(L, 4, 0);
+  vkffi_StreamBindDescriptorSet(stream, plptr->pipelineLayout, set, table->set);
+  return 0;
+}
+
+static int l_vk_StreamPushConstants(lua_State *L) {
+  VulkanCommandStream *stream = check_stream(L, 1);
+  VulkanPipelineLayout *plptr = (VulkanPipelineLayout *)luaL_checkudata(L, 2, "VulkanPipelineLayout");
+  uint32_t stageFlags = (uint32_t)luaL_checkinteger(L, 3);
+  uint32_t offset = (uint32_t)luaL_checkinteger(L, 4);
+  size_t size;
+  const char *data = luaL_checklstring(L, 5, &size); // Packed bytes, e.g. from ffi.string
+  vkffi_StreamPushConstants(stream, plptr->pipelineLayout, stageFlags, offset, (uint32_t)size, data);
+  return 0;
+}
+
+static int l_vk_StreamDraw(lua_State *L) {
+  VulkanCommandStream *stream = check_stream(L, 1);
+  uint32_t vertexCount = (uint32_t)luaL_checkinteger(L, 2);
+  uint32_t instanceCount = (uint32_t)luaL_checkinteger(L, 3);
+  uint32_t firstVertex = (uint32_t)luaL_checkinteger(L, 4);
+  uint32_t firstInstance = (uint32_t)luaL_checkinteger(L, 5);
+  vkffi_StreamDraw(stream, vertexCount, instanceCount, firstVertex, firstInstance);
+  return 0;
+}
 
+static int l_vk_StreamDrawIndexed(lua_State *L) {
+  VulkanCommandStream *stream = check_stream(L, 1);
+  uint32_t indexCount = (uint32_t)luaL_checkinteger(L, 2);
+  uint32_t instanceCount = (uint32_t)luaL_checkinteger(L, 3);
+  uint32_t firstIndex = (uint32_t)luaL_checkinteger(L, 4);
+  int32_t vertexOffset = (int32_t)luaL_checkinteger(L, 5);
+  uint32_t firstInstance = (uint32_t)luaL_checkinteger(L, 6);
+  vkffi_StreamDrawIndexed(stream, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
   return 0;
 }
 
-static int l_vk_WaitForFences(lua_State *L) {
-  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
-  VulkanFence *fptr = (VulkanFence *)luaL_checkudata(L, 2, "VulkanFence");
+// vk_StreamDrawIndirect(stream, buffer, offset, drawCount[, stride])
+static int l_vk_StreamDrawIndirect(lua_State *L) {
+  VulkanCommandStream *stream = check_stream(L, 1);
+  VulkanBuffer *bptr = (VulkanBuffer *)luaL_checkudata(L, 2, "VulkanBuffer");
+  VkDeviceSize offset = (VkDeviceSize)luaL_checkinteger(L, 3);
+  uint32_t drawCount = (uint32_t)luaL_checkinteger(L, 4);
+  uint32_t stride = (uint32_t)luaL_optinteger(L, 5, sizeof(VkDrawIndirectCommand));
+  vkffi_StreamDrawIndirect(stream, bptr->buffer, offset, drawCount, stride);
+  return 0;
+}
 
-  VkResult result = vkWaitForFences(dptr->device, 1, &fptr->fence, VK_TRUE, UINT64_MAX);
-  if (result != VK_SUCCESS) {
-      char errMsg[64];
-      snprintf(errMsg, sizeof(errMsg), "vkWaitForFences failed with result %d", result);
-      lua_pushnil(L);
-      lua_pushstring(L, errMsg);
-      return 2;
-  }
+// vk_StreamDrawIndexedIndirect(stream, buffer, offset, drawCount[, stride])
+static int l_vk_StreamDrawIndexedIndirect(lua_State *L) {
+  VulkanCommandStream *stream = check_stream(L, 1);
+  VulkanBuffer *bptr = (VulkanBuffer *)luaL_checkudata(L, 2, "VulkanBuffer");
+  VkDeviceSize offset = (VkDeviceSize)luaL_checkinteger(L, 3);
+  uint32_t drawCount = (uint32_t)luaL_checkinteger(L, 4);
+  uint32_t stride = (uint32_t)luaL_optinteger(L, 5, sizeof(VkDrawIndexedIndirectCommand));
+  vkffi_StreamDrawIndexedIndirect(stream, bptr->buffer, offset, drawCount, stride);
+  return 0;
+}
 
-  lua_pushboolean(L, true);
-  return 1;
+static int l_vk_StreamMemoryBarrier(lua_State *L) {
+  VulkanCommandStream *stream = check_stream(L, 1);
+  uint32_t srcStageMask = (uint32_t)luaL_checkinteger(L, 2);
+  uint32_t dstStageMask = (uint32_t)luaL_checkinteger(L, 3);
+  uint32_t srcAccessMask = (uint32_t)luaL_optinteger(L, 4, 0);
+  uint32_t dstAccessMask = (uint32_t)luaL_optinteger(L, 5, 0);
+  vkffi_StreamMemoryBarrier(stream, srcStageMask, dstStageMask, srcAccessMask, dstAccessMask);
+  return 0;
 }
 
-static int l_vk_ResetFences(lua_State *L) {
-  VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
-  VulkanFence *fptr = (VulkanFence *)luaL_checkudata(L, 2, "VulkanFence");
+static int l_vk_StreamImageBarrier(lua_State *L) {
+  VulkanCommandStream *stream = check_stream(L, 1);
+  luaL_checktype(L, 2, LUA_TTABLE);
 
-  VkResult result = vkResetFences(dptr->device, 1, &fptr->fence);
-  if (result != VK_SUCCESS) {
-      char errMsg[64];
-      snprintf(errMsg, sizeof(errMsg), "vkResetFences failed with result %d", result);
-      lua_pushnil(L);
-      lua_pushstring(L, errMsg);
-      return 2;
-  }
+  lua_getfield(L, 2, "image");
+  VulkanImage *imgptr = (VulkanImage *)luaL_checkudata(L, -1, "VulkanImage");
+  lua_pop(L, 1);
 
-  lua_pushboolean(L, true);
-  return 1;
+  lua_getfield(L, 2, "oldLayout");
+  uint32_t oldLayout = (uint32_t)luaL_checkinteger(L, -1);
+  lua_pop(L, 1);
+
+  lua_getfield(L, 2, "newLayout");
+  uint32_t newLayout = (uint32_t)luaL_checkinteger(L, -1);
+  lua_pop(L, 1);
+
+  lua_getfield(L, 2, "srcStageMask");
+  uint32_t srcStageMask = (uint32_t)luaL_checkinteger(L, -1);
+  lua_pop(L, 1);
+
+  lua_getfield(L, 2, "dstStageMask");
+  uint32_t dstStageMask = (uint32_t)luaL_checkinteger(L, -1);
+  lua_pop(L, 1);
+
+  lua_getfield(L, 2, "srcAccessMask");
+  uint32_t srcAccessMask = (uint32_t)luaL_optinteger(L, -1, 0);
+  lua_pop(L, 1);
+
+  lua_getfield(L, 2, "dstAccessMask");
+  uint32_t dstAccessMask = (uint32_t)luaL_optinteger(L, -1, 0);
+  lua_pop(L, 1);
+
+  lua_getfield(L, 2, "aspectMask");
+  uint32_t aspectMask = (uint32_t)luaL_optinteger(L, -1, VK_IMAGE_ASPECT_COLOR_BIT);
+  lua_pop(L, 1);
+
+  vkffi_StreamImageBarrier(stream, imgptr->image, oldLayout, newLayout, srcStageMask, dstStageMask,
+      srcAccessMask, dstAccessMask, aspectMask);
+  return 0;
 }
 
-// Update vk_QueueWaitIdle to return true on success
-static int l_vk_QueueWaitIdle(lua_State *L) {
-  VulkanQueue *qptr = (VulkanQueue *)luaL_checkudata(L, 1, "VulkanQueue");
-  VkResult result = vkQueueWaitIdle(qptr->queue);
+static int l_vk_ReplayCommandStream(lua_State *L) {
+  VulkanCommandBuffer *cptr = (VulkanCommandBuffer *)luaL_checkudata(L, 1, "VulkanCommandBuffer");
+  VulkanCommandStream *stream = (VulkanCommandStream *)luaL_checkudata(L, 2, "VulkanCommandStream");
+
+  VkResult result = replay_command_stream(cptr->vkd, cptr->commandBuffer, stream);
   if (result != VK_SUCCESS) {
       char errMsg[64];
-      snprintf(errMsg, sizeof(errMsg), "vkQueueWaitIdle failed with result %d", result);
+      snprintf(errMsg, sizeof(errMsg), "vk_ReplayCommandStream failed with result %d", result);
       lua_pushnil(L);
       lua_pushstring(L, errMsg);
       return 2;
   }
+
   lua_pushboolean(L, true);
   return 1;
 }
 
 static int l_vk_DestroySemaphore(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   VulkanSemaphore *sptr = (VulkanSemaphore *)luaL_checkudata(L, 2, "VulkanSemaphore");
   if (sptr->semaphore) {
-      vkDestroySemaphore(dptr->device, sptr->semaphore, NULL);
+      vkd->vkDestroySemaphore(dptr->device, sptr->semaphore, NULL);
       sptr->semaphore = VK_NULL_HANDLE;
   }
   lua_pushboolean(L, true); // Return true on success
@@ -1430,9 +7840,10 @@ static int l_vk_DestroySemaphore(lua_State *L) {
 
 static int l_vk_DestroyFence(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   VulkanFence *fptr = (VulkanFence *)luaL_checkudata(L, 2, "VulkanFence");
   if (fptr->fence) {
-      vkDestroyFence(dptr->device, fptr->fence, NULL);
+      vkd->vkDestroyFence(dptr->device, fptr->fence, NULL);
       fptr->fence = VK_NULL_HANDLE;
   }
   lua_pushboolean(L, true); // Return true on success
@@ -1441,9 +7852,10 @@ static int l_vk_DestroyFence(lua_State *L) {
 
 static int l_vk_DestroyCommandPool(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   VulkanCommandPool *cpptr = (VulkanCommandPool *)luaL_checkudata(L, 2, "VulkanCommandPool");
   if (cpptr->commandPool) {
-      vkDestroyCommandPool(dptr->device, cpptr->commandPool, NULL);
+      vkd->vkDestroyCommandPool(dptr->device, cpptr->commandPool, NULL);
       cpptr->commandPool = VK_NULL_HANDLE;
   }
   lua_pushboolean(L, true); // Return true on success
@@ -1452,9 +7864,10 @@ static int l_vk_DestroyCommandPool(lua_State *L) {
 
 static int l_vk_DestroyPipeline(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   VulkanPipeline *pptr = (VulkanPipeline *)luaL_checkudata(L, 2, "VulkanPipeline");
   if (pptr->pipeline) {
-      vkDestroyPipeline(dptr->device, pptr->pipeline, NULL);
+      vkd->vkDestroyPipeline(dptr->device, pptr->pipeline, NULL);
       pptr->pipeline = VK_NULL_HANDLE;
   }
   lua_pushboolean(L, true);
@@ -1463,9 +7876,10 @@ static int l_vk_DestroyPipeline(lua_State *L) {
 
 static int l_vk_DestroyPipelineLayout(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   VulkanPipelineLayout *plptr = (VulkanPipelineLayout *)luaL_checkudata(L, 2, "VulkanPipelineLayout");
   if (plptr->pipelineLayout) {
-      vkDestroyPipelineLayout(dptr->device, plptr->pipelineLayout, NULL);
+      vkd->vkDestroyPipelineLayout(dptr->device, plptr->pipelineLayout, NULL);
       plptr->pipelineLayout = VK_NULL_HANDLE;
   }
   lua_pushboolean(L, true);
@@ -1474,9 +7888,10 @@ static int l_vk_DestroyPipelineLayout(lua_State *L) {
 
 static int l_vk_DestroyShaderModule(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   VulkanShaderModule *smptr = (VulkanShaderModule *)luaL_checkudata(L, 2, "VulkanShaderModule");
   if (smptr->shaderModule) {
-      vkDestroyShaderModule(dptr->device, smptr->shaderModule, NULL);
+      vkd->vkDestroyShaderModule(dptr->device, smptr->shaderModule, NULL);
       smptr->shaderModule = VK_NULL_HANDLE;
   }
   lua_pushboolean(L, true);
@@ -1485,9 +7900,10 @@ static int l_vk_DestroyShaderModule(lua_State *L) {
 
 static int l_vk_DestroyFramebuffer(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   VulkanFramebuffer *fbptr = (VulkanFramebuffer *)luaL_checkudata(L, 2, "VulkanFramebuffer");
   if (fbptr->framebuffer) {
-      vkDestroyFramebuffer(dptr->device, fbptr->framebuffer, NULL);
+      vkd->vkDestroyFramebuffer(dptr->device, fbptr->framebuffer, NULL);
       fbptr->framebuffer = VK_NULL_HANDLE;
   }
   lua_pushboolean(L, true);
@@ -1496,9 +7912,10 @@ static int l_vk_DestroyFramebuffer(lua_State *L) {
 
 static int l_vk_DestroyRenderPass(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   VulkanRenderPass *rpptr = (VulkanRenderPass *)luaL_checkudata(L, 2, "VulkanRenderPass");
   if (rpptr->renderPass) {
-      vkDestroyRenderPass(dptr->device, rpptr->renderPass, NULL);
+      vkd->vkDestroyRenderPass(dptr->device, rpptr->renderPass, NULL);
       rpptr->renderPass = VK_NULL_HANDLE;
   }
   lua_pushboolean(L, true);
@@ -1507,9 +7924,10 @@ static int l_vk_DestroyRenderPass(lua_State *L) {
 
 static int l_vk_DestroyImageView(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   VulkanImageView *viewptr = (VulkanImageView *)luaL_checkudata(L, 2, "VulkanImageView");
   if (viewptr->imageView) {
-      vkDestroyImageView(dptr->device, viewptr->imageView, NULL);
+      vkd->vkDestroyImageView(dptr->device, viewptr->imageView, NULL);
       viewptr->imageView = VK_NULL_HANDLE;
   }
   lua_pushboolean(L, true);
@@ -1518,9 +7936,10 @@ static int l_vk_DestroyImageView(lua_State *L) {
 
 static int l_vk_DestroySwapchainKHR(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
+  const VulkanDeviceDispatch *vkd = dptr->vkd;
   VulkanSwapchain *swptr = (VulkanSwapchain *)luaL_checkudata(L, 2, "VulkanSwapchain");
   if (swptr->swapchain) {
-      vkDestroySwapchainKHR(dptr->device, swptr->swapchain, NULL);
+      vkd->vkDestroySwapchainKHR(dptr->device, swptr->swapchain, NULL);
       swptr->swapchain = VK_NULL_HANDLE;
   }
   lua_pushboolean(L, true);
@@ -1530,8 +7949,7 @@ static int l_vk_DestroySwapchainKHR(lua_State *L) {
 static int l_vk_DestroyDevice(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
   if (dptr->device) {
-      vkDestroyDevice(dptr->device, NULL);
-      dptr->device = VK_NULL_HANDLE;
+      destroy_device(dptr);
   }
   lua_pushboolean(L, true);
   return 1;
@@ -1540,8 +7958,7 @@ static int l_vk_DestroyDevice(lua_State *L) {
 static int l_vk_DestroyInstance(lua_State *L) {
   VulkanInstance *iptr = (VulkanInstance *)luaL_checkudata(L, 1, "VulkanInstance");
   if (iptr->instance) {
-      vkDestroyInstance(iptr->instance, NULL);
-      iptr->instance = VK_NULL_HANDLE;
+      destroy_instance(iptr);
   }
   lua_pushboolean(L, true);
   return 1;
@@ -1551,7 +7968,7 @@ static int l_vk_DestroySurfaceKHR(lua_State *L) {
   VulkanInstance *iptr = (VulkanInstance *)luaL_checkudata(L, 1, "VulkanInstance");
   VulkanSurface *sptr = (VulkanSurface *)luaL_checkudata(L, 2, "VulkanSurface");
   if (sptr->surface) {
-      vkDestroySurfaceKHR(iptr->instance, sptr->surface, NULL);
+      iptr->vki->vkDestroySurfaceKHR(iptr->instance, sptr->surface, NULL);
       sptr->surface = VK_NULL_HANDLE;
   }
   lua_pushboolean(L, true);
@@ -1560,8 +7977,9 @@ static int l_vk_DestroySurfaceKHR(lua_State *L) {
 
 static int l_vk_commandpool_gc(lua_State *L) {
   VulkanCommandPool *cpptr = (VulkanCommandPool *)luaL_checkudata(L, 1, "VulkanCommandPool");
+  const VulkanDeviceDispatch *vkd = cpptr->vkd;
   if (cpptr->commandPool) {
-      vkDestroyCommandPool(cpptr->device, cpptr->commandPool, NULL);
+      vkd->vkDestroyCommandPool(cpptr->device, cpptr->commandPool, NULL);
       cpptr->commandPool = VK_NULL_HANDLE;
   }
   return 0;
@@ -1569,17 +7987,114 @@ static int l_vk_commandpool_gc(lua_State *L) {
 
 static int l_vk_swapchain_gc(lua_State *L) {
   VulkanSwapchain *swptr = (VulkanSwapchain *)luaL_checkudata(L, 1, "VulkanSwapchain");
+  const VulkanDeviceDispatch *vkd = swptr->vkd;
   if (swptr->swapchain) {
-      vkDestroySwapchainKHR(swptr->device, swptr->swapchain, NULL);
+      vkd->vkDestroySwapchainKHR(swptr->device, swptr->swapchain, NULL);
       swptr->swapchain = VK_NULL_HANDLE;
   }
   return 0;
 }
 
+static int l_vk_image_gc(lua_State *L) {
+  destroy_image((VulkanImage *)luaL_checkudata(L, 1, "VulkanImage"));
+  return 0;
+}
+
+static int l_vk_buffer_gc(lua_State *L) {
+  destroy_buffer((VulkanBuffer *)luaL_checkudata(L, 1, "VulkanBuffer"));
+  return 0;
+}
+
+static int l_vk_allocator_gc(lua_State *L) {
+  return l_vk_DestroyAllocator(L);
+}
+
+// A job still queued is taken off the queue; one being built is waited for,
+// since the description (and so its shaders) is released right after
+static int l_vk_pipelinefuture_gc(lua_State *L) {
+  VulkanPipelineFuture *future = (VulkanPipelineFuture *)luaL_checkudata(L, 1, "VulkanPipelineFuture");
+  VulkanPipelineCompiler *compiler = future->compiler;
+  if (future->job) {
+      VulkanPipelineJob *job = future->job;
+      if (compiler) {
+          SDL_LockMutex(compiler->mutex);
+          if (!job->started) {
+              VulkanPipelineJob *prev = NULL;
+              for (VulkanPipelineJob *it = compiler->head; it && it != job; it = it->next) {
+                  prev = it;
+              }
+              if (prev) {
+                  prev->next = job->next;
+              } else {
+                  compiler->head = job->next;
+              }
+              if (compiler->tail == job) {
+                  compiler->tail = prev;
+              }
+              job->result = VK_INCOMPLETE; // Never built, so there is no pipeline to destroy
+              release_pipeline_job_locked(job); // The queue's reference
+          }
+          while (!job->done && job->started) {
+              SDL_WaitCondition(compiler->jobDone, compiler->mutex);
+          }
+          release_pipeline_job_locked(job);
+          SDL_UnlockMutex(compiler->mutex);
+      } else {
+          release_pipeline_job_locked(job); // Never queued
+      }
+      future->job = NULL;
+  }
+  release_pipeline_desc(L, future);
+  if (compiler) {
+      pipeline_compiler_unref(compiler);
+      future->compiler = NULL;
+  }
+  return 0;
+}
+
+static int l_vk_pipelinecompiler_gc(lua_State *L) {
+  return l_vk_DestroyPipelineCompiler(L);
+}
+
+static int l_vk_stagingring_gc(lua_State *L) {
+  destroy_staging_ring((VulkanStagingRing *)luaL_checkudata(L, 1, "VulkanStagingRing"));
+  return 0;
+}
+
+static int l_vk_recordworkers_gc(lua_State *L) {
+  destroy_record_workers((VulkanRecordWorkers *)luaL_checkudata(L, 1, "VulkanRecordWorkers"));
+  return 0;
+}
+
+static int l_vk_readback_gc(lua_State *L) {
+  destroy_readback((VulkanReadback *)luaL_checkudata(L, 1, "VulkanReadback"));
+  return 0;
+}
+
+static int l_vk_gpuprofiler_gc(lua_State *L) {
+  destroy_gpu_profiler((VulkanGpuProfiler *)luaL_checkudata(L, 1, "VulkanGpuProfiler"));
+  return 0;
+}
+
+static int l_vk_sampler_gc(lua_State *L) {
+  destroy_sampler((VulkanSampler *)luaL_checkudata(L, 1, "VulkanSampler"));
+  return 0;
+}
+
+static int l_vk_bindlesstable_gc(lua_State *L) {
+  destroy_bindless_table((VulkanBindlessTable *)luaL_checkudata(L, 1, "VulkanBindlessTable"));
+  return 0;
+}
+
+static int l_vk_memorypool_gc(lua_State *L) {
+  return l_vk_DestroyMemoryPool(L);
+}
+
 static int l_vk_imageview_gc(lua_State *L) {
   VulkanImageView *viewptr = (VulkanImageView *)luaL_checkudata(L, 1, "VulkanImageView");
+  const VulkanDeviceDispatch *vkd = viewptr->vkd;
   if (viewptr->imageView) {
-      vkDestroyImageView(viewptr->device, viewptr->imageView, NULL);
+      vkd->vkDestroyImageView(viewptr->device, viewptr->imageView, NULL);
       viewptr->imageView = VK_NULL_HANDLE;
   }
   return 0;
@@ -1587,8 +8102,9 @@ static int l_vk_imageview_gc(lua_State *L) {
 
 static int l_vk_renderpass_gc(lua_State *L) {
   VulkanRenderPass *rpptr = (VulkanRenderPass *)luaL_checkudata(L, 1, "VulkanRenderPass");
+  const VulkanDeviceDispatch *vkd = rpptr->vkd;
   if (rpptr->renderPass) {
-      vkDestroyRenderPass(rpptr->device, rpptr->renderPass, NULL);
+      vkd->vkDestroyRenderPass(rpptr->device, rpptr->renderPass, NULL);
       rpptr->renderPass = VK_NULL_HANDLE;
   }
   return 0;
@@ -1596,8 +8112,9 @@ static int l_vk_renderpass_gc(lua_State *L) {
 
 static int l_vk_framebuffer_gc(lua_State *L) {
   VulkanFramebuffer *fbptr = (VulkanFramebuffer *)luaL_checkudata(L, 1, "VulkanFramebuffer");
+  const VulkanDeviceDispatch *vkd = fbptr->vkd;
   if (fbptr->framebuffer) {
-      vkDestroyFramebuffer(fbptr->device, fbptr->framebuffer, NULL);
+      vkd->vkDestroyFramebuffer(fbptr->device, fbptr->framebuffer, NULL);
       fbptr->framebuffer = VK_NULL_HANDLE;
   }
   return 0;
@@ -1605,8 +8122,9 @@ static int l_vk_framebuffer_gc(lua_State *L) {
 
 static int l_vk_shadermodule_gc(lua_State *L) {
   VulkanShaderModule *smptr = (VulkanShaderModule *)luaL_checkudata(L, 1, "VulkanShaderModule");
+  const VulkanDeviceDispatch *vkd = smptr->vkd;
   if (smptr->shaderModule) {
-      vkDestroyShaderModule(smptr->device, smptr->shaderModule, NULL);
+      vkd->vkDestroyShaderModule(smptr->device, smptr->shaderModule, NULL);
       smptr->shaderModule = VK_NULL_HANDLE;
   }
   return 0;
@@ -1614,17 +8132,29 @@ static int l_vk_shadermodule_gc(lua_State *L) {
 
 static int l_vk_pipelinelayout_gc(lua_State *L) {
   VulkanPipelineLayout *plptr = (VulkanPipelineLayout *)luaL_checkudata(L, 1, "VulkanPipelineLayout");
+  const VulkanDeviceDispatch *vkd = plptr->vkd;
   if (plptr->pipelineLayout) {
-      vkDestroyPipelineLayout(plptr->device, plptr->pipelineLayout, NULL);
+      vkd->vkDestroyPipelineLayout(plptr->device, plptr->pipelineLayout, NULL);
       plptr->pipelineLayout = VK_NULL_HANDLE;
   }
   return 0;
 }
 
+static int l_vk_pipelinecache_gc(lua_State *L) {
+  VulkanPipelineCache *pcptr = (VulkanPipelineCache *)luaL_checkudata(L, 1, "VulkanPipelineCache");
+  const VulkanDeviceDispatch *vkd = pcptr->vkd;
+  if (pcptr->pipelineCache) {
+      vkd->vkDestroyPipelineCache(pcptr->device, pcptr->pipelineCache, NULL);
+      pcptr->pipelineCache = VK_NULL_HANDLE;
+  }
+  return 0;
+}
+
 static int l_vk_pipeline_gc(lua_State *L) {
   VulkanPipeline *pptr = (VulkanPipeline *)luaL_checkudata(L, 1, "VulkanPipeline");
+  const VulkanDeviceDispatch *vkd = pptr->vkd;
   if (pptr->pipeline) {
-      vkDestroyPipeline(pptr->device, pptr->pipeline, NULL);
+      vkd->vkDestroyPipeline(pptr->device, pptr->pipeline, NULL);
       pptr->pipeline = VK_NULL_HANDLE;
   }
   return 0;
@@ -1632,8 +8162,9 @@ static int l_vk_pipeline_gc(lua_State *L) {
 
 static int l_vk_semaphore_gc(lua_State *L) {
   VulkanSemaphore *sptr = (VulkanSemaphore *)luaL_checkudata(L, 1, "VulkanSemaphore");
+  const VulkanDeviceDispatch *vkd = sptr->vkd;
   if (sptr->semaphore) {
-      vkDestroySemaphore(sptr->device, sptr->semaphore, NULL);
+      vkd->vkDestroySemaphore(sptr->device, sptr->semaphore, NULL);
       sptr->semaphore = VK_NULL_HANDLE;
   }
   return 0;
@@ -1641,18 +8172,32 @@ static int l_vk_semaphore_gc(lua_State *L) {
 
 static int l_vk_fence_gc(lua_State *L) {
   VulkanFence *fptr = (VulkanFence *)luaL_checkudata(L, 1, "VulkanFence");
+  const VulkanDeviceDispatch *vkd = fptr->vkd;
   if (fptr->fence) {
-      vkDestroyFence(fptr->device, fptr->fence, NULL);
+      vkd->vkDestroyFence(fptr->device, fptr->fence, NULL);
       fptr->fence = VK_NULL_HANDLE;
   }
   return 0;
 }
 
+static int l_vk_framedriver_gc(lua_State *L) {
+  VulkanFrameDriver *fd = (VulkanFrameDriver *)luaL_checkudata(L, 1, "VulkanFrameDriver");
+  destroy_frame_driver(fd);
+  return 0;
+}
+
+static int l_vk_commandstream_gc(lua_State *L) {
+  VulkanCommandStream *stream = (VulkanCommandStream *)luaL_checkudata(L, 1, "VulkanCommandStream");
+  free(stream->data);
+  stream->data = NULL;
+  stream->size = stream->capacity = 0;
+  return 0;
+}
+
 static int l_vk_instance_gc(lua_State *L) {
   VulkanInstance *iptr = (VulkanInstance *)luaL_checkudata(L, 1, "VulkanInstance");
   if (iptr->instance) {
-      vkDestroyInstance(iptr->instance, NULL);
-      iptr->instance = VK_NULL_HANDLE;
+      destroy_instance(iptr);
   }
   return 0;
 }
@@ -1660,17 +8205,23 @@ static int l_vk_instance_gc(lua_State *L) {
 static int l_vk_device_gc(lua_State *L) {
   VulkanDevice *dptr = (VulkanDevice *)luaL_checkudata(L, 1, "VulkanDevice");
   if (dptr->device) {
-      vkDestroyDevice(dptr->device, NULL);
-      dptr->device = VK_NULL_HANDLE;
+      destroy_device(dptr);
   }
   return 0;
 }
 
 static int l_vk_EnumerateInstanceLayerProperties(lua_State *L) {
+  scratch_begin();
+  const char *loaderError = load_vulkan_loader();
+  if (loaderError) {
+      lua_pushnil(L);
+      lua_pushstring(L, loaderError);
+      return 2;
+  }
   uint32_t layerCount;
-  vkEnumerateInstanceLayerProperties(&layerCount, NULL);
-  VkLayerProperties *layers = malloc(layerCount * sizeof(VkLayerProperties));
-  vkEnumerateInstanceLayerProperties(&layerCount, layers);
+  enumerateInstanceLayerProperties(&layerCount, NULL);
+  VkLayerProperties *layers = check_scratch_alloc(L, layerCount * sizeof(VkLayerProperties));
+  enumerateInstanceLayerProperties(&layerCount, layers);
 
   lua_newtable(L);
   for (uint32_t i = 0; i < layerCount; i++) {
@@ -1681,7 +8232,6 @@ static int l_vk_EnumerateInstanceLayerProperties(lua_State *L) {
       lua_setfield(L, -2, "specVersion");
       lua_rawseti(L, -2, i + 1);
   }
-  free(layers);
   return 1;
 }
 
@@ -1705,7 +8255,53 @@ static const luaL_Reg swapchain_mt[] = {
 };
 
 static const luaL_Reg image_mt[] = {
-  {NULL, NULL} // No cleanup needed; images are tied to swapchain
+  {"__gc", l_vk_image_gc}, // Only images from vk_CreateImage; swapchain images are left alone
+  {NULL, NULL}
+};
+
+static const luaL_Reg buffer_mt[] = {
+  {"__gc", l_vk_buffer_gc},
+  {NULL, NULL}
+};
+
+static const luaL_Reg allocator_mt[] = {
+  {"__gc", l_vk_allocator_gc},
+  {NULL, NULL}
+};
+
+static const luaL_Reg stagingring_mt[] = {
+  {"__gc", l_vk_stagingring_gc},
+  {NULL, NULL}
+};
+
+static const luaL_Reg recordworkers_mt[] = {
+  {"__gc", l_vk_recordworkers_gc},
+  {NULL, NULL}
+};
+
+static const luaL_Reg readback_mt[] = {
+  {"__gc", l_vk_readback_gc},
+  {NULL, NULL}
+};
+
+static const luaL_Reg gpuprofiler_mt[] = {
+  {"__gc", l_vk_gpuprofiler_gc},
+  {NULL, NULL}
+};
+
+static const luaL_Reg sampler_mt[] = {
+  {"__gc", l_vk_sampler_gc},
+  {NULL, NULL}
+};
+
+static const luaL_Reg bindlesstable_mt[] = {
+  {"__gc", l_vk_bindlesstable_gc},
+  {NULL, NULL}
+};
+
+static const luaL_Reg memorypool_mt[] = {
+  {"__gc", l_vk_memorypool_gc},
+  {NULL, NULL}
 };
 
 static const luaL_Reg imageview_mt[] = {
@@ -1733,6 +8329,21 @@ static const luaL_Reg pipelinelayout_mt[] = {
   {NULL, NULL}
 };
 
+static const luaL_Reg pipelinecache_mt[] = {
+  {"__gc", l_vk_pipelinecache_gc},
+  {NULL, NULL}
+};
+
+static const luaL_Reg pipelinecompiler_mt[] = {
+  {"__gc", l_vk_pipelinecompiler_gc},
+  {NULL, NULL}
+};
+
+static const luaL_Reg pipelinefuture_mt[] = {
+  {"__gc", l_vk_pipelinefuture_gc},
+  {NULL, NULL}
+};
+
 static const luaL_Reg pipeline_mt[] = {
   {"__gc", l_vk_pipeline_gc},
   {NULL, NULL}
@@ -1757,10 +8368,29 @@ static const luaL_Reg vulkancommandbuffer_mt[] = {
   {NULL, NULL}
 };
 
+static const luaL_Reg submitinfo_mt[] = {
+  {NULL, NULL} // Plain memory, nothing to release
+};
+
+static const luaL_Reg presentinfo_mt[] = {
+  {NULL, NULL}
+};
+
+static const luaL_Reg framedriver_mt[] = {
+  {"__gc", l_vk_framedriver_gc},
+  {NULL, NULL}
+};
+
+static const luaL_Reg commandstream_mt[] = {
+  {"__gc", l_vk_commandstream_gc},
+  {NULL, NULL}
+};
+
 static const luaL_Reg vulkan_funcs[] = {
   {"vk_EnumerateInstanceLayerProperties", l_vk_EnumerateInstanceLayerProperties},
   {"create_instance", l_vk_CreateInstance},
   {"vk_CreateInstance", l_vk_CreateInstance},
+  {"vk_GetHeapAllocationCount", l_vk_GetHeapAllocationCount},
   {"vk_EnumeratePhysicalDevices", l_vk_EnumeratePhysicalDevices},
   {"vk_GetPhysicalDeviceProperties", l_vk_GetPhysicalDeviceProperties},
   {"vk_GetPhysicalDeviceQueueFamilyProperties", l_vk_GetPhysicalDeviceQueueFamilyProperties},
@@ -1770,15 +8400,32 @@ static const luaL_Reg vulkan_funcs[] = {
   {"vk_GetPhysicalDeviceSurfaceCapabilitiesKHR", l_vk_GetPhysicalDeviceSurfaceCapabilitiesKHR},
   {"vk_GetPhysicalDeviceSurfaceFormatsKHR", l_vk_GetPhysicalDeviceSurfaceFormatsKHR},
   {"vk_GetPhysicalDeviceSurfacePresentModesKHR", l_vk_GetPhysicalDeviceSurfacePresentModesKHR},
+  {"vk_ChoosePresentMode", l_vk_ChoosePresentMode},
+  {"vk_EnumerateDeviceExtensionProperties", l_vk_EnumerateDeviceExtensionProperties},
   {"vk_CreateSwapchainKHR", l_vk_CreateSwapchainKHR},
   {"vk_GetSwapchainImagesKHR", l_vk_GetSwapchainImagesKHR},
+  {"vk_GetSwapchainExtent", l_vk_GetSwapchainExtent},
+  {"vk_RecreateSwapchainKHR", l_vk_RecreateSwapchainKHR},
   {"vk_CreateImageView", l_vk_CreateImageView},
   {"vk_CreateRenderPass", l_vk_CreateRenderPass},
   {"vk_CreateFramebuffer", l_vk_CreateFramebuffer},
   {"vk_CreateShaderModule", l_vk_CreateShaderModule},
+  {"vk_CreateShaderModuleFromFile", l_vk_CreateShaderModuleFromFile},
   {"vk_CreatePipelineLayout", l_vk_CreatePipelineLayout},
   {"vk_CreateGraphicsPipelines", l_vk_CreateGraphicsPipelines},
+  {"vk_CreatePipelineCache", l_vk_CreatePipelineCache},
+  {"vk_SavePipelineCache", l_vk_SavePipelineCache},
+  {"vk_DestroyPipelineCache", l_vk_DestroyPipelineCache},
+  {"vk_CreatePipelineCompiler", l_vk_CreatePipelineCompiler},
+  {"vk_CompileGraphicsPipelines", l_vk_CompileGraphicsPipelines},
+  {"vk_PipelineFutureReady", l_vk_PipelineFutureReady},
+  {"vk_PipelineFutureWait", l_vk_PipelineFutureWait},
+  {"vk_DestroyPipelineCompiler", l_vk_DestroyPipelineCompiler},
   {"vk_CreateSemaphore", l_vk_CreateSemaphore},
+  {"vk_CreateTimelineSemaphore", l_vk_CreateTimelineSemaphore},
+  {"vk_GetSemaphoreCounterValue", l_vk_GetSemaphoreCounterValue},
+  {"vk_SignalSemaphore", l_vk_SignalSemaphore},
+  {"vk_WaitSemaphores", l_vk_WaitSemaphores},
   {"vk_CreateFence", l_vk_CreateFence},
   {"vk_AcquireNextImageKHR", l_vk_AcquireNextImageKHR},
   {"vk_QueueSubmit", l_vk_QueueSubmit},
@@ -1787,9 +8434,20 @@ static const luaL_Reg vulkan_funcs[] = {
   {"vk_AllocateCommandBuffers", l_vk_AllocateCommandBuffers},
   {"vk_BeginCommandBuffer", l_vk_BeginCommandBuffer},
   {"vk_CmdBeginRenderPass", l_vk_CmdBeginRenderPass},
+  {"vk_CmdBeginRendering", l_vk_CmdBeginRendering},
+  {"vk_CmdEndRendering", l_vk_CmdEndRendering},
+  {"vk_CmdSetViewport", l_vk_CmdSetViewport},
+  {"vk_CmdSetScissor", l_vk_CmdSetScissor},
   {"vk_CmdPipelineBarrier", l_vk_CmdPipelineBarrier},
   {"vk_CmdBindPipeline", l_vk_CmdBindPipeline},
   {"vk_CmdDraw", l_vk_CmdDraw},
+  {"vk_CmdBindVertexBuffers", l_vk_CmdBindVertexBuffers},
+  {"vk_CmdBindIndexBuffer", l_vk_CmdBindIndexBuffer},
+  {"vk_CmdDrawIndexed", l_vk_CmdDrawIndexed},
+  {"vk_CmdDrawIndirect", l_vk_CmdDrawIndirect},
+  {"vk_CmdDrawIndexedIndirect", l_vk_CmdDrawIndexedIndirect},
+  {"vk_CmdDrawIndirectCount", l_vk_CmdDrawIndirectCount},
+  {"vk_CmdDrawIndexedIndirectCount", l_vk_CmdDrawIndexedIndirectCount},
   {"vk_CmdEndRenderPass", l_vk_CmdEndRenderPass},
   {"vk_EndCommandBuffer", l_vk_EndCommandBuffer},
   {"vk_WaitForFences", l_vk_WaitForFences},
@@ -1801,6 +8459,61 @@ static const luaL_Reg vulkan_funcs[] = {
   {"vk_DestroyFramebuffer", l_vk_DestroyFramebuffer},
   {"vk_DestroyRenderPass", l_vk_DestroyRenderPass},
   {"vk_DestroyImageView", l_vk_DestroyImageView},
+  {"vk_CreateAllocator", l_vk_CreateAllocator},
+  {"vk_DestroyAllocator", l_vk_DestroyAllocator},
+  {"vk_GetAllocatorStats", l_vk_GetAllocatorStats},
+  {"vk_CreateMemoryPool", l_vk_CreateMemoryPool},
+  {"vk_ResetMemoryPool", l_vk_ResetMemoryPool},
+  {"vk_DestroyMemoryPool", l_vk_DestroyMemoryPool},
+  {"vk_GetMemoryPoolStats", l_vk_GetMemoryPoolStats},
+  {"vk_CreateBuffer", l_vk_CreateBuffer},
+  {"vk_DestroyBuffer", l_vk_DestroyBuffer},
+  {"vk_WriteBuffer", l_vk_WriteBuffer},
+  {"vk_CreateImage", l_vk_CreateImage},
+  {"vk_DestroyImage", l_vk_DestroyImage},
+  {"vk_CreateStagingRing", l_vk_CreateStagingRing},
+  {"vk_DestroyStagingRing", l_vk_DestroyStagingRing},
+  {"vk_StagingReserve", l_vk_StagingReserve},
+  {"vk_StagingWrite", l_vk_StagingWrite},
+  {"vk_StagingUpload", l_vk_StagingUpload},
+  {"vk_StagingBeginFrame", l_vk_StagingBeginFrame},
+  {"vk_StagingEndFrame", l_vk_StagingEndFrame},
+  {"vk_GetStagingRingStats", l_vk_GetStagingRingStats},
+  {"vk_CmdCopyBuffer", l_vk_CmdCopyBuffer},
+  {"vk_ResetCommandPool", l_vk_ResetCommandPool},
+  {"vk_CmdExecuteCommands", l_vk_CmdExecuteCommands},
+  {"vk_CreateRecordWorkers", l_vk_CreateRecordWorkers},
+  {"vk_DispatchRecordWorkers", l_vk_DispatchRecordWorkers},
+  {"vk_WaitRecordWorkers", l_vk_WaitRecordWorkers},
+  {"vk_DestroyRecordWorkers", l_vk_DestroyRecordWorkers},
+  {"vk_CreateRenderTarget", l_vk_CreateRenderTarget},
+  {"vk_CreateReadback", l_vk_CreateReadback},
+  {"vk_CmdReadbackImage", l_vk_CmdReadbackImage},
+  {"vk_ReadbackReady", l_vk_ReadbackReady},
+  {"vk_WaitReadback", l_vk_WaitReadback},
+  {"vk_GetReadbackData", l_vk_GetReadbackData},
+  {"vk_DestroyReadback", l_vk_DestroyReadback},
+  {"vk_CreateGpuProfiler", l_vk_CreateGpuProfiler},
+  {"vk_GpuProfilerBeginFrame", l_vk_GpuProfilerBeginFrame},
+  {"vk_GpuProfilerBeginRegion", l_vk_GpuProfilerBeginRegion},
+  {"vk_GpuProfilerEndRegion", l_vk_GpuProfilerEndRegion},
+  {"vk_GpuProfilerEndFrame", l_vk_GpuProfilerEndFrame},
+  {"vk_GpuProfilerGetResults", l_vk_GpuProfilerGetResults},
+  {"vk_GetGpuProfilerStats", l_vk_GetGpuProfilerStats},
+  {"vk_DestroyGpuProfiler", l_vk_DestroyGpuProfiler},
+  {"vk_CreateSampler", l_vk_CreateSampler},
+  {"vk_DestroySampler", l_vk_DestroySampler},
+  {"vk_CreateBindlessTable", l_vk_CreateBindlessTable},
+  {"vk_BindlessAddTexture", l_vk_BindlessAddTexture},
+  {"vk_BindlessAddBuffer", l_vk_BindlessAddBuffer},
+  {"vk_BindlessFreeTexture", l_vk_BindlessFreeTexture},
+  {"vk_BindlessFreeBuffer", l_vk_BindlessFreeBuffer},
+  {"vk_BindlessBeginFrame", l_vk_BindlessBeginFrame},
+  {"vk_BindlessEndFrame", l_vk_BindlessEndFrame},
+  {"vk_GetBindlessTableStats", l_vk_GetBindlessTableStats},
+  {"vk_DestroyBindlessTable", l_vk_DestroyBindlessTable},
+  {"vk_CmdBindBindlessTable", l_vk_CmdBindBindlessTable},
+  {"vk_CmdPushConstants", l_vk_CmdPushConstants},
   {"vk_DestroySwapchainKHR", l_vk_DestroySwapchainKHR},
   {"vk_DestroyDevice", l_vk_DestroyDevice},
   {"vk_DestroyInstance", l_vk_DestroyInstance},
@@ -1809,9 +8522,217 @@ static const luaL_Reg vulkan_funcs[] = {
   {"vk_DestroySemaphore", l_vk_DestroySemaphore},
   {"vk_DestroyCommandPool", l_vk_DestroyCommandPool},
   {"vk_DestroyPipeline", l_vk_DestroyPipeline},
+  {"vk_CreateSubmitInfo", l_vk_CreateSubmitInfo},
+  {"vk_SubmitInfoSetCommandBuffer", l_vk_SubmitInfoSetCommandBuffer},
+  {"vk_SubmitInfoSetFence", l_vk_SubmitInfoSetFence},
+  {"vk_CreatePresentInfo", l_vk_CreatePresentInfo},
+  {"vk_PresentInfoSetImageIndex", l_vk_PresentInfoSetImageIndex},
+  {"FrameDriver", l_vk_CreateFrameDriver},
+  {"vk_CreateFrameDriver", l_vk_CreateFrameDriver},
+  {"vk_FrameDriverRunFrame", l_vk_FrameDriverRunFrame},
+  {"vk_FrameDriverGetStats", l_vk_FrameDriverGetStats},
+  {"vk_FrameDriverSetDirty", l_vk_FrameDriverSetDirty},
+  {"vk_FrameDriverIsDirty", l_vk_FrameDriverIsDirty},
+  {"vk_FrameDriverPace", l_vk_FrameDriverPace},
+  {"vk_FrameDriverSetFrameLimit", l_vk_FrameDriverSetFrameLimit},
+  {"vk_FrameDriverGetFrameTimings", l_vk_FrameDriverGetFrameTimings},
+  {"vk_DestroyFrameDriver", l_vk_DestroyFrameDriver},
+  {"vk_CreateCommandStream", l_vk_CreateCommandStream},
+  {"vk_ResetCommandStream", l_vk_ResetCommandStream},
+  {"vk_GetCommandStreamInfo", l_vk_GetCommandStreamInfo},
+  {"vk_StreamBindPipeline", l_vk_StreamBindPipeline},
+  {"vk_StreamBindVertexBuffer", l_vk_StreamBindVertexBuffer},
+  {"vk_StreamBindIndexBuffer", l_vk_StreamBindIndexBuffer},
+  {"vk_StreamBindBindlessTable", l_vk_StreamBindBindlessTable},
+  {"vk_StreamPushConstants", l_vk_StreamPushConstants},
+  {"vk_StreamDraw", l_vk_StreamDraw},
+  {"vk_StreamDrawIndexed", l_vk_StreamDrawIndexed},
+  {"vk_StreamDrawIndirect", l_vk_StreamDrawIndirect},
+  {"vk_StreamDrawIndexedIndirect", l_vk_StreamDrawIndexedIndirect},
+  {"vk_StreamMemoryBarrier", l_vk_StreamMemoryBarrier},
+  {"vk_StreamImageBarrier", l_vk_StreamImageBarrier},
+  {"vk_ReplayCommandStream", l_vk_ReplayCommandStream},
   {NULL, NULL}
 };
 
+#if defined(LUAJIT_BINDING_STATS)
+static BindingStats vulkan_funcs_stats[sizeof(vulkan_funcs) / sizeof(vulkan_funcs[0])];
+#endif
+
+// FFI fast path: plain C entry points called through ffi.C by lua/vulkan/ffi.lua.
+// They take raw handles, or plain pointers to the device, queue and command
+// buffer userdata for their dispatch table, and return VkResult, so no
+// metatable lookups happen and the LuaJIT trace compiler can keep the frame
+// loop compiled.
+
+VULKAN_LUAJIT_API VkResult vkffi_BeginCommandBuffer(const VulkanCommandBuffer *cbuf) {
+  VkCommandBufferBeginInfo beginInfo = {
+      .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO,
+      .flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT
+  };
+  return cbuf->vkd->vkBeginCommandBuffer(cbuf->commandBuffer, &beginInfo);
+}
+
+VULKAN_LUAJIT_API VkResult vkffi_EndCommandBuffer(const VulkanCommandBuffer *cbuf) {
+  return cbuf->vkd->vkEndCommandBuffer(cbuf->commandBuffer);
+}
+
+VULKAN_LUAJIT_API VkResult vkffi_ResetCommandBuffer(const VulkanCommandBuffer *cbuf) {
+  return cbuf->vkd->vkResetCommandBuffer(cbuf->commandBuffer, 0);
+}
+
+VULKAN_LUAJIT_API void vkffi_CmdBeginRenderPass(const VulkanCommandBuffer *cbuf, VkRenderPass renderPass,
+    VkFramebuffer framebuffer, uint32_t width, uint32_t height) {
+  VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+  VkRenderPassBeginInfo renderPassInfo = {
+      .sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO,
+      .renderPass = renderPass,
+      .framebuffer = framebuffer,
+      .renderArea = {{0, 0}, {width, height}},
+      .clearValueCount = 1,
+      .pClearValues = &clearColor
+  };
+  cbuf->vkd->vkCmdBeginRenderPass(cbuf->commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+}
+
+VULKAN_LUAJIT_API void vkffi_CmdEndRenderPass(const VulkanCommandBuffer *cbuf) {
+  cbuf->vkd->vkCmdEndRenderPass(cbuf->commandBuffer);
+}
+
+// One color attachment, cleared to opaque black and stored
+VULKAN_LUAJIT_API void vkffi_CmdBeginRendering(const VulkanCommandBuffer *cbuf, VkImageView colorView,
+    uint32_t width, uint32_t height) {
+  VkRenderingAttachmentInfo colorAttachment = {
+      .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
+      .imageView = colorView,
+      .imageLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+      .loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR,
+      .storeOp = VK_ATTACHMENT_STORE_OP_STORE,
+      .clearValue = {{{0.0f, 0.0f, 0.0f, 1.0f}}}
+  };
+  VkRenderingInfo renderingInfo = {
+      .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
+      .renderArea = {{0, 0}, {width, height}},
+      .layerCount = 1,
+      .colorAttachmentCount = 1,
+      .pColorAttachments = &colorAttachment
+  };
+  cbuf->vkd->vkCmdBeginRendering(cbuf->commandBuffer, &renderingInfo);
+}
+
+VULKAN_LUAJIT_API void vkffi_CmdEndRendering(const VulkanCommandBuffer *cbuf) {
+  cbuf->vkd->vkCmdEndRendering(cbuf->commandBuffer);
+}
+
+VULKAN_LUAJIT_API void vkffi_CmdBindPipeline(const VulkanCommandBuffer *cbuf, VkPipeline pipeline) {
+  cbuf->vkd->vkCmdBindPipeline(cbuf->commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+}
+
+VULKAN_LUAJIT_API void vkffi_CmdSetViewport(const VulkanCommandBuffer *cbuf, float x, float y,
+    float width, float height, float minDepth, float maxDepth) {
+  VkViewport viewport = { x, y, width, height, minDepth, maxDepth };
+  cbuf->vkd->vkCmdSetViewport(cbuf->commandBuffer, 0, 1, &viewport);
+}
+
+VULKAN_LUAJIT_API void vkffi_CmdSetScissor(const VulkanCommandBuffer *cbuf, int32_t x, int32_t y,
+    uint32_t width, uint32_t height) {
+  VkRect2D scissor = { { x, y }, { width, height } };
+  cbuf->vkd->vkCmdSetScissor(cbuf->commandBuffer, 0, 1, &scissor);
+}
+
+VULKAN_LUAJIT_API void vkffi_CmdDraw(const VulkanCommandBuffer *cbuf, uint32_t vertexCount,
+    uint32_t instanceCount, uint32_t firstVertex, uint32_t firstInstance) {
+  cbuf->vkd->vkCmdDraw(cbuf->commandBuffer, vertexCount, instanceCount, firstVertex, firstInstance);
+}
+
+VULKAN_LUAJIT_API void vkffi_CmdBindVertexBuffer(const VulkanCommandBuffer *cbuf, uint32_t binding,
+    VkBuffer buffer, VkDeviceSize offset) {
+  cbuf->vkd->vkCmdBindVertexBuffers(cbuf->commandBuffer, binding, 1, &buffer, &offset);
+}
+
+VULKAN_LUAJIT_API void vkffi_CmdBindIndexBuffer(const VulkanCommandBuffer *cbuf, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t indexType) {
+  cbuf->vkd->vkCmdBindIndexBuffer(cbuf->commandBuffer, buffer, offset, (VkIndexType)indexType);
+}
+
+VULKAN_LUAJIT_API void vkffi_CmdDrawIndexed(const VulkanCommandBuffer *cbuf, uint32_t indexCount,
+    uint32_t instanceCount, uint32_t firstIndex, int32_t vertexOffset, uint32_t firstInstance) {
+  cbuf->vkd->vkCmdDrawIndexed(cbuf->commandBuffer, indexCount, instanceCount, firstIndex, vertexOffset, firstInstance);
+}
+
+VULKAN_LUAJIT_API void vkffi_CmdDrawIndirect(const VulkanCommandBuffer *cbuf, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t drawCount, uint32_t stride) {
+  cbuf->vkd->vkCmdDrawIndirect(cbuf->commandBuffer, buffer, offset, drawCount, stride);
+}
+
+VULKAN_LUAJIT_API void vkffi_CmdDrawIndexedIndirect(const VulkanCommandBuffer *cbuf, VkBuffer buffer,
+    VkDeviceSize offset, uint32_t drawCount, uint32_t stride) {
+  cbuf->vkd->vkCmdDrawIndexedIndirect(cbuf->commandBuffer, buffer, offset, drawCount, stride);
+}
+
+VULKAN_LUAJIT_API VkResult vkffi_WaitForFences(const VulkanDevice *dptr, VkFence fence, uint64_t timeout) {
+  return dptr->vkd->vkWaitForFences(dptr->device, 1, &fence, VK_TRUE, timeout);
+}
+
+VULKAN_LUAJIT_API VkResult vkffi_ResetFences(const VulkanDevice *dptr, VkFence fence) {
+  return dptr->vkd->vkResetFences(dptr->device, 1, &fence);
+}
+
+VULKAN_LUAJIT_API uint64_t vkffi_GetSemaphoreCounterValue(const VulkanDevice *dptr, VkSemaphore semaphore) {
+  uint64_t value = 0;
+  dptr->vkd->vkGetSemaphoreCounterValue(dptr->device, semaphore, &value);
+  return value;
+}
+
+VULKAN_LUAJIT_API VkResult vkffi_WaitSemaphore(const VulkanDevice *dptr, VkSemaphore semaphore, uint64_t value,
+    uint64_t timeout) {
+  VkSemaphoreWaitInfo waitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+      .semaphoreCount = 1,
+      .pSemaphores = &semaphore,
+      .pValues = &value
+  };
+  return dptr->vkd->vkWaitSemaphores(dptr->device, &waitInfo, timeout);
+}
+
+VULKAN_LUAJIT_API VkResult vkffi_AcquireNextImageKHR(const VulkanDevice *dptr, VkSwapchainKHR swapchain, uint64_t timeout,
+    VkSemaphore semaphore, VkFence fence, uint32_t *pImageIndex) {
+  return dptr->vkd->vkAcquireNextImageKHR(dptr->device, swapchain, timeout, semaphore, fence, pImageIndex);
+}
+
+VULKAN_LUAJIT_API uint64_t vkffi_GetHeapAllocationCount(void) {
+  return heapAllocationCount;
+}
+
+VULKAN_LUAJIT_API VkResult vkffi_QueueSubmit(const VulkanQueue *qptr, const VulkanCommandBuffer *cbuf,
+    VkSemaphore waitSemaphore, VkSemaphore signalSemaphore, VkFence fence) {
+  VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+  VkSubmitInfo submitInfo = {
+      .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+      .waitSemaphoreCount = waitSemaphore ? 1 : 0,
+      .pWaitSemaphores = &waitSemaphore,
+      .pWaitDstStageMask = &waitStage,
+      .commandBufferCount = 1,
+      .pCommandBuffers = &cbuf->commandBuffer,
+      .signalSemaphoreCount = signalSemaphore ? 1 : 0,
+      .pSignalSemaphores = &signalSemaphore
+  };
+  return qptr->vkd->vkQueueSubmit(qptr->queue, 1, &submitInfo, fence);
+}
+
+VULKAN_LUAJIT_API VkResult vkffi_QueuePresentKHR(const VulkanQueue *qptr, VkSwapchainKHR swapchain, uint32_t imageIndex,
+    VkSemaphore waitSemaphore) {
+  VkPresentInfoKHR presentInfo = {
+      .sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR,
+      .waitSemaphoreCount = waitSemaphore ? 1 : 0,
+      .pWaitSemaphores = &waitSemaphore,
+      .swapchainCount = 1,
+      .pSwapchains = &swapchain,
+      .pImageIndices = &imageIndex
+  };
+  return qptr->vkd->vkQueuePresentKHR(qptr->queue, &presentInfo);
+}
+
 int luaopen_vulkan(lua_State *L) {
     // Register metatables
     luaL_newmetatable(L, "VulkanInstance");
@@ -1837,6 +8758,42 @@ int luaopen_vulkan(lua_State *L) {
     luaL_setfuncs(L, image_mt, 0);
     lua_pop(L, 1);
 
+    luaL_newmetatable(L, "VulkanBuffer");
+    luaL_setfuncs(L, buffer_mt, 0);
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "VulkanAllocator");
+    luaL_setfuncs(L, allocator_mt, 0);
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "VulkanMemoryPool");
+    luaL_setfuncs(L, memorypool_mt, 0);
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "VulkanStagingRing");
+    luaL_setfuncs(L, stagingring_mt, 0);
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "VulkanRecordWorkers");
+    luaL_setfuncs(L, recordworkers_mt, 0);
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "VulkanReadback");
+    luaL_setfuncs(L, readback_mt, 0);
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "VulkanGpuProfiler");
+    luaL_setfuncs(L, gpuprofiler_mt, 0);
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "VulkanSampler");
+    luaL_setfuncs(L, sampler_mt, 0);
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "VulkanBindlessTable");
+    luaL_setfuncs(L, bindlesstable_mt, 0);
+    lua_pop(L, 1);
+
     luaL_newmetatable(L, "VulkanImageView");
     luaL_setfuncs(L, imageview_mt, 0);
     lua_pop(L, 1);
@@ -1857,6 +8814,18 @@ int luaopen_vulkan(lua_State *L) {
     luaL_setfuncs(L, pipelinelayout_mt, 0);
     lua_pop(L, 1);
 
+    luaL_newmetatable(L, "VulkanPipelineCache");
+    luaL_setfuncs(L, pipelinecache_mt, 0);
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "VulkanPipelineCompiler");
+    luaL_setfuncs(L, pipelinecompiler_mt, 0);
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "VulkanPipelineFuture");
+    luaL_setfuncs(L, pipelinefuture_mt, 0);
+    lua_pop(L, 1);
+
     luaL_newmetatable(L, "VulkanPipeline");
     luaL_setfuncs(L, pipeline_mt, 0);
     lua_pop(L, 1);
@@ -1877,8 +8846,24 @@ int luaopen_vulkan(lua_State *L) {
     luaL_setfuncs(L, vulkancommandpool_mt, 0);
     lua_pop(L, 1);
 
+    luaL_newmetatable(L, "VulkanSubmitInfo");
+    luaL_setfuncs(L, submitinfo_mt, 0);
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "VulkanPresentInfo");
+    luaL_setfuncs(L, presentinfo_mt, 0);
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "VulkanFrameDriver");
+    luaL_setfuncs(L, framedriver_mt, 0);
+    lua_pop(L, 1);
+
+    luaL_newmetatable(L, "VulkanCommandStream");
+    luaL_setfuncs(L, commandstream_mt, 0);
+    lua_pop(L, 1);
+
     // Create the module table
-    luaL_newlib(L, vulkan_funcs);
+    binding_stats_newlib(L, vulkan_funcs); // Also adds stats() and reset_stats()
 
     // Add Vulkan constants and helpers
     lua_pushinteger(L, VK_API_VERSION_1_0);
@@ -1891,6 +8876,12 @@ int luaopen_vulkan(lua_State *L) {
     lua_setfield(L, -2, "VK_COLOR_SPACE_SRGB_NONLINEAR_KHR");
     lua_pushinteger(L, VK_PRESENT_MODE_FIFO_KHR);
     lua_setfield(L, -2, "VK_PRESENT_MODE_FIFO_KHR");
+    lua_pushinteger(L, VK_PRESENT_MODE_FIFO_RELAXED_KHR);
+    lua_setfield(L, -2, "VK_PRESENT_MODE_FIFO_RELAXED_KHR");
+    lua_pushinteger(L, VK_PRESENT_MODE_MAILBOX_KHR);
+    lua_setfield(L, -2, "VK_PRESENT_MODE_MAILBOX_KHR");
+    lua_pushinteger(L, VK_PRESENT_MODE_IMMEDIATE_KHR);
+    lua_setfield(L, -2, "VK_PRESENT_MODE_IMMEDIATE_KHR");
 
     // Pipeline stage flags
     lua_pushinteger(L, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT);
@@ -1907,6 +8898,34 @@ int luaopen_vulkan(lua_State *L) {
     lua_setfield(L, -2, "VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL");
     lua_pushinteger(L, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR);
     lua_setfield(L, -2, "VK_IMAGE_LAYOUT_PRESENT_SRC_KHR");
+    lua_pushinteger(L, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL);
+    lua_setfield(L, -2, "VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL");
+
+    // Dynamic rendering attachments
+    lua_pushinteger(L, VK_ATTACHMENT_LOAD_OP_LOAD);
+    lua_setfield(L, -2, "VK_ATTACHMENT_LOAD_OP_LOAD");
+    lua_pushinteger(L, VK_ATTACHMENT_LOAD_OP_CLEAR);
+    lua_setfield(L, -2, "VK_ATTACHMENT_LOAD_OP_CLEAR");
+    lua_pushinteger(L, VK_ATTACHMENT_LOAD_OP_DONT_CARE);
+    lua_setfield(L, -2, "VK_ATTACHMENT_LOAD_OP_DONT_CARE");
+    lua_pushinteger(L, VK_ATTACHMENT_STORE_OP_STORE);
+    lua_setfield(L, -2, "VK_ATTACHMENT_STORE_OP_STORE");
+    lua_pushinteger(L, VK_ATTACHMENT_STORE_OP_DONT_CARE);
+    lua_setfield(L, -2, "VK_ATTACHMENT_STORE_OP_DONT_CARE");
+    lua_pushinteger(L, VK_IMAGE_ASPECT_DEPTH_BIT);
+    lua_setfield(L, -2, "VK_IMAGE_ASPECT_DEPTH_BIT");
+    lua_pushinteger(L, VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT);
+    lua_setfield(L, -2, "VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT");
+    lua_pushinteger(L, VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT);
+    lua_setfield(L, -2, "VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT");
+    lua_pushinteger(L, VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT);
+    lua_setfield(L, -2, "VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT");
+
+    // Wait stages for vk_QueueSubmit's waitStages
+    lua_pushinteger(L, VK_PIPELINE_STAGE_TRANSFER_BIT);
+    lua_setfield(L, -2, "VK_PIPELINE_STAGE_TRANSFER_BIT");
+    lua_pushinteger(L, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    lua_setfield(L, -2, "VK_PIPELINE_STAGE_ALL_COMMANDS_BIT");
 
     // Structure types
     lua_pushinteger(L, VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER);
@@ -1926,6 +8945,150 @@ int luaopen_vulkan(lua_State *L) {
     lua_pushinteger(L, VK_ACCESS_MEMORY_READ_BIT);
     lua_setfield(L, -2, "VK_ACCESS_MEMORY_READ_BIT");
 
+    // Results returned next to acquire/present so callers can recreate the swapchain
+    lua_pushinteger(L, VK_SUCCESS);
+    lua_setfield(L, -2, "VK_SUCCESS");
+    lua_pushinteger(L, VK_NOT_READY);
+    lua_setfield(L, -2, "VK_NOT_READY");
+    lua_pushinteger(L, VK_SUBOPTIMAL_KHR);
+    lua_setfield(L, -2, "VK_SUBOPTIMAL_KHR");
+    lua_pushinteger(L, VK_ERROR_OUT_OF_DATE_KHR);
+    lua_setfield(L, -2, "VK_ERROR_OUT_OF_DATE_KHR");
+
+    // Buffer/image usage and memory properties for the allocator
+    lua_pushinteger(L, VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    lua_setfield(L, -2, "VK_BUFFER_USAGE_TRANSFER_SRC_BIT");
+    lua_pushinteger(L, VK_BUFFER_USAGE_TRANSFER_DST_BIT);
+    lua_setfield(L, -2, "VK_BUFFER_USAGE_TRANSFER_DST_BIT");
+    lua_pushinteger(L, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT);
+    lua_setfield(L, -2, "VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT");
+    lua_pushinteger(L, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    lua_setfield(L, -2, "VK_BUFFER_USAGE_STORAGE_BUFFER_BIT");
+    lua_pushinteger(L, VK_BUFFER_USAGE_INDEX_BUFFER_BIT);
+    lua_setfield(L, -2, "VK_BUFFER_USAGE_INDEX_BUFFER_BIT");
+    lua_pushinteger(L, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT);
+    lua_setfield(L, -2, "VK_BUFFER_USAGE_VERTEX_BUFFER_BIT");
+    lua_pushinteger(L, VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT);
+    lua_setfield(L, -2, "VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT");
+    lua_pushinteger(L, VK_IMAGE_USAGE_TRANSFER_SRC_BIT);
+    lua_setfield(L, -2, "VK_IMAGE_USAGE_TRANSFER_SRC_BIT");
+    lua_pushinteger(L, VK_IMAGE_USAGE_TRANSFER_DST_BIT);
+    lua_setfield(L, -2, "VK_IMAGE_USAGE_TRANSFER_DST_BIT");
+    lua_pushinteger(L, VK_IMAGE_USAGE_SAMPLED_BIT);
+    lua_setfield(L, -2, "VK_IMAGE_USAGE_SAMPLED_BIT");
+    lua_pushinteger(L, VK_IMAGE_USAGE_STORAGE_BIT);
+    lua_setfield(L, -2, "VK_IMAGE_USAGE_STORAGE_BIT");
+    lua_pushinteger(L, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT);
+    lua_setfield(L, -2, "VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT");
+    lua_pushinteger(L, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT);
+    lua_setfield(L, -2, "VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT");
+    lua_pushinteger(L, VK_IMAGE_TILING_OPTIMAL);
+    lua_setfield(L, -2, "VK_IMAGE_TILING_OPTIMAL");
+    lua_pushinteger(L, VK_IMAGE_TILING_LINEAR);
+    lua_setfield(L, -2, "VK_IMAGE_TILING_LINEAR");
+    lua_pushinteger(L, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+    lua_setfield(L, -2, "VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT");
+    lua_pushinteger(L, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+    lua_setfield(L, -2, "VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT");
+    lua_pushinteger(L, VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    lua_setfield(L, -2, "VK_MEMORY_PROPERTY_HOST_COHERENT_BIT");
+    lua_pushinteger(L, VK_MEMORY_PROPERTY_HOST_CACHED_BIT);
+    lua_setfield(L, -2, "VK_MEMORY_PROPERTY_HOST_CACHED_BIT");
+    lua_pushinteger(L, VK_FORMAT_R8G8B8A8_UNORM);
+    lua_setfield(L, -2, "VK_FORMAT_R8G8B8A8_UNORM");
+    lua_pushinteger(L, VK_FORMAT_D32_SFLOAT);
+    lua_setfield(L, -2, "VK_FORMAT_D32_SFLOAT");
+
+    // Index types and shader stages for command streams
+    lua_pushinteger(L, VK_INDEX_TYPE_UINT16);
+    lua_setfield(L, -2, "VK_INDEX_TYPE_UINT16");
+    lua_pushinteger(L, VK_INDEX_TYPE_UINT32);
+    lua_setfield(L, -2, "VK_INDEX_TYPE_UINT32");
+    lua_pushinteger(L, VK_SHADER_STAGE_VERTEX_BIT);
+    lua_setfield(L, -2, "VK_SHADER_STAGE_VERTEX_BIT");
+    lua_pushinteger(L, VK_SHADER_STAGE_FRAGMENT_BIT);
+    lua_setfield(L, -2, "VK_SHADER_STAGE_FRAGMENT_BIT");
+
+    // Secondary command buffers
+    lua_pushinteger(L, VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+    lua_setfield(L, -2, "VK_COMMAND_BUFFER_LEVEL_PRIMARY");
+    lua_pushinteger(L, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+    lua_setfield(L, -2, "VK_COMMAND_BUFFER_LEVEL_SECONDARY");
+    lua_pushinteger(L, VK_SUBPASS_CONTENTS_INLINE);
+    lua_setfield(L, -2, "VK_SUBPASS_CONTENTS_INLINE");
+    lua_pushinteger(L, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+    lua_setfield(L, -2, "VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS");
+
+    // Vertex input, topology and indirect draws
+    lua_pushinteger(L, VK_VERTEX_INPUT_RATE_VERTEX);
+    lua_setfield(L, -2, "VK_VERTEX_INPUT_RATE_VERTEX");
+    lua_pushinteger(L, VK_VERTEX_INPUT_RATE_INSTANCE);
+    lua_setfield(L, -2, "VK_VERTEX_INPUT_RATE_INSTANCE");
+    lua_pushinteger(L, VK_PRIMITIVE_TOPOLOGY_POINT_LIST);
+    lua_setfield(L, -2, "VK_PRIMITIVE_TOPOLOGY_POINT_LIST");
+    lua_pushinteger(L, VK_PRIMITIVE_TOPOLOGY_LINE_LIST);
+    lua_setfield(L, -2, "VK_PRIMITIVE_TOPOLOGY_LINE_LIST");
+    lua_pushinteger(L, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST);
+    lua_setfield(L, -2, "VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST");
+    lua_pushinteger(L, VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP);
+    lua_setfield(L, -2, "VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP");
+    lua_pushinteger(L, VK_FORMAT_R32_SFLOAT);
+    lua_setfield(L, -2, "VK_FORMAT_R32_SFLOAT");
+    lua_pushinteger(L, VK_FORMAT_R32G32_SFLOAT);
+    lua_setfield(L, -2, "VK_FORMAT_R32G32_SFLOAT");
+    lua_pushinteger(L, VK_FORMAT_R32G32B32_SFLOAT);
+    lua_setfield(L, -2, "VK_FORMAT_R32G32B32_SFLOAT");
+    lua_pushinteger(L, VK_FORMAT_R32G32B32A32_SFLOAT);
+    lua_setfield(L, -2, "VK_FORMAT_R32G32B32A32_SFLOAT");
+    lua_pushinteger(L, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT);
+    lua_setfield(L, -2, "VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT");
+    lua_pushinteger(L, VK_PIPELINE_STAGE_VERTEX_INPUT_BIT);
+    lua_setfield(L, -2, "VK_PIPELINE_STAGE_VERTEX_INPUT_BIT");
+    lua_pushinteger(L, VK_ACCESS_INDIRECT_COMMAND_READ_BIT);
+    lua_setfield(L, -2, "VK_ACCESS_INDIRECT_COMMAND_READ_BIT");
+    lua_pushinteger(L, VK_ACCESS_INDEX_READ_BIT);
+    lua_setfield(L, -2, "VK_ACCESS_INDEX_READ_BIT");
+    lua_pushinteger(L, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT);
+    lua_setfield(L, -2, "VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT");
+
+    // Bindless tables
+    lua_pushinteger(L, VULKAN_BINDLESS_BUFFERS);
+    lua_setfield(L, -2, "BINDLESS_BUFFER_BINDING");
+    lua_pushinteger(L, VULKAN_BINDLESS_TEXTURES);
+    lua_setfield(L, -2, "BINDLESS_TEXTURE_BINDING");
+    lua_pushinteger(L, VK_SHADER_STAGE_ALL_GRAPHICS);
+    lua_setfield(L, -2, "VK_SHADER_STAGE_ALL_GRAPHICS");
+    lua_pushinteger(L, VK_SHADER_STAGE_ALL);
+    lua_setfield(L, -2, "VK_SHADER_STAGE_ALL");
+    lua_pushinteger(L, VK_PIPELINE_BIND_POINT_GRAPHICS);
+    lua_setfield(L, -2, "VK_PIPELINE_BIND_POINT_GRAPHICS");
+    lua_pushinteger(L, VK_PIPELINE_BIND_POINT_COMPUTE);
+    lua_setfield(L, -2, "VK_PIPELINE_BIND_POINT_COMPUTE");
+    lua_pushinteger(L, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
+    lua_setfield(L, -2, "VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL");
+    lua_pushinteger(L, VK_IMAGE_LAYOUT_GENERAL);
+    lua_setfield(L, -2, "VK_IMAGE_LAYOUT_GENERAL");
+    lua_pushinteger(L, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT);
+    lua_setfield(L, -2, "VK_PIPELINE_STAGE_VERTEX_SHADER_BIT");
+    lua_pushinteger(L, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT);
+    lua_setfield(L, -2, "VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT");
+    lua_pushinteger(L, VK_ACCESS_SHADER_READ_BIT);
+    lua_setfield(L, -2, "VK_ACCESS_SHADER_READ_BIT");
+    lua_pushinteger(L, VK_FILTER_NEAREST);
+    lua_setfield(L, -2, "VK_FILTER_NEAREST");
+    lua_pushinteger(L, VK_FILTER_LINEAR);
+    lua_setfield(L, -2, "VK_FILTER_LINEAR");
+    lua_pushinteger(L, VK_SAMPLER_MIPMAP_MODE_NEAREST);
+    lua_setfield(L, -2, "VK_SAMPLER_MIPMAP_MODE_NEAREST");
+    lua_pushinteger(L, VK_SAMPLER_MIPMAP_MODE_LINEAR);
+    lua_setfield(L, -2, "VK_SAMPLER_MIPMAP_MODE_LINEAR");
+    lua_pushinteger(L, VK_SAMPLER_ADDRESS_MODE_REPEAT);
+    lua_setfield(L, -2, "VK_SAMPLER_ADDRESS_MODE_REPEAT");
+    lua_pushinteger(L, VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT);
+    lua_setfield(L, -2, "VK_SAMPLER_ADDRESS_MODE_MIRRORED_REPEAT");
+    lua_pushinteger(L, VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE);
+    lua_setfield(L, -2, "VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE");
+
     lua_pushcfunction(L, l_vk_make_version);
     lua_setfield(L, -2, "make_version");
     return 1;